@@ -0,0 +1,77 @@
+#include "securecomm/random.hpp"
+#include <sodium.h>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <atomic>
+#include <functional>
+
+using namespace securecomm;
+
+// Per-call cost of the buffered thread-local generator against calling
+// randombytes_buf directly, for nonce-sized (12 B) and key-sized (32 B) draws
+// with 1..N threads hammering the generator at once.
+
+static constexpr size_t CALLS_PER_THREAD = 200000;
+
+static double ns_per_call(size_t threads, size_t bytes,
+                          const std::function<void(uint8_t*, size_t)>& fill) {
+    std::atomic<bool> go{false};
+    std::vector<std::thread> workers;
+    std::vector<double> per_thread(threads);
+
+    for (size_t t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t] {
+            uint8_t out[64];
+            volatile uint8_t sink = 0;    // keeps the fill loop from being optimised away
+            while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+            auto start = std::chrono::steady_clock::now();
+            for (size_t i = 0; i < CALLS_PER_THREAD; ++i) {
+                fill(out, bytes);
+                sink = sink ^ out[0];
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+            per_thread[t] = std::chrono::duration<double, std::nano>(elapsed).count() / CALLS_PER_THREAD;
+        });
+    }
+    go.store(true, std::memory_order_release);
+    for (auto& w : workers) w.join();
+
+    double total = 0;
+    for (double v : per_thread) total += v;
+    return total / threads;
+}
+
+int main() {
+    if (sodium_init() < 0) {
+        std::cerr << "libsodium init failed" << std::endl;
+        return 1;
+    }
+
+    const size_t hw = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<size_t> thread_counts = {1, 2, 4, 8};
+    if (hw > 8) thread_counts.push_back(hw);
+
+    auto direct = [](uint8_t* out, size_t len) { randombytes_buf(out, len); };
+    auto buffered = [](uint8_t* out, size_t len) { random_bytes(out, len); };
+
+    std::cout << "=== RNG benchmark (" << CALLS_PER_THREAD << " calls/thread, "
+              << hw << " hardware threads) ===" << std::endl;
+    std::cout << std::left << std::setw(10) << "threads" << std::setw(8) << "bytes"
+              << std::setw(22) << "randombytes_buf ns" << std::setw(20) << "random_bytes ns"
+              << "speedup" << std::endl;
+
+    for (size_t bytes : {size_t(12), size_t(32)}) {
+        for (size_t threads : thread_counts) {
+            double base = ns_per_call(threads, bytes, direct);
+            double fast = ns_per_call(threads, bytes, buffered);
+            std::cout << std::left << std::setw(10) << threads << std::setw(8) << bytes
+                      << std::fixed << std::setprecision(1)
+                      << std::setw(22) << base << std::setw(20) << fast
+                      << std::setprecision(2) << base / fast << "x" << std::endl;
+        }
+    }
+    return 0;
+}
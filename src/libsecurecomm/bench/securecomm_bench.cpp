@@ -0,0 +1,489 @@
+#include "securecomm/crypto.hpp"
+#include "securecomm/ratchet.hpp"
+#include "securecomm/envelope.hpp"
+#include "securecomm/bytes.hpp"
+#include "securecomm/dispatcher.hpp"
+#include "securecomm/frame_batcher.hpp"
+#include "securecomm/random.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
+#include <sodium.h>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <new>
+#include <thread>
+
+// Microbenchmarks for the crypto and serialization hot paths. Prints one JSON
+// document (ns/op, bytes/s, heap allocations/op per case) to stdout, or to the
+// file given with --out, so results can be diffed between releases.
+//
+// Usage: securecomm_bench [--out FILE] [--filter SUBSTRING] [--min-time-ms N]
+
+// ---- Allocation counting ---------------------------------------------------
+
+static std::atomic<uint64_t> g_allocations{0};
+
+// The whole replaceable set is defined so every form is counted and released by
+// its counterpart. malloc and free sit behind out-of-line helpers: once inlined,
+// GCC sees free() on a pointer from operator new and warns (-Wmismatched-new-delete).
+[[gnu::noinline]] static void* counted_alloc(size_t size, size_t align = 0) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (size == 0) size = 1;
+    if (align <= alignof(std::max_align_t)) return std::malloc(size);
+    return std::aligned_alloc(align, (size + align - 1) / align * align);
+}
+[[gnu::noinline]] static void counted_free(void* p) noexcept { std::free(p); }
+
+void* operator new(size_t size) {
+    if (void* p = counted_alloc(size)) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size) { return operator new(size); }
+void* operator new(size_t size, std::align_val_t align) {
+    if (void* p = counted_alloc(size, static_cast<size_t>(align))) return p;
+    throw std::bad_alloc();
+}
+void* operator new[](size_t size, std::align_val_t align) { return operator new(size, align); }
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size); }
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_alloc(size); }
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return counted_alloc(size, static_cast<size_t>(align));
+}
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return counted_alloc(size, static_cast<size_t>(align));
+}
+
+void operator delete(void* p) noexcept { counted_free(p); }
+void operator delete[](void* p) noexcept { counted_free(p); }
+void operator delete(void* p, size_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t) noexcept { counted_free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { counted_free(p); }
+void operator delete(void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete(void* p, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(p); }
+void operator delete[](void* p, std::align_val_t, const std::nothrow_t&) noexcept { counted_free(p); }
+
+namespace securecomm {
+
+// Declared a friend of Ratchet so the private helpers can be timed
+struct BenchAccess {
+    static SecretKey32 derive_message_key(const Ratchet& r) { return r.derive_message_key(r.send_chain_key_); }
+    static SecretKey32 advance_chain_key(const Ratchet& r) { return r.advance_chain_key(r.send_chain_key_); }
+    static void hkdf_root_chain(Ratchet& r, const SecretKey32& dh, const PublicKey32& remote) { r.hkdf_root_chain(dh, remote); }
+    static SecretKey32 dh_compute(const Ratchet& r, const PublicKey32& remote) { return r.dh_compute(remote); }
+};
+
+} // namespace securecomm
+
+using namespace securecomm;
+
+// ---- Harness ---------------------------------------------------------------
+
+namespace {
+
+struct BenchResult {
+    std::string name;
+    size_t bytes_per_op;
+    uint64_t iterations;
+    double ns_per_op;
+    double bytes_per_sec;
+    double allocs_per_op;
+};
+
+struct Options {
+    std::string out_path;
+    std::string filter;
+    double min_time_ms = 200.0;
+};
+
+// Keeps results observable so the optimiser cannot drop the measured work
+volatile uint8_t g_sink;
+
+class Bench {
+public:
+    explicit Bench(const Options& opts) : opts_(opts) {}
+
+    void run(const std::string& name, size_t bytes_per_op, const std::function<void()>& op) {
+        if (!opts_.filter.empty() && name.find(opts_.filter) == std::string::npos) return;
+
+        op();    // warm-up: first-use allocations (arena blocks, thread-local buffers) are not counted
+
+        // Grow the batch until it runs for at least a tenth of the budget, then scale up
+        uint64_t iterations = 1;
+        for (;;) {
+            double ms = time_ms(op, iterations);
+            if (ms >= opts_.min_time_ms / 10 || iterations >= (1ull << 30)) {
+                if (ms < opts_.min_time_ms) {
+                    double scale = ms > 0 ? opts_.min_time_ms / ms : 10;
+                    iterations = std::max<uint64_t>(iterations, uint64_t(iterations * scale));
+                }
+                break;
+            }
+            iterations *= 10;
+        }
+
+        uint64_t allocs_before = g_allocations.load(std::memory_order_relaxed);
+        double ms = time_ms(op, iterations);
+        uint64_t allocs = g_allocations.load(std::memory_order_relaxed) - allocs_before;
+
+        BenchResult r;
+        r.name = name;
+        r.bytes_per_op = bytes_per_op;
+        r.iterations = iterations;
+        r.ns_per_op = ms * 1e6 / iterations;
+        r.bytes_per_sec = bytes_per_op ? bytes_per_op * 1e9 / r.ns_per_op : 0;
+        r.allocs_per_op = double(allocs) / iterations;
+        results_.push_back(r);
+        std::cerr << "[bench] " << name << ": " << r.ns_per_op << " ns/op" << std::endl;
+    }
+
+    std::string to_json() const {
+        std::ostringstream js;
+        js << "{\n";
+        js << "  \"suite\": \"securecomm_bench\",\n";
+        js << "  \"default_cipher_suite\": \"" << aead_backend(default_cipher_suite())->name() << "\",\n";
+        js << "  \"min_time_ms\": " << opts_.min_time_ms << ",\n";
+        js << "  \"benchmarks\": [\n";
+        for (size_t i = 0; i < results_.size(); ++i) {
+            const auto& r = results_[i];
+            js << "    {\"name\": \"" << r.name << "\""
+               << ", \"bytes_per_op\": " << r.bytes_per_op
+               << ", \"iterations\": " << r.iterations
+               << ", \"ns_per_op\": " << r.ns_per_op
+               << ", \"bytes_per_sec\": " << r.bytes_per_sec
+               << ", \"allocs_per_op\": " << r.allocs_per_op << "}"
+               << (i + 1 < results_.size() ? "," : "") << "\n";
+        }
+        js << "  ]\n}\n";
+        return js.str();
+    }
+
+private:
+    static double time_ms(const std::function<void()>& op, uint64_t iterations) {
+        auto start = std::chrono::steady_clock::now();
+        for (uint64_t i = 0; i < iterations; ++i) op();
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    const Options& opts_;
+    std::vector<BenchResult> results_;
+};
+
+// Dispatcher needs a transport; nothing is sent during the benchmarks
+class NullTransport : public Transport {
+public:
+    void start() override {}
+    void stop() override {}
+    void send(const std::vector<uint8_t>&) override {}
+    void send_iov(std::span<const std::span<const uint8_t>>, std::shared_ptr<const void>) override {}
+    void set_on_message(OnMessageCb) override {}
+};
+
+// Keeps the last frame, as a transport with a send queue would
+class QueueingTransport : public Transport {
+public:
+    void start() override {}
+    void stop() override {}
+    void send(const std::vector<uint8_t>& bytes) override { held_ = std::make_shared<const std::vector<uint8_t>>(bytes); }
+    // Like WebSocketClientTransport: keeps the parts and their owner
+    void send_iov(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner) override {
+        held_parts_.assign(parts.begin(), parts.end());
+        held_ = std::move(owner);
+    }
+    void set_on_message(OnMessageCb) override {}
+
+private:
+    std::vector<std::span<const uint8_t>> held_parts_;
+    std::shared_ptr<const void> held_;
+};
+
+std::string size_label(size_t bytes) {
+    if (bytes >= 1024 * 1024) return std::to_string(bytes / (1024 * 1024)) + "MB";
+    if (bytes >= 1024) return std::to_string(bytes / 1024) + "KB";
+    return std::to_string(bytes) + "B";
+}
+
+Envelope sample_envelope(size_t ciphertext_bytes) {
+    Envelope env;
+    env.session_id.resize(16);
+    random_bytes(env.session_id);
+    env.message_index = 42;
+    env.previous_counter = 41;
+    env.timestamp = 1700000000000ull;
+    env.sender_device_id = "device-0123456789";
+    env.associated_data.resize(37);
+    random_bytes(env.associated_data);
+    env.ciphertext.resize(ciphertext_bytes);
+    random_bytes(env.ciphertext);
+    return env;
+}
+
+// ---- Cases -----------------------------------------------------------------
+
+void bench_aead(Bench& bench) {
+    std::vector<uint8_t> key(32);
+    random_bytes(key);
+    const std::vector<uint8_t> aad(37, 0xAD);
+
+    for (CipherSuite suite : available_cipher_suites()) {
+        AEAD aead(suite);
+        aead.set_key(key);
+        const std::string prefix = std::string("aead/") + aead_backend(suite)->name() + "/";
+
+        for (size_t size : {size_t(64), size_t(1024), size_t(64 * 1024), size_t(1024 * 1024)}) {
+            std::vector<uint8_t> plaintext(size);
+            random_bytes(plaintext);
+            const std::vector<uint8_t> sealed = aead.encrypt(plaintext, aad);
+
+            bench.run(prefix + "encrypt/" + size_label(size), size, [&] {
+                auto c = aead.encrypt(plaintext, aad);
+                g_sink = c[0];
+            });
+            bench.run(prefix + "decrypt/" + size_label(size), size, [&] {
+                auto m = aead.decrypt(sealed, aad);
+                g_sink = m ? (*m)[0] : 0;
+            });
+
+            std::vector<uint8_t> out(aead.ciphertext_size(size));
+            std::vector<uint8_t> back(size);
+            bench.run(prefix + "encrypt_into/" + size_label(size), size, [&] {
+                aead.encrypt_into(plaintext, aad, out);
+                g_sink = out[0];
+            });
+            bench.run(prefix + "decrypt_into/" + size_label(size), size, [&] {
+                auto n = aead.decrypt_into(sealed, aad, back);
+                g_sink = n ? back[0] : 0;
+            });
+        }
+    }
+}
+
+void bench_ratchet(Bench& bench) {
+    std::vector<uint8_t> root(32);
+    random_bytes(root);
+    Ratchet alice;
+    Ratchet bob;
+    alice.initialize(root);
+    bob.initialize(root);
+
+    bench.run("ratchet/derive_message_key", 0, [&] {
+        g_sink = BenchAccess::derive_message_key(alice).data()[0];
+    });
+    bench.run("ratchet/advance_chain_key", 0, [&] {
+        g_sink = BenchAccess::advance_chain_key(alice).data()[0];
+    });
+
+    const PublicKey32 remote = bob.dh_public_key();
+    SecretKey32 dh;
+    random_bytes(dh.data(), dh.size());
+    bench.run("ratchet/hkdf_root_chain", 0, [&] {
+        BenchAccess::hkdf_root_chain(alice, dh, remote);
+    });
+
+    bench.run("ratchet/dh_compute", 0, [&] {
+        g_sink = BenchAccess::dh_compute(alice, remote).data()[0];
+    });
+}
+
+void bench_envelope(Bench& bench) {
+    for (size_t size : {size_t(64), size_t(1024), size_t(64 * 1024)}) {
+        const Envelope env = sample_envelope(size);
+        const std::vector<uint8_t> wire = env.serialize();
+
+        bench.run("envelope/serialize/" + size_label(size), wire.size(), [&] {
+            auto bytes = env.serialize();
+            g_sink = bytes[0];
+        });
+        bench.run("envelope/deserialize/" + size_label(size), wire.size(), [&] {
+            Envelope e = Envelope::deserialize(wire);
+            g_sink = uint8_t(e.message_index);
+        });
+        // The receive path: bounds checks only, no copies
+        bench.run("envelope/parse_view/" + size_label(size), wire.size(), [&] {
+            auto v = EnvelopeView::parse(wire);
+            g_sink = v ? uint8_t(v->ciphertext.size()) : 0;
+        });
+        std::vector<uint8_t> out(wire.size());
+        bench.run("envelope/serialize_into/" + size_label(size), wire.size(), [&] {
+            g_sink = uint8_t(env.serialize_into(out));
+        });
+        // v2 with connection state: varints, timestamp deltas, dictionary sender ids
+        WireCodec sender, receiver;
+        sender.set_connection_state(true);
+        receiver.set_connection_state(true);
+        sender.set_peer_version(Envelope::WIRE_VERSION_V2);
+        receiver.decode(sender.encode(env));
+        const std::vector<uint8_t> compact = sender.encode(env);
+        bench.run("envelope/encode_v2/" + size_label(size), compact.size(), [&] {
+            auto bytes = sender.encode(env);
+            g_sink = bytes[0];
+        });
+        bench.run("envelope/decode_v2/" + size_label(size), compact.size(), [&] {
+            auto v = receiver.decode(compact);
+            g_sink = v ? uint8_t(v->ciphertext.size()) : 0;
+        });
+        // What Dispatcher hands to send_iov: the framing only, ciphertext in place
+        WireCodec framer;
+        std::vector<uint8_t> framing;
+        bench.run("envelope/encode_framing/" + size_label(size), wire.size(), [&] {
+            g_sink = uint8_t(framer.encode_framing(env, framing));
+        });
+    }
+}
+
+// A received frame on its way through transport queues and inbound workers: one
+// pooled copy, then shared references, against a vector copy per hop
+void bench_bytes(Bench& bench) {
+    for (size_t size : {size_t(64), size_t(1024), size_t(64 * 1024)}) {
+        const std::vector<uint8_t> frame(size, 0x5A);
+        bench.run("bytes/vector_copy/" + size_label(size), size, [&] {
+            std::vector<uint8_t> copy(frame);
+            g_sink = copy[0];
+        });
+        bench.run("bytes/copy/" + size_label(size), size, [&] {
+            Bytes copy = Bytes::copy(frame);
+            g_sink = copy[0];
+        });
+        const Bytes shared = Bytes::copy(frame);
+        bench.run("bytes/share/" + size_label(size), size, [&] {
+            Bytes ref = shared;
+            g_sink = ref[0];
+        });
+    }
+}
+
+// A fan-out of 32 small envelopes (framing, ciphertext and trailer parts each) to a
+// queueing transport: one send_iov per envelope, against one FrameBatcher batch
+void bench_frame_batch(Bench& bench) {
+    constexpr size_t FRAMES = 32;
+    const std::vector<uint8_t> framing(40, 0x11), ciphertext(256, 0x5A), trailer(4, 0x22);
+    const std::span<const uint8_t> parts[] = {framing, ciphertext, trailer};
+    auto owner = std::make_shared<int>(0);
+    const std::string label = std::to_string(FRAMES) + "x" + size_label(ciphertext.size());
+    QueueingTransport transport;
+    bench.run("transport/send_iov/" + label, FRAMES * ciphertext.size(), [&] {
+        for (size_t i = 0; i < FRAMES; i++) transport.send_iov(parts, owner);
+    });
+    FrameBatcher batcher(1 << 20, std::chrono::seconds(10),
+                         [&](std::span<const std::span<const uint8_t>> batch, std::shared_ptr<const void> keep) {
+                             transport.send_iov(batch, std::move(keep));
+                         });
+    bench.run("frame_batcher/flush/" + label, FRAMES * ciphertext.size(), [&] {
+        for (size_t i = 0; i < FRAMES; i++) batcher.add(parts, owner);
+        batcher.flush();
+    });
+}
+
+void bench_dispatcher(Bench& bench) {
+    auto dispatcher = std::make_unique<Dispatcher>(std::make_shared<NullTransport>());
+
+    // Sends to distinct peers, one after another and then from every core at once.
+    // Sessions have their own locks, so the parallel case should scale with cores.
+    constexpr size_t PEERS = 64;
+    const std::vector<uint8_t> payload(1024, 0x5A);
+    std::vector<uint8_t> root(32);
+    random_bytes(root);
+    std::vector<std::string> peers;
+    dispatcher->register_device("bench-self");
+    for (size_t i = 0; i < PEERS; ++i) {
+        peers.push_back("bench-peer-" + std::to_string(i));
+        dispatcher->create_session_with(peers.back(), root);
+    }
+    bench.run("dispatcher/send_to_peers/serial/" + std::to_string(PEERS), PEERS * payload.size(), [&] {
+        for (const auto& peer : peers) dispatcher->send_message_to_device(peer, payload);
+    });
+    WorkerPool senders(std::max(2u, std::thread::hardware_concurrency()) - 1);
+    bench.run("dispatcher/send_to_peers/parallel/" + std::to_string(PEERS), PEERS * payload.size(), [&] {
+        senders.parallel_for(PEERS, [&](size_t begin, size_t end) {
+            for (size_t i = begin; i < end; ++i) dispatcher->send_message_to_device(peers[i], payload);
+        });
+    });
+
+    dispatcher.reset();
+
+    // One peer, through a transport that queues what it is given
+    auto queueing = std::make_unique<Dispatcher>(std::make_shared<QueueingTransport>());
+    queueing->register_device("bench-self");
+    queueing->create_session_with("bench-peer", root);
+    for (size_t size : {size_t(1024), size_t(64 * 1024)}) {
+        const std::vector<uint8_t> message(size, 0x5A);
+        bench.run("dispatcher/send/queueing/" + size_label(size), size, [&] {
+            queueing->send_message_to_device("bench-peer", message);
+        });
+    }
+}
+
+// One scoped trace event (two clock reads and a buffer slot) per op. The buffer
+// fills early in the enabled run; later events skip only the 48-byte store.
+void bench_trace(Bench& bench) {
+    const std::vector<uint8_t> session_id(16, 0x42);
+    uint32_t index = 0;
+    bench.run("trace/scope/disabled", 0, [&] {
+        TraceScope scope("bench", TraceKey::of(session_id, index++));
+    });
+    start_tracing();
+    bench.run("trace/scope/enabled", 0, [&] {
+        TraceScope scope("bench", TraceKey::of(session_id, index++));
+    });
+    stop_tracing();
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opts;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--out" && i + 1 < argc) {
+            opts.out_path = argv[++i];
+        } else if (arg == "--filter" && i + 1 < argc) {
+            opts.filter = argv[++i];
+        } else if (arg == "--min-time-ms" && i + 1 < argc) {
+            opts.min_time_ms = std::atof(argv[++i]);
+        } else {
+            std::cerr << "usage: " << argv[0] << " [--out FILE] [--filter SUBSTRING] [--min-time-ms N]" << std::endl;
+            return 2;
+        }
+    }
+
+    if (sodium_init() < 0) {
+        std::cerr << "libsodium init failed" << std::endl;
+        return 1;
+    }
+    // Library logging goes to stdout; keep it out of the JSON
+    set_log_level(LogLevel::Warn);
+
+    Bench bench(opts);
+    bench_aead(bench);
+    bench_ratchet(bench);
+    bench_envelope(bench);
+    bench_bytes(bench);
+    bench_frame_batch(bench);
+    bench_dispatcher(bench);
+    bench_trace(bench);
+
+    const std::string json = bench.to_json();
+    if (opts.out_path.empty()) {
+        std::cout << json;
+    } else {
+        std::ofstream out(opts.out_path);
+        if (!out) {
+            std::cerr << "cannot write " << opts.out_path << std::endl;
+            return 1;
+        }
+        out << json;
+    }
+    return 0;
+}
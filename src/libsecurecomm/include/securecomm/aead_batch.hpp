@@ -0,0 +1,80 @@
+#pragma once
+
+#include "crypto.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+namespace securecomm {
+
+class WorkerPool;
+
+// Seals or opens many independent messages in one pass. Jobs only reference
+// caller memory, so key/nonce/aad/input must stay alive until seal()/open()
+// returns. Outputs either go to the job's own buffer or are carved out of one
+// arena owned by the batch, which is reused across runs.
+class AEADBatch {
+public:
+    struct Job {
+        std::span<const uint8_t> key;     // 32 bytes
+        // Empty: random nonce written in front of the ciphertext on seal and read
+        // back from it on open (the AEAD::encrypt layout). Otherwise exactly the
+        // suite's nonce size and not transmitted (e.g. AEAD::make_counter_nonce).
+        std::span<const uint8_t> nonce;
+        std::span<const uint8_t> aad;
+        std::span<const uint8_t> input;   // plaintext for seal, ciphertext for open
+        std::span<uint8_t> output;        // optional; at least sealed_size()/opened_size()
+        CipherSuite suite = default_cipher_suite();
+    };
+
+    struct Result {
+        bool ok = false;
+        std::span<uint8_t> output;        // valid until the next run or clear()
+    };
+
+    // Jobs per task when splitting across a pool; smaller batches stay on the caller
+    static constexpr size_t MIN_JOBS_PER_TASK = 32;
+
+    AEADBatch() = default;
+    ~AEADBatch();
+
+    AEADBatch(const AEADBatch&) = delete;
+    AEADBatch& operator=(const AEADBatch&) = delete;
+
+    void reserve(size_t jobs);
+
+    // Queue a job and return its index; throws if the suite is unavailable or the
+    // nonce has the wrong size. seal()/open() throw if an output buffer is too small.
+    size_t add(const Job& job);
+
+    size_t size() const { return jobs_.size(); }
+
+    // Drop all jobs and wipe the arena, keeping its capacity for the next batch
+    void clear();
+
+    // Process every job, optionally across `pool`. Results are in submission order.
+    const std::vector<Result>& seal(WorkerPool* pool = nullptr);
+    const std::vector<Result>& open(WorkerPool* pool = nullptr);
+
+    const std::vector<Result>& results() const { return results_; }
+
+    static size_t sealed_size(const Job& job);
+    static size_t opened_size(const Job& job);
+
+private:
+    struct Slot {
+        Job job;
+        const AEADBackend* backend;
+    };
+
+    const std::vector<Result>& run(bool seal, WorkerPool* pool);
+    void process(bool seal, size_t begin, size_t end);
+
+    std::vector<Slot> jobs_;
+    std::vector<Result> results_;
+    std::vector<uint8_t> arena_;
+};
+
+} // namespace securecomm
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+#include <span>
+#include <functional>
+
+namespace securecomm {
+
+// Everything a recipient needs to open an attachment stream. It is small and is
+// sent as the plaintext of an ordinary ratchet message, so the per-attachment key
+// gets the session's forward secrecy while the bulk data travels separately.
+struct AttachmentDescriptor {
+    static constexpr size_t KEY_BYTES = 32;
+    static constexpr size_t HEADER_BYTES = 24;
+    static constexpr uint32_t MAX_CHUNK_BYTES = 16 * 1024 * 1024;
+    // [magic(4) "SCAT"] [version(1)] [chunk_bytes(4)] [size(8)] [key(32)] [header(24)]
+    static constexpr size_t SERIALIZED_BYTES = 4 + 1 + 4 + 8 + KEY_BYTES + HEADER_BYTES;
+
+    uint32_t chunk_bytes = 0;                   // plaintext bytes per chunk (last may be shorter)
+    uint64_t size = 0;                          // total plaintext bytes
+    std::array<uint8_t, KEY_BYTES> key{};
+    std::array<uint8_t, HEADER_BYTES> header{}; // secretstream header
+
+    ~AttachmentDescriptor();
+
+    uint64_t chunk_count() const;
+
+    std::vector<uint8_t> serialize() const;
+    // nullopt if `bytes` is not a descriptor (e.g. an ordinary text message)
+    static std::optional<AttachmentDescriptor> parse(std::span<const uint8_t> bytes);
+};
+
+// Seals an attachment chunk by chunk with crypto_secretstream_xchacha20poly1305.
+// Memory use is independent of the attachment size.
+class AttachmentEncryptor {
+public:
+    static constexpr uint32_t DEFAULT_CHUNK_BYTES = 64 * 1024;
+    static constexpr size_t CHUNK_OVERHEAD = 17;    // secretstream tag + MAC
+
+    explicit AttachmentEncryptor(uint64_t size, uint32_t chunk_bytes = DEFAULT_CHUNK_BYTES);
+    ~AttachmentEncryptor();
+
+    AttachmentEncryptor(const AttachmentEncryptor&) = delete;
+    AttachmentEncryptor& operator=(const AttachmentEncryptor&) = delete;
+
+    const AttachmentDescriptor& descriptor() const { return descriptor_; }
+
+    // Seal the next chunk into `out` (at least chunk.size() + CHUNK_OVERHEAD bytes) and
+    // return the bytes written. Every chunk but the last must be exactly chunk_bytes;
+    // the one that reaches `size` is tagged final. Throws on misuse.
+    size_t push(std::span<const uint8_t> chunk, std::span<uint8_t> out);
+
+    bool finished() const { return finished_; }
+
+private:
+    AttachmentDescriptor descriptor_;
+    std::array<uint8_t, 52> state_;     // crypto_secretstream_xchacha20poly1305_state
+    uint64_t consumed_ = 0;
+    bool finished_ = false;
+};
+
+class AttachmentDecryptor {
+public:
+    explicit AttachmentDecryptor(const AttachmentDescriptor& descriptor);
+    ~AttachmentDecryptor();
+
+    AttachmentDecryptor(const AttachmentDecryptor&) = delete;
+    AttachmentDecryptor& operator=(const AttachmentDecryptor&) = delete;
+
+    // Sealed size of the next expected chunk (0 once finished)
+    size_t next_chunk_size() const;
+
+    // Open the next chunk into `out` (at least next_chunk_size() - CHUNK_OVERHEAD bytes).
+    // Returns the plaintext length, or nullopt if the chunk fails authentication, is
+    // out of order, or ends the stream early or late. The decryptor is unusable
+    // after a failure.
+    std::optional<size_t> pull(std::span<const uint8_t> chunk, std::span<uint8_t> out);
+
+    // True once the final chunk has been opened and the full size received
+    bool finished() const { return finished_; }
+
+private:
+    AttachmentDescriptor descriptor_;
+    std::array<uint8_t, 52> state_;
+    uint64_t produced_ = 0;
+    bool finished_ = false;
+    bool failed_ = false;
+};
+
+// Receives each sealed chunk in order (e.g. to append to an upload)
+using AttachmentSink = std::function<void(std::span<const uint8_t> chunk)>;
+
+// Encrypt an in-memory or memory-mapped region
+AttachmentDescriptor encrypt_attachment(std::span<const uint8_t> data,
+                                        const AttachmentSink& sink,
+                                        uint32_t chunk_bytes = AttachmentEncryptor::DEFAULT_CHUNK_BYTES);
+
+// Stream a file through one chunk-sized buffer; throws if it cannot be read
+AttachmentDescriptor encrypt_attachment_file(const std::string& path,
+                                             const AttachmentSink& sink,
+                                             uint32_t chunk_bytes = AttachmentEncryptor::DEFAULT_CHUNK_BYTES);
+
+// Decrypt a file of concatenated sealed chunks into `out_path`. On failure the
+// partial output is removed and false is returned.
+bool decrypt_attachment_file(const AttachmentDescriptor& descriptor,
+                             const std::string& in_path,
+                             const std::string& out_path);
+
+} // namespace securecomm
@@ -0,0 +1,135 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <span>
+#include <vector>
+
+namespace securecomm {
+
+namespace detail {
+struct BytesBlock;
+}
+
+// Immutable, reference-counted bytes. Copies and slices share one buffer, so a
+// received frame can sit in a transport queue, be handed to the dispatcher and wait
+// on an inbound worker without being copied again. Copying one costs an atomic
+// increment. The buffer comes from BytesPool and goes back to it once the last
+// Bytes pointing into it is gone.
+class Bytes {
+public:
+    Bytes() = default;
+    Bytes(const Bytes& other) noexcept;
+    Bytes(Bytes&& other) noexcept;
+    Bytes& operator=(const Bytes& other) noexcept;
+    Bytes& operator=(Bytes&& other) noexcept;
+    ~Bytes();
+
+    // The one copy: `data` into a pooled buffer
+    static Bytes copy(std::span<const uint8_t> data);
+
+    // Shares this buffer; throws std::out_of_range if the range is outside it
+    Bytes slice(size_t offset, size_t length) const;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    const uint8_t* begin() const { return data_; }
+    const uint8_t* end() const { return data_ + size_; }
+    uint8_t operator[](size_t i) const { return data_[i]; }
+
+    std::span<const uint8_t> span() const { return {data_, size_}; }
+    operator std::span<const uint8_t>() const { return span(); }
+    std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(begin(), end()); }
+
+    // True if both point into the same buffer
+    bool shares_buffer(const Bytes& other) const { return block_ && block_ == other.block_; }
+
+private:
+    friend class BytesBuilder;
+    Bytes(detail::BytesBlock* block, const uint8_t* data, size_t size) : block_(block), data_(data), size_(size) {}
+
+    detail::BytesBlock* block_ = nullptr;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// A pooled buffer being filled, e.g. a frame gathered from several parts. freeze()
+// turns it into Bytes without copying; it cannot be written after that.
+class BytesBuilder {
+public:
+    // `size` writable bytes, uninitialised
+    explicit BytesBuilder(size_t size);
+    BytesBuilder(BytesBuilder&& other) noexcept;
+    BytesBuilder& operator=(BytesBuilder&& other) noexcept;
+    ~BytesBuilder();
+
+    BytesBuilder(const BytesBuilder&) = delete;
+    BytesBuilder& operator=(const BytesBuilder&) = delete;
+
+    uint8_t* data() { return data_; }
+    size_t size() const { return size_; }
+    std::span<uint8_t> span() { return {data_, size_}; }
+
+    // The first `used` bytes (default all) as Bytes; the builder is left empty
+    Bytes freeze() &&;
+    Bytes freeze(size_t used) &&;
+
+private:
+    detail::BytesBlock* block_ = nullptr;
+    uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+// Process-wide free lists of Bytes buffers in power-of-two size classes from 64 B
+// to 64 KB. Releasing a buffer pushes it on its class's list (up to
+// MAX_CACHED_BYTES per class) and allocating pops one, so steady traffic stops
+// reaching the heap. Larger buffers are allocated and freed directly. Buffers are
+// often freed on a different thread than the one that allocated them (transport
+// thread in, inbound worker out), so the lists are shared, each behind its own lock.
+class BytesPool {
+public:
+    static constexpr size_t MIN_CLASS_BYTES = 64;
+    static constexpr size_t MAX_CLASS_BYTES = 64 * 1024;
+    static constexpr size_t CLASSES = 11;    // 64 B << 0..10
+    static constexpr size_t MAX_CACHED_BYTES = 1024 * 1024;
+
+    static BytesPool& global();
+
+    // Pooled sizes only
+    struct Stats {
+        uint64_t hits = 0;            // allocations served from a free list
+        uint64_t misses = 0;          // allocations that went to the heap
+        size_t cached_buffers = 0;    // sitting in the free lists now
+        size_t cached_bytes = 0;
+    };
+    Stats stats() const;
+    // Frees every cached buffer
+    void trim();
+
+    BytesPool(const BytesPool&) = delete;
+    BytesPool& operator=(const BytesPool&) = delete;
+
+private:
+    friend class Bytes;
+    friend class BytesBuilder;
+    friend struct detail::BytesBlock;
+    BytesPool() = default;
+
+    // A block with room for at least `size` bytes and one reference
+    detail::BytesBlock* allocate(size_t size);
+    void release(detail::BytesBlock* block);
+
+    struct FreeList {
+        mutable std::mutex mutex;
+        detail::BytesBlock* head = nullptr;
+        size_t count = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+    };
+    std::array<FreeList, CLASSES> classes_;
+};
+
+} // namespace securecomm
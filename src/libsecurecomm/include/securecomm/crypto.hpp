@@ -1,18 +1,97 @@
 #pragma once
 
+#include "secure_key.hpp"
+#include "secure_arena.hpp"
+
 #include <vector>
 #include <cstdint>
+#include <cstddef>
 #include <optional>
+#include <span>
 #include <string>
 
 namespace securecomm {
 
+// AEAD algorithms. The numeric value travels on the wire (see Ratchet header flags),
+// so existing values must never be renumbered.
+enum class CipherSuite : uint8_t {
+    ChaCha20Poly1305 = 0,   // IETF variant, 12-byte nonce (legacy default)
+    XChaCha20Poly1305 = 1,  // 24-byte nonce
+    Aes256Gcm = 2           // 12-byte nonce, only on hosts with AES-NI/PCLMUL
+};
+
+// A single AEAD algorithm. All backends use 32-byte keys and 16-byte tags.
+class AEADBackend {
+public:
+    virtual ~AEADBackend() = default;
+
+    virtual CipherSuite suite() const = 0;
+    virtual const char* name() const = 0;
+    virtual size_t nonce_bytes() const = 0;
+
+    // `c` receives mlen + tag bytes; `m` receives clen - tag bytes. Input and
+    // output may share an address. Return false on failure.
+    virtual bool seal(uint8_t* c, const uint8_t* m, size_t mlen,
+                      const uint8_t* ad, size_t adlen,
+                      const uint8_t* nonce, const uint8_t* key) const = 0;
+    virtual bool open(uint8_t* m, const uint8_t* c, size_t clen,
+                      const uint8_t* ad, size_t adlen,
+                      const uint8_t* nonce, const uint8_t* key) const = 0;
+};
+
+// Backend for `suite`, or nullptr if it is unknown or unsupported on this host.
+const AEADBackend* aead_backend(CipherSuite suite);
+bool cipher_suite_available(CipherSuite suite);
+std::vector<CipherSuite> available_cipher_suites();
+
+// Times every available suite sealing `payload_bytes` and returns the fastest.
+// Intended to be run once at startup and fed to set_default_cipher_suite().
+CipherSuite select_fastest_cipher_suite(size_t payload_bytes = 64 * 1024, int iterations = 32);
+
+// Process-wide suite used by newly constructed AEAD and Ratchet instances (MLS
+// groups stay on ChaCha20-Poly1305 unless MLSManager::set_cipher_suite is called).
+void set_default_cipher_suite(CipherSuite suite);
+CipherSuite default_cipher_suite();
+
 class AEAD {
 public:
-    AEAD();
+    // Random:  a fresh nonce is drawn per message and sealed as [nonce] [ciphertext] [tag(16)]
+    // Counter: the nonce is BE32(counter) || salt(8) (zero-padded to the suite's nonce
+    //          size), derived by both ends and never transmitted, so the sealed form is
+    //          [ciphertext] [tag(16)]. The caller must guarantee (key, salt, counter) is
+    //          never reused.
+    enum class NonceMode : uint8_t {
+        Random = 0,
+        Counter = 1
+    };
+
+    static constexpr size_t NONCE_BYTES = 12;       // ChaCha20-Poly1305 and AES-256-GCM
+    static constexpr size_t MAX_NONCE_BYTES = 24;   // XChaCha20-Poly1305
+    static constexpr size_t TAG_BYTES = 16;
+    static constexpr size_t SALT_BYTES = 8;
+
+    explicit AEAD(CipherSuite suite = default_cipher_suite());
     ~AEAD();
 
+    // Copies into the AEAD's SecureArena slot; throws unless the key is 32 bytes
     void set_key(const std::vector<uint8_t>& key);
+    void set_key(std::span<const uint8_t> key);
+
+    // Switch algorithm; throws if the suite is unavailable on this host.
+    void set_suite(CipherSuite suite);
+    CipherSuite suite() const { return backend_->suite(); }
+    size_t nonce_bytes() const { return backend_->nonce_bytes(); }
+
+    // Exact output sizes for a given input, so callers can size buffers up front
+    size_t overhead(NonceMode mode = NonceMode::Random) const {
+        return (mode == NonceMode::Random ? nonce_bytes() : 0) + TAG_BYTES;
+    }
+    size_t ciphertext_size(size_t plaintext_len, NonceMode mode = NonceMode::Random) const {
+        return plaintext_len + overhead(mode);
+    }
+    size_t plaintext_size(size_t ciphertext_len, NonceMode mode = NonceMode::Random) const {
+        return ciphertext_len < overhead(mode) ? 0 : ciphertext_len - overhead(mode);
+    }
 
     std::vector<uint8_t> encrypt(const std::vector<uint8_t>& plaintext,
                                  const std::vector<uint8_t>& aad = {}) const;
@@ -20,8 +99,46 @@ public:
     std::optional<std::vector<uint8_t>> decrypt(const std::vector<uint8_t>& ciphertext,
                                                 const std::vector<uint8_t>& aad = {}) const;
 
+    // Seal into a caller-owned buffer of at least ciphertext_size(plaintext.size()) bytes.
+    // The plaintext may already sit at out.data() + nonce_bytes() (in-place encryption).
+    // Returns the number of bytes written.
+    size_t encrypt_into(std::span<const uint8_t> plaintext,
+                        std::span<const uint8_t> aad,
+                        std::span<uint8_t> out) const;
+
+    // Open into a caller-owned buffer of at least plaintext_size(ciphertext.size()) bytes.
+    // Returns the plaintext length, or nullopt on authentication failure.
+    std::optional<size_t> decrypt_into(std::span<const uint8_t> ciphertext,
+                                       std::span<const uint8_t> aad,
+                                       std::span<uint8_t> out) const;
+
+    // Open a sealed message in place. On success the returned span views the
+    // plaintext inside `buffer` (starting nonce_bytes() in).
+    std::optional<std::span<uint8_t>> decrypt_in_place(std::span<uint8_t> buffer,
+                                                       std::span<const uint8_t> aad) const;
+
+    // Counter-mode variants. `salt` must hold at least SALT_BYTES bytes; only the
+    // first SALT_BYTES are used, so a 32-byte public key can be passed directly.
+    size_t encrypt_into(std::span<const uint8_t> plaintext,
+                        std::span<const uint8_t> aad,
+                        std::span<uint8_t> out,
+                        uint32_t counter,
+                        std::span<const uint8_t> salt) const;
+
+    std::optional<size_t> decrypt_into(std::span<const uint8_t> ciphertext,
+                                       std::span<const uint8_t> aad,
+                                       std::span<uint8_t> out,
+                                       uint32_t counter,
+                                       std::span<const uint8_t> salt) const;
+
+    // Fill `nonce` (the suite's nonce size) with the counter-mode nonce
+    static void make_counter_nonce(std::span<uint8_t> nonce, uint32_t counter,
+                                   std::span<const uint8_t> salt);
+
 private:
-    std::vector<uint8_t> key_;
+    const AEADBackend* backend_;
+    LockedKey32 key_;
+    bool has_key_ = false;
 };
 
-} // namespace securecomm
\ No newline at end of file
+} // namespace securecomm
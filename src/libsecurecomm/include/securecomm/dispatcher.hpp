@@ -4,18 +4,34 @@
 #include "envelope.hpp"
 #include "ratchet.hpp"
 #include "mls_manager.hpp"
+#include "worker_pool.hpp"
+#include "attachment.hpp"
+#include "metrics.hpp"
+#include "frame_batcher.hpp"
 
+#include <span>
 #include <string>
+#include <string_view>
 #include <unordered_map>
 #include <memory>
 #include <functional>
 #include <mutex>
+#include <shared_mutex>
+#include <array>
+#include <deque>
+#include <future>
+#include <exception>
+#include <chrono>
 
 namespace securecomm {
 
+struct BenchAccess;
+
 class Dispatcher {
 public:
     using OnInboundMessage = std::function<void(const Envelope& env)>;
+    // Receives nullptr once the transport has accepted the message, or the error
+    using SendCompletion = std::function<void(std::exception_ptr error)>;
 
     Dispatcher(TransportPtr transport);
     ~Dispatcher();
@@ -25,28 +41,203 @@ public:
 
     void register_device(const std::string& device_id);
     void create_session_with(const std::string& remote_device_id, const std::vector<uint8_t>& root_key);
-    void send_message_to_device(const std::string& remote_device_id, const std::vector<uint8_t>& plaintext);
+    void send_message_to_device(const std::string& remote_device_id, std::span<const uint8_t> plaintext);
     void send_group_message(const std::vector<uint8_t>& group_id, const std::string& sender_id, const std::vector<uint8_t>& plaintext);
 
+    // Non-blocking send. Encryption, framing and the transport call run on a send
+    // worker chosen by peer, so messages queued for one peer go out in the order
+    // they were queued. The future (or `done`) completes once transport send() has
+    // returned for the message. Without batching, `done` is called on the send
+    // worker. With batching, the message's batch completes it on the batcher's
+    // thread once it goes out. Errors such as a missing session or a failed
+    // transport send come back through it instead of being thrown. If the peer's
+    // queue is full the send fails straight away rather than blocking the caller.
+    std::future<void> send_async(const std::string& remote_device_id, std::vector<uint8_t> plaintext);
+    void send_async(const std::string& remote_device_id, std::vector<uint8_t> plaintext, SendCompletion done);
+
+    // Size of the send stage behind send_async (0 workers = one per core). Created
+    // with the defaults on first use if not set.
+    static constexpr size_t DEFAULT_SEND_QUEUE = 1024;
+    void set_send_workers(size_t workers, size_t queue_capacity = DEFAULT_SEND_QUEUE);
+
+    // Batch sends: every plaintext is sealed in one AEADBatch pass and handed to the
+    // transport in order.
+    void send_messages_to_device(const std::string& remote_device_id, const std::vector<std::vector<uint8_t>>& plaintexts);
+    void send_group_messages(const std::vector<uint8_t>& group_id, const std::string& sender_id, const std::vector<std::vector<uint8_t>>& plaintexts);
+
+    // Encrypt the file at `path` chunk by chunk into `sink` (e.g. an upload to the
+    // relay), then send its descriptor, key included, as a normal ratchet message.
+    // The receiver recognises it with AttachmentDescriptor::parse().
+    AttachmentDescriptor send_attachment(const std::string& remote_device_id,
+                                         const std::string& path,
+                                         const AttachmentSink& sink);
+
+    // Spread batch AEAD work over `threads` workers (0 = one per core). Without a
+    // call batches run on the sending thread.
+    void set_crypto_workers(size_t threads);
+
+    // Precompute up to `window` send keys per session (see Ratchet::set_send_key_window).
+    // The window is topped up after a send once it is half empty: on the crypto
+    // workers when set_crypto_workers() was called, otherwise inline after the
+    // envelope has gone to the transport. 0 turns it off.
+    void set_send_key_window(size_t window);
+
+    // Run DH ratchet steps (X25519 + HKDF on a peer key change) on the crypto
+    // workers instead of the transport callback thread. Messages for that session
+    // are held and replayed in order once the new chain is installed; other sessions
+    // keep flowing. Needs set_crypto_workers(); without workers steps stay inline.
+    void set_async_ratchet_steps(bool enabled);
+
+    // Decrypt inbound traffic on `workers` threads (0 = one per core) instead of the
+    // transport's receive thread. Messages are spread over the workers by sender and
+    // session id, so each session keeps its order while different sessions decrypt
+    // in parallel. At most `queue_capacity` messages wait per worker; beyond that the
+    // transport's receive thread blocks until the worker catches up. The on_inbound
+    // callback then runs on the workers. Meant to be called before start(): messages
+    // already queued when the stage is replaced can be reordered. Messages received
+    // in one batch are queued as one task per worker, and the queue limit and stats
+    // count those tasks.
+    static constexpr size_t DEFAULT_INBOUND_QUEUE = 1024;
+    void set_inbound_workers(size_t workers, size_t queue_capacity = DEFAULT_INBOUND_QUEUE);
+
+    // Wire format on the transport (see WireCodec). Envelopes go out in the legacy
+    // unversioned layout, which earlier Dispatchers read, until the peer is known
+    // to read v1; as v1 until it is known to read v2; then as compact v2 frames.
+    // The peer's version is either set out of band, or learnt from its frames once
+    // negotiation is on; turning negotiation on assumes the peer reads v1.
+    // Negotiation assumes the transport is a direct link to one peer; behind a
+    // relay one peer's frames say nothing about the rest, so it is off by default.
+    void set_wire_negotiation(bool enabled);
+    void set_peer_wire_version(uint32_t version);
+    uint32_t peer_wire_version() const { return wire_.peer_version(); }
+    // With connection state on, v2 frames also replace repeated sender ids with
+    // dictionary indexes and send timestamp deltas. That needs a transport that is
+    // one reliable, ordered link to one peer. Sends then reach the transport one at
+    // a time and bypass the batcher. A send that throws makes the next frame reset
+    // the state at both ends.
+    void set_wire_connection_state(bool enabled);
+
+    // Pack outgoing envelopes into batch frames (see FrameBatcher) once the peer
+    // is known to read them: an envelope waits until the pending ones reach
+    // `max_bytes` or the oldest has waited `max_delay`. The batch sends
+    // (send_messages_to_device, send_group_messages) flush when they are done, so
+    // a fan-out goes out as one frame without waiting. 0 bytes turns it off,
+    // sending what is pending. stop() flushes too. A synchronous send returns once
+    // its envelope is queued. If the batch fails on the timer, that is only logged
+    // and counted in failed_sends; send_async reports it to the sender.
+    void set_send_batching(size_t max_bytes, std::chrono::microseconds max_delay);
+    // Send any envelopes waiting in the batcher now
+    void flush_sends();
+    FrameBatcher::Stats send_batching_stats() const;
+
+    struct InboundStats {
+        size_t workers = 0;                     // 0: handled on the transport thread
+        size_t queue_capacity = 0;
+        size_t queued = 0;                      // waiting across all workers
+        uint64_t processed = 0;
+        uint64_t backpressure_waits = 0;        // receives that blocked on a full queue
+        std::vector<LanePool::LaneStats> lanes; // per worker
+    };
+    InboundStats inbound_stats() const;
+
+    // Per-stage latency histograms for the message path (encrypt, serialize, queue
+    // wait, transport send, deserialize, session lookup, decrypt, callback) plus the
+    // counters and gauges registered by the dispatcher and its owners. Each thread
+    // records into its own histograms; a snapshot merges them.
+    MetricsSnapshot metrics() const;
+    std::string metrics_prometheus() const { return metrics().to_prometheus(); }
+    MetricsRegistry& metrics_registry() { return metrics_; }
+
     void set_on_inbound(OnInboundMessage cb);
 
 private:
-    void on_raw_message(const std::vector<uint8_t>& bytes);
-    std::vector<uint8_t> serialize_envelope(const Envelope& env);
-    std::optional<Envelope> deserialize_envelope(const std::vector<uint8_t>& bytes);
+    // Everything the transport delivered in one go; batch frames are unpacked and
+    // all frames decoded under one hold of wire_recv_mutex_
+    void on_raw_messages(std::span<const Bytes> frames);
+    // Session lookup, decrypt and callback; on an inbound worker when configured.
+    // The _locked variant is called with config_mutex_ held shared.
+    void process_inbound(const EnvelopeView& env);
+    void process_inbound_locked(const EnvelopeView& env);
+    std::shared_ptr<LanePool> send_lanes();
+    // send_message_to_device, for send_async: see send_envelope for `done`
+    void send_message(const std::string& remote_device_id, std::span<const uint8_t> plaintext, SendCompletion& done);
+    // Encode with wire_ and hand to the transport's send_iov (or to batcher_), both
+    // timed. Called with config_mutex_ held shared. If the envelope goes to the
+    // batcher it takes `done`, leaving it empty, and calls it once the batch has
+    // gone out; otherwise `done` is left for the caller.
+    void send_envelope(Envelope env);
+    void send_envelope(Envelope env, SendCompletion& done);
 
     TransportPtr transport_;
-    std::string device_id_;
-    std::mutex mutex_;
+    MetricsRegistry metrics_;    // before anything that records into it
+
+    // One lock per direction. With connection state on, the send lock also covers
+    // transport send(), so frames reach the peer in the order they were encoded;
+    // with batching, it covers adding the frame to batcher_.
+    WireCodec wire_;
+    std::mutex wire_send_mutex_;
+    std::mutex wire_recv_mutex_;
+    // Guarded by config_mutex_; its sends go straight to the transport
+    std::unique_ptr<FrameBatcher> batcher_;
+
+    // Locking. config_mutex_ guards the dispatcher-wide settings below; the send and
+    // receive paths hold it shared, only the setters take it exclusively. Sessions
+    // live in SESSION_SHARDS hash shards whose locks cover the maps alone, and each
+    // session has its own mutex for its ratchet, so traffic to different peers runs
+    // in parallel. Order: config_mutex_, then a shard, then a session. Sessions are
+    // never erased, so a looked-up SessionState stays valid after the shard lock is
+    // dropped.
+    mutable std::shared_mutex config_mutex_;
 
     struct SessionState {
+        std::mutex mutex;
         Ratchet ratchet;
         bool initialized = false;
+        bool refill_pending = false;
+        bool step_in_flight = false;
+        std::deque<Envelope> held;    // inbound envelopes waiting on step_in_flight
     };
 
-    std::unordered_map<std::string, SessionState> sessions_;
+    static constexpr size_t SESSION_SHARDS = 64;
+    // Lets the receive path look sessions up by the sender id it views in the
+    // received bytes, without building a std::string
+    struct DeviceIdHash {
+        using is_transparent = void;
+        size_t operator()(std::string_view id) const { return std::hash<std::string_view>{}(id); }
+    };
+    struct SessionShard {
+        std::shared_mutex mutex;
+        std::unordered_map<std::string, SessionState, DeviceIdHash, std::equal_to<>> sessions;
+    };
+    SessionShard& shard_for(std::string_view remote_device_id);
+    // nullptr if there is no session with that device
+    SessionState* find_session(std::string_view remote_device_id);
+    SessionState& session_for(const std::string& remote_device_id);
+
+    // The following are called with config_mutex_ (shared) and the session's mutex held
+    void deliver_direct(SessionState& s, const EnvelopeView& env);
+    bool async_steps_active() const { return async_ratchet_steps_ && crypto_pool_; }
+    void launch_dh_step(const std::string& remote_device_id, SessionState& s, const PublicKey32& remote_pub);
+    void replay_held(const std::string& remote_device_id, SessionState& s);
+
+    // Same locks held, after the envelope has been handed to the transport
+    void refill_send_keys(const std::string& remote_device_id, SessionState& s);
+
+    std::array<SessionShard, SESSION_SHARDS> shards_;
     MLSManager mls_;
+    std::string device_id_;
     OnInboundMessage on_inbound_;
+    size_t send_key_window_ = 0;
+    bool async_ratchet_steps_ = false;
+    std::unique_ptr<WorkerPool> crypto_pool_;    // joined before the sessions go away
+    // send_async stage; its own lock so send_async never waits on config_mutex_
+    // (it may be called from the on_inbound callback, which runs under it)
+    std::mutex send_lanes_mutex_;
+    std::shared_ptr<LanePool> send_lanes_;
+    // Shared so the receive thread can block on a full lane without holding
+    // config_mutex_. Destroyed first: its queue drains into the sessions, send_lanes_
+    // and crypto_pool_.
+    std::shared_ptr<LanePool> inbound_lanes_;
 };
 
 using DispatcherPtr = std::shared_ptr<Dispatcher>;
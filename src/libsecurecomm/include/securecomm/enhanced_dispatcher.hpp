@@ -38,7 +38,9 @@ public:
     void enable_mesh_networking(bool enable);
     void set_offline_mode(bool offline);
     
-    // Stats
+    // Stats. The counters live in the dispatcher's MetricsRegistry (as
+    // securecomm_messages_*_total, next to the offline queue gauges), so they also
+    // show up in get_dispatcher()->metrics() and its Prometheus output.
     struct EnhancedStats {
         int messages_sent;
         int messages_received;
@@ -66,11 +68,11 @@ private:
     std::atomic<bool> mesh_enabled_;
     std::atomic<bool> offline_mode_;
     
-    // Stats
-    std::atomic<int> messages_sent_{0};
-    std::atomic<int> messages_received_{0};
-    std::atomic<int> messages_queued_{0};
-    std::atomic<int> messages_delivered_via_mesh_{0};
+    // Stats, registered in dispatcher_'s metrics registry
+    std::atomic<uint64_t>& messages_sent_;
+    std::atomic<uint64_t>& messages_received_;
+    std::atomic<uint64_t>& messages_queued_;
+    std::atomic<uint64_t>& messages_delivered_via_mesh_;
     
     std::thread connectivity_thread_;
     std::thread retry_thread_;
@@ -1,12 +1,48 @@
 #pragma once
 
+#include "bytes.hpp"
 #include <vector>
 #include <string>
+#include <string_view>
+#include <span>
 #include <cstdint>
+#include <cstddef>
 #include <optional>
+#include <atomic>
+#include <deque>
+#include <unordered_map>
 
 namespace securecomm {
 
+// Wire format v1 (all integers big-endian):
+//   [version (4)] [session_id len (4) + bytes] [message_index (4)]
+//   [previous_counter (4)] [timestamp (8)] [sender_device_id len (4) + bytes]
+//   [associated_data len (4) + bytes] [ciphertext len (4) + bytes]
+//   [signature len (4) + bytes] [aad len (4) + bytes]
+// The version field is 1 in its low byte; the byte above it is the highest
+// version the sender can read (0, 2, or 3 for v2 plus batch frames), which is how
+// peers agree on v2 and on batching.
+//
+// Wire format v2 (lengths and integers are LEB128 varints, shortest form only):
+//   [0x02] [flags (1)] [session_id len + bytes] [message_index] [previous_counter]
+//   [timestamp: absolute, or zigzag delta from the previous v2 frame on the
+//    connection if TIMESTAMP_DELTA] [sender: dictionary index if SENDER_INDEX,
+//    else len + bytes] [associated_data len + bytes] [ciphertext len + bytes]
+//   then, only if TRAILER: [signature len + bytes] [aad len + bytes]
+// Frames using connection state (TIMESTAMP_DELTA, SENDER_INDEX, SENDER_NEW) can
+// only be decoded by the WireCodec that saw every earlier frame of the connection
+// since the last RESET frame. RESET empties the dictionary and sets the timestamp
+// base to 0 before the frame itself is decoded.
+//
+// Batch frame (version 3), several frames of any version in one transport message:
+//   [0x03] [frame count] then per frame [length + bytes]
+// Count and lengths are varints as in v2; a batch holds at least two frames and
+// none is empty. See BatchFrame.
+//
+// The decoder also accepts the older unversioned Dispatcher layout (session id
+// through ciphertext, no version, signature or aad), whose first byte is the top
+// byte of a session id length and so never 0x02 or 0x03 in practice. WireCodec
+// still sends it to peers that may only read that layout.
 class Envelope {
 public:
     // Data fields (POD-like for easy access)
@@ -23,9 +59,20 @@ public:
     std::vector<uint8_t> signature;
     std::vector<uint8_t> aad;  // This is different from associated_data above
     
-    // Serialization methods
+    static constexpr uint32_t WIRE_VERSION_LEGACY = 0;    // the unversioned layout
+    static constexpr uint32_t WIRE_VERSION = 1;
+    static constexpr uint32_t WIRE_VERSION_V2 = 2;
+    static constexpr uint32_t WIRE_VERSION_BATCH = 3;
+
+    // Serialization methods. serialize() makes exactly one allocation;
+    // serialize_into() writes serialized_size() bytes into `out` and throws if it
+    // is shorter. deserialize() throws on malformed input, try_deserialize()
+    // returns nullopt.
+    size_t serialized_size() const;
     std::vector<uint8_t> serialize() const;
+    size_t serialize_into(std::span<uint8_t> out) const;
     static Envelope deserialize(const std::vector<uint8_t>& input);
+    static std::optional<Envelope> try_deserialize(std::span<const uint8_t> input);
     
     // Helper methods for serialization
     static void push_u32(std::vector<uint8_t>& out, uint32_t v);
@@ -36,4 +83,155 @@ public:
     void migrate_to_old_format() const;
 };
 
-} // namespace securecomm
\ No newline at end of file
+// An envelope decoded in place: every field points into the buffer it was parsed
+// from (a dictionary sender id points into the WireCodec), so routing and
+// decryption need no copies. Valid only while that buffer is alive and unchanged.
+struct EnvelopeView {
+    uint32_t version = Envelope::WIRE_VERSION;    // wire format parsed from
+    std::span<const uint8_t> session_id;
+    uint32_t message_index = 0;
+    uint32_t previous_counter = 0;
+    uint64_t timestamp = 0;
+    std::string_view sender_device_id;
+    std::span<const uint8_t> associated_data;
+    std::span<const uint8_t> ciphertext;
+    std::span<const uint8_t> signature;
+    std::span<const uint8_t> aad;
+
+    // Bounds-checked; nullopt unless `bytes` is exactly one well-formed envelope
+    // that needs no connection state
+    static std::optional<EnvelopeView> parse(std::span<const uint8_t> bytes);
+    // View over an envelope already in memory
+    static EnvelopeView of(const Envelope& env);
+
+    Envelope to_envelope() const;
+
+    // Session id and message index of a frame of any version, connection state or
+    // not; the start of the frame up to the index is enough (the transports key
+    // their trace events with it)
+    struct MessageId {
+        std::span<const uint8_t> session_id;
+        uint32_t message_index = 0;
+    };
+    static std::optional<MessageId> peek_id(std::span<const uint8_t> bytes);
+};
+
+// Batch frames are unpacked before decoding: each frame inside is decoded on its
+// own, in order, as if it had arrived alone.
+struct BatchFrame {
+    static constexpr size_t MAX_HEADER_BYTES = 1 + 5;    // tag and count
+    static constexpr size_t MAX_LENGTH_BYTES = 5;
+
+    static bool is_batch(std::span<const uint8_t> frame) {
+        return !frame.empty() && frame[0] == Envelope::WIRE_VERSION_BATCH;
+    }
+    // Write the tag and frame count, or one frame's length prefix; return the
+    // number of bytes written
+    static size_t write_header(uint8_t* out, uint32_t count);
+    static size_t write_length(uint8_t* out, uint32_t length);
+    // Append the frames inside `batch` to `out` as slices of its buffer. False,
+    // with `out` unchanged, if `batch` is not a well-formed batch frame.
+    static bool unpack(const Bytes& batch, std::vector<Bytes>& out);
+};
+
+// One transport connection's end of the wire format: negotiates v2 with the peer
+// and, when enabled, keeps the connection state v2 frames may use. Frames go out
+// as v1 (advertising version 3) until a frame from the peer shows it reads v2.
+// A peer set to WIRE_VERSION_LEGACY is sent the unversioned layout, which carries
+// no version to negotiate with, until its version is raised.
+// The first frame is v1 even if the peer's v2 frames arrived first, so the peer
+// learns this side's version too, including whether it reads batch frames.
+//
+// Connection state replaces sender ids seen before with small dictionary indexes
+// and sends timestamps as deltas. It assumes the peer decodes every frame, in the
+// order encode() produced them, with one WireCodec: a single reliable, ordered
+// link to one peer. A frame that may not have arrived breaks that, so the sender
+// reports it with send_failed() and the next v2 frame starts the state over.
+// Frames that use it are only decoded while it is enabled here too.
+//
+// encode() calls must be serialized with each other, and so must decode() calls;
+// the two directions may run concurrently.
+class WireCodec {
+public:
+    // Sender ids past this many go out inline
+    static constexpr size_t DICTIONARY_CAPACITY = 1024;
+    // Decoded dictionary entries are kept across resets (views may point at them);
+    // a frame that would take their total size (id bytes plus a fixed cost per
+    // entry) past this is rejected. The encoder counts the entries it has added
+    // the same way and sends ids inline once it would get there.
+    static constexpr size_t DICTIONARY_STORAGE_BYTES = 256 * 1024;
+    static constexpr size_t DICTIONARY_ENTRY_COST = 32;
+
+    std::vector<uint8_t> encode(const Envelope& env);
+    // The frame encode() would produce minus the ciphertext: `framing` is resized
+    // to the bytes before it followed by the bytes after it, and the return value
+    // is where the first part ends. Lets the ciphertext go to the transport in place.
+    size_t encode_framing(const Envelope& env, std::vector<uint8_t>& framing);
+    // The view may point into `frame` and into this codec
+    std::optional<EnvelopeView> decode(std::span<const uint8_t> frame);
+
+    void set_connection_state(bool enabled) { connection_state_.store(enabled, std::memory_order_relaxed); }
+    bool connection_state() const { return connection_state_.load(std::memory_order_relaxed); }
+    // The frame from the last encode() did not reach the peer, or may not have.
+    // Drops the send-side connection state; the next v2 frame carries RESET. The
+    // next frame also advertises this side's version again. Serialized with encode().
+    void send_failed();
+
+    // Whether decode() learns the peer's version from its frames (on by default).
+    // Turn it off when the frames decoded here come from more than one peer, e.g.
+    // through a relay, and one peer's version says nothing about the others.
+    void set_negotiation(bool enabled) { negotiation_.store(enabled, std::memory_order_relaxed); }
+    bool negotiation() const { return negotiation_.load(std::memory_order_relaxed); }
+    // Highest wire version the peer has shown it reads (1 until then); may be set
+    // up front when it is known out of band, and then no v1 frame is sent first.
+    // Any v1 or v2 frame from the peer raises a legacy peer to at least v1.
+    uint32_t peer_version() const { return peer_version_.load(std::memory_order_relaxed); }
+    void set_peer_version(uint32_t version) {
+        advertised_.store(version != Envelope::WIRE_VERSION_LEGACY, std::memory_order_relaxed);
+        peer_version_.store(version, std::memory_order_relaxed);
+    }
+    // The caller unpacked a batch frame from the peer, so the peer reads them
+    void saw_batch_frame() {
+        if (negotiation()) raise_peer_version(Envelope::WIRE_VERSION_BATCH);
+    }
+
+private:
+    // A frame is [head] [ciphertext] [tail]
+    struct Layout {
+        bool legacy = false;
+        bool v2 = false;
+        uint8_t flags = 0;
+        uint64_t timestamp = 0;    // as written: absolute or zigzag delta
+        uint32_t sender_index = 0;
+        size_t head = 0;
+        size_t tail = 0;
+    };
+    // Picks the format and updates the send state as if the frame were written
+    Layout plan(const Envelope& env);
+    void write(const Layout& layout, const Envelope& env, uint8_t* head, uint8_t* tail);
+
+    void raise_peer_version(uint32_t version) {
+        if (version > peer_version()) peer_version_.store(version, std::memory_order_relaxed);
+    }
+
+    std::atomic<uint32_t> peer_version_{Envelope::WIRE_VERSION};
+    std::atomic<bool> advertised_{false};    // a v1 frame has told the peer our version
+    std::atomic<bool> negotiation_{true};
+
+    std::atomic<bool> connection_state_{false};
+
+    // encode() side
+    bool reset_pending_ = false;    // next v2 frame with connection state carries RESET
+    uint64_t send_timestamp_ = 0;
+    std::unordered_map<std::string, uint32_t> send_senders_;
+    size_t sent_sender_bytes_ = 0;    // every entry added since the codec was made
+
+    // decode() side; a deque so views of its strings survive later additions, and
+    // so a RESET moves recv_first_sender_ past the old entries instead of erasing them
+    uint64_t recv_timestamp_ = 0;
+    std::deque<std::string> recv_senders_;
+    size_t recv_first_sender_ = 0;
+    size_t recv_sender_bytes_ = 0;    // storage of every entry, counted as DICTIONARY_STORAGE_BYTES does
+};
+
+} // namespace securecomm
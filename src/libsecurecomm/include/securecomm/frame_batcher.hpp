@@ -0,0 +1,102 @@
+#pragma once
+
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+namespace securecomm {
+
+// Packs the frames going to one transport into batch frames (see BatchFrame).
+// Frames wait until those pending add up to `max_bytes` or the oldest has waited
+// `max_delay`; then all of them go out in one send call, as a batch frame or, if
+// only one is pending, as that frame alone. Frames leave in the order they were
+// added. Their parts are passed on with their owners, not copied: the send sees
+// the batch header and length prefixes interleaved with the frames' own parts.
+// A send that throws loses its frames; each frame's completion gets the error.
+class FrameBatcher {
+public:
+    // Same contract as Transport::send_iov
+    using SendFn = std::function<void(std::span<const std::span<const uint8_t>> parts,
+                                      std::shared_ptr<const void> owner)>;
+    // Outcome of the send that carried a frame: nullptr, or what it threw
+    using Completion = std::function<void(std::exception_ptr error)>;
+
+    FrameBatcher(size_t max_bytes, std::chrono::microseconds max_delay, SendFn send);
+    // Sends whatever is still pending and runs the completions not yet run
+    ~FrameBatcher();
+
+    FrameBatcher(const FrameBatcher&) = delete;
+    FrameBatcher& operator=(const FrameBatcher&) = delete;
+
+    // Queue one frame, the concatenation of `parts`, which `owner` keeps alive (the
+    // parts are copied if there is no owner). Sends on the calling thread when the
+    // frame fills the batch. Empty frames are dropped. `done`, if set, is called
+    // once the send carrying the frame has returned. It runs on the batcher's
+    // thread, never under the caller's locks.
+    // A send that throws also throws from the add() or flush() that made it.
+    void add(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner,
+             Completion done = nullptr);
+    // Send everything pending now
+    void flush();
+
+    struct Stats {
+        uint64_t frames = 0;           // added
+        uint64_t sends = 0;            // send calls, batch frames and lone frames
+        uint64_t size_flushes = 0;     // sends triggered by max_bytes
+        uint64_t timer_flushes = 0;    // sends triggered by max_delay
+        uint64_t failed_sends = 0;     // sends that threw, losing their frames
+    };
+    Stats stats() const;
+
+private:
+    // Sent frames' completions, with the send's outcome
+    struct Finished {
+        std::vector<Completion> done;
+        std::exception_ptr error;
+    };
+
+    // Called with mutex_ held. Queues the completions for the timer thread and
+    // returns the send's error rather than throwing it.
+    std::exception_ptr flush_locked();
+    void send_batch_locked();
+    void run_timer();
+    // For sends nobody else hears about: the timer's and the destructor's
+    static void log_lost(size_t frames, std::exception_ptr error);
+    static void run_completions(std::deque<Finished>& finished);
+
+    const size_t max_bytes_;
+    const std::chrono::microseconds max_delay_;
+    const SendFn send_;
+
+    // Held across the send too, so batches reach the transport in order
+    mutable std::mutex mutex_;
+    std::condition_variable cond_;
+    struct Frame {
+        size_t first_part;
+        size_t part_count;
+        size_t size;
+    };
+    std::vector<Frame> frames_;
+    std::vector<std::span<const uint8_t>> parts_;
+    std::vector<std::shared_ptr<const void>> owners_;
+    std::vector<Completion> done_;    // of the pending frames that have one, in order
+    std::vector<std::span<const uint8_t>> batch_parts_;    // what flush_locked() sends
+    std::deque<Finished> finished_;    // for the timer thread to run
+    size_t pending_bytes_ = 0;
+    std::chrono::steady_clock::time_point deadline_;    // oldest pending frame + max_delay
+    bool timer_idle_ = false;    // waiting for a frame rather than a deadline
+    bool stopping_ = false;
+    Stats stats_;
+    std::thread timer_;
+};
+
+} // namespace securecomm
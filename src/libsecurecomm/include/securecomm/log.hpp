@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+// Statements below this level are compiled out entirely:
+// 0 trace, 1 debug, 2 info, 3 warn, 4 error, 5 off. Set from CMake.
+#ifndef SECURECOMM_LOG_MIN_LEVEL
+#define SECURECOMM_LOG_MIN_LEVEL 1
+#endif
+
+namespace securecomm {
+
+enum class LogLevel : uint8_t { Trace = 0, Debug, Info, Warn, Error, Off };
+
+const char* log_level_name(LogLevel level);
+
+// One formatted line as it sits in the ring buffer. Fixed size, so logging never
+// allocates; longer messages are truncated.
+struct LogRecord {
+    static constexpr size_t MAX_TEXT = 232;
+    uint64_t timestamp_us;     // system clock
+    uint32_t thread;           // hash of the producing thread's id
+    LogLevel level;
+    const char* component;     // string literal, e.g. "Dispatcher"
+    uint16_t length;
+    char text[MAX_TEXT];
+
+    std::string_view message() const { return std::string_view(text, length); }
+};
+
+// Runtime threshold on top of the compile-time one (default Info)
+void set_log_level(LogLevel level);
+LogLevel log_level();
+
+namespace detail {
+extern std::atomic<uint8_t> g_log_level;
+}
+
+inline bool log_enabled(LogLevel level) {
+    return static_cast<uint8_t>(level) >= detail::g_log_level.load(std::memory_order_relaxed);
+}
+
+// Records go into a lock-free bounded ring (multi-producer, single consumer) and a
+// background thread hands them to the sink, so producers never block on I/O or on
+// each other. When the ring is full new records are dropped and counted. The
+// default sink writes "[component] message" lines to stdout, warnings and errors to
+// stderr, flushing once per batch. A replacement sink runs on the logging thread.
+using LogSink = std::function<void(const LogRecord& record)>;
+void set_log_sink(LogSink sink);    // nullptr restores the default
+// Block until everything logged so far has reached the sink
+void flush_log();
+uint64_t log_dropped();
+
+// Builds one record in place; used through the SC_LOG_* macros
+class LogLine {
+public:
+    LogLine(LogLevel level, const char* component);
+    LogLine(const LogLine&) = delete;
+    LogLine& operator=(const LogLine&) = delete;
+
+    LogLine& operator<<(std::string_view s) { append(s.data(), s.size()); return *this; }
+    LogLine& operator<<(const char* s) { return *this << std::string_view(s ? s : "(null)"); }
+    LogLine& operator<<(const std::string& s) { return *this << std::string_view(s); }
+    LogLine& operator<<(char c) { append(&c, 1); return *this; }
+    LogLine& operator<<(bool b) { return *this << (b ? "true" : "false"); }
+    LogLine& operator<<(const void* p);
+    LogLine& operator<<(double v);
+
+    template <typename T, typename = std::enable_if_t<std::is_integral_v<T>>>
+    LogLine& operator<<(T v) {
+        char buf[24];
+        auto res = std::to_chars(buf, buf + sizeof(buf), v);
+        append(buf, static_cast<size_t>(res.ptr - buf));
+        return *this;
+    }
+
+    void submit();
+
+private:
+    void append(const char* s, size_t n) {
+        n = std::min(n, LogRecord::MAX_TEXT - record_.length);
+        memcpy(record_.text + record_.length, s, n);
+        record_.length = static_cast<uint16_t>(record_.length + n);
+    }
+
+    LogRecord record_;
+};
+
+} // namespace securecomm
+
+// SC_LOG_INFO("Dispatcher", "sent " << n << " bytes to " << peer);
+// Below SECURECOMM_LOG_MIN_LEVEL the statement, arguments included, is discarded at
+// compile time; otherwise a disabled level costs one relaxed atomic load.
+#define SC_LOG(level, component, expr)                                              \
+    do {                                                                            \
+        if constexpr (static_cast<int>(level) >= SECURECOMM_LOG_MIN_LEVEL) {        \
+            if (::securecomm::log_enabled(level)) {                                 \
+                ::securecomm::LogLine sc_log_line_(level, component);               \
+                sc_log_line_ << expr;                                               \
+                sc_log_line_.submit();                                              \
+            }                                                                       \
+        }                                                                           \
+    } while (0)
+
+#define SC_LOG_TRACE(component, expr) SC_LOG(::securecomm::LogLevel::Trace, component, expr)
+#define SC_LOG_DEBUG(component, expr) SC_LOG(::securecomm::LogLevel::Debug, component, expr)
+#define SC_LOG_INFO(component, expr)  SC_LOG(::securecomm::LogLevel::Info, component, expr)
+#define SC_LOG_WARN(component, expr)  SC_LOG(::securecomm::LogLevel::Warn, component, expr)
+#define SC_LOG_ERROR(component, expr) SC_LOG(::securecomm::LogLevel::Error, component, expr)
@@ -0,0 +1,173 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace securecomm {
+
+// Where a message spends its time between send_message_to_device() and the peer's
+// on_inbound callback
+enum class Stage : uint8_t {
+    Encrypt,          // ratchet encrypt
+    Serialize,        // envelope to wire bytes
+    QueueWait,        // waiting in a send_async or inbound worker queue
+    TransportSend,    // Transport::send()
+    Deserialize,      // wire bytes to envelope
+    SessionLookup,    // session table and session lock
+    Decrypt,          // ratchet decrypt
+    Callback,         // on_inbound
+    Count
+};
+constexpr size_t STAGE_COUNT = static_cast<size_t>(Stage::Count);
+const char* stage_name(Stage stage);
+
+// Log-linear latency histogram in nanoseconds, HDR style: 16 linear sub-buckets per
+// power of two, so any recorded value is off by at most 1/16 (about 6%). Values
+// beyond ~18 minutes land in the last bucket. Only the owning thread records into
+// one, so recording is a few relaxed loads and stores, no locked instructions.
+class LatencyHistogram {
+public:
+    static constexpr unsigned SUB_BITS = 4;
+    static constexpr uint64_t SUB_BUCKETS = uint64_t(1) << SUB_BITS;
+    static constexpr unsigned MAX_EXPONENT = 39;
+    static constexpr size_t BUCKETS = (MAX_EXPONENT - SUB_BITS + 2) * SUB_BUCKETS;
+
+    static size_t bucket_for(uint64_t ns);
+    // Smallest value counted in bucket i, and one past its largest
+    static uint64_t bucket_lower(size_t i);
+    static uint64_t bucket_upper(size_t i);
+
+    void record(uint64_t ns) {
+        bump(buckets_[bucket_for(ns)], 1);
+        bump(sum_, ns);
+        if (ns > max_.load(std::memory_order_relaxed)) max_.store(ns, std::memory_order_relaxed);
+    }
+
+private:
+    friend class MetricsRegistry;
+    static void bump(std::atomic<uint64_t>& v, uint64_t n) {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    std::array<std::atomic<uint64_t>, BUCKETS> buckets_{};
+    std::atomic<uint64_t> sum_{0};
+    std::atomic<uint64_t> max_{0};
+};
+
+struct MetricsSnapshot {
+    struct Histogram {
+        Stage stage;
+        uint64_t count = 0;
+        uint64_t sum_ns = 0;
+        uint64_t max_ns = 0;
+        std::vector<uint64_t> buckets;    // LatencyHistogram::BUCKETS counts, merged over threads
+
+        // Upper bound of the bucket holding quantile q (0..1); 0 when empty
+        uint64_t percentile_ns(double q) const;
+        double mean_ns() const { return count ? double(sum_ns) / double(count) : 0.0; }
+    };
+    struct Value {
+        std::string name;    // Prometheus metric name
+        std::string help;
+        double value = 0;
+        bool counter = true;    // false: gauge
+    };
+
+    std::array<Histogram, STAGE_COUNT> stages;
+    std::vector<Value> values;
+
+    const Histogram& stage(Stage s) const { return stages[static_cast<size_t>(s)]; }
+    // nullptr if no counter or gauge has that name
+    const Value* value(std::string_view name) const;
+
+    // Prometheus text exposition format (version 0.0.4). Stages become one
+    // securecomm_stage_duration_seconds histogram labelled by stage, bucketed at
+    // powers of two from 256 ns to 17 s.
+    std::string to_prometheus() const;
+};
+
+// Stage histograms (one set per recording thread, merged on snapshot) plus named
+// counters and gauges. Counters are shared atomics meant for low-rate events; the
+// per-message path only records stage times.
+class MetricsRegistry {
+public:
+    MetricsRegistry();
+    ~MetricsRegistry();
+
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    void record(Stage stage, uint64_t ns) { local().stages[static_cast<size_t>(stage)].record(ns); }
+    void record(Stage stage, std::chrono::steady_clock::time_point since) {
+        record(stage, static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                          std::chrono::steady_clock::now() - since).count()));
+    }
+
+    // Registered on first use; the reference stays valid for the registry's lifetime
+    std::atomic<uint64_t>& counter(const std::string& name, const std::string& help);
+    // `read` is called on every snapshot, from the snapshotting thread
+    void set_gauge(const std::string& name, const std::string& help, std::function<double()> read);
+    void remove_gauge(const std::string& name);
+
+    MetricsSnapshot snapshot() const;
+
+private:
+    struct ThreadBlock {
+        std::array<LatencyHistogram, STAGE_COUNT> stages;
+    };
+    ThreadBlock& local();
+    ThreadBlock& register_thread();
+
+    struct Counter {
+        std::string name;
+        std::string help;
+        std::atomic<uint64_t> value{0};
+    };
+    struct Gauge {
+        std::string name;
+        std::string help;
+        std::function<double()> read;
+    };
+
+    const uint64_t id_;    // never reused, so a thread's cached block cannot outlive its registry
+    // Separate locks: a thread registers itself while the dispatcher holds its own
+    // locks, and gauges take those locks while being read
+    mutable std::mutex threads_mutex_;
+    std::vector<std::unique_ptr<ThreadBlock>> threads_;
+    mutable std::mutex values_mutex_;
+    std::deque<Counter> counters_;
+    std::vector<Gauge> gauges_;
+};
+
+// Records the time from construction to destruction (or to stop()) into one stage
+class StageTimer {
+public:
+    StageTimer(MetricsRegistry& registry, Stage stage)
+        : registry_(&registry), stage_(stage), start_(std::chrono::steady_clock::now()) {}
+    ~StageTimer() { stop(); }
+
+    StageTimer(const StageTimer&) = delete;
+    StageTimer& operator=(const StageTimer&) = delete;
+
+    void stop() {
+        if (registry_) registry_->record(stage_, start_);
+        registry_ = nullptr;
+    }
+
+private:
+    MetricsRegistry* registry_;
+    Stage stage_;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace securecomm
@@ -7,10 +7,19 @@
 #include <string>
 #include <unordered_map>
 #include <map>
+#include <span>
+#include <algorithm>
+#include <array>
 #include <cstdint>
+#include <mutex>
 
 namespace securecomm {
 
+class WorkerPool;
+
+// Thread-safe: group state, send counters and the shared AEAD are guarded by one
+// mutex. The batch variants only hold it while consuming counters and building
+// their jobs; the AEAD work itself runs unlocked.
 class MLSManager {
 public:
     MLSManager();
@@ -28,28 +37,77 @@ public:
                                                               const std::string& member_id,
                                                               const Envelope& env);
 
+    // Batch variants: the epoch key and AAD are derived once and the AEAD work runs
+    // as one AEADBatch, optionally across `pool`. Results are in input order.
+    std::vector<Envelope> encrypt_group_messages(const std::vector<uint8_t>& group_id,
+                                                 const std::string& sender_id,
+                                                 const std::vector<std::vector<uint8_t>>& plaintexts,
+                                                 WorkerPool* pool = nullptr);
+
+    std::vector<std::optional<std::vector<uint8_t>>> decrypt_group_messages(const std::vector<uint8_t>& group_id,
+                                                                            const std::string& member_id,
+                                                                            const std::vector<Envelope>& envs,
+                                                                            WorkerPool* pool = nullptr);
+
     std::vector<uint8_t> get_group_epoch_secret(const std::vector<uint8_t>& group_id) const;
-    uint64_t get_group_epoch(const std::vector<uint8_t>& group_id) const;
+    // 0 if there is no such group
+    uint64_t get_group_epoch(std::span<const uint8_t> group_id) const;
+
+    // Counter mode derives each group message nonce from a per-epoch send counter
+    // carried in Envelope::message_index and a random salt this manager picks for
+    // the epoch and sends in the AAD, so members sharing the epoch key (or this
+    // manager after a restart) never build the same nonce. Opt-in; the default is
+    // random nonces.
+    void set_nonce_mode(AEAD::NonceMode mode);
+
+    // Suite used for outgoing group messages; recorded in the AAD flags byte.
+    // Groups stay on ChaCha20-Poly1305 regardless of default_cipher_suite(), since
+    // every member must be able to open them: only switch once all members have
+    // advertised the suite.
+    void set_cipher_suite(CipherSuite suite);
 
 private:
     struct Group {
         std::vector<uint8_t> id;
         uint64_t epoch = 0;
-        std::vector<std::vector<uint8_t>> leaf_secrets;
+        std::vector<LockedKey32> leaf_secrets;
         std::map<std::string, size_t> member_index;
-        std::vector<uint8_t> epoch_secret;
+        LockedKey32 epoch_secret;
+        uint32_t send_counter = 0;      // reset whenever the epoch key changes
+        std::array<uint8_t, AEAD::SALT_BYTES> nonce_salt{};    // redrawn with send_counter
     };
 
+    // Optional trailing AAD byte: bit 1 counter nonce, bits 4-7 CipherSuite; with
+    // bit 1 set the sender's nonce salt follows it
+    static constexpr uint8_t AAD_FLAG_COUNTER_NONCE = 0x02;
+    static constexpr unsigned AAD_SUITE_SHIFT = 4;
+
     std::unordered_map<std::string, std::vector<uint8_t>> members_keys_;
     std::unordered_map<std::string, std::vector<uint8_t>> device_ids_;
-    std::map<std::vector<uint8_t>, Group> groups_;
+    // Transparent, so a group id viewed in received bytes is looked up as is
+    struct GroupIdLess {
+        using is_transparent = void;
+        bool operator()(std::span<const uint8_t> a, std::span<const uint8_t> b) const {
+            return std::lexicographical_compare(a.begin(), a.end(), b.begin(), b.end());
+        }
+    };
+    mutable std::mutex mutex_;
+    std::map<std::vector<uint8_t>, Group, GroupIdLess> groups_;
     AEAD aead_;
+    AEAD::NonceMode nonce_mode_ = AEAD::NonceMode::Random;
+    CipherSuite suite_ = CipherSuite::ChaCha20Poly1305;
 
-    std::vector<uint8_t> derive_epoch_secret(const Group& g) const;
-    std::vector<uint8_t> derive_epoch_key(const std::vector<uint8_t>& epoch_secret,
-                                          const std::vector<uint8_t>& group_id,
-                                          uint64_t epoch) const;
-    std::vector<uint8_t> random_bytes(size_t n) const;
+    SecretKey32 derive_epoch_secret(const Group& g) const;
+    SecretKey32 derive_epoch_key(const LockedKey32& epoch_secret,
+                                 const std::vector<uint8_t>& group_id,
+                                 uint64_t epoch) const;
+    void reset_send_counter(Group& g) const;
+    std::vector<uint8_t> group_aad(const Group& g) const;
+    // Flags byte (0 if absent) and counter-nonce salt of a received group AAD;
+    // false if the AAD has neither valid layout
+    static bool parse_group_aad(const Group& g, std::span<const uint8_t> aad,
+                                uint8_t& flags, std::span<const uint8_t>& salt);
+    Envelope group_envelope(Group& g, const std::string& sender_id) const;
 };
 
 } 
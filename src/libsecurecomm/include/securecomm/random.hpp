@@ -0,0 +1,19 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+
+namespace securecomm {
+
+// Per-thread buffer refilled from randombytes_buf in RANDOM_BLOCK_BYTES blocks.
+static constexpr size_t RANDOM_BLOCK_BYTES = 4096;
+
+// Fill `out` with CSPRNG output. Small requests (nonces, IDs, keys) are served from
+// the calling thread's buffer with no locking or syscalls; bytes are wiped from the
+// buffer as they are handed out and the buffer is discarded after fork(). Requests
+// larger than half a block go straight to libsodium.
+void random_bytes(std::span<uint8_t> out);
+void random_bytes(void* out, size_t len);
+
+} // namespace securecomm
@@ -2,14 +2,45 @@
 
 #include "crypto.hpp"
 #include "envelope.hpp"
+#include "skipped_key_cache.hpp"
 
 #include <vector>
+#include <span>
 #include <cstdint>
 #include <optional>
-#include <map>
 
 namespace securecomm {
 
+class WorkerPool;
+struct BenchAccess;
+
+// Ratchet message header, decoded in place from the envelope's associated data.
+// Layout: [msg_num(4)] [dh_pub(32)] [flags(1), optional]
+// flags: bits 0-3 capabilities/mode, bits 4-7 CipherSuite of this message.
+// Every field is fixed-size, so parsing never allocates.
+struct RatchetHeaderView {
+    static constexpr size_t LEGACY_BYTES = 4 + 32;
+    static constexpr size_t EXTENDED_BYTES = LEGACY_BYTES + 1;
+    static constexpr uint8_t FLAG_COUNTER_NONCE_CAPABLE = 0x01;
+    static constexpr uint8_t FLAG_COUNTER_NONCE = 0x02;
+    static constexpr uint8_t FLAG_AES256GCM_CAPABLE = 0x04;
+    static constexpr unsigned SUITE_SHIFT = 4;
+
+    std::span<const uint8_t> bytes;    // the whole header; authenticated as AAD
+    uint32_t message_number = 0;
+    PublicKey32 dh_public;
+    uint8_t flags = 0;
+    bool extended = false;             // flags byte present
+
+    // nullopt if shorter than the legacy header
+    static std::optional<RatchetHeaderView> parse(std::span<const uint8_t> header);
+
+    AEAD::NonceMode nonce_mode() const {
+        return (flags & FLAG_COUNTER_NONCE) ? AEAD::NonceMode::Counter : AEAD::NonceMode::Random;
+    }
+    CipherSuite suite() const { return static_cast<CipherSuite>(flags >> SUITE_SHIFT); }
+};
+
 class Ratchet {
 public:
     Ratchet();
@@ -19,53 +50,211 @@ public:
                     const std::vector<uint8_t>& session_id = {});
 
     // Perform a ratchet step using the remote's DH public key
+    void ratchet_step(const PublicKey32& remote_dh_public);
     void ratchet_step(const std::vector<uint8_t>& remote_dh_public);
 
     // High-level API using Envelope
     Envelope encrypt_envelope(const std::vector<uint8_t>& plaintext);
+    Envelope encrypt_envelope(std::span<const uint8_t> plaintext);
     std::optional<std::vector<uint8_t>> decrypt_envelope(const Envelope& env);
+    // Same, reading the envelope in place (e.g. straight from received bytes)
+    std::optional<std::vector<uint8_t>> decrypt_envelope(const EnvelopeView& env);
+
+    // Allocation-free receive path: decrypt straight from the envelope's bytes into
+    // `out` and return the plaintext length. `out` must hold the plaintext
+    // (ciphertext.size() bytes always suffice); a short buffer is rejected before
+    // any state changes. Only adopting the first session id and caching skipped keys
+    // touch the heap.
+    std::optional<size_t> decrypt_into(std::span<const uint8_t> session_id,
+                                       std::span<const uint8_t> header,
+                                       std::span<const uint8_t> ciphertext,
+                                       std::span<uint8_t> out);
+    std::optional<size_t> decrypt_into(const Envelope& env, std::span<uint8_t> out);
+
+    // Encrypt several messages in order. The chain is stepped serially and the AEAD
+    // work is done as one AEADBatch, optionally spread across `pool`.
+    std::vector<Envelope> encrypt_envelopes(const std::vector<std::vector<uint8_t>>& plaintexts,
+                                            WorkerPool* pool = nullptr);
 
     std::vector<uint8_t> encrypt(const std::vector<uint8_t>& plaintext,
                                  const std::vector<uint8_t>& aad = {});
     std::optional<std::vector<uint8_t>> decrypt(const std::vector<uint8_t>& ciphertext,
                                                 const std::vector<uint8_t>& aad = {});
 
+    // Full snapshot: keys, counters, DH keys, remote key, session id, negotiated peer
+    // capabilities, settings and every cached skipped key. import_state also accepts
+    // the original 168-byte layout (keys, counters and DH keys only).
     std::vector<uint8_t> export_state() const;
     void import_state(const std::vector<uint8_t>& state);
 
-    const std::vector<uint8_t>& dh_public_key() const { return dh_public_key_; }
+    // Incremental persistence. While enabled, every change is journaled and
+    // export_state_delta() returns what changed since the previous delta (chain
+    // advances, skipped keys added or dropped, ...) - typically a few dozen bytes
+    // per message. Enable tracking, then take the base snapshot; deltas apply in
+    // order on top of it. Each is length-prefixed and carries the generation it
+    // applies to, so they can be appended to one log and a gap is rejected.
+    void set_delta_tracking(bool enabled);
+    std::vector<uint8_t> export_state_delta();
+    void apply_state_delta(const std::vector<uint8_t>& delta);
+    uint64_t state_generation() const { return state_generation_; }
+
+    const PublicKey32& dh_public_key() const { return dh_public_key_; }
+
+    // Preferred nonce mode for outgoing envelopes. Counter nonces are advertised in
+    // the header and only used once the peer has advertised support in return, so
+    // legacy peers keep receiving random-nonce envelopes.
+    void set_nonce_mode(AEAD::NonceMode mode) { nonce_mode_ = mode; dirty_ |= DIRTY_CONFIG; }
+    AEAD::NonceMode nonce_mode() const { return nonce_mode_; }
+
+    // Preferred AEAD suite for outgoing envelopes (defaults to default_cipher_suite()).
+    // The suite actually used is carried in the header; AES-256-GCM is only sent to
+    // peers that advertised they can open it, otherwise ChaCha20-Poly1305 is used.
+    void set_cipher_suite(CipherSuite suite);
+    CipherSuite cipher_suite() const { return suite_; }
+
+    // Most message keys a single header may make us derive (gap between the next
+    // expected index and the received one). Larger gaps are rejected before any
+    // key is derived, so a forged index costs a bounded amount of work.
+    static constexpr uint32_t DEFAULT_MAX_SKIP = 1000;
+    void set_max_skip(uint32_t max_skip) { max_skip_ = max_skip; dirty_ |= DIRTY_CONFIG; }
+    uint32_t max_skip() const { return max_skip_; }
+
+    // Keys of the old receive chain cached on each DH ratchet step (at most
+    // max_skip), so messages the peer sent before switching keys still open when
+    // they arrive after the first message on the new key
+    static constexpr uint32_t PREVIOUS_CHAIN_KEYS = 32;
+
+    // Skipped message keys kept for out-of-order delivery; beyond this the least
+    // recently used are dropped
+    void set_skipped_key_capacity(size_t capacity);
+    size_t skipped_key_count() const { return skipped_keys_.size(); }
+
+    // Asynchronous DH ratchet step. The first message after the peer changes its DH
+    // key normally runs X25519 + HKDF inside decrypt_envelope. Instead, a caller can
+    // prepare_dh_step() (copies the inputs), run DhStep::compute() on any thread,
+    // then commit_dh_step() and decrypt as usual. Commit refuses a step that went
+    // stale because the ratchet moved on in the meantime.
+    struct DhStep {
+        PublicKey32 remote_pub;
+        PublicKey32 local_pub;
+        LockedKey32 dh_private_key;    // wiped by compute()
+        LockedKey32 base_root;
+        LockedKey32 root_key;
+        LockedKey32 send_chain_key;
+        LockedKey32 recv_chain_key;
+        uint64_t epoch = 0;
+        bool computed = false;
+
+        // Throws if the remote key is a low-order point
+        void compute();
+    };
+    // The remote key decrypting `env` would ratchet to, or nullopt if no step is due
+    std::optional<PublicKey32> dh_step_needed(const Envelope& env) const;
+    std::optional<PublicKey32> dh_step_needed(const RatchetHeaderView& header) const;
+    DhStep prepare_dh_step(const PublicKey32& remote_pub) const;
+    bool commit_dh_step(const DhStep& step);
+
+    // Opt-in send-key window: keep up to `window` upcoming message keys (and the
+    // chain keys after them) precomputed, so a send copies a key instead of running
+    // two HMACs. Keys are wiped as they are consumed and the window is dropped on
+    // every DH ratchet step or state import. 0 (the default) turns it off.
+    void set_send_key_window(size_t window);
+    size_t send_key_window() const { return send_window_.size() / 2; }
+    size_t precomputed_send_keys() const { return window_count_; }
+    // Derive keys until the window is full and return how many were added. Meant to
+    // run off the send path; sends never refill the window themselves.
+    size_t precompute_send_keys();
 
 private:
-    // Root & chain keys (32 bytes)
-    std::vector<uint8_t> root_key_;
-    std::vector<uint8_t> send_chain_key_;
-    std::vector<uint8_t> recv_chain_key_;
+    // securecomm_bench times the private helpers directly
+    friend struct BenchAccess;
+
+    // Root & chain keys (SecureArena slots)
+    LockedKey32 root_key_;
+    LockedKey32 send_chain_key_;
+    LockedKey32 recv_chain_key_;
 
     // Message counters
     uint32_t send_message_number_;
     uint32_t recv_message_number_;
 
     // Last seen remote public key
-    std::vector<uint8_t> last_remote_pub_;
+    std::optional<PublicKey32> last_remote_pub_;
 
     // Session id (opaque)
     std::vector<uint8_t> session_id_;
 
     // X25519 keypair
-    std::vector<uint8_t> dh_private_key_;
-    std::vector<uint8_t> dh_public_key_;
+    LockedKey32 dh_private_key_;
+    PublicKey32 dh_public_key_;
+
+    // Skipped message keys ((remote DH pub, message_number) -> message_key)
+    SkippedKeyCache skipped_keys_;
+    uint32_t max_skip_ = DEFAULT_MAX_SKIP;
+
+    // Delta journal: scalar fields are tracked by dirty bit, skipped-key changes in
+    // order (ids only; key bytes are read from the cache when the delta is built)
+    static constexpr uint32_t DIRTY_ROOT = 0x01;
+    static constexpr uint32_t DIRTY_SEND_CHAIN = 0x02;
+    static constexpr uint32_t DIRTY_RECV_CHAIN = 0x04;
+    static constexpr uint32_t DIRTY_REMOTE_PUB = 0x08;
+    static constexpr uint32_t DIRTY_SESSION_ID = 0x10;
+    static constexpr uint32_t DIRTY_PEER_CAPS = 0x20;
+    static constexpr uint32_t DIRTY_CONFIG = 0x40;
+    static constexpr uint32_t DIRTY_SKIPPED_CLEAR = 0x80;
+    struct SkippedChange {
+        SkippedKeyCache::KeyId id;
+        bool erased;
+    };
+    uint32_t dirty_ = 0;
+    bool track_deltas_ = false;
+    std::vector<SkippedChange> skipped_changes_;
+    uint64_t state_generation_ = 0;
 
-    // Skipped message keys (message_number -> message_key)
-    std::map<uint32_t, std::vector<uint8_t>> skipped_message_keys_;
+    // Precomputed send keys: ring of (message key, following chain key) pairs in
+    // arena slots; entry i belongs to message send_message_number_ + i
+    std::vector<LockedKey32> send_window_;
+    size_t window_head_ = 0;
+    size_t window_count_ = 0;
+    void drop_send_key_window();
+
+    // Bumped whenever the root and chains are replaced, so stale DhSteps are refused
+    uint64_t root_epoch_ = 0;
+
+    void skipped_put(const PublicKey32& remote_pub, uint32_t index, const SecretKey32& key);
+    void skipped_erase(const PublicKey32& remote_pub, uint32_t index);
+    void stash_receive_chain();
+    void reset_journal();
 
     // AEAD wrapper
     AEAD aead_;
 
+    // Nonce and suite negotiation
+    AEAD::NonceMode nonce_mode_ = AEAD::NonceMode::Counter;
+    CipherSuite suite_ = default_cipher_suite();
+    bool peer_extended_header_ = false;
+    bool peer_counter_nonce_ = false;
+    bool peer_aes256gcm_ = false;
+
+    void note_peer_header(const RatchetHeaderView& header);
+
+    // Header, message key and parameters of the next outgoing message
+    struct OutgoingMessage {
+        Envelope env;
+        SecretKey32 msg_key;
+        AEAD::NonceMode mode;
+        CipherSuite suite;
+    };
+
+    // Builds the header and advances the send chain; the caller seals
+    OutgoingMessage next_outgoing(bool extended_header);
+    Envelope seal_envelope(std::span<const uint8_t> plaintext, bool extended_header);
+
     // Helpers
-    std::vector<uint8_t> derive_message_key(const std::vector<uint8_t>& chain_key) const;
-    std::vector<uint8_t> advance_chain_key(const std::vector<uint8_t>& chain_key) const;
-    void hkdf_root_chain(const std::vector<uint8_t>& dh_shared_secret);
-    std::vector<uint8_t> dh_compute(const std::vector<uint8_t>& remote_public) const;
+    SecretKey32 derive_message_key(const LockedKey32& chain_key) const;
+    SecretKey32 advance_chain_key(const LockedKey32& chain_key) const;
+    void hkdf_root_chain(const SecretKey32& dh_shared_secret, const PublicKey32& remote_pub);
+    SecretKey32 dh_compute(const PublicKey32& remote_public) const;
 
     // Small helpers to serialize uint32 BE
     static void push_u32_be(std::vector<uint8_t>& out, uint32_t v);
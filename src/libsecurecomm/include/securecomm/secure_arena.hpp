@@ -0,0 +1,84 @@
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <mutex>
+
+namespace securecomm {
+
+// Process-wide pool of 32-byte slots carved from a few large sodium_malloc blocks
+// (guard pages, mlock'd, excluded from core dumps). Allocation and release pop and
+// push an intrusive free list, so they are O(1) and never touch the page tables
+// once a block exists. Blocks are kept for the life of the process.
+class SecureArena {
+public:
+    static constexpr size_t SLOT_BYTES = 32;
+    static constexpr size_t BLOCK_BYTES = 64 * 1024;
+    static constexpr size_t SLOTS_PER_BLOCK = BLOCK_BYTES / SLOT_BYTES;
+
+    static SecureArena& global();
+
+    // A zeroed slot; throws std::bad_alloc if a new block cannot be mapped
+    uint8_t* allocate();
+    // Wipes the slot and returns it to the free list
+    void release(uint8_t* slot);
+
+    size_t slots_in_use() const;
+    size_t blocks() const;
+
+    SecureArena(const SecureArena&) = delete;
+    SecureArena& operator=(const SecureArena&) = delete;
+
+private:
+    SecureArena() = default;
+
+    struct FreeSlot { FreeSlot* next; };
+
+    mutable std::mutex mutex_;
+    std::vector<void*> blocks_;
+    FreeSlot* free_ = nullptr;
+    size_t in_use_ = 0;
+};
+
+// 32-byte secret held in a SecureArena slot. Meant for long-lived keys (root and
+// chain keys, identity keys, epoch secrets); short-lived per-message keys use the
+// inline SecretKey32 instead.
+class LockedKey32 {
+public:
+    static constexpr size_t BYTES = 32;
+
+    LockedKey32();
+    explicit LockedKey32(std::span<const uint8_t> bytes);
+    LockedKey32(const LockedKey32& other);
+    LockedKey32(LockedKey32&& other) noexcept;
+    LockedKey32& operator=(const LockedKey32& other);
+    LockedKey32& operator=(LockedKey32&& other) noexcept;
+    ~LockedKey32();
+
+    // Throws unless `bytes` is exactly 32 bytes long
+    void assign(std::span<const uint8_t> bytes);
+    void clear();
+
+    uint8_t* data() { return slot(); }
+    const uint8_t* data() const { return slot_; }
+    static constexpr size_t size() { return BYTES; }
+
+    uint8_t* begin() { return data(); }
+    uint8_t* end() { return data() + BYTES; }
+    const uint8_t* begin() const { return slot_; }
+    const uint8_t* end() const { return slot_ + BYTES; }
+
+    std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(begin(), end()); }
+
+    bool operator==(const LockedKey32& other) const;
+
+private:
+    // A moved-from key lazily takes a fresh slot if it is written again
+    uint8_t* slot();
+
+    uint8_t* slot_;
+};
+
+} // namespace securecomm
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <array>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+#include <algorithm>
+#include <stdexcept>
+
+namespace securecomm {
+
+// sodium_memzero / sodium_memcmp, kept out of line so this header does not pull in sodium.h
+void secure_zero(void* data, size_t len);
+bool secure_equal(const void* a, const void* b, size_t len);
+
+// Fixed-size key stored inline, so copying or returning one never touches the heap.
+// Secret keys are wiped on destruction and compared in constant time.
+template <size_t N, bool Secret>
+class FixedKey {
+public:
+    static constexpr size_t BYTES = N;
+
+    FixedKey() = default;
+    explicit FixedKey(std::span<const uint8_t> bytes) { assign(bytes); }
+    FixedKey(const FixedKey&) = default;
+    FixedKey& operator=(const FixedKey&) = default;
+    ~FixedKey() {
+        if constexpr (Secret) secure_zero(bytes_.data(), N);
+    }
+
+    // Throws unless `bytes` is exactly N bytes long
+    void assign(std::span<const uint8_t> bytes) {
+        if (bytes.size() != N) throw std::runtime_error("key must be " + std::to_string(N) + " bytes");
+        std::copy(bytes.begin(), bytes.end(), bytes_.begin());
+    }
+
+    void clear() { secure_zero(bytes_.data(), N); }
+
+    uint8_t* data() { return bytes_.data(); }
+    const uint8_t* data() const { return bytes_.data(); }
+    static constexpr size_t size() { return N; }
+
+    uint8_t* begin() { return bytes_.data(); }
+    uint8_t* end() { return bytes_.data() + N; }
+    const uint8_t* begin() const { return bytes_.data(); }
+    const uint8_t* end() const { return bytes_.data() + N; }
+
+    uint8_t& operator[](size_t i) { return bytes_[i]; }
+    uint8_t operator[](size_t i) const { return bytes_[i]; }
+
+    std::vector<uint8_t> to_vector() const { return std::vector<uint8_t>(begin(), end()); }
+
+    bool operator==(const FixedKey& other) const {
+        if constexpr (Secret) return secure_equal(data(), other.data(), N);
+        return bytes_ == other.bytes_;
+    }
+
+private:
+    std::array<uint8_t, N> bytes_{};
+};
+
+using SecretKey32 = FixedKey<32, true>;
+using PublicKey32 = FixedKey<32, false>;
+
+} // namespace securecomm
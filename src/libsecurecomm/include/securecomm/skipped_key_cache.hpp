@@ -0,0 +1,85 @@
+#pragma once
+
+#include "secure_key.hpp"
+#include "secure_arena.hpp"
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <optional>
+
+namespace securecomm {
+
+// Message keys for ratchet indices that were skipped over, keyed by the sender's
+// DH public key and the message index. Flat open-addressed table (linear probing,
+// backward-shift deletion, at most half full) threaded with an intrusive LRU list:
+// put/find/erase are O(1), and once `capacity` keys are held the least recently
+// used one is evicted. Keys live in SecureArena slots.
+class SkippedKeyCache {
+public:
+    static constexpr size_t DEFAULT_CAPACITY = 1000;
+
+    struct KeyId {
+        PublicKey32 remote_pub;
+        uint32_t index;
+    };
+
+    explicit SkippedKeyCache(size_t capacity = DEFAULT_CAPACITY);
+
+    // Insert (or overwrite) a key and mark it most recently used. Returns the
+    // entry evicted to make room, if any.
+    std::optional<KeyId> put(const PublicKey32& remote_pub, uint32_t index, std::span<const uint8_t> key);
+    // nullptr when absent; a hit becomes the most recently used entry
+    const LockedKey32* find(const PublicKey32& remote_pub, uint32_t index);
+    // Lookup that leaves the LRU order alone
+    const LockedKey32* peek(const PublicKey32& remote_pub, uint32_t index) const;
+    bool erase(const PublicKey32& remote_pub, uint32_t index);
+    void clear();
+
+    size_t size() const { return size_; }
+    size_t capacity() const { return capacity_; }
+    // Shrinking evicts least recently used keys down to the new capacity; returns them
+    std::vector<KeyId> set_capacity(size_t capacity);
+    uint64_t evictions() const { return evictions_; }
+
+    // Visit every entry, least recently used first
+    template <typename Fn>
+    void for_each(Fn&& fn) const {
+        for (uint32_t i = lru_; i != NIL; i = slots_[i].next) {
+            fn(slots_[i].pub, slots_[i].index, *slots_[i].key);
+        }
+    }
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+    static constexpr size_t MIN_SLOTS = 16;
+
+    struct Slot {
+        PublicKey32 pub;
+        uint32_t index = 0;
+        uint32_t hash = 0;
+        uint32_t prev = NIL;    // towards least recently used
+        uint32_t next = NIL;    // towards most recently used
+        bool used = false;
+        std::optional<LockedKey32> key;    // engaged only while used
+    };
+
+    uint32_t hash_of(const PublicKey32& remote_pub, uint32_t index) const;
+    uint32_t locate(const PublicKey32& remote_pub, uint32_t index, uint32_t hash) const;
+    void link_back(uint32_t i);
+    void unlink(uint32_t i);
+    void remove_at(uint32_t i);
+    void move_slot(uint32_t from, uint32_t to);
+    void grow();
+    size_t max_slots() const;
+
+    std::vector<Slot> slots_;    // power-of-two length, allocated on first put
+    size_t size_ = 0;
+    size_t capacity_;
+    uint32_t lru_ = NIL;         // least recently used
+    uint32_t mru_ = NIL;         // most recently used
+    uint64_t seed_;              // per-cache hash seed, so peers cannot aim for collisions
+    uint64_t evictions_ = 0;
+};
+
+} // namespace securecomm
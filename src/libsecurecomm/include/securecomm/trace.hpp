@@ -0,0 +1,108 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <string>
+#include <string_view>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define SECURECOMM_TRACE_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SECURECOMM_TRACE_TSC 1
+#else
+#define SECURECOMM_TRACE_TSC 0
+#endif
+
+// 0 compiles every trace point out; set from CMake
+#ifndef SECURECOMM_TRACING
+#define SECURECOMM_TRACING 1
+#endif
+
+namespace securecomm {
+
+// Identifies one message across the pipeline: the first 8 bytes of its session id
+// (big-endian, so it reads like the id's hex prefix) and its message index.
+// Modules that only know their own ids (offline queue, mesh) hash them into
+// `session` with index 0.
+struct TraceKey {
+    uint64_t session = 0;
+    uint32_t index = 0;
+
+    static TraceKey of(std::span<const uint8_t> session_id, uint32_t message_index);
+    static TraceKey of(std::string_view id);
+};
+
+// Start recording into a fresh buffer of `capacity` events, discarding the previous
+// one. Recording stops when the buffer is full; later events are counted as
+// dropped. An event is one relaxed load when tracing is off and, when on, one
+// cycle-counter read per timestamp (converted to wall time on export), an atomic
+// increment and a 48-byte store.
+inline constexpr size_t DEFAULT_TRACE_CAPACITY = 1 << 16;
+void start_tracing(size_t capacity = DEFAULT_TRACE_CAPACITY);
+void stop_tracing();
+
+// Events recorded so far as Chrome trace JSON (chrome://tracing, Perfetto). Each
+// event carries its session prefix and message index as args, and events sharing
+// a key are chained with flow arrows. Safe to call while tracing is running.
+std::string chrome_trace_json();
+// Writes chrome_trace_json() to `path`; false if the file cannot be written
+bool write_chrome_trace(const std::string& path);
+uint64_t trace_dropped();
+
+namespace detail {
+extern std::atomic<bool> g_tracing;
+// TSC ticks on x86, steady_clock nanoseconds elsewhere; never 0
+inline uint64_t trace_ticks() {
+#if SECURECOMM_TRACE_TSC
+    return __rdtsc();
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+void trace_record(const char* name, TraceKey key, uint64_t start, uint64_t duration);
+}
+
+inline bool tracing_enabled() {
+#if SECURECOMM_TRACING
+    return detail::g_tracing.load(std::memory_order_relaxed);
+#else
+    return false;
+#endif
+}
+
+// Zero-length event. `name` must be a string literal.
+inline void trace_instant(const char* name, TraceKey key) {
+    if (tracing_enabled()) detail::trace_record(name, key, detail::trace_ticks(), 0);
+}
+
+// Records a complete event spanning its lifetime. The key may be filled in later
+// with set_key(), e.g. once the envelope has been decrypted or parsed.
+class TraceScope {
+public:
+    explicit TraceScope(const char* name, TraceKey key = {})
+        : name_(name), key_(key), start_(tracing_enabled() ? detail::trace_ticks() : 0) {}
+    ~TraceScope() {
+        if (start_ != 0 && tracing_enabled()) {
+            detail::trace_record(name_, key_, start_, detail::trace_ticks() - start_);
+        }
+    }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+    bool active() const { return start_ != 0; }
+    void set_key(TraceKey key) { key_ = key; }
+
+private:
+    const char* name_;
+    TraceKey key_;
+    uint64_t start_;    // 0: tracing was off when the scope opened
+};
+
+} // namespace securecomm
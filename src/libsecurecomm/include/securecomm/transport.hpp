@@ -1,22 +1,51 @@
 #pragma once
 
 #include "envelope.hpp"
+#include "bytes.hpp"
 #include <vector>
 #include <functional>
 #include <memory>
+#include <span>
 #include <string>
 
 namespace securecomm {
 
 class Transport {
 public:
-    using OnMessageCb = std::function<void(const std::vector<uint8_t>&)>;
+    // One received frame. The receiver may keep it (a copy shares the buffer), so a
+    // transport hands over the Bytes it queued rather than copying into a new one.
+    using OnMessageCb = std::function<void(const Bytes&)>;
+    // Every frame that was waiting when the transport's receive thread woke, in
+    // arrival order, so the receiver can take its locks once per batch. A frame may
+    // itself be a batch frame (see BatchFrame); unpacking it is up to the receiver.
+    using OnMessageBatchCb = std::function<void(std::span<const Bytes> frames)>;
 
     virtual ~Transport() = default;
     virtual void start() = 0;
     virtual void stop() = 0;
+    // May be called from several threads at once (Dispatcher sends per session in parallel)
     virtual void send(const std::vector<uint8_t>& bytes) = 0;
+    // Vectored send of one frame, the concatenation of `parts`. The parts are valid
+    // during the call and, when `owner` is set, for as long as it lives, so a
+    // transport that queues can keep them instead of copying. Dispatcher sends the
+    // envelope framing and the ciphertext this way, the ciphertext in place. The
+    // default joins the parts and calls send().
+    virtual void send_iov(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner) {
+        (void)owner;
+        std::vector<uint8_t> joined;
+        for (const auto& part : parts) joined.insert(joined.end(), part.begin(), part.end());
+        send(joined);
+    }
     virtual void set_on_message(OnMessageCb cb) = 0;
+    // Replaces the set_on_message() callback. The default hands frames over one
+    // at a time.
+    virtual void set_on_message_batch(OnMessageBatchCb cb) {
+        if (!cb) {
+            set_on_message(nullptr);
+            return;
+        }
+        set_on_message([cb = std::move(cb)](const Bytes& frame) { cb(std::span<const Bytes>(&frame, 1)); });
+    }
 };
 
 using TransportPtr = std::shared_ptr<Transport>;
@@ -0,0 +1,93 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace securecomm {
+
+// Fixed-size pool of threads draining a FIFO task queue.
+class WorkerPool {
+public:
+    // threads == 0 uses std::thread::hardware_concurrency()
+    explicit WorkerPool(size_t threads = 0);
+    ~WorkerPool();
+
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+
+    size_t size() const { return workers_.size(); }
+
+    void submit(std::function<void()> task);
+
+    // Split [0, count) into contiguous ranges of at least `min_per_task` items, run
+    // them on the pool and the calling thread, and return once every range is done.
+    // The first exception thrown by `fn` is rethrown here. Must not be called from
+    // inside a pool task.
+    void parallel_for(size_t count,
+                      const std::function<void(size_t begin, size_t end)>& fn,
+                      size_t min_per_task = 1);
+
+private:
+    void run();
+
+    std::vector<std::thread> workers_;
+    std::queue<std::function<void()>> tasks_;
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool stopping_ = false;
+};
+
+// Fixed set of lanes, each one thread draining its own bounded FIFO. Tasks
+// submitted to the same lane run in submission order; different lanes run in
+// parallel. submit() blocks while the lane is full, which pushes back on the
+// producer. Queued tasks are finished before the destructor returns.
+class LanePool {
+public:
+    struct LaneStats {
+        size_t depth = 0;            // queued, not yet started
+        size_t high_water = 0;       // deepest the queue has been
+        uint64_t completed = 0;
+        uint64_t full_waits = 0;     // submits that blocked on a full queue
+    };
+
+    // lanes == 0 uses std::thread::hardware_concurrency()
+    LanePool(size_t lanes, size_t capacity);
+    ~LanePool();
+
+    LanePool(const LanePool&) = delete;
+    LanePool& operator=(const LanePool&) = delete;
+
+    size_t size() const { return lanes_.size(); }
+    size_t capacity() const { return capacity_; }
+    size_t lane_for(uint64_t key_hash) const { return key_hash % lanes_.size(); }
+
+    void submit(size_t lane, std::function<void()> task);
+    // Never blocks: returns false, leaving `task` untouched, if the lane is full
+    bool try_submit(size_t lane, std::function<void()>&& task);
+    std::vector<LaneStats> stats() const;
+
+private:
+    struct Lane {
+        std::thread thread;
+        std::deque<std::function<void()>> tasks;
+        mutable std::mutex mutex;
+        std::condition_variable not_empty;
+        std::condition_variable not_full;
+        bool stopping = false;
+        LaneStats stats;
+    };
+    void run(Lane& lane);
+
+    std::vector<std::unique_ptr<Lane>> lanes_;
+    size_t capacity_;
+};
+
+} // namespace securecomm
@@ -0,0 +1,123 @@
+#include "securecomm/aead_batch.hpp"
+#include "securecomm/random.hpp"
+#include "securecomm/worker_pool.hpp"
+#include <sodium.h>
+#include <stdexcept>
+
+namespace securecomm {
+
+AEADBatch::~AEADBatch() {
+    sodium_memzero(arena_.data(), arena_.size());
+}
+
+void AEADBatch::reserve(size_t jobs) {
+    jobs_.reserve(jobs);
+    results_.reserve(jobs);
+}
+
+size_t AEADBatch::add(const Job& job) {
+    const AEADBackend* backend = aead_backend(job.suite);
+    if (!backend) throw std::runtime_error("cipher suite not available on this host");
+    if (job.key.size() != 32) throw std::runtime_error("AEAD key must be 32 bytes");
+    if (!job.nonce.empty() && job.nonce.size() != backend->nonce_bytes()) {
+        throw std::runtime_error("AEADBatch nonce size mismatch");
+    }
+    jobs_.push_back(Slot{ job, backend });
+    return jobs_.size() - 1;
+}
+
+void AEADBatch::clear() {
+    sodium_memzero(arena_.data(), arena_.size());
+    jobs_.clear();
+    results_.clear();
+}
+
+size_t AEADBatch::sealed_size(const Job& job) {
+    const AEADBackend* backend = aead_backend(job.suite);
+    const size_t nonce_len = job.nonce.empty() && backend ? backend->nonce_bytes() : 0;
+    return nonce_len + job.input.size() + AEAD::TAG_BYTES;
+}
+
+size_t AEADBatch::opened_size(const Job& job) {
+    const AEADBackend* backend = aead_backend(job.suite);
+    const size_t overhead = (job.nonce.empty() && backend ? backend->nonce_bytes() : 0) + AEAD::TAG_BYTES;
+    return job.input.size() < overhead ? 0 : job.input.size() - overhead;
+}
+
+const std::vector<AEADBatch::Result>& AEADBatch::seal(WorkerPool* pool) {
+    return run(true, pool);
+}
+
+const std::vector<AEADBatch::Result>& AEADBatch::open(WorkerPool* pool) {
+    return run(false, pool);
+}
+
+const std::vector<AEADBatch::Result>& AEADBatch::run(bool seal, WorkerPool* pool) {
+    // Size everything up front so the arena is allocated at most once per run
+    size_t arena_bytes = 0;
+    for (const auto& slot : jobs_) {
+        const size_t need = seal ? sealed_size(slot.job) : opened_size(slot.job);
+        if (slot.job.output.empty()) {
+            arena_bytes += need;
+        } else if (slot.job.output.size() < need) {
+            throw std::runtime_error("AEADBatch output buffer too small");
+        }
+    }
+    if (arena_.size() < arena_bytes) {
+        sodium_memzero(arena_.data(), arena_.size());
+        arena_.resize(arena_bytes);
+    }
+
+    results_.assign(jobs_.size(), Result{});
+    size_t offset = 0;
+    for (size_t i = 0; i < jobs_.size(); i++) {
+        const auto& job = jobs_[i].job;
+        const size_t need = seal ? sealed_size(job) : opened_size(job);
+        if (job.output.empty()) {
+            results_[i].output = std::span<uint8_t>(arena_.data() + offset, need);
+            offset += need;
+        } else {
+            results_[i].output = job.output.first(need);
+        }
+    }
+
+    if (pool) {
+        pool->parallel_for(jobs_.size(),
+                           [this, seal](size_t begin, size_t end) { process(seal, begin, end); },
+                           MIN_JOBS_PER_TASK);
+    } else {
+        process(seal, 0, jobs_.size());
+    }
+    return results_;
+}
+
+// Each job writes only its own output range, so ranges can run concurrently
+void AEADBatch::process(bool seal, size_t begin, size_t end) {
+    for (size_t i = begin; i < end; i++) {
+        const Job& job = jobs_[i].job;
+        const AEADBackend* backend = jobs_[i].backend;
+        Result& result = results_[i];
+        uint8_t* out = result.output.data();
+
+        if (seal) {
+            const uint8_t* nonce = job.nonce.data();
+            if (job.nonce.empty()) {
+                random_bytes(out, backend->nonce_bytes());
+                nonce = out;
+                out += backend->nonce_bytes();
+            }
+            result.ok = backend->seal(out, job.input.data(), job.input.size(),
+                                      job.aad.data(), job.aad.size(), nonce, job.key.data());
+        } else {
+            const size_t overhead = (job.nonce.empty() ? backend->nonce_bytes() : 0) + AEAD::TAG_BYTES;
+            if (job.input.size() < overhead) continue;
+            const uint8_t* nonce = job.nonce.empty() ? job.input.data() : job.nonce.data();
+            const size_t skip = job.nonce.empty() ? backend->nonce_bytes() : 0;
+            result.ok = backend->open(out, job.input.data() + skip, job.input.size() - skip,
+                                      job.aad.data(), job.aad.size(), nonce, job.key.data());
+        }
+        if (!result.ok) result.output = {};
+    }
+}
+
+} // namespace securecomm
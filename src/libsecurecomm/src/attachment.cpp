@@ -0,0 +1,240 @@
+#include "securecomm/attachment.hpp"
+#include <sodium.h>
+#include <stdexcept>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <algorithm>
+
+namespace securecomm {
+
+using StreamState = crypto_secretstream_xchacha20poly1305_state;
+
+static_assert(sizeof(StreamState) == 52, "secretstream state size mismatch");
+static_assert(AttachmentEncryptor::CHUNK_OVERHEAD == crypto_secretstream_xchacha20poly1305_ABYTES,
+              "secretstream overhead mismatch");
+static_assert(AttachmentDescriptor::KEY_BYTES == crypto_secretstream_xchacha20poly1305_KEYBYTES,
+              "secretstream key size mismatch");
+static_assert(AttachmentDescriptor::HEADER_BYTES == crypto_secretstream_xchacha20poly1305_HEADERBYTES,
+              "secretstream header size mismatch");
+
+namespace {
+
+const uint8_t DESCRIPTOR_MAGIC[4] = { 'S', 'C', 'A', 'T' };
+const uint8_t DESCRIPTOR_VERSION = 1;
+
+StreamState* as_state(std::array<uint8_t, 52>& raw) {
+    return reinterpret_cast<StreamState*>(raw.data());
+}
+
+} // namespace
+
+AttachmentDescriptor::~AttachmentDescriptor() {
+    sodium_memzero(key.data(), key.size());
+}
+
+uint64_t AttachmentDescriptor::chunk_count() const {
+    if (chunk_bytes == 0) return 0;
+    // An empty attachment is still one (empty) final chunk
+    return size == 0 ? 1 : (size + chunk_bytes - 1) / chunk_bytes;
+}
+
+std::vector<uint8_t> AttachmentDescriptor::serialize() const {
+    std::vector<uint8_t> out;
+    out.reserve(SERIALIZED_BYTES);
+    out.insert(out.end(), DESCRIPTOR_MAGIC, DESCRIPTOR_MAGIC + sizeof(DESCRIPTOR_MAGIC));
+    out.push_back(DESCRIPTOR_VERSION);
+    for (int i = 3; i >= 0; --i) out.push_back(static_cast<uint8_t>((chunk_bytes >> (8 * i)) & 0xFF));
+    for (int i = 7; i >= 0; --i) out.push_back(static_cast<uint8_t>((size >> (8 * i)) & 0xFF));
+    out.insert(out.end(), key.begin(), key.end());
+    out.insert(out.end(), header.begin(), header.end());
+    return out;
+}
+
+std::optional<AttachmentDescriptor> AttachmentDescriptor::parse(std::span<const uint8_t> bytes) {
+    if (bytes.size() != SERIALIZED_BYTES) return std::nullopt;
+    if (memcmp(bytes.data(), DESCRIPTOR_MAGIC, sizeof(DESCRIPTOR_MAGIC)) != 0) return std::nullopt;
+    if (bytes[4] != DESCRIPTOR_VERSION) return std::nullopt;
+    size_t off = 5;
+    AttachmentDescriptor d;
+    for (int i = 0; i < 4; i++) d.chunk_bytes = (d.chunk_bytes << 8) | bytes[off++];
+    for (int i = 0; i < 8; i++) d.size = (d.size << 8) | bytes[off++];
+    if (d.chunk_bytes == 0 || d.chunk_bytes > MAX_CHUNK_BYTES) return std::nullopt;
+    memcpy(d.key.data(), bytes.data() + off, KEY_BYTES);
+    off += KEY_BYTES;
+    memcpy(d.header.data(), bytes.data() + off, HEADER_BYTES);
+    return d;
+}
+
+AttachmentEncryptor::AttachmentEncryptor(uint64_t size, uint32_t chunk_bytes) {
+    if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
+    if (chunk_bytes == 0 || chunk_bytes > AttachmentDescriptor::MAX_CHUNK_BYTES) {
+        throw std::runtime_error("attachment chunk size out of range");
+    }
+    descriptor_.chunk_bytes = chunk_bytes;
+    descriptor_.size = size;
+    crypto_secretstream_xchacha20poly1305_keygen(descriptor_.key.data());
+    crypto_secretstream_xchacha20poly1305_init_push(as_state(state_), descriptor_.header.data(),
+                                                    descriptor_.key.data());
+}
+
+AttachmentEncryptor::~AttachmentEncryptor() {
+    sodium_memzero(state_.data(), state_.size());
+}
+
+size_t AttachmentEncryptor::push(std::span<const uint8_t> chunk, std::span<uint8_t> out) {
+    if (finished_) throw std::runtime_error("attachment already finished");
+    const uint64_t remaining = descriptor_.size - consumed_;
+    const bool final = chunk.size() == remaining;
+    if (chunk.size() > remaining || (!final && chunk.size() != descriptor_.chunk_bytes) ||
+        chunk.size() > descriptor_.chunk_bytes) {
+        throw std::runtime_error("attachment chunk has the wrong size");
+    }
+    if (out.size() < chunk.size() + CHUNK_OVERHEAD) {
+        throw std::runtime_error("attachment output buffer too small");
+    }
+
+    unsigned long long clen = 0;
+    const uint8_t tag = final ? crypto_secretstream_xchacha20poly1305_TAG_FINAL
+                              : crypto_secretstream_xchacha20poly1305_TAG_MESSAGE;
+    if (crypto_secretstream_xchacha20poly1305_push(as_state(state_), out.data(), &clen,
+                                                   chunk.data(), chunk.size(), nullptr, 0, tag) != 0) {
+        throw std::runtime_error("attachment encryption failed");
+    }
+    consumed_ += chunk.size();
+    finished_ = final;
+    return static_cast<size_t>(clen);
+}
+
+AttachmentDecryptor::AttachmentDecryptor(const AttachmentDescriptor& descriptor)
+    : descriptor_(descriptor) {
+    if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
+    if (descriptor_.chunk_bytes == 0 || descriptor_.chunk_bytes > AttachmentDescriptor::MAX_CHUNK_BYTES) {
+        throw std::runtime_error("attachment chunk size out of range");
+    }
+    if (crypto_secretstream_xchacha20poly1305_init_pull(as_state(state_), descriptor_.header.data(),
+                                                        descriptor_.key.data()) != 0) {
+        failed_ = true;
+    }
+}
+
+AttachmentDecryptor::~AttachmentDecryptor() {
+    sodium_memzero(state_.data(), state_.size());
+}
+
+size_t AttachmentDecryptor::next_chunk_size() const {
+    if (finished_ || failed_) return 0;
+    const uint64_t remaining = descriptor_.size - produced_;
+    const uint64_t plain = remaining < descriptor_.chunk_bytes ? remaining : descriptor_.chunk_bytes;
+    return static_cast<size_t>(plain) + AttachmentEncryptor::CHUNK_OVERHEAD;
+}
+
+std::optional<size_t> AttachmentDecryptor::pull(std::span<const uint8_t> chunk, std::span<uint8_t> out) {
+    const size_t expected = next_chunk_size();
+    if (expected == 0 || chunk.size() != expected ||
+        out.size() < expected - AttachmentEncryptor::CHUNK_OVERHEAD) {
+        failed_ = true;
+        return std::nullopt;
+    }
+
+    unsigned long long mlen = 0;
+    unsigned char tag = 0;
+    if (crypto_secretstream_xchacha20poly1305_pull(as_state(state_), out.data(), &mlen, &tag,
+                                                   chunk.data(), chunk.size(), nullptr, 0) != 0) {
+        failed_ = true;
+        return std::nullopt;
+    }
+
+    // The final tag must land exactly on the advertised size: this catches
+    // truncated streams as well as chunks appended after the end.
+    produced_ += mlen;
+    const bool at_end = produced_ == descriptor_.size;
+    const bool final = tag == crypto_secretstream_xchacha20poly1305_TAG_FINAL;
+    if (at_end != final) {
+        sodium_memzero(out.data(), static_cast<size_t>(mlen));
+        failed_ = true;
+        return std::nullopt;
+    }
+    finished_ = final;
+    return static_cast<size_t>(mlen);
+}
+
+AttachmentDescriptor encrypt_attachment(std::span<const uint8_t> data,
+                                        const AttachmentSink& sink,
+                                        uint32_t chunk_bytes) {
+    AttachmentEncryptor enc(data.size(), chunk_bytes);
+    std::vector<uint8_t> sealed(static_cast<size_t>(chunk_bytes) + AttachmentEncryptor::CHUNK_OVERHEAD);
+    size_t off = 0;
+    do {
+        const size_t n = std::min<size_t>(chunk_bytes, data.size() - off);
+        const size_t clen = enc.push(data.subspan(off, n), sealed);
+        sink(std::span<const uint8_t>(sealed.data(), clen));
+        off += n;
+    } while (!enc.finished());
+    return enc.descriptor();
+}
+
+AttachmentDescriptor encrypt_attachment_file(const std::string& path,
+                                             const AttachmentSink& sink,
+                                             uint32_t chunk_bytes) {
+    std::ifstream in(path, std::ios::binary | std::ios::ate);
+    if (!in) throw std::runtime_error("cannot open attachment: " + path);
+    const uint64_t size = static_cast<uint64_t>(in.tellg());
+    in.seekg(0);
+
+    AttachmentEncryptor enc(size, chunk_bytes);
+    std::vector<uint8_t> plain(chunk_bytes);
+    std::vector<uint8_t> sealed(static_cast<size_t>(chunk_bytes) + AttachmentEncryptor::CHUNK_OVERHEAD);
+    uint64_t remaining = size;
+    do {
+        const size_t n = static_cast<size_t>(std::min<uint64_t>(chunk_bytes, remaining));
+        if (!in.read(reinterpret_cast<char*>(plain.data()), static_cast<std::streamsize>(n))) {
+            sodium_memzero(plain.data(), plain.size());
+            throw std::runtime_error("short read on attachment: " + path);
+        }
+        const size_t clen = enc.push(std::span<const uint8_t>(plain.data(), n), sealed);
+        sink(std::span<const uint8_t>(sealed.data(), clen));
+        remaining -= n;
+    } while (!enc.finished());
+
+    sodium_memzero(plain.data(), plain.size());
+    return enc.descriptor();
+}
+
+bool decrypt_attachment_file(const AttachmentDescriptor& descriptor,
+                             const std::string& in_path,
+                             const std::string& out_path) {
+    std::ifstream in(in_path, std::ios::binary);
+    std::ofstream out(out_path, std::ios::binary | std::ios::trunc);
+    if (!in || !out) return false;
+
+    AttachmentDecryptor dec(descriptor);
+    std::vector<uint8_t> sealed(static_cast<size_t>(descriptor.chunk_bytes) + AttachmentEncryptor::CHUNK_OVERHEAD);
+    std::vector<uint8_t> plain(descriptor.chunk_bytes);
+    bool ok = true;
+    while (!dec.finished()) {
+        const size_t n = dec.next_chunk_size();
+        if (n == 0 || !in.read(reinterpret_cast<char*>(sealed.data()), static_cast<std::streamsize>(n))) {
+            ok = false;
+            break;
+        }
+        auto plen = dec.pull(std::span<const uint8_t>(sealed.data(), n), plain);
+        if (!plen.has_value()) {
+            ok = false;
+            break;
+        }
+        out.write(reinterpret_cast<const char*>(plain.data()), static_cast<std::streamsize>(*plen));
+    }
+    // Trailing bytes after the final chunk mean the stream was tampered with
+    if (ok && in.peek() != std::char_traits<char>::eof()) ok = false;
+    sodium_memzero(plain.data(), plain.size());
+
+    out.close();
+    if (!ok || !out) {
+        std::remove(out_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace securecomm
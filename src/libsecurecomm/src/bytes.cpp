@@ -0,0 +1,228 @@
+#include "securecomm/bytes.hpp"
+
+#include <atomic>
+#include <bit>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+namespace securecomm {
+
+namespace detail {
+
+// Header in front of every buffer; the bytes follow it in the same allocation
+struct alignas(16) BytesBlock {
+    std::atomic<uint32_t> refs{1};
+    uint8_t size_class;    // BytesPool::CLASSES: not pooled
+    size_t capacity;
+    BytesBlock* next = nullptr;    // free list link while cached
+
+    uint8_t* bytes() { return reinterpret_cast<uint8_t*>(this + 1); }
+
+    static void retain(BytesBlock* block) {
+        if (block) block->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    static void drop(BytesBlock* block) {
+        if (block && block->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            BytesPool::global().release(block);
+        }
+    }
+};
+
+} // namespace detail
+
+using detail::BytesBlock;
+
+namespace {
+
+size_t class_for(size_t size) {
+    if (size <= BytesPool::MIN_CLASS_BYTES) return 0;
+    return static_cast<size_t>(std::bit_width(size - 1) - std::bit_width(BytesPool::MIN_CLASS_BYTES - 1));
+}
+
+BytesBlock* new_block(uint8_t size_class, size_t capacity) {
+    void* p = ::operator new(sizeof(BytesBlock) + capacity);
+    auto* block = new (p) BytesBlock;
+    block->size_class = size_class;
+    block->capacity = capacity;
+    return block;
+}
+
+void delete_block(BytesBlock* block) {
+    block->~BytesBlock();
+    ::operator delete(block);
+}
+
+} // namespace
+
+Bytes::Bytes(const Bytes& other) noexcept : block_(other.block_), data_(other.data_), size_(other.size_) {
+    BytesBlock::retain(block_);
+}
+
+Bytes::Bytes(Bytes&& other) noexcept : block_(other.block_), data_(other.data_), size_(other.size_) {
+    other.block_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+Bytes& Bytes::operator=(const Bytes& other) noexcept {
+    if (this != &other) {
+        BytesBlock::retain(other.block_);
+        BytesBlock::drop(block_);
+        block_ = other.block_;
+        data_ = other.data_;
+        size_ = other.size_;
+    }
+    return *this;
+}
+
+Bytes& Bytes::operator=(Bytes&& other) noexcept {
+    if (this != &other) {
+        BytesBlock::drop(block_);
+        block_ = other.block_;
+        data_ = other.data_;
+        size_ = other.size_;
+        other.block_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+Bytes::~Bytes() {
+    BytesBlock::drop(block_);
+}
+
+Bytes Bytes::copy(std::span<const uint8_t> data) {
+    BytesBuilder builder(data.size());
+    if (!data.empty()) std::memcpy(builder.data(), data.data(), data.size());
+    return std::move(builder).freeze();
+}
+
+Bytes Bytes::slice(size_t offset, size_t length) const {
+    if (offset > size_ || length > size_ - offset) throw std::out_of_range("Bytes::slice out of range");
+    if (length == 0) return Bytes();
+    BytesBlock::retain(block_);
+    return Bytes(block_, data_ + offset, length);
+}
+
+BytesBuilder::BytesBuilder(size_t size) : size_(size) {
+    if (size == 0) return;
+    block_ = BytesPool::global().allocate(size);
+    data_ = block_->bytes();
+}
+
+BytesBuilder::BytesBuilder(BytesBuilder&& other) noexcept
+    : block_(other.block_), data_(other.data_), size_(other.size_) {
+    other.block_ = nullptr;
+    other.data_ = nullptr;
+    other.size_ = 0;
+}
+
+BytesBuilder& BytesBuilder::operator=(BytesBuilder&& other) noexcept {
+    if (this != &other) {
+        BytesBlock::drop(block_);
+        block_ = other.block_;
+        data_ = other.data_;
+        size_ = other.size_;
+        other.block_ = nullptr;
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    return *this;
+}
+
+BytesBuilder::~BytesBuilder() {
+    BytesBlock::drop(block_);
+}
+
+Bytes BytesBuilder::freeze() && {
+    return std::move(*this).freeze(size_);
+}
+
+Bytes BytesBuilder::freeze(size_t used) && {
+    if (used > size_) throw std::out_of_range("BytesBuilder::freeze past the end");
+    if (used == 0) {
+        BytesBlock::drop(block_);
+        block_ = nullptr;
+        data_ = nullptr;
+        size_ = 0;
+        return Bytes();
+    }
+    Bytes out(block_, data_, used);    // takes over the builder's reference
+    block_ = nullptr;
+    data_ = nullptr;
+    size_ = 0;
+    return out;
+}
+
+BytesPool& BytesPool::global() {
+    // Never destroyed: Bytes held by static objects may be released after exit starts
+    static auto* pool = new BytesPool;
+    return *pool;
+}
+
+BytesBlock* BytesPool::allocate(size_t size) {
+    if (size > MAX_CLASS_BYTES) return new_block(CLASSES, size);
+    const size_t c = class_for(size);
+    FreeList& list = classes_[c];
+    {
+        std::lock_guard<std::mutex> lk(list.mutex);
+        if (BytesBlock* block = list.head) {
+            list.head = block->next;
+            list.count--;
+            list.hits++;
+            block->next = nullptr;
+            block->refs.store(1, std::memory_order_relaxed);
+            return block;
+        }
+        list.misses++;
+    }
+    return new_block(static_cast<uint8_t>(c), MIN_CLASS_BYTES << c);
+}
+
+void BytesPool::release(BytesBlock* block) {
+    if (block->size_class < CLASSES) {
+        FreeList& list = classes_[block->size_class];
+        std::lock_guard<std::mutex> lk(list.mutex);
+        if ((list.count + 1) * block->capacity <= MAX_CACHED_BYTES) {
+            block->next = list.head;
+            list.head = block;
+            list.count++;
+            return;
+        }
+    }
+    delete_block(block);
+}
+
+BytesPool::Stats BytesPool::stats() const {
+    Stats stats;
+    for (size_t c = 0; c < CLASSES; c++) {
+        const FreeList& list = classes_[c];
+        std::lock_guard<std::mutex> lk(list.mutex);
+        stats.hits += list.hits;
+        stats.misses += list.misses;
+        stats.cached_buffers += list.count;
+        stats.cached_bytes += list.count * (MIN_CLASS_BYTES << c);
+    }
+    return stats;
+}
+
+void BytesPool::trim() {
+    for (FreeList& list : classes_) {
+        BytesBlock* head;
+        {
+            std::lock_guard<std::mutex> lk(list.mutex);
+            head = list.head;
+            list.head = nullptr;
+            list.count = 0;
+        }
+        while (head) {
+            BytesBlock* next = head->next;
+            delete_block(head);
+            head = next;
+        }
+    }
+}
+
+} // namespace securecomm
@@ -11,6 +11,11 @@ extern "C" securecomm::Transport* create_inmemory_transport_b();
 int main() {
     try {
         std::cout << "Starting SecureComm demo..." << std::endl;
+
+        // Pick the fastest AEAD this host supports before any sessions exist
+        securecomm::set_default_cipher_suite(securecomm::select_fastest_cipher_suite());
+        std::cout << "Cipher suite: "
+                  << securecomm::aead_backend(securecomm::default_cipher_suite())->name() << std::endl;
         
         // Create CONNECTED transports
         // Use no-op deleters since the factories manage lifetime via global static
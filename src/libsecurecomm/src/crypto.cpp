@@ -1,72 +1,314 @@
 #include "securecomm/crypto.hpp"
+#include "securecomm/random.hpp"
 #include <sodium.h>
 #include <stdexcept>
 #include <optional>
+#include <cstring>
+#include <atomic>
+#include <chrono>
 
 namespace securecomm {
 
-AEAD::AEAD() {
+static_assert(AEAD::NONCE_BYTES == crypto_aead_chacha20poly1305_ietf_NPUBBYTES, "AEAD nonce size mismatch");
+static_assert(AEAD::NONCE_BYTES == crypto_aead_aes256gcm_NPUBBYTES, "AEAD nonce size mismatch");
+static_assert(AEAD::MAX_NONCE_BYTES == crypto_aead_xchacha20poly1305_ietf_NPUBBYTES, "AEAD nonce size mismatch");
+static_assert(AEAD::TAG_BYTES == crypto_aead_chacha20poly1305_ietf_ABYTES, "AEAD tag size mismatch");
+static_assert(AEAD::TAG_BYTES == crypto_aead_xchacha20poly1305_ietf_ABYTES, "AEAD tag size mismatch");
+static_assert(AEAD::TAG_BYTES == crypto_aead_aes256gcm_ABYTES, "AEAD tag size mismatch");
+
+namespace {
+
+using SodiumEncryptFn = int (*)(unsigned char*, unsigned long long*,
+                                const unsigned char*, unsigned long long,
+                                const unsigned char*, unsigned long long,
+                                const unsigned char*, const unsigned char*, const unsigned char*);
+using SodiumDecryptFn = int (*)(unsigned char*, unsigned long long*, unsigned char*,
+                                const unsigned char*, unsigned long long,
+                                const unsigned char*, unsigned long long,
+                                const unsigned char*, const unsigned char*);
+
+// All three libsodium AEADs share the same combined-mode signature, so one
+// adapter parameterised on the function pair covers them.
+template <CipherSuite Suite, size_t NonceBytes, SodiumEncryptFn Encrypt, SodiumDecryptFn Decrypt>
+class SodiumAEADBackend final : public AEADBackend {
+public:
+    explicit SodiumAEADBackend(const char* name) : name_(name) {}
+
+    CipherSuite suite() const override { return Suite; }
+    const char* name() const override { return name_; }
+    size_t nonce_bytes() const override { return NonceBytes; }
+
+    bool seal(uint8_t* c, const uint8_t* m, size_t mlen,
+              const uint8_t* ad, size_t adlen,
+              const uint8_t* nonce, const uint8_t* key) const override {
+        unsigned long long clen;
+        return Encrypt(c, &clen, m, mlen, ad, adlen, nullptr, nonce, key) == 0;
+    }
+
+    bool open(uint8_t* m, const uint8_t* c, size_t clen,
+              const uint8_t* ad, size_t adlen,
+              const uint8_t* nonce, const uint8_t* key) const override {
+        unsigned long long mlen;
+        return Decrypt(m, &mlen, nullptr, c, clen, ad, adlen, nonce, key) == 0;
+    }
+
+private:
+    const char* name_;
+};
+
+const SodiumAEADBackend<CipherSuite::ChaCha20Poly1305,
+                        crypto_aead_chacha20poly1305_ietf_NPUBBYTES,
+                        crypto_aead_chacha20poly1305_ietf_encrypt,
+                        crypto_aead_chacha20poly1305_ietf_decrypt>
+    chacha20poly1305_backend("ChaCha20-Poly1305");
+
+const SodiumAEADBackend<CipherSuite::XChaCha20Poly1305,
+                        crypto_aead_xchacha20poly1305_ietf_NPUBBYTES,
+                        crypto_aead_xchacha20poly1305_ietf_encrypt,
+                        crypto_aead_xchacha20poly1305_ietf_decrypt>
+    xchacha20poly1305_backend("XChaCha20-Poly1305");
+
+const SodiumAEADBackend<CipherSuite::Aes256Gcm,
+                        crypto_aead_aes256gcm_NPUBBYTES,
+                        crypto_aead_aes256gcm_encrypt,
+                        crypto_aead_aes256gcm_decrypt>
+    aes256gcm_backend("AES-256-GCM");
+
+std::atomic<CipherSuite> g_default_suite{CipherSuite::ChaCha20Poly1305};
+
+} // namespace
+
+void AEAD::make_counter_nonce(std::span<uint8_t> nonce, uint32_t counter,
+                              std::span<const uint8_t> salt) {
+    if (salt.size() < SALT_BYTES) {
+        throw std::runtime_error("AEAD counter nonce salt must be 8 bytes");
+    }
+    if (nonce.size() < 4 + SALT_BYTES) {
+        throw std::runtime_error("AEAD counter nonce buffer too small");
+    }
+    nonce[0] = static_cast<uint8_t>((counter >> 24) & 0xFF);
+    nonce[1] = static_cast<uint8_t>((counter >> 16) & 0xFF);
+    nonce[2] = static_cast<uint8_t>((counter >> 8) & 0xFF);
+    nonce[3] = static_cast<uint8_t>(counter & 0xFF);
+    memcpy(nonce.data() + 4, salt.data(), SALT_BYTES);
+    memset(nonce.data() + 4 + SALT_BYTES, 0, nonce.size() - 4 - SALT_BYTES);
+}
+
+const AEADBackend* aead_backend(CipherSuite suite) {
+    switch (suite) {
+        case CipherSuite::ChaCha20Poly1305:
+            return &chacha20poly1305_backend;
+        case CipherSuite::XChaCha20Poly1305:
+            return &xchacha20poly1305_backend;
+        case CipherSuite::Aes256Gcm:
+            // libsodium only ships the hardware (AES-NI + PCLMUL) implementation
+            if (sodium_init() < 0 || crypto_aead_aes256gcm_is_available() == 0) return nullptr;
+            return &aes256gcm_backend;
+    }
+    return nullptr;
+}
+
+bool cipher_suite_available(CipherSuite suite) {
+    return aead_backend(suite) != nullptr;
+}
+
+std::vector<CipherSuite> available_cipher_suites() {
+    std::vector<CipherSuite> out;
+    for (auto suite : { CipherSuite::ChaCha20Poly1305,
+                        CipherSuite::XChaCha20Poly1305,
+                        CipherSuite::Aes256Gcm }) {
+        if (cipher_suite_available(suite)) out.push_back(suite);
+    }
+    return out;
+}
+
+CipherSuite select_fastest_cipher_suite(size_t payload_bytes, int iterations) {
+    if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
+
+    std::vector<uint8_t> key(32);
+    std::vector<uint8_t> nonce(AEAD::MAX_NONCE_BYTES);
+    std::vector<uint8_t> buf(payload_bytes + AEAD::TAG_BYTES);
+    random_bytes(key.data(), key.size());
+    random_bytes(nonce.data(), nonce.size());
+    random_bytes(buf.data(), payload_bytes);
+
+    CipherSuite best = CipherSuite::ChaCha20Poly1305;
+    auto best_time = std::chrono::steady_clock::duration::max();
+    for (auto suite : available_cipher_suites()) {
+        const AEADBackend* backend = aead_backend(suite);
+        backend->seal(buf.data(), buf.data(), payload_bytes, nullptr, 0, nonce.data(), key.data());  // warm-up
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < iterations; i++) {
+            backend->seal(buf.data(), buf.data(), payload_bytes, nullptr, 0, nonce.data(), key.data());
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if (elapsed < best_time) {
+            best_time = elapsed;
+            best = suite;
+        }
+    }
+
+    sodium_memzero(key.data(), key.size());
+    return best;
+}
+
+void set_default_cipher_suite(CipherSuite suite) {
+    if (!cipher_suite_available(suite)) {
+        throw std::runtime_error("cipher suite not available on this host");
+    }
+    g_default_suite.store(suite);
+}
+
+CipherSuite default_cipher_suite() {
+    return g_default_suite.load();
+}
+
+AEAD::AEAD(CipherSuite suite) {
     if (sodium_init() < 0) {
         throw std::runtime_error("libsodium init failed");
     }
+    set_suite(suite);
 }
 
-AEAD::~AEAD() {
-    sodium_memzero(key_.data(), key_.size());
-}
+AEAD::~AEAD() = default;
 
 void AEAD::set_key(const std::vector<uint8_t>& key) {
+    set_key(std::span<const uint8_t>(key));
+}
+
+void AEAD::set_key(std::span<const uint8_t> key) {
     if (key.size() != crypto_aead_chacha20poly1305_ietf_KEYBYTES) {
         throw std::runtime_error("AEAD key must be 32 bytes");
     }
-    key_ = key;
+    key_.assign(key);
+    has_key_ = true;
 }
 
-std::vector<uint8_t> AEAD::encrypt(const std::vector<uint8_t>& plaintext,
-                                   const std::vector<uint8_t>& aad) const {
-    if (key_.empty()) throw std::runtime_error("AEAD key not set");
-
-    std::vector<uint8_t> nonce(crypto_aead_chacha20poly1305_ietf_NPUBBYTES);
-    randombytes_buf(nonce.data(), nonce.size());
-
-    std::vector<uint8_t> ciphertext(plaintext.size() + crypto_aead_chacha20poly1305_ietf_ABYTES);
-    unsigned long long clen;
-    if (crypto_aead_chacha20poly1305_ietf_encrypt(
-            ciphertext.data(), &clen,
-            plaintext.data(), plaintext.size(),
-            aad.data(), aad.size(),
-            nullptr, nonce.data(), key_.data()) != 0) {
+void AEAD::set_suite(CipherSuite suite) {
+    const AEADBackend* backend = aead_backend(suite);
+    if (!backend) throw std::runtime_error("cipher suite not available on this host");
+    backend_ = backend;
+}
+
+size_t AEAD::encrypt_into(std::span<const uint8_t> plaintext,
+                          std::span<const uint8_t> aad,
+                          std::span<uint8_t> out) const {
+    if (!has_key_) throw std::runtime_error("AEAD key not set");
+    if (out.size() < ciphertext_size(plaintext.size())) {
+        throw std::runtime_error("AEAD output buffer too small");
+    }
+
+    const size_t nonce_len = nonce_bytes();
+    uint8_t* nonce = out.data();
+    random_bytes(nonce, nonce_len);
+
+    if (!backend_->seal(out.data() + nonce_len,
+                        plaintext.data(), plaintext.size(),
+                        aad.data(), aad.size(),
+                        nonce, key_.data())) {
         throw std::runtime_error("AEAD encryption failed");
     }
 
-    ciphertext.insert(ciphertext.begin(), nonce.begin(), nonce.end());
-    return ciphertext;
+    return nonce_len + plaintext.size() + TAG_BYTES;
 }
 
-std::optional<std::vector<uint8_t>> AEAD::decrypt(const std::vector<uint8_t>& ciphertext,
-                                                   const std::vector<uint8_t>& aad) const {
-    if (key_.empty()) return std::nullopt;
-    if (ciphertext.size() < crypto_aead_chacha20poly1305_ietf_NPUBBYTES + crypto_aead_chacha20poly1305_ietf_ABYTES)
+std::optional<size_t> AEAD::decrypt_into(std::span<const uint8_t> ciphertext,
+                                         std::span<const uint8_t> aad,
+                                         std::span<uint8_t> out) const {
+    const size_t nonce_len = nonce_bytes();
+    if (!has_key_) return std::nullopt;
+    if (ciphertext.size() < nonce_len + TAG_BYTES) return std::nullopt;
+    if (out.size() < plaintext_size(ciphertext.size())) return std::nullopt;
+
+    const uint8_t* nonce = ciphertext.data();
+    const uint8_t* body = ciphertext.data() + nonce_len;
+    const size_t body_len = ciphertext.size() - nonce_len;
+
+    if (!backend_->open(out.data(),
+                        body, body_len,
+                        aad.data(), aad.size(),
+                        nonce, key_.data())) {
         return std::nullopt;
+    }
 
-    const size_t nonce_len = crypto_aead_chacha20poly1305_ietf_NPUBBYTES;
-    std::vector<uint8_t> nonce(ciphertext.begin(), ciphertext.begin() + nonce_len);
-    std::vector<uint8_t> ctext(ciphertext.begin() + nonce_len, ciphertext.end());
+    return body_len - TAG_BYTES;
+}
+
+std::optional<std::span<uint8_t>> AEAD::decrypt_in_place(std::span<uint8_t> buffer,
+                                                         std::span<const uint8_t> aad) const {
+    if (buffer.size() < nonce_bytes() + TAG_BYTES) return std::nullopt;
+    // libsodium permits the plaintext and ciphertext to share an address exactly,
+    // so the body is decrypted over itself and the nonce is left untouched.
+    auto body = buffer.subspan(nonce_bytes());
+    auto plen = decrypt_into(buffer, aad, body);
+    if (!plen.has_value()) return std::nullopt;
+    return body.first(*plen);
+}
+
+size_t AEAD::encrypt_into(std::span<const uint8_t> plaintext,
+                          std::span<const uint8_t> aad,
+                          std::span<uint8_t> out,
+                          uint32_t counter,
+                          std::span<const uint8_t> salt) const {
+    if (!has_key_) throw std::runtime_error("AEAD key not set");
+    if (out.size() < ciphertext_size(plaintext.size(), NonceMode::Counter)) {
+        throw std::runtime_error("AEAD output buffer too small");
+    }
 
-    std::vector<uint8_t> plaintext(ctext.size() - crypto_aead_chacha20poly1305_ietf_ABYTES);
-    unsigned long long plen;
+    uint8_t nonce[MAX_NONCE_BYTES];
+    make_counter_nonce(std::span<uint8_t>(nonce, nonce_bytes()), counter, salt);
 
-    if (crypto_aead_chacha20poly1305_ietf_decrypt(
-            plaintext.data(), &plen,
-            nullptr,
-            ctext.data(), ctext.size(),
-            aad.data(), aad.size(),
-            nonce.data(), key_.data()) != 0) {
+    if (!backend_->seal(out.data(),
+                        plaintext.data(), plaintext.size(),
+                        aad.data(), aad.size(),
+                        nonce, key_.data())) {
+        throw std::runtime_error("AEAD encryption failed");
+    }
+
+    return plaintext.size() + TAG_BYTES;
+}
+
+std::optional<size_t> AEAD::decrypt_into(std::span<const uint8_t> ciphertext,
+                                         std::span<const uint8_t> aad,
+                                         std::span<uint8_t> out,
+                                         uint32_t counter,
+                                         std::span<const uint8_t> salt) const {
+    if (!has_key_) return std::nullopt;
+    if (ciphertext.size() < TAG_BYTES) return std::nullopt;
+    if (out.size() < plaintext_size(ciphertext.size(), NonceMode::Counter)) return std::nullopt;
+    if (salt.size() < SALT_BYTES) return std::nullopt;
+
+    uint8_t nonce[MAX_NONCE_BYTES];
+    make_counter_nonce(std::span<uint8_t>(nonce, nonce_bytes()), counter, salt);
+
+    if (!backend_->open(out.data(),
+                        ciphertext.data(), ciphertext.size(),
+                        aad.data(), aad.size(),
+                        nonce, key_.data())) {
         return std::nullopt;
     }
 
-    plaintext.resize(plen);
+    return ciphertext.size() - TAG_BYTES;
+}
+
+std::vector<uint8_t> AEAD::encrypt(const std::vector<uint8_t>& plaintext,
+                                   const std::vector<uint8_t>& aad) const {
+    std::vector<uint8_t> ciphertext(ciphertext_size(plaintext.size()));
+    encrypt_into(plaintext, aad, ciphertext);
+    return ciphertext;
+}
+
+std::optional<std::vector<uint8_t>> AEAD::decrypt(const std::vector<uint8_t>& ciphertext,
+                                                   const std::vector<uint8_t>& aad) const {
+    if (ciphertext.size() < nonce_bytes() + TAG_BYTES) return std::nullopt;
+
+    std::vector<uint8_t> plaintext(plaintext_size(ciphertext.size()));
+    auto plen = decrypt_into(ciphertext, aad, plaintext);
+    if (!plen.has_value()) return std::nullopt;
+
+    plaintext.resize(*plen);
     return plaintext;
 }
 
-} 
+}
@@ -1,45 +1,109 @@
 #include "securecomm/dispatcher.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
 #include <sodium.h>
 #include <stdexcept>
 #include <cstring>
 #include <chrono>
-#include <iostream>
+#include <string_view>
+#include <algorithm>
+#include <utility>
 
 namespace securecomm {
 
+namespace {
+
+// What on_inbound receives for a direct message: the envelope as received, with
+// the plaintext in place of the ciphertext
+Envelope inbound_envelope(const EnvelopeView& env, std::vector<uint8_t> plaintext) {
+    Envelope out;
+    out.session_id.assign(env.session_id.begin(), env.session_id.end());
+    out.message_index = env.message_index;
+    out.previous_counter = env.previous_counter;
+    out.timestamp = env.timestamp;
+    out.sender_device_id.assign(env.sender_device_id);
+    out.associated_data.assign(env.associated_data.begin(), env.associated_data.end());
+    out.ciphertext = std::move(plaintext);
+    out.signature.assign(env.signature.begin(), env.signature.end());
+    out.aad.assign(env.aad.begin(), env.aad.end());
+    return out;
+}
+
+// A decoded frame and the buffer its view points into
+struct InboundFrame {
+    Bytes frame;
+    EnvelopeView view;
+};
+
+// Same sender and session, same lane: per-session order survives
+uint64_t inbound_lane_key(const EnvelopeView& env) {
+    uint64_t key = std::hash<std::string_view>{}(env.sender_device_id);
+    key ^= std::hash<std::string_view>{}(std::string_view(reinterpret_cast<const char*>(env.session_id.data()),
+                                                          env.session_id.size())) * 0x9e3779b97f4a7c15ull;
+    return key;
+}
+
+} // namespace
+
 Dispatcher::Dispatcher(TransportPtr transport)
     : transport_(transport) {
-    std::cout << "[Dispatcher] Constructor for transport: " << transport.get() << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "Constructor for transport: " << transport.get());
     if (sodium_init() < 0) throw std::runtime_error("sodium_init failed");
-    transport_->set_on_message([this](const std::vector<uint8_t>& b){ on_raw_message(b); });
+    // Until told the transport is a direct link (set_wire_negotiation), and the
+    // layout earlier Dispatchers read until told the peer reads more
+    wire_.set_negotiation(false);
+    wire_.set_peer_version(Envelope::WIRE_VERSION_LEGACY);
+    metrics_.set_gauge("securecomm_inbound_queued", "Inbound messages waiting for a worker.",
+                       [this] { return double(inbound_stats().queued); });
+    transport_->set_on_message_batch([this](std::span<const Bytes> frames) { on_raw_messages(frames); });
 }
 
 Dispatcher::~Dispatcher() {
-    std::cout << "[Dispatcher] Destructor" << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "Destructor");
     stop();
 }
 
 void Dispatcher::start() {
-    std::cout << "[Dispatcher] start()" << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "start()");
     transport_->start();
 }
 
 void Dispatcher::stop() {
-    std::cout << "[Dispatcher] stop()" << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "stop()");
+    flush_sends();
     transport_->stop();
 }
 
 void Dispatcher::register_device(const std::string& device_id) {
-    std::cout << "[Dispatcher] register_device: " << device_id << std::endl;
-    std::lock_guard<std::mutex> lk(mutex_);
+    SC_LOG_INFO("Dispatcher", "register_device: " << device_id);
+    std::unique_lock<std::shared_mutex> cfg(config_mutex_);
     device_id_ = device_id;
 }
 
+Dispatcher::SessionShard& Dispatcher::shard_for(std::string_view remote_device_id) {
+    return shards_[std::hash<std::string_view>{}(remote_device_id) % SESSION_SHARDS];
+}
+
+Dispatcher::SessionState* Dispatcher::find_session(std::string_view remote_device_id) {
+    SessionShard& shard = shard_for(remote_device_id);
+    std::shared_lock<std::shared_mutex> lk(shard.mutex);
+    auto it = shard.sessions.find(remote_device_id);
+    return it == shard.sessions.end() ? nullptr : &it->second;
+}
+
+Dispatcher::SessionState& Dispatcher::session_for(const std::string& remote_device_id) {
+    if (SessionState* s = find_session(remote_device_id)) return *s;
+    SessionShard& shard = shard_for(remote_device_id);
+    std::lock_guard<std::shared_mutex> lk(shard.mutex);
+    return shard.sessions[remote_device_id];
+}
+
 void Dispatcher::create_session_with(const std::string& remote_device_id, const std::vector<uint8_t>& root_key) {
-    std::cout << "[Dispatcher] create_session_with: " << remote_device_id 
-              << ", root_key size: " << root_key.size() << std::endl;
-    std::lock_guard<std::mutex> lk(mutex_);
-    SessionState& s = sessions_[remote_device_id];
+    SC_LOG_DEBUG("Dispatcher", "create_session_with: " << remote_device_id 
+              << ", root_key size: " << root_key.size());
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    SessionState& s = session_for(remote_device_id);
+    std::lock_guard<std::mutex> lk(s.mutex);
     
     // Compute a deterministic session_id from device IDs and root key
     // This ensures both parties have the same session_id
@@ -64,196 +128,532 @@ void Dispatcher::create_session_with(const std::string& remote_device_id, const
     std::vector<uint8_t> session_id(session_id_bytes, session_id_bytes + 16);
     
     s.ratchet.initialize(root_key, session_id);
+    if (s.ratchet.send_key_window() != send_key_window_) s.ratchet.set_send_key_window(send_key_window_);
     // Don't do ratchet_step here - it will happen on first message exchange
     // The ratchet_step should use the remote party's public key, which we get from the first message header
     s.initialized = true;
-    std::cout << "[Dispatcher] Session created for: " << remote_device_id << std::endl;
+    SC_LOG_INFO("Dispatcher", "Session created for: " << remote_device_id);
+}
+
+void Dispatcher::send_message_to_device(const std::string& remote_device_id, std::span<const uint8_t> plaintext) {
+    SendCompletion none;
+    send_message(remote_device_id, plaintext, none);
 }
 
-void Dispatcher::send_message_to_device(const std::string& remote_device_id, const std::vector<uint8_t>& plaintext) {
-    std::lock_guard<std::mutex> lk(mutex_);
-    auto it = sessions_.find(remote_device_id);
-    if (it == sessions_.end() || !it->second.initialized) {
-        std::cout << "[Dispatcher] ERROR: Session with " << remote_device_id << " not initialized" << std::endl;
+void Dispatcher::send_message(const std::string& remote_device_id, std::span<const uint8_t> plaintext, SendCompletion& done) {
+    TraceScope trace("send_message_to_device");
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    SessionState* s = find_session(remote_device_id);
+    std::unique_lock<std::mutex> lk;
+    if (s) lk = std::unique_lock<std::mutex>(s->mutex);
+    if (!s || !s->initialized) {
+        SC_LOG_WARN("Dispatcher", "Session with " << remote_device_id << " not initialized");
         throw std::runtime_error("session not initialized");
     }
     
-    std::cout << "[Dispatcher] Sending message to " << remote_device_id 
-              << ", plaintext size: " << plaintext.size() << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "Sending message to " << remote_device_id 
+              << ", plaintext size: " << plaintext.size());
     
-    Envelope env = it->second.ratchet.encrypt_envelope(plaintext);
+    StageTimer encrypt_timer(metrics_, Stage::Encrypt);
+    Envelope env = s->ratchet.encrypt_envelope(plaintext);
     env.sender_device_id = device_id_;
+    encrypt_timer.stop();
+    if (trace.active()) trace.set_key(TraceKey::of(env.session_id, env.message_index));
     
-    std::cout << "[Dispatcher] Encrypted envelope. Session ID size: " << env.session_id.size()
-              << ", Ciphertext size: " << env.ciphertext.size() << std::endl;
-    
-    auto bytes = serialize_envelope(env);
-    std::cout << "[Dispatcher] Serialized envelope size: " << bytes.size() << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "Encrypted envelope. Session ID size: " << env.session_id.size()
+              << ", Ciphertext size: " << env.ciphertext.size());
     
-    transport_->send(bytes);
-    std::cout << "[Dispatcher] Message sent to transport" << std::endl;
+    send_envelope(std::move(env), done);
+    SC_LOG_DEBUG("Dispatcher", "Message sent to transport");
+    refill_send_keys(remote_device_id, *s);
+}
+
+std::future<void> Dispatcher::send_async(const std::string& remote_device_id, std::vector<uint8_t> plaintext) {
+    auto promise = std::make_shared<std::promise<void>>();
+    std::future<void> future = promise->get_future();
+    send_async(remote_device_id, std::move(plaintext), [promise](std::exception_ptr error) {
+        if (error) {
+            promise->set_exception(error);
+        } else {
+            promise->set_value();
+        }
+    });
+    return future;
+}
+
+void Dispatcher::send_async(const std::string& remote_device_id, std::vector<uint8_t> plaintext, SendCompletion done) {
+    auto lanes = send_lanes();
+    auto completion = std::make_shared<SendCompletion>(std::move(done));
+    const auto queued_at = std::chrono::steady_clock::now();
+    std::function<void()> task = [this, remote_device_id, plaintext = std::move(plaintext), completion, queued_at]() mutable {
+        metrics_.record(Stage::QueueWait, queued_at);
+        SendCompletion done = [completion](std::exception_ptr error) {
+            if (*completion) (*completion)(error);
+        };
+        std::exception_ptr error;
+        try {
+            send_message(remote_device_id, plaintext, done);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        sodium_memzero(plaintext.data(), plaintext.size());
+        // Unless the batcher took it, to call once the batch has gone out
+        if (done) done(error);
+    };
+    if (!lanes->try_submit(lanes->lane_for(std::hash<std::string>{}(remote_device_id)), std::move(task))) {
+        SC_LOG_WARN("Dispatcher", "Send queue for " << remote_device_id << " is full");
+        if (*completion) (*completion)(std::make_exception_ptr(std::runtime_error("send queue full")));
+    }
+}
+
+void Dispatcher::set_send_workers(size_t workers, size_t queue_capacity) {
+    auto lanes = std::make_shared<LanePool>(workers, queue_capacity);
+    {
+        std::lock_guard<std::mutex> lk(send_lanes_mutex_);
+        std::swap(lanes, send_lanes_);
+    }
+    // The old stage finishes its queued sends as the last reference goes away
+}
+
+std::shared_ptr<LanePool> Dispatcher::send_lanes() {
+    std::lock_guard<std::mutex> lk(send_lanes_mutex_);
+    if (!send_lanes_) send_lanes_ = std::make_shared<LanePool>(0, DEFAULT_SEND_QUEUE);
+    return send_lanes_;
 }
 
 void Dispatcher::send_group_message(const std::vector<uint8_t>& group_id, const std::string& sender_id, const std::vector<uint8_t>& plaintext) {
-    std::cout << "[Dispatcher] send_group_message to group_id size: " << group_id.size() 
-              << ", sender: " << sender_id << std::endl;
+    SC_LOG_DEBUG("Dispatcher", "send_group_message to group_id size: " << group_id.size() 
+              << ", sender: " << sender_id);
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    StageTimer encrypt_timer(metrics_, Stage::Encrypt);
     Envelope env = mls_.encrypt_group_message(group_id, sender_id, plaintext);
     env.sender_device_id = device_id_;
-    auto bytes = serialize_envelope(env);
-    transport_->send(bytes);
+    encrypt_timer.stop();
+    send_envelope(std::move(env));
+}
+
+void Dispatcher::send_messages_to_device(const std::string& remote_device_id, const std::vector<std::vector<uint8_t>>& plaintexts) {
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    SessionState* s = find_session(remote_device_id);
+    std::unique_lock<std::mutex> lk;
+    if (s) lk = std::unique_lock<std::mutex>(s->mutex);
+    if (!s || !s->initialized) {
+        SC_LOG_WARN("Dispatcher", "Session with " << remote_device_id << " not initialized");
+        throw std::runtime_error("session not initialized");
+    }
+
+    SC_LOG_DEBUG("Dispatcher", "Sending batch of " << plaintexts.size()
+              << " messages to " << remote_device_id);
+
+    auto envs = s->ratchet.encrypt_envelopes(plaintexts, crypto_pool_.get());
+    for (auto& env : envs) {
+        env.sender_device_id = device_id_;
+        send_envelope(std::move(env));
+    }
+    if (batcher_) batcher_->flush();
+    refill_send_keys(remote_device_id, *s);
+}
+
+void Dispatcher::send_group_messages(const std::vector<uint8_t>& group_id, const std::string& sender_id, const std::vector<std::vector<uint8_t>>& plaintexts) {
+    SC_LOG_DEBUG("Dispatcher", "send_group_messages: " << plaintexts.size()
+              << " messages, sender: " << sender_id);
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    auto envs = mls_.encrypt_group_messages(group_id, sender_id, plaintexts, crypto_pool_.get());
+    for (auto& env : envs) {
+        env.sender_device_id = device_id_;
+        send_envelope(std::move(env));
+    }
+    if (batcher_) batcher_->flush();
+}
+
+AttachmentDescriptor Dispatcher::send_attachment(const std::string& remote_device_id,
+                                                 const std::string& path,
+                                                 const AttachmentSink& sink) {
+    SC_LOG_DEBUG("Dispatcher", "send_attachment to " << remote_device_id << ": " << path);
+    // Bulk encryption runs outside the dispatcher lock; only the descriptor goes through the ratchet
+    AttachmentDescriptor descriptor = encrypt_attachment_file(path, sink);
+    auto payload = descriptor.serialize();
+    send_message_to_device(remote_device_id, payload);
+    sodium_memzero(payload.data(), payload.size());
+    return descriptor;
+}
+
+void Dispatcher::set_crypto_workers(size_t threads) {
+    auto pool = std::make_unique<WorkerPool>(threads);
+    {
+        std::unique_lock<std::shared_mutex> cfg(config_mutex_);
+        std::swap(pool, crypto_pool_);
+    }
+    // The old pool is joined outside the lock: its queued refills need config_mutex_
+}
+
+void Dispatcher::set_send_key_window(size_t window) {
+    std::unique_lock<std::shared_mutex> cfg(config_mutex_);
+    send_key_window_ = window;
+    for (SessionShard& shard : shards_) {
+        std::shared_lock<std::shared_mutex> shard_lk(shard.mutex);
+        for (auto& [id, s] : shard.sessions) {
+            std::lock_guard<std::mutex> lk(s.mutex);
+            s.ratchet.set_send_key_window(window);
+            s.ratchet.precompute_send_keys();
+        }
+    }
+}
+
+void Dispatcher::set_async_ratchet_steps(bool enabled) {
+    std::unique_lock<std::shared_mutex> cfg(config_mutex_);
+    async_ratchet_steps_ = enabled;
+}
+
+void Dispatcher::set_inbound_workers(size_t workers, size_t queue_capacity) {
+    auto lanes = std::make_shared<LanePool>(workers, queue_capacity);
+    {
+        std::unique_lock<std::shared_mutex> cfg(config_mutex_);
+        std::swap(lanes, inbound_lanes_);
+    }
+    // The old stage drains outside the lock: its queued messages need config_mutex_
+}
+
+Dispatcher::InboundStats Dispatcher::inbound_stats() const {
+    std::shared_ptr<LanePool> lanes;
+    {
+        std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+        lanes = inbound_lanes_;
+    }
+    InboundStats stats;
+    if (!lanes) return stats;
+    stats.workers = lanes->size();
+    stats.queue_capacity = lanes->capacity();
+    stats.lanes = lanes->stats();
+    for (const auto& lane : stats.lanes) {
+        stats.queued += lane.depth;
+        stats.processed += lane.completed;
+        stats.backpressure_waits += lane.full_waits;
+    }
+    return stats;
+}
+
+MetricsSnapshot Dispatcher::metrics() const {
+    return metrics_.snapshot();
+}
+
+void Dispatcher::set_wire_connection_state(bool enabled) {
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    std::lock_guard<std::mutex> lk(wire_send_mutex_);
+    // Frames encoded before the switch leave before any encoded after it
+    if (batcher_) batcher_->flush();
+    wire_.set_connection_state(enabled);
+}
+
+void Dispatcher::set_wire_negotiation(bool enabled) {
+    // Negotiating peers read v1, which is what carries the negotiation
+    std::lock_guard<std::mutex> lk(wire_send_mutex_);
+    if (enabled && wire_.peer_version() < Envelope::WIRE_VERSION) wire_.set_peer_version(Envelope::WIRE_VERSION);
+    wire_.set_negotiation(enabled);
+}
+
+void Dispatcher::set_peer_wire_version(uint32_t version) {
+    std::lock_guard<std::mutex> lk(wire_send_mutex_);
+    wire_.set_peer_version(version);
+}
+
+void Dispatcher::set_send_batching(size_t max_bytes, std::chrono::microseconds max_delay) {
+    std::unique_ptr<FrameBatcher> old;
+    {
+        std::unique_lock<std::shared_mutex> cfg(config_mutex_);
+        std::swap(old, batcher_);
+        // What the old batcher holds goes out before anything sent after this
+        if (old) {
+            try {
+                old->flush();
+            } catch (const std::exception& e) {
+                SC_LOG_WARN("Dispatcher", "Flushing the old batcher failed: " << e.what());
+            }
+        }
+        if (max_bytes > 0) {
+            batcher_ = std::make_unique<FrameBatcher>(max_bytes, max_delay,
+                [this](std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner) {
+                    StageTimer send_timer(metrics_, Stage::TransportSend);
+                    transport_->send_iov(parts, std::move(owner));
+                });
+        }
+    }
+    // Joined outside the lock: its last send_async completions may call back in
+}
+
+void Dispatcher::flush_sends() {
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    if (batcher_) batcher_->flush();
+}
+
+FrameBatcher::Stats Dispatcher::send_batching_stats() const {
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    return batcher_ ? batcher_->stats() : FrameBatcher::Stats{};
+}
+
+void Dispatcher::send_envelope(Envelope env) {
+    SendCompletion none;
+    send_envelope(std::move(env), none);
+}
+
+void Dispatcher::send_envelope(Envelope env, SendCompletion& done) {
+    // The transport gets the framing and the ciphertext as separate parts, both
+    // owned by one shared frame, so the ciphertext is never copied into a frame buffer
+    struct OutboundFrame {
+        Envelope env;
+        std::vector<uint8_t> framing;
+    };
+    auto frame = std::make_shared<OutboundFrame>();
+    frame->env = std::move(env);
+
+    std::unique_lock<std::mutex> wire(wire_send_mutex_);
+    StageTimer serialize_timer(metrics_, Stage::Serialize);
+    const size_t head = wire_.encode_framing(frame->env, frame->framing);
+    serialize_timer.stop();
+    SC_LOG_DEBUG("Dispatcher", "Serialized envelope size: " << frame->framing.size() + frame->env.ciphertext.size());
+
+    const std::span<const uint8_t> framing(frame->framing);
+    const std::span<const uint8_t> parts[] = {framing.first(head), frame->env.ciphertext, framing.subspan(head)};
+    // Connection state needs each send's outcome before the next frame is encoded,
+    // which a batch only has once it goes out
+    const bool connection_state = wire_.connection_state();
+    if (batcher_ && !connection_state && wire_.peer_version() >= Envelope::WIRE_VERSION_BATCH) {
+        // Added under the wire lock, so the flush in set_wire_connection_state()
+        // catches every frame encoded before it. Timed as TransportSend when the
+        // batch goes out.
+        batcher_->add(parts, std::move(frame), std::exchange(done, nullptr));
+        return;
+    }
+    if (!connection_state) wire.unlock();
+    StageTimer send_timer(metrics_, Stage::TransportSend);
+    try {
+        transport_->send_iov(parts, std::move(frame));
+    } catch (...) {
+        if (!wire.owns_lock()) wire.lock();
+        wire_.send_failed();
+        throw;
+    }
+}
+
+void Dispatcher::refill_send_keys(const std::string& remote_device_id, SessionState& s) {
+    if (send_key_window_ == 0 || s.refill_pending) return;
+    if (s.ratchet.precomputed_send_keys() * 2 > s.ratchet.send_key_window()) return;
+    if (!crypto_pool_) {
+        s.ratchet.precompute_send_keys();
+        return;
+    }
+    s.refill_pending = true;
+    crypto_pool_->submit([this, remote_device_id] {
+        std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+        SessionState* s = find_session(remote_device_id);
+        if (!s) return;
+        std::lock_guard<std::mutex> lk(s->mutex);
+        s->ratchet.precompute_send_keys();
+        s->refill_pending = false;
+    });
 }
 
 void Dispatcher::set_on_inbound(OnInboundMessage cb) {
-    std::cout << "[Dispatcher] set_on_inbound callback" << std::endl;
-    std::lock_guard<std::mutex> lk(mutex_);
+    SC_LOG_DEBUG("Dispatcher", "set_on_inbound callback");
+    std::unique_lock<std::shared_mutex> cfg(config_mutex_);
     on_inbound_ = cb;
 }
 
-void Dispatcher::on_raw_message(const std::vector<uint8_t>& bytes) {
-    std::cout << "[Dispatcher] on_raw_message received, bytes size: " << bytes.size() << std::endl;
-    
-    auto env_opt = deserialize_envelope(bytes);
-    if (!env_opt.has_value()) {
-        std::cout << "[Dispatcher] Failed to deserialize envelope" << std::endl;
-        return;
+void Dispatcher::on_raw_messages(std::span<const Bytes> frames) {
+    SC_LOG_DEBUG("Dispatcher", "on_raw_messages received " << frames.size() << " frames");
+
+    // Batch frames open into slices of their own buffer
+    std::span<const Bytes> messages = frames;
+    std::vector<Bytes> unpacked;
+    const bool any_batch = std::any_of(frames.begin(), frames.end(),
+                                       [](const Bytes& f) { return BatchFrame::is_batch(f); });
+    if (any_batch) {
+        for (const Bytes& frame : frames) {
+            if (!BatchFrame::is_batch(frame)) {
+                unpacked.push_back(frame);
+            } else if (!BatchFrame::unpack(frame, unpacked)) {
+                SC_LOG_WARN("Dispatcher", "Dropping malformed batch frame");
+            }
+        }
+        messages = unpacked;
     }
-    
-    Envelope env = env_opt.value();
-    std::cout << "[Dispatcher] Envelope deserialized. Sender: " << env.sender_device_id 
+
+    // Reused across calls on the same thread; taken out while in use, so a
+    // callback that re-enters on this thread gets a fresh one
+    thread_local std::vector<InboundFrame> scratch;
+    std::vector<InboundFrame> inbound = std::move(scratch);
+    inbound.clear();
+    {
+        std::lock_guard<std::mutex> wire(wire_recv_mutex_);
+        if (any_batch) wire_.saw_batch_frame();
+        for (const Bytes& message : messages) {
+            TraceScope trace("on_raw_message");
+            StageTimer deserialize_timer(metrics_, Stage::Deserialize);
+            auto view = wire_.decode(message);
+            deserialize_timer.stop();
+            if (!view) {
+                SC_LOG_WARN("Dispatcher", "Failed to deserialize envelope");
+                continue;
+            }
+            if (trace.active()) trace.set_key(TraceKey::of(view->session_id, view->message_index));
+            inbound.push_back({message, *view});
+        }
+    }
+
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    std::shared_ptr<LanePool> lanes = inbound_lanes_;
+    if (!lanes) {
+        for (const InboundFrame& in : inbound) process_inbound_locked(in.view);
+    } else {
+        // A full lane blocks submit(); don't hold up the setters meanwhile
+        cfg.unlock();
+        // Workers keep the frames alive and use the views decoded here (a v2 frame
+        // may not decode on its own). A dictionary sender id points into wire_,
+        // whose dictionary only grows, so the view stays valid.
+        const auto queued_at = std::chrono::steady_clock::now();
+        if (inbound.size() == 1) {
+            lanes->submit(lanes->lane_for(inbound_lane_key(inbound[0].view)),
+                          [this, in = std::move(inbound[0]), queued_at] {
+                metrics_.record(Stage::QueueWait, queued_at);
+                process_inbound(in.view);
+            });
+        } else {
+            // One task per lane, holding that lane's messages in arrival order
+            std::vector<std::vector<InboundFrame>> per_lane(lanes->size());
+            for (InboundFrame& in : inbound) per_lane[lanes->lane_for(inbound_lane_key(in.view))].push_back(std::move(in));
+            for (size_t lane = 0; lane < per_lane.size(); lane++) {
+                if (per_lane[lane].empty()) continue;
+                lanes->submit(lane, [this, group = std::move(per_lane[lane]), queued_at] {
+                    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+                    for (const InboundFrame& in : group) {
+                        metrics_.record(Stage::QueueWait, queued_at);
+                        process_inbound_locked(in.view);
+                    }
+                });
+            }
+        }
+    }
+    inbound.clear();
+    scratch = std::move(inbound);
+}
+
+void Dispatcher::process_inbound(const EnvelopeView& env) {
+    std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+    process_inbound_locked(env);
+}
+
+void Dispatcher::process_inbound_locked(const EnvelopeView& env) {
+    StageTimer lookup_timer(metrics_, Stage::SessionLookup);
+    SC_LOG_DEBUG("Dispatcher", "Envelope deserialized. Sender: " << env.sender_device_id 
               << ", My device ID: " << device_id_ 
-              << ", Session ID size: " << env.session_id.size() << std::endl;
+              << ", Session ID size: " << env.session_id.size());
 
     // Determine if group or direct
     if (!env.session_id.empty() && mls_.get_group_epoch(env.session_id) != 0) {
-        std::cout << "[Dispatcher] Group message detected" << std::endl;
-        // group
-        auto pt = mls_.decrypt_group_message(env.session_id, device_id_, env);
+        SC_LOG_DEBUG("Dispatcher", "Group message detected");
+        lookup_timer.stop();
+        // group: MLSManager and the callback work on an owned Envelope
+        const Envelope group_env = env.to_envelope();
+        StageTimer decrypt_timer(metrics_, Stage::Decrypt);
+        auto pt = mls_.decrypt_group_message(group_env.session_id, device_id_, group_env);
+        decrypt_timer.stop();
         if (pt.has_value()) {
-            std::cout << "[Dispatcher] Group message decrypted successfully" << std::endl;
-            if (on_inbound_) on_inbound_(env);
+            SC_LOG_DEBUG("Dispatcher", "Group message decrypted successfully");
+            StageTimer callback_timer(metrics_, Stage::Callback);
+            if (on_inbound_) on_inbound_(group_env);
         } else {
-            std::cout << "[Dispatcher] Failed to decrypt group message" << std::endl;
+            SC_LOG_WARN("Dispatcher", "Failed to decrypt group message");
         }
         return;
     }
 
     // direct: find session by sender device id
-    std::string sender = env.sender_device_id;
-    std::cout << "[Dispatcher] Direct message from: " << sender << std::endl;
+    const std::string_view sender = env.sender_device_id;
+    SC_LOG_DEBUG("Dispatcher", "Direct message from: " << sender);
     
-    std::lock_guard<std::mutex> lk(mutex_);
-    auto it = sessions_.find(sender);
-    if (it == sessions_.end()) {
-        std::cout << "[Dispatcher] No session found for sender: " << sender << std::endl;
+    SessionState* session = find_session(sender);
+    if (!session) {
+        SC_LOG_WARN("Dispatcher", "No session found for sender: " << sender);
         return;
     }
     
-    std::cout << "[Dispatcher] Found session, attempting decryption..." << std::endl;
-    auto pt = it->second.ratchet.decrypt_envelope(env);
+    SessionState& s = *session;
+    std::lock_guard<std::mutex> lk(s.mutex);
+    lookup_timer.stop();
+    if (s.step_in_flight) {
+        // Keep order: everything behind a pending DH step waits for it
+        SC_LOG_DEBUG("Dispatcher", "Holding message until the ratchet step completes");
+        s.held.push_back(env.to_envelope());
+        return;
+    }
+    if (async_steps_active()) {
+        const auto header = RatchetHeaderView::parse(env.associated_data);
+        if (auto remote_pub = header ? s.ratchet.dh_step_needed(*header) : std::nullopt) {
+            s.held.push_back(env.to_envelope());
+            launch_dh_step(std::string(sender), s, *remote_pub);
+            return;
+        }
+    }
+    deliver_direct(s, env);
+}
+
+void Dispatcher::deliver_direct(SessionState& s, const EnvelopeView& env) {
+    SC_LOG_DEBUG("Dispatcher", "Found session, attempting decryption...");
+    StageTimer decrypt_timer(metrics_, Stage::Decrypt);
+    auto pt = s.ratchet.decrypt_envelope(env);
+    decrypt_timer.stop();
     if (pt.has_value()) {
-        std::cout << "[Dispatcher] Message decrypted successfully! Plaintext size: " << pt.value().size() << std::endl;
+        SC_LOG_DEBUG("Dispatcher", "Message decrypted successfully! Plaintext size: " << pt.value().size());
         if (on_inbound_) {
-            // Create a new envelope with the decrypted plaintext for the callback
-            Envelope decrypted_env = env;
-            decrypted_env.ciphertext = pt.value(); // Replace ciphertext with plaintext for demo
-            on_inbound_(decrypted_env);
+            StageTimer callback_timer(metrics_, Stage::Callback);
+            on_inbound_(inbound_envelope(env, std::move(*pt)));
         }
     } else {
-        std::cout << "[Dispatcher] Failed to decrypt message" << std::endl;
+        SC_LOG_WARN("Dispatcher", "Failed to decrypt message");
     }
 }
 
-std::vector<uint8_t> Dispatcher::serialize_envelope(const Envelope& env) {
-    std::vector<uint8_t> out;
-    // session id length + session id
-    uint32_t sid_len = static_cast<uint32_t>(env.session_id.size());
-    out.push_back((sid_len >> 24) & 0xFF);
-    out.push_back((sid_len >> 16) & 0xFF);
-    out.push_back((sid_len >> 8) & 0xFF);
-    out.push_back((sid_len) & 0xFF);
-    out.insert(out.end(), env.session_id.begin(), env.session_id.end());
-
-    // message_index, previous_counter, timestamp
-    uint32_t mi = env.message_index;
-    out.push_back((mi >> 24) & 0xFF);
-    out.push_back((mi >> 16) & 0xFF);
-    out.push_back((mi >> 8) & 0xFF);
-    out.push_back((mi) & 0xFF);
-
-    uint32_t pc = env.previous_counter;
-    out.push_back((pc >> 24) & 0xFF);
-    out.push_back((pc >> 16) & 0xFF);
-    out.push_back((pc >> 8) & 0xFF);
-    out.push_back((pc) & 0xFF);
-
-    uint64_t ts = env.timestamp;
-    for (int i = 7; i >= 0; --i) out.push_back((ts >> (8*i)) & 0xFF);
-
-    // sender_device_id length + bytes
-    uint32_t idlen = static_cast<uint32_t>(env.sender_device_id.size());
-    out.push_back((idlen >> 24) & 0xFF);
-    out.push_back((idlen >> 16) & 0xFF);
-    out.push_back((idlen >> 8) & 0xFF);
-    out.push_back((idlen) & 0xFF);
-    out.insert(out.end(), env.sender_device_id.begin(), env.sender_device_id.end());
-
-    // aad len + aad, ct len + ct
-    uint32_t aadlen = static_cast<uint32_t>(env.associated_data.size());
-    out.push_back((aadlen >> 24) & 0xFF);
-    out.push_back((aadlen >> 16) & 0xFF);
-    out.push_back((aadlen >> 8) & 0xFF);
-    out.push_back((aadlen) & 0xFF);
-    out.insert(out.end(), env.associated_data.begin(), env.associated_data.end());
-
-    uint32_t ctlen = static_cast<uint32_t>(env.ciphertext.size());
-    out.push_back((ctlen >> 24) & 0xFF);
-    out.push_back((ctlen >> 16) & 0xFF);
-    out.push_back((ctlen >> 8) & 0xFF);
-    out.push_back((ctlen) & 0xFF);
-    out.insert(out.end(), env.ciphertext.begin(), env.ciphertext.end());
+void Dispatcher::launch_dh_step(const std::string& remote_device_id, SessionState& s, const PublicKey32& remote_pub) {
+    SC_LOG_DEBUG("Dispatcher", "Ratchet step for " << remote_device_id << " queued on crypto workers");
+    s.step_in_flight = true;
+    auto step = std::make_shared<Ratchet::DhStep>(s.ratchet.prepare_dh_step(remote_pub));
+    crypto_pool_->submit([this, remote_device_id, step] {
+        bool ok = true;
+        try {
+            step->compute();
+        } catch (const std::exception&) {
+            ok = false;
+        }
 
-    return out;
+        std::shared_lock<std::shared_mutex> cfg(config_mutex_);
+        SessionState* session = find_session(remote_device_id);
+        if (!session) return;
+        SessionState& s = *session;
+        std::lock_guard<std::mutex> lk(s.mutex);
+        s.step_in_flight = false;
+        if (ok) {
+            s.ratchet.commit_dh_step(*step);
+        } else if (!s.held.empty()) {
+            // Invalid remote key: the message that announced it cannot be opened
+            SC_LOG_WARN("Dispatcher", "Ratchet step failed; dropping message");
+            s.held.pop_front();
+        }
+        replay_held(remote_device_id, s);
+    });
 }
 
-std::optional<Envelope> Dispatcher::deserialize_envelope(const std::vector<uint8_t>& bytes) {
-    size_t off = 0;
-    if (bytes.size() < 4) return std::nullopt;
-    auto read_u32 = [&](uint32_t& out)->bool {
-        if (off + 4 > bytes.size()) return false;
-        out = (uint32_t(bytes[off])<<24) | (uint32_t(bytes[off+1])<<16) | (uint32_t(bytes[off+2])<<8) | uint32_t(bytes[off+3]);
-        off +=4;
-        return true;
-    };
-    Envelope env;
-    uint32_t sid_len;
-    if (!read_u32(sid_len)) return std::nullopt;
-    if (off + sid_len > bytes.size()) return std::nullopt;
-    env.session_id = std::vector<uint8_t>(bytes.begin()+off, bytes.begin()+off+sid_len);
-    off += sid_len;
-
-    uint32_t mi; if (!read_u32(mi)) return std::nullopt; env.message_index = mi;
-    uint32_t pc; if (!read_u32(pc)) return std::nullopt; env.previous_counter = pc;
-    if (off + 8 > bytes.size()) return std::nullopt;
-    uint64_t ts = 0;
-    for (int i=0;i<8;i++) { ts = (ts<<8) | bytes[off++]; }
-    env.timestamp = ts;
-
-    uint32_t idlen; if (!read_u32(idlen)) return std::nullopt;
-    if (off + idlen > bytes.size()) return std::nullopt;
-    env.sender_device_id = std::string(bytes.begin()+off, bytes.begin()+off+idlen);
-    off += idlen;
-
-    uint32_t aadlen; if (!read_u32(aadlen)) return std::nullopt;
-    if (off + aadlen > bytes.size()) return std::nullopt;
-    env.associated_data = std::vector<uint8_t>(bytes.begin()+off, bytes.begin()+off+aadlen);
-    off += aadlen;
-
-    uint32_t ctlen; if (!read_u32(ctlen)) return std::nullopt;
-    if (off + ctlen > bytes.size()) return std::nullopt;
-    env.ciphertext = std::vector<uint8_t>(bytes.begin()+off, bytes.begin()+off+ctlen);
-    off += ctlen;
-
-    return env;
+void Dispatcher::replay_held(const std::string& remote_device_id, SessionState& s) {
+    while (!s.held.empty()) {
+        if (async_steps_active()) {
+            if (auto remote_pub = s.ratchet.dh_step_needed(s.held.front())) {
+                launch_dh_step(remote_device_id, s, *remote_pub);
+                return;
+            }
+        }
+        Envelope env = std::move(s.held.front());
+        s.held.pop_front();
+        deliver_direct(s, EnvelopeView::of(env));
+    }
 }
 
 } // namespace securecomm
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "securecomm/enhanced_dispatcher.hpp"
-#include <iostream>
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
+#include <algorithm>
 #include <chrono>
 #include <sstream>
 #include <iomanip>
@@ -8,19 +10,36 @@ namespace securecomm {
 
 EnhancedDispatcher::EnhancedDispatcher(TransportPtr transport, 
                                      const std::string& data_dir)
-    : data_dir_(data_dir)
+    : dispatcher_(std::make_shared<Dispatcher>(transport))
+    , data_dir_(data_dir)
     , connection_state_(STATE_OFFLINE)
     , mesh_enabled_(true)
-    , offline_mode_(false) {
-    
-    // Create dispatcher
-    dispatcher_ = std::make_shared<Dispatcher>(transport);
+    , offline_mode_(false)
+    , messages_sent_(dispatcher_->metrics_registry().counter(
+          "securecomm_messages_sent_total", "Messages handed to EnhancedDispatcher for sending."))
+    , messages_received_(dispatcher_->metrics_registry().counter(
+          "securecomm_messages_received_total", "Messages received over the mesh network."))
+    , messages_queued_(dispatcher_->metrics_registry().counter(
+          "securecomm_messages_queued_total", "Messages put in the offline queue after a failed send."))
+    , messages_delivered_via_mesh_(dispatcher_->metrics_registry().counter(
+          "securecomm_messages_delivered_via_mesh_total", "Messages delivered over the mesh network.")) {
     
     // Initialize offline queue
     offline_queue_ = std::make_unique<OfflineQueue>();
     std::string db_path = data_dir_ + "/carrierbridge_queue.db";
     offline_queue_->initialize(db_path);
     
+    // Offline queue state, read from the database on each metrics snapshot
+    auto& metrics = dispatcher_->metrics_registry();
+    metrics.set_gauge("securecomm_offline_queue_pending", "Messages waiting in the offline queue.",
+                      [this] { return double(offline_queue_->get_stats().pending_count); });
+    metrics.set_gauge("securecomm_offline_queue_delivered", "Offline queue messages marked delivered.",
+                      [this] { return double(offline_queue_->get_stats().delivered_count); });
+    metrics.set_gauge("securecomm_offline_queue_failed", "Offline queue messages that gave up.",
+                      [this] { return double(offline_queue_->get_stats().failed_count); });
+    metrics.set_gauge("securecomm_offline_queue_retries", "Delivery retries recorded in the offline queue.",
+                      [this] { return double(offline_queue_->get_stats().total_retries); });
+    
     // Initialize mesh network
     mesh_network_ = std::make_unique<MeshNetwork>();
     
@@ -29,11 +48,17 @@ EnhancedDispatcher::EnhancedDispatcher(TransportPtr transport,
         process_mesh_packet(packet);
     });
     
-    std::cout << "[EnhancedDispatcher] Initialized with data_dir: " << data_dir_ << std::endl;
+    SC_LOG_INFO("EnhancedDispatcher", "Initialized with data_dir: " << data_dir_);
 }
 
 EnhancedDispatcher::~EnhancedDispatcher() {
     stop();
+    // dispatcher_ may outlive us through get_dispatcher()
+    auto& metrics = dispatcher_->metrics_registry();
+    metrics.remove_gauge("securecomm_offline_queue_pending");
+    metrics.remove_gauge("securecomm_offline_queue_delivered");
+    metrics.remove_gauge("securecomm_offline_queue_failed");
+    metrics.remove_gauge("securecomm_offline_queue_retries");
 }
 
 void EnhancedDispatcher::start() {
@@ -63,7 +88,7 @@ void EnhancedDispatcher::start() {
         }
     });
     
-    std::cout << "[EnhancedDispatcher] Started" << std::endl;
+    SC_LOG_INFO("EnhancedDispatcher", "Started");
 }
 
 void EnhancedDispatcher::stop() {
@@ -79,7 +104,7 @@ void EnhancedDispatcher::stop() {
     mesh_network_->stop();
     dispatcher_->stop();
     
-    std::cout << "[EnhancedDispatcher] Stopped" << std::endl;
+    SC_LOG_INFO("EnhancedDispatcher", "Stopped");
 }
 
 void EnhancedDispatcher::register_device(const std::string& device_id) {
@@ -106,16 +131,16 @@ void EnhancedDispatcher::send_message_to_device(const std::string& remote_device
     try {
         // Send via dispatcher
         dispatcher_->send_message_to_device(remote_device_id, plaintext);
-        std::cout << "[EnhancedDispatcher] Message sent via dispatcher" << std::endl;
+        SC_LOG_DEBUG("EnhancedDispatcher", "Message sent via dispatcher");
         
     } catch (const std::exception& e) {
-        std::cerr << "[EnhancedDispatcher] Failed to send via dispatcher: " 
-                  << e.what() << std::endl;
+        SC_LOG_ERROR("EnhancedDispatcher", "Failed to send via dispatcher: " 
+                  << e.what());
         
         // Queue for later delivery
         offline_queue_->queue_message(msg_id.str(), remote_device_id, plaintext);
         messages_queued_++;
-        std::cout << "[EnhancedDispatcher] Message queued for offline delivery" << std::endl;
+        SC_LOG_DEBUG("EnhancedDispatcher", "Message queued for offline delivery");
     }
 }
 
@@ -147,7 +172,7 @@ void EnhancedDispatcher::check_connectivity() {
             case STATE_CONNECTING: state_str = "CONNECTING"; break;
             case STATE_OFFLINE: state_str = "OFFLINE"; break;
         }
-        std::cout << "[EnhancedDispatcher] Connection state changed to: " << state_str << std::endl;
+        SC_LOG_INFO("EnhancedDispatcher", "Connection state changed to: " << state_str);
     }
 }
 
@@ -158,32 +183,45 @@ void EnhancedDispatcher::retry_queued_messages() {
     
     auto pending = offline_queue_->get_pending_messages();
     
-    std::cout << "[EnhancedDispatcher] Checking " << pending.size() 
-              << " pending messages for retry" << std::endl;
+    SC_LOG_DEBUG("EnhancedDispatcher", "Checking " << pending.size() 
+              << " pending messages for retry");
     
-    for (const auto& msg : pending) {
+    // Each recipient's backlog goes out back to back (oldest first), so with send
+    // batching on it leaves in a few batch frames; the pause is between recipients
+    std::stable_sort(pending.begin(), pending.end(),
+                     [](const OfflineQueue::QueuedMessage& a, const OfflineQueue::QueuedMessage& b) {
+                         return a.recipient_id < b.recipient_id;
+                     });
+    for (size_t i = 0; i < pending.size(); i++) {
+        const auto& msg = pending[i];
+        if (i > 0 && msg.recipient_id != pending[i - 1].recipient_id) {
+            dispatcher_->flush_sends();
+            // Small delay between recipients
+            std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        }
         if (msg.retry_count > 10) { // Max retries
             offline_queue_->mark_failed(msg.message_id);
-            std::cout << "[EnhancedDispatcher] Message exceeded max retries: " 
-                      << msg.message_id << std::endl;
+            SC_LOG_WARN("EnhancedDispatcher", "Message exceeded max retries: " 
+                      << msg.message_id);
             continue;
         }
         
-        try {
-            // Try to send via dispatcher
-            dispatcher_->send_message_to_device(msg.recipient_id, msg.envelope);
-            offline_queue_->mark_delivered(msg.message_id);
-            std::cout << "[EnhancedDispatcher] Retry successful for message: " 
-                      << msg.message_id << std::endl;
-        } catch (const std::exception& e) {
-            offline_queue_->mark_failed(msg.message_id);
-            std::cerr << "[EnhancedDispatcher] Retry failed for message: " 
-                      << msg.message_id << ", error: " << e.what() << std::endl;
+        {
+            TraceScope trace("offline_retry", tracing_enabled() ? TraceKey::of(msg.message_id) : TraceKey{});
+            try {
+                // Try to send via dispatcher
+                dispatcher_->send_message_to_device(msg.recipient_id, msg.envelope);
+                offline_queue_->mark_delivered(msg.message_id);
+                SC_LOG_DEBUG("EnhancedDispatcher", "Retry successful for message: " 
+                          << msg.message_id);
+            } catch (const std::exception& e) {
+                offline_queue_->mark_failed(msg.message_id);
+                SC_LOG_ERROR("EnhancedDispatcher", "Retry failed for message: " 
+                          << msg.message_id << ", error: " << e.what());
+            }
         }
-        
-        // Small delay between retries
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
     }
+    dispatcher_->flush_sends();
 }
 
 void EnhancedDispatcher::process_mesh_packet(const MeshNetwork::MeshPacket& packet) {
@@ -197,12 +235,12 @@ void EnhancedDispatcher::process_mesh_packet(const MeshNetwork::MeshPacket& pack
             // Send ACK if needed
             if (packet.recipient_device_id != "broadcast") {
                 // Send ACK back through mesh
-                std::vector<uint8_t> ack = {'A','C','K'};
-                mesh_network_->send_packet(packet.sender_mesh_id, ack);
+                static const uint8_t ack[] = {'A','C','K'};
+                mesh_network_->send_packet(packet.sender_mesh_id, Bytes::copy(ack));
             }
         } catch (const std::exception& e) {
-            std::cerr << "[EnhancedDispatcher] Failed to process mesh packet: " 
-                      << e.what() << std::endl;
+            SC_LOG_ERROR("EnhancedDispatcher", "Failed to process mesh packet: " 
+                      << e.what());
         }
     }
 }
@@ -215,24 +253,24 @@ void EnhancedDispatcher::enable_mesh_networking(bool enable) {
     mesh_enabled_ = enable;
     if (enable && running_) {
         mesh_network_->start();
-        std::cout << "[EnhancedDispatcher] Mesh networking enabled" << std::endl;
+        SC_LOG_INFO("EnhancedDispatcher", "Mesh networking enabled");
     } else if (!enable) {
         mesh_network_->stop();
-        std::cout << "[EnhancedDispatcher] Mesh networking disabled" << std::endl;
+        SC_LOG_INFO("EnhancedDispatcher", "Mesh networking disabled");
     }
 }
 
 void EnhancedDispatcher::set_offline_mode(bool offline) {
     offline_mode_ = offline;
-    std::cout << "[EnhancedDispatcher] Offline mode: " << (offline ? "ON" : "OFF") << std::endl;
+    SC_LOG_INFO("EnhancedDispatcher", "Offline mode: " << (offline ? "ON" : "OFF"));
 }
 
 EnhancedDispatcher::EnhancedStats EnhancedDispatcher::get_stats() const {
     EnhancedStats stats;
-    stats.messages_sent = messages_sent_;
-    stats.messages_received = messages_received_;
-    stats.messages_queued = messages_queued_;
-    stats.messages_delivered_via_mesh = messages_delivered_via_mesh_;
+    stats.messages_sent = static_cast<int>(messages_sent_.load());
+    stats.messages_received = static_cast<int>(messages_received_.load());
+    stats.messages_queued = static_cast<int>(messages_queued_.load());
+    stats.messages_delivered_via_mesh = static_cast<int>(messages_delivered_via_mesh_.load());
     stats.queue_stats = offline_queue_->get_stats();
     return stats;
 }
@@ -24,98 +24,538 @@ uint32_t Envelope::read_u32(const std::vector<uint8_t>& in, size_t& offset) {
     return v;
 }
 
-std::vector<uint8_t> Envelope::serialize() const {
-    std::vector<uint8_t> out;
+namespace {
+
+// version, session id length, message index, previous counter, timestamp, and the
+// lengths of sender id, associated data, ciphertext, signature and aad
+constexpr size_t FIXED_BYTES = 4 + 4 + 4 + 4 + 8 + 4 * 5;
+// The same fields of the unversioned layout: no version, signature or aad
+constexpr size_t LEGACY_FIXED_BYTES = 4 + 4 + 4 + 8 + 4 * 3;
+
+class Writer {
+public:
+    explicit Writer(uint8_t* p) : p_(p) {}
+
+    void u32(uint32_t v) {
+        p_[0] = uint8_t(v >> 24);
+        p_[1] = uint8_t(v >> 16);
+        p_[2] = uint8_t(v >> 8);
+        p_[3] = uint8_t(v);
+        p_ += 4;
+    }
+    void u64(uint64_t v) {
+        u32(uint32_t(v >> 32));
+        u32(uint32_t(v));
+    }
+    void bytes(const void* data, size_t n) {
+        u32(static_cast<uint32_t>(n));
+        raw(data, n);
+    }
+    void u8(uint8_t v) { *p_++ = v; }
+    void varint(uint64_t v) {
+        while (v >= 0x80) {
+            *p_++ = uint8_t(v) | 0x80;
+            v >>= 7;
+        }
+        *p_++ = uint8_t(v);
+    }
+    void varbytes(const void* data, size_t n) {
+        varint(n);
+        raw(data, n);
+    }
+
+private:
+    void raw(const void* data, size_t n) {
+        if (n) memcpy(p_, data, n);
+        p_ += n;
+    }
+
+    uint8_t* p_;
+};
+
+// Every read is checked against the end of the buffer; after the first failure
+// ok() stays false and reads return empty values.
+class Reader {
+public:
+    explicit Reader(std::span<const uint8_t> in) : in_(in) {}
+
+    uint32_t u32() {
+        if (!take(4)) return 0;
+        const uint8_t* p = in_.data() + off_ - 4;
+        return (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+    }
+    uint64_t u64() {
+        const uint64_t hi = u32();
+        return (hi << 32) | u32();
+    }
+    std::span<const uint8_t> bytes() { return take_span(u32()); }
+    uint8_t u8() { return take(1) ? in_[off_ - 1] : 0; }
+    // Shortest-form LEB128 of at most `max_bits` bits
+    uint64_t varint(unsigned max_bits = 64) {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < max_bits; shift += 7) {
+            const uint8_t b = u8();
+            if (!ok_) return 0;
+            if (shift + 7 > max_bits && (b >> (max_bits - shift)) != 0) break;    // too large
+            v |= uint64_t(b & 0x7F) << shift;
+            if (!(b & 0x80)) {
+                if (b == 0 && shift != 0) break;    // overlong
+                return v;
+            }
+        }
+        ok_ = false;
+        return 0;
+    }
+    uint32_t varint32() { return static_cast<uint32_t>(varint(32)); }
+    std::span<const uint8_t> varbytes() { return take_span(varint(32)); }
+
+    bool ok() const { return ok_; }
+    bool at_end() const { return ok_ && off_ == in_.size(); }
+
+private:
+    std::span<const uint8_t> take_span(size_t n) {
+        if (!take(n)) return {};
+        return in_.subspan(off_ - n, n);
+    }
+    bool take(size_t n) {
+        if (!ok_ || n > in_.size() - off_) {
+            ok_ = false;
+            return false;
+        }
+        off_ += n;
+        return true;
+    }
+
+    std::span<const uint8_t> in_;
+    size_t off_ = 0;
+    bool ok_ = true;
+};
+
+std::string_view as_chars(std::span<const uint8_t> s) {
+    return std::string_view(reinterpret_cast<const char*>(s.data()), s.size());
+}
 
-    // Version 1: New format with all fields
-    push_u32(out, version);
+// v1 version field: format version in the low byte, highest readable version above it
+constexpr uint32_t V1_READS_SHIFT = 8;
 
-    // Session ID
-    push_u32(out, static_cast<uint32_t>(session_id.size()));
-    out.insert(out.end(), session_id.begin(), session_id.end());
+// v2 flags
+constexpr uint8_t FLAG_TIMESTAMP_DELTA = 0x01;
+constexpr uint8_t FLAG_SENDER_INDEX = 0x02;    // sender is a dictionary index
+constexpr uint8_t FLAG_SENDER_NEW = 0x04;      // inline sender joins the dictionary
+constexpr uint8_t FLAG_TRAILER = 0x08;         // signature and aad follow
+constexpr uint8_t FLAG_RESET = 0x10;           // connection state starts over with this frame
+constexpr uint8_t FLAG_CONNECTION_STATE = FLAG_TIMESTAMP_DELTA | FLAG_SENDER_INDEX | FLAG_SENDER_NEW | FLAG_RESET;
+constexpr uint8_t FLAGS_KNOWN = FLAG_CONNECTION_STATE | FLAG_TRAILER;
 
-    // Message indices
-    push_u32(out, message_index);
-    push_u32(out, previous_counter);
-    
-    // Timestamp
-    for (int i = 7; i >= 0; --i) {
-        out.push_back((timestamp >> (8 * i)) & 0xFF);
+size_t varint_size(uint64_t v) {
+    size_t n = 1;
+    while (v >= 0x80) {
+        v >>= 7;
+        n++;
     }
+    return n;
+}
+
+size_t varbytes_size(size_t n) { return varint_size(n) + n; }
+
+uint64_t zigzag(int64_t v) { return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63); }
+int64_t unzigzag(uint64_t v) { return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1); }
+
+// Every format is laid out as [head] [ciphertext] [tail], the head ending with the
+// ciphertext length, so a frame can go out with the ciphertext left in place
+constexpr size_t V1_TAIL_FIXED = 4 + 4;
+
+size_t v1_head_size(const Envelope& env) {
+    return FIXED_BYTES - V1_TAIL_FIXED + env.session_id.size() + env.sender_device_id.size() + env.associated_data.size();
+}
+
+size_t v1_tail_size(const Envelope& env) {
+    return V1_TAIL_FIXED + env.signature.size() + env.aad.size();
+}
+
+void write_v1_head(const Envelope& env, uint8_t* out, uint32_t reads_version) {
+    Writer w(out);
+    w.u32(Envelope::WIRE_VERSION | (reads_version << V1_READS_SHIFT));
+    w.bytes(env.session_id.data(), env.session_id.size());
+    w.u32(env.message_index);
+    w.u32(env.previous_counter);
+    w.u64(env.timestamp);
+    w.bytes(env.sender_device_id.data(), env.sender_device_id.size());
+    w.bytes(env.associated_data.data(), env.associated_data.size());
+    w.u32(static_cast<uint32_t>(env.ciphertext.size()));
+}
+
+void write_v1_tail(const Envelope& env, uint8_t* out) {
+    Writer w(out);
+    w.bytes(env.signature.data(), env.signature.size());
+    w.bytes(env.aad.data(), env.aad.size());
+}
 
-    // Sender device ID
-    push_u32(out, static_cast<uint32_t>(sender_device_id.size()));
-    out.insert(out.end(), sender_device_id.begin(), sender_device_id.end());
+// The legacy layout is the v1 head without the version field, and no tail
+size_t legacy_head_size(const Envelope& env) {
+    return LEGACY_FIXED_BYTES + env.session_id.size() + env.sender_device_id.size() + env.associated_data.size();
+}
+
+void write_legacy_head(const Envelope& env, uint8_t* out) {
+    Writer w(out);
+    w.bytes(env.session_id.data(), env.session_id.size());
+    w.u32(env.message_index);
+    w.u32(env.previous_counter);
+    w.u64(env.timestamp);
+    w.bytes(env.sender_device_id.data(), env.sender_device_id.size());
+    w.bytes(env.associated_data.data(), env.associated_data.size());
+    w.u32(static_cast<uint32_t>(env.ciphertext.size()));
+}
+
+void copy_bytes(uint8_t* out, const std::vector<uint8_t>& in) {
+    if (!in.empty()) memcpy(out, in.data(), in.size());
+}
+
+std::optional<EnvelopeView> parse_v1(std::span<const uint8_t> bytes) {
+    Reader r(bytes);
+    EnvelopeView v;
+    const uint32_t version = r.u32();
+    if ((version & 0xFF) != Envelope::WIRE_VERSION || (version >> 16) != 0) return std::nullopt;
+    v.version = Envelope::WIRE_VERSION;
+    v.session_id = r.bytes();
+    v.message_index = r.u32();
+    v.previous_counter = r.u32();
+    v.timestamp = r.u64();
+    v.sender_device_id = as_chars(r.bytes());
+    v.associated_data = r.bytes();
+    v.ciphertext = r.bytes();
+    v.signature = r.bytes();
+    v.aad = r.bytes();
+    if (!r.at_end()) return std::nullopt;
+    return v;
+}
+
+std::optional<EnvelopeView> parse_legacy(std::span<const uint8_t> bytes) {
+    Reader r(bytes);
+    EnvelopeView v;
+    v.version = Envelope::WIRE_VERSION_LEGACY;
+    v.session_id = r.bytes();
+    v.message_index = r.u32();
+    v.previous_counter = r.u32();
+    v.timestamp = r.u64();
+    v.sender_device_id = as_chars(r.bytes());
+    v.associated_data = r.bytes();
+    v.ciphertext = r.bytes();
+    if (!r.at_end()) return std::nullopt;
+    return v;
+}
 
-    // Associated data (for ratchet)
-    push_u32(out, static_cast<uint32_t>(associated_data.size()));
-    out.insert(out.end(), associated_data.begin(), associated_data.end());
+// Decoder-side connection state, or nullptr for a stateless parse. A frame that
+// parses yields the updates to apply; nothing changes for a rejected one.
+struct V2State {
+    uint64_t timestamp;
+    const std::deque<std::string>* senders;
+    size_t first_sender;    // index 0 of the dictionary; earlier entries predate a reset
+    size_t stored_bytes;    // of all entries, including those before first_sender
+};
 
-    // Ciphertext
-    push_u32(out, static_cast<uint32_t>(ciphertext.size()));
-    out.insert(out.end(), ciphertext.begin(), ciphertext.end());
+std::optional<EnvelopeView> parse_v2(std::span<const uint8_t> bytes, const V2State* state, uint8_t& flags) {
+    Reader r(bytes);
+    EnvelopeView v;
+    if (r.u8() != Envelope::WIRE_VERSION_V2) return std::nullopt;
+    v.version = Envelope::WIRE_VERSION_V2;
+    flags = r.u8();
+    if ((flags & ~FLAGS_KNOWN) || (flags & FLAG_SENDER_INDEX && flags & FLAG_SENDER_NEW)) return std::nullopt;
+    if ((flags & FLAG_CONNECTION_STATE) && !state) return std::nullopt;
+    v.session_id = r.varbytes();
+    v.message_index = r.varint32();
+    v.previous_counter = r.varint32();
+    const uint64_t timestamp = r.varint();
+    const bool reset = flags & FLAG_RESET;
+    const uint64_t base_timestamp = reset ? 0 : state ? state->timestamp : 0;
+    const size_t first_sender = reset ? state->senders->size() : state ? state->first_sender : 0;
+    v.timestamp = flags & FLAG_TIMESTAMP_DELTA ? base_timestamp + static_cast<uint64_t>(unzigzag(timestamp)) : timestamp;
+    if (flags & FLAG_SENDER_INDEX) {
+        const uint32_t index = r.varint32();
+        if (index >= state->senders->size() - first_sender) return std::nullopt;
+        v.sender_device_id = (*state->senders)[first_sender + index];
+    } else {
+        v.sender_device_id = as_chars(r.varbytes());
+        if (flags & FLAG_SENDER_NEW &&
+            (state->senders->size() - first_sender >= WireCodec::DICTIONARY_CAPACITY ||
+             state->stored_bytes + v.sender_device_id.size() + WireCodec::DICTIONARY_ENTRY_COST > WireCodec::DICTIONARY_STORAGE_BYTES)) {
+            return std::nullopt;
+        }
+    }
+    v.associated_data = r.varbytes();
+    v.ciphertext = r.varbytes();
+    if (flags & FLAG_TRAILER) {
+        v.signature = r.varbytes();
+        v.aad = r.varbytes();
+    }
+    if (!r.at_end()) return std::nullopt;
+    return v;
+}
 
-    // Signature (for backward compatibility)
-    push_u32(out, static_cast<uint32_t>(signature.size()));
-    out.insert(out.end(), signature.begin(), signature.end());
+} // namespace
 
-    // AAD (for backward compatibility - different from associated_data)
-    push_u32(out, static_cast<uint32_t>(aad.size()));
-    out.insert(out.end(), aad.begin(), aad.end());
+size_t Envelope::serialized_size() const {
+    return FIXED_BYTES + session_id.size() + sender_device_id.size() + associated_data.size() +
+           ciphertext.size() + signature.size() + aad.size();
+}
 
+std::vector<uint8_t> Envelope::serialize() const {
+    std::vector<uint8_t> out(serialized_size());
+    serialize_into(out);
     return out;
 }
 
+size_t Envelope::serialize_into(std::span<uint8_t> out) const {
+    const size_t n = serialized_size();
+    if (out.size() < n) throw std::runtime_error("Envelope: output buffer too small");
+    const size_t head = v1_head_size(*this);
+    write_v1_head(*this, out.data(), 0);
+    copy_bytes(out.data() + head, ciphertext);
+    write_v1_tail(*this, out.data() + head + ciphertext.size());
+    return n;
+}
+
 Envelope Envelope::deserialize(const std::vector<uint8_t>& input) {
+    auto env = try_deserialize(input);
+    if (!env) throw std::runtime_error("Envelope: malformed input");
+    return std::move(*env);
+}
+
+std::optional<Envelope> Envelope::try_deserialize(std::span<const uint8_t> input) {
+    auto view = EnvelopeView::parse(input);
+    if (!view) return std::nullopt;
+    return view->to_envelope();
+}
+
+std::optional<EnvelopeView> EnvelopeView::parse(std::span<const uint8_t> bytes) {
+    if (!bytes.empty() && bytes[0] == Envelope::WIRE_VERSION_V2) {
+        uint8_t flags;
+        return parse_v2(bytes, nullptr, flags);
+    }
+    // A legacy frame starts with its session id length, which is never 1 in
+    // practice; if it is, the version-1 parse fails the length check and the
+    // legacy parse still gets its turn
+    if (bytes.size() >= FIXED_BYTES) {
+        if (auto v = parse_v1(bytes)) return v;
+    }
+    if (bytes.size() >= LEGACY_FIXED_BYTES) return parse_legacy(bytes);
+    return std::nullopt;
+}
+
+std::optional<EnvelopeView::MessageId> EnvelopeView::peek_id(std::span<const uint8_t> bytes) {
+    MessageId id;
+    if (!bytes.empty() && bytes[0] == Envelope::WIRE_VERSION_V2) {
+        // Session id and index precede everything that needs connection state
+        if (bytes.size() < 2) return std::nullopt;
+        Reader r(bytes.subspan(2));
+        id.session_id = r.varbytes();
+        id.message_index = r.varint32();
+        if (!r.ok()) return std::nullopt;
+        return id;
+    }
+    if (auto v = parse(bytes)) return MessageId{v->session_id, v->message_index};
+
+    // Only the start of a frame (the head of a vectored send): read the leading
+    // fields, taking a version-1 marker at face value
+    if (bytes.size() < 4) return std::nullopt;
+    const uint32_t version = Reader(bytes).u32();
+    const bool v1 = (version & 0xFF) == Envelope::WIRE_VERSION && (version >> 16) == 0;
+    Reader r(v1 ? bytes.subspan(4) : bytes);
+    id.session_id = r.bytes();
+    id.message_index = r.u32();
+    if (!r.ok()) return std::nullopt;
+    return id;
+}
+
+EnvelopeView EnvelopeView::of(const Envelope& env) {
+    EnvelopeView v;
+    v.session_id = env.session_id;
+    v.message_index = env.message_index;
+    v.previous_counter = env.previous_counter;
+    v.timestamp = env.timestamp;
+    v.sender_device_id = env.sender_device_id;
+    v.associated_data = env.associated_data;
+    v.ciphertext = env.ciphertext;
+    v.signature = env.signature;
+    v.aad = env.aad;
+    return v;
+}
+
+Envelope EnvelopeView::to_envelope() const {
     Envelope env;
-    size_t offset = 0;
+    env.session_id.assign(session_id.begin(), session_id.end());
+    env.message_index = message_index;
+    env.previous_counter = previous_counter;
+    env.timestamp = timestamp;
+    env.sender_device_id.assign(sender_device_id);
+    env.associated_data.assign(associated_data.begin(), associated_data.end());
+    env.ciphertext.assign(ciphertext.begin(), ciphertext.end());
+    env.signature.assign(signature.begin(), signature.end());
+    env.aad.assign(aad.begin(), aad.end());
+    return env;
+}
 
-    env.version = read_u32(input, offset);
+WireCodec::Layout WireCodec::plan(const Envelope& env) {
+    Layout l;
+    if (peer_version() == Envelope::WIRE_VERSION_LEGACY) {
+        // Signature and aad have no place in this layout
+        l.legacy = true;
+        l.head = legacy_head_size(env);
+        return l;
+    }
+    if (peer_version() < Envelope::WIRE_VERSION_V2 || !advertised_.load(std::memory_order_relaxed)) {
+        advertised_.store(true, std::memory_order_relaxed);
+        l.head = v1_head_size(env);
+        l.tail = v1_tail_size(env);
+        return l;
+    }
 
-    // Session ID
-    uint32_t sid_len = read_u32(input, offset);
-    env.session_id.assign(input.begin() + offset, input.begin() + offset + sid_len);
-    offset += sid_len;
+    l.v2 = true;
+    l.timestamp = env.timestamp;
+    if (connection_state_) {
+        if (reset_pending_) {
+            l.flags |= FLAG_RESET;
+            reset_pending_ = false;
+        }
+        l.flags |= FLAG_TIMESTAMP_DELTA;
+        l.timestamp = zigzag(static_cast<int64_t>(env.timestamp - send_timestamp_));
+        auto it = send_senders_.find(env.sender_device_id);
+        if (it != send_senders_.end()) {
+            l.flags |= FLAG_SENDER_INDEX;
+            l.sender_index = it->second;
+        } else if (send_senders_.size() < DICTIONARY_CAPACITY &&
+                   sent_sender_bytes_ + env.sender_device_id.size() + DICTIONARY_ENTRY_COST <= DICTIONARY_STORAGE_BYTES) {
+            // Counted across resets like the peer does, so it never has to reject one
+            l.flags |= FLAG_SENDER_NEW;
+            send_senders_.emplace(env.sender_device_id, static_cast<uint32_t>(send_senders_.size()));
+            sent_sender_bytes_ += env.sender_device_id.size() + DICTIONARY_ENTRY_COST;
+        }
+    }
+    if (!env.signature.empty() || !env.aad.empty()) {
+        l.flags |= FLAG_TRAILER;
+        l.tail = varbytes_size(env.signature.size()) + varbytes_size(env.aad.size());
+    }
+    l.head = 2 + varbytes_size(env.session_id.size()) + varint_size(env.message_index) +
+             varint_size(env.previous_counter) + varint_size(l.timestamp) +
+             (l.flags & FLAG_SENDER_INDEX ? varint_size(l.sender_index) : varbytes_size(env.sender_device_id.size())) +
+             varbytes_size(env.associated_data.size()) + varint_size(env.ciphertext.size());
+    send_timestamp_ = env.timestamp;
+    return l;
+}
 
-    // Message indices
-    env.message_index = read_u32(input, offset);
-    env.previous_counter = read_u32(input, offset);
+void WireCodec::write(const Layout& l, const Envelope& env, uint8_t* head, uint8_t* tail) {
+    if (l.legacy) {
+        write_legacy_head(env, head);
+        return;
+    }
+    if (!l.v2) {
+        write_v1_head(env, head, Envelope::WIRE_VERSION_BATCH);
+        write_v1_tail(env, tail);
+        return;
+    }
 
-    // Timestamp
-    env.timestamp = 0;
-    for (int i = 0; i < 8; ++i) {
-        env.timestamp = (env.timestamp << 8) | input[offset++];
+    Writer w(head);
+    w.u8(Envelope::WIRE_VERSION_V2);
+    w.u8(l.flags);
+    w.varbytes(env.session_id.data(), env.session_id.size());
+    w.varint(env.message_index);
+    w.varint(env.previous_counter);
+    w.varint(l.timestamp);
+    if (l.flags & FLAG_SENDER_INDEX) {
+        w.varint(l.sender_index);
+    } else {
+        w.varbytes(env.sender_device_id.data(), env.sender_device_id.size());
+    }
+    w.varbytes(env.associated_data.data(), env.associated_data.size());
+    w.varint(env.ciphertext.size());
+    if (l.flags & FLAG_TRAILER) {
+        Writer t(tail);
+        t.varbytes(env.signature.data(), env.signature.size());
+        t.varbytes(env.aad.data(), env.aad.size());
     }
+}
+
+std::vector<uint8_t> WireCodec::encode(const Envelope& env) {
+    const Layout l = plan(env);
+    std::vector<uint8_t> out(l.head + env.ciphertext.size() + l.tail);
+    copy_bytes(out.data() + l.head, env.ciphertext);
+    write(l, env, out.data(), out.data() + l.head + env.ciphertext.size());
+    return out;
+}
 
-    // Sender device ID
-    uint32_t sender_len = read_u32(input, offset);
-    env.sender_device_id.assign(
-        reinterpret_cast<const char*>(input.data() + offset), 
-        sender_len
-    );
-    offset += sender_len;
+size_t WireCodec::encode_framing(const Envelope& env, std::vector<uint8_t>& framing) {
+    const Layout l = plan(env);
+    framing.resize(l.head + l.tail);
+    write(l, env, framing.data(), framing.data() + l.head);
+    return l.head;
+}
+
+void WireCodec::send_failed() {
+    advertised_.store(false, std::memory_order_relaxed);
+    send_timestamp_ = 0;
+    send_senders_.clear();
+    reset_pending_ = true;
+}
 
-    // Associated data
-    uint32_t ad_len = read_u32(input, offset);
-    env.associated_data.assign(input.begin() + offset, input.begin() + offset + ad_len);
-    offset += ad_len;
+std::optional<EnvelopeView> WireCodec::decode(std::span<const uint8_t> frame) {
+    if (frame.empty() || frame[0] != Envelope::WIRE_VERSION_V2) {
+        auto v = EnvelopeView::parse(frame);
+        if (v && v->version == Envelope::WIRE_VERSION && negotiation()) {
+            const uint32_t reads = std::min<uint32_t>(frame[2], Envelope::WIRE_VERSION_BATCH);
+            raise_peer_version(std::max(reads, Envelope::WIRE_VERSION));
+        }
+        return v;
+    }
 
-    // Ciphertext
-    uint32_t ct_len = read_u32(input, offset);
-    env.ciphertext.assign(input.begin() + offset, input.begin() + offset + ct_len);
-    offset += ct_len;
+    // Without connection state enabled here, frames that use it are rejected
+    const V2State state{recv_timestamp_, &recv_senders_, recv_first_sender_, recv_sender_bytes_};
+    uint8_t flags = 0;
+    auto v = parse_v2(frame, connection_state() ? &state : nullptr, flags);
+    if (!v) return std::nullopt;
+    // Earlier entries stay in the deque, since views may still point at them, and
+    // still count towards DICTIONARY_STORAGE_BYTES
+    if (flags & FLAG_RESET) recv_first_sender_ = recv_senders_.size();
+    recv_timestamp_ = v->timestamp;
+    if (flags & FLAG_SENDER_NEW) {
+        recv_senders_.emplace_back(v->sender_device_id);
+        recv_sender_bytes_ += v->sender_device_id.size() + DICTIONARY_ENTRY_COST;
+    }
+    if (negotiation()) raise_peer_version(Envelope::WIRE_VERSION_V2);
+    return v;
+}
 
-    // Signature
-    uint32_t sig_len = read_u32(input, offset);
-    env.signature.assign(input.begin() + offset, input.begin() + offset + sig_len);
-    offset += sig_len;
+size_t BatchFrame::write_header(uint8_t* out, uint32_t count) {
+    Writer w(out);
+    w.u8(Envelope::WIRE_VERSION_BATCH);
+    w.varint(count);
+    return 1 + varint_size(count);
+}
 
-    // AAD
-    uint32_t aad_len = read_u32(input, offset);
-    env.aad.assign(input.begin() + offset, input.begin() + offset + aad_len);
-    offset += aad_len;
+size_t BatchFrame::write_length(uint8_t* out, uint32_t length) {
+    Writer w(out);
+    w.varint(length);
+    return varint_size(length);
+}
 
-    return env;
+bool BatchFrame::unpack(const Bytes& batch, std::vector<Bytes>& out) {
+    Reader r(batch);
+    if (r.u8() != Envelope::WIRE_VERSION_BATCH) return false;
+    const uint32_t count = r.varint32();
+    if (!r.ok() || count < 2) return false;
+    const size_t first = out.size();
+    for (uint32_t i = 0; i < count; i++) {
+        const auto frame = r.varbytes();
+        if (!r.ok() || frame.empty()) {
+            out.resize(first);
+            return false;
+        }
+        out.push_back(batch.slice(static_cast<size_t>(frame.data() - batch.data()), frame.size()));
+    }
+    if (!r.at_end()) {
+        out.resize(first);
+        return false;
+    }
+    return true;
 }
 
 void Envelope::migrate_from_old_format() {
@@ -130,4 +570,4 @@ void Envelope::migrate_to_old_format() const {
     // This would create a new envelope with old structure
 }
 
-} // namespace securecomm
\ No newline at end of file
+} // namespace securecomm
@@ -0,0 +1,191 @@
+#include "securecomm/frame_batcher.hpp"
+#include "securecomm/envelope.hpp"
+#include "securecomm/log.hpp"
+
+#include <exception>
+
+namespace securecomm {
+
+FrameBatcher::FrameBatcher(size_t max_bytes, std::chrono::microseconds max_delay, SendFn send)
+    : max_bytes_(max_bytes), max_delay_(max_delay), send_(std::move(send)) {
+    timer_ = std::thread([this] { run_timer(); });
+}
+
+FrameBatcher::~FrameBatcher() {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stopping_ = true;
+    }
+    cond_.notify_all();
+    if (timer_.joinable()) timer_.join();
+    std::deque<Finished> finished;
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        const size_t pending = frames_.size();
+        if (auto error = flush_locked()) log_lost(pending, error);
+        finished.swap(finished_);
+    }
+    run_completions(finished);
+}
+
+void FrameBatcher::add(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner,
+                       Completion done) {
+    size_t size = 0;
+    for (const auto& part : parts) size += part.size();
+    if (size == 0) {
+        // Nothing to send, so nothing can fail
+        if (done) {
+            std::lock_guard<std::mutex> lk(mutex_);
+            finished_.push_back({{std::move(done)}, nullptr});
+            cond_.notify_one();
+        }
+        return;
+    }
+
+    std::shared_ptr<std::vector<uint8_t>> copy;
+    std::span<const uint8_t> copied;
+    if (!owner) {
+        copy = std::make_shared<std::vector<uint8_t>>();
+        copy->reserve(size);
+        for (const auto& part : parts) copy->insert(copy->end(), part.begin(), part.end());
+        copied = *copy;
+        parts = std::span<const std::span<const uint8_t>>(&copied, 1);
+        owner = std::move(copy);
+    }
+
+    std::unique_lock<std::mutex> lk(mutex_);
+    const bool was_empty = frames_.empty();
+    Frame frame{parts_.size(), 0, size};
+    for (const auto& part : parts) {
+        if (part.empty()) continue;
+        parts_.push_back(part);
+        frame.part_count++;
+    }
+    frames_.push_back(frame);
+    owners_.push_back(std::move(owner));
+    if (done) done_.push_back(std::move(done));
+    pending_bytes_ += size;
+    stats_.frames++;
+
+    if (pending_bytes_ >= max_bytes_) {
+        stats_.size_flushes++;
+        if (auto error = flush_locked()) std::rethrow_exception(error);
+    } else if (was_empty) {
+        deadline_ = std::chrono::steady_clock::now() + max_delay_;
+        // A timer still waiting on an earlier deadline picks this one up when it
+        // wakes, so only an idle one needs the (costly) wakeup. It comes after the
+        // lock is released so the timer does not block on it straight away.
+        if (timer_idle_) {
+            lk.unlock();
+            cond_.notify_one();
+        }
+    }
+}
+
+void FrameBatcher::flush() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (auto error = flush_locked()) std::rethrow_exception(error);
+}
+
+FrameBatcher::Stats FrameBatcher::stats() const {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return stats_;
+}
+
+std::exception_ptr FrameBatcher::flush_locked() {
+    if (frames_.empty()) return nullptr;
+    stats_.sends++;
+    std::exception_ptr error;
+    try {
+        if (frames_.size() == 1) {
+            // Alone it goes out as is, readable by a peer that knows nothing of batches
+            send_(parts_, std::move(owners_[0]));
+        } else {
+            send_batch_locked();
+        }
+    } catch (...) {
+        error = std::current_exception();
+        stats_.failed_sends++;
+    }
+
+    // The frames are dropped even if the send threw, rather than resent; their
+    // completions say which. The frame vectors keep their capacity for the next batch.
+    if (!done_.empty()) {
+        finished_.push_back({std::move(done_), error});
+        done_.clear();
+        cond_.notify_one();
+    }
+    frames_.clear();
+    parts_.clear();
+    owners_.clear();
+    batch_parts_.clear();
+    pending_bytes_ = 0;
+    return error;
+}
+
+void FrameBatcher::send_batch_locked() {
+    // The header and each length prefix are written into one buffer; each run of
+    // it that precedes a frame becomes one part
+    struct Batch {
+        std::vector<uint8_t> prefixes;
+        std::vector<std::shared_ptr<const void>> owners;
+    };
+    auto batch = std::make_shared<Batch>();
+    batch->prefixes.resize(BatchFrame::MAX_HEADER_BYTES + frames_.size() * BatchFrame::MAX_LENGTH_BYTES);
+    batch->owners.reserve(owners_.size());
+    for (auto& owner : owners_) batch->owners.push_back(std::move(owner));
+    batch_parts_.reserve(parts_.size() + frames_.size());
+    uint8_t* p = batch->prefixes.data();
+    const uint8_t* run = p;
+    p += BatchFrame::write_header(p, static_cast<uint32_t>(frames_.size()));
+    for (const Frame& f : frames_) {
+        p += BatchFrame::write_length(p, static_cast<uint32_t>(f.size));
+        batch_parts_.emplace_back(run, p);
+        run = p;
+        batch_parts_.insert(batch_parts_.end(), parts_.begin() + f.first_part, parts_.begin() + f.first_part + f.part_count);
+    }
+    send_(batch_parts_, std::move(batch));
+}
+
+void FrameBatcher::run_timer() {
+    std::unique_lock<std::mutex> lk(mutex_);
+    while (true) {
+        if (!finished_.empty()) {
+            std::deque<Finished> finished;
+            finished.swap(finished_);
+            lk.unlock();
+            run_completions(finished);
+            lk.lock();
+        } else if (stopping_) {
+            return;
+        } else if (frames_.empty()) {
+            timer_idle_ = true;
+            cond_.wait(lk);
+            timer_idle_ = false;
+        } else if (std::chrono::steady_clock::now() >= deadline_) {
+            stats_.timer_flushes++;
+            const size_t pending = frames_.size();
+            if (auto error = flush_locked()) log_lost(pending, error);
+        } else {
+            cond_.wait_until(lk, deadline_);
+        }
+    }
+}
+
+void FrameBatcher::log_lost(size_t frames, std::exception_ptr error) {
+    try {
+        std::rethrow_exception(error);
+    } catch (const std::exception& e) {
+        SC_LOG_WARN("FrameBatcher", "Send failed, " << frames << " frames lost: " << e.what());
+    } catch (...) {
+        SC_LOG_WARN("FrameBatcher", "Send failed, " << frames << " frames lost");
+    }
+}
+
+void FrameBatcher::run_completions(std::deque<Finished>& finished) {
+    for (Finished& f : finished) {
+        for (Completion& done : f.done) done(f.error);
+    }
+}
+
+} // namespace securecomm
@@ -1,5 +1,7 @@
 #include "securecomm/transport.hpp"
-#include <iostream>
+#include "securecomm/envelope.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
 #include <mutex>
 #include <queue>
 #include <thread>
@@ -7,6 +9,8 @@
 #include <atomic>
 #include <memory>
 #include <map>
+#include <cstring>
+#include <vector>
 
 namespace securecomm {
 
@@ -26,7 +30,7 @@ public:
     static void connect(InMemoryTransport* a, std::shared_ptr<InMemoryTransport> b) {
         std::lock_guard<std::mutex> lock(bridge_mutex);
         connections[a].peer = b;
-        std::cout << "TransportBridge: Connected " << a << " -> " << b.get() << std::endl;
+        SC_LOG_DEBUG("TransportBridge", "Connected " << a << " -> " << b.get());
     }
     
     static void disconnect(InMemoryTransport* a) {
@@ -51,89 +55,146 @@ std::mutex TransportBridge::bridge_mutex;
 class InMemoryTransport : public Transport {
 public:
     InMemoryTransport() : running_(false) {
-        std::cout << "InMemoryTransport constructor: " << this << std::endl;
+        SC_LOG_DEBUG("InMemoryTransport", "Constructor: " << this);
     }
     
     ~InMemoryTransport() override { 
-        std::cout << "InMemoryTransport destructor: " << this << std::endl;
+        SC_LOG_DEBUG("InMemoryTransport", "Destructor: " << this);
         stop();
         TransportBridge::disconnect(this);
     }
 
     void start() override {
-        std::cout << "InMemoryTransport::start() called for " << this << std::endl;
+        SC_LOG_DEBUG("InMemoryTransport", "start() called for " << this);
         
         bool expected = false;
         if (!running_.compare_exchange_strong(expected, true)) {
-            std::cout << "Transport " << this << " already started, skipping" << std::endl;
+            SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " already started, skipping");
             return;
         }
         
         worker_ = std::thread([this] {
-            std::cout << "Transport worker thread started for " << this << std::endl;
+            SC_LOG_DEBUG("InMemoryTransport", "Transport worker thread started for " << this);
             std::unique_lock<std::mutex> lk(mutex_);
             while (running_) {
                 cond_.wait(lk, [this]{ return !queue_.empty() || !running_; });
-                std::cout << "Transport " << this << " worker woke up, queue size: " << queue_.size() << std::endl;
+                SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " worker woke up, queue size: " << queue_.size());
+                if (on_message_batch_) {
+                    deliver_batch(lk);
+                    continue;
+                }
                 while (!queue_.empty()) {
-                    auto msg = queue_.front(); queue_.pop();
+                    auto msg = std::move(queue_.front()); queue_.pop();
                     lk.unlock();
                     if (on_message_) {
-                        std::cout << "Transport " << this << " calling on_message callback" << std::endl;
+                        SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " calling on_message callback");
+                        TraceScope trace("transport_deliver");
+                        if (trace.active()) {
+                            if (auto id = EnvelopeView::peek_id(msg)) trace.set_key(TraceKey::of(id->session_id, id->message_index));
+                        }
                         on_message_(msg);
                     } else {
-                        std::cout << "Transport " << this << " ERROR: on_message_ callback is null!" << std::endl;
+                        SC_LOG_WARN("InMemoryTransport", "Transport " << this << " has no on_message callback");
                     }
                     lk.lock();
                 }
             }
-            std::cout << "Transport worker thread exiting for " << this << std::endl;
+            SC_LOG_DEBUG("InMemoryTransport", "Transport worker thread exiting for " << this);
         });
-        std::cout << "InMemoryTransport::start() completed for " << this << std::endl;
+        SC_LOG_DEBUG("InMemoryTransport", "start() completed for " << this);
     }
 
     void stop() override {
-        std::cout << "InMemoryTransport::stop() for " << this << std::endl;
+        SC_LOG_DEBUG("InMemoryTransport", "stop() for " << this);
         running_ = false;
         cond_.notify_all();
         if (worker_.joinable()) {
             worker_.join();
-            std::cout << "Transport worker joined for " << this << std::endl;
+            SC_LOG_DEBUG("InMemoryTransport", "Transport worker joined for " << this);
         }
     }
 
     void send(const std::vector<uint8_t>& bytes) override {
-        std::cout << "Transport " << this << " sending " << bytes.size() << " bytes" << std::endl;
-        
-        auto peer = TransportBridge::get_peer(this);
-        if (peer) {
-            std::cout << "Transport " << this << " delivering to peer " << peer.get() << std::endl;
-            peer->deliver(bytes);
-        } else {
-            std::cout << "Transport " << this << " has NO peer! Delivering to self." << std::endl;
-            deliver(bytes);  // Fallback: deliver to self
+        SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " sending " << bytes.size() << " bytes");
+        deliver_to_peer(Bytes::copy(bytes));
+    }
+
+    // The receiving side gets one contiguous buffer, so the parts are gathered
+    // straight into it: the only copy the frame sees on its way to the peer's
+    // dispatcher, which keeps that same buffer
+    void send_iov(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void>) override {
+        size_t size = 0;
+        for (const auto& part : parts) size += part.size();
+        BytesBuilder frame(size);
+        size_t offset = 0;
+        for (const auto& part : parts) {
+            if (!part.empty()) std::memcpy(frame.data() + offset, part.data(), part.size());
+            offset += part.size();
         }
+        deliver_to_peer(std::move(frame).freeze());
     }
     
-    void deliver(const std::vector<uint8_t>& bytes) {
-        std::cout << "Transport " << this << " delivering " << bytes.size() << " bytes to own queue" << std::endl;
+    void deliver(Bytes bytes) {
+        SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " delivering " << bytes.size() << " bytes to own queue");
         {
             std::lock_guard<std::mutex> lk(mutex_);
-            queue_.push(bytes);
+            queue_.push(std::move(bytes));
         }
         cond_.notify_one();
     }
 
     void set_on_message(OnMessageCb cb) override { 
-        std::cout << "Transport " << this << " setting on_message callback" << std::endl;
-        on_message_ = cb; 
+        SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " setting on_message callback");
+        std::lock_guard<std::mutex> lk(mutex_);
+        on_message_ = cb;
+        on_message_batch_ = nullptr;
+    }
+
+    void set_on_message_batch(OnMessageBatchCb cb) override {
+        std::lock_guard<std::mutex> lk(mutex_);
+        on_message_batch_ = std::move(cb);
+        on_message_ = nullptr;
     }
 
 private:
+    // Up to MAX_RECEIVE_BATCH queued frames in one callback; called with `lk` held
+    // and returns with it held
+    static constexpr size_t MAX_RECEIVE_BATCH = 256;
+    void deliver_batch(std::unique_lock<std::mutex>& lk) {
+        if (queue_.empty()) return;
+        while (!queue_.empty() && batch_.size() < MAX_RECEIVE_BATCH) {
+            batch_.push_back(std::move(queue_.front()));
+            queue_.pop();
+        }
+        auto cb = on_message_batch_;
+        lk.unlock();
+        if (tracing_enabled()) {
+            for (const Bytes& msg : batch_) {
+                if (auto id = EnvelopeView::peek_id(msg)) trace_instant("transport_deliver", TraceKey::of(id->session_id, id->message_index));
+            }
+        }
+        cb(batch_);
+        batch_.clear();
+        lk.lock();
+    }
+
+    void deliver_to_peer(Bytes bytes) {
+        auto peer = TransportBridge::get_peer(this);
+        if (peer) {
+            SC_LOG_DEBUG("InMemoryTransport", "Transport " << this << " delivering to peer " << peer.get());
+            peer->deliver(std::move(bytes));
+        } else {
+            SC_LOG_WARN("InMemoryTransport", "Transport " << this << " has no peer; delivering to self");
+            deliver(std::move(bytes));  // Fallback: deliver to self
+        }
+    }
+
     std::mutex mutex_;
     std::condition_variable cond_;
-    std::queue<std::vector<uint8_t>> queue_;
+    std::queue<Bytes> queue_;
     OnMessageCb on_message_;
+    OnMessageBatchCb on_message_batch_;
+    std::vector<Bytes> batch_;    // worker thread only; reused across batches
     std::thread worker_;
     std::atomic<bool> running_;
 };
@@ -156,8 +217,8 @@ namespace {
         securecomm::TransportBridge::connect(transportA.get(), transportB);
         securecomm::TransportBridge::connect(transportB.get(), transportA);
         
-        std::cout << "Created connected transport pair: A=" << transportA.get() 
-                  << " <-> B=" << transportB.get() << std::endl;
+        SC_LOG_DEBUG("InMemoryTransport", "Created connected transport pair: A=" << transportA.get() 
+                  << " <-> B=" << transportB.get());
         
         global_transport_pair = {transportA, transportB};
     }
@@ -0,0 +1,200 @@
+#include "securecomm/log.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace securecomm {
+
+namespace detail {
+std::atomic<uint8_t> g_log_level{static_cast<uint8_t>(LogLevel::Info)};
+}
+
+namespace {
+
+constexpr size_t RING_SLOTS = 4096;    // power of two
+constexpr auto DRAIN_INTERVAL = std::chrono::milliseconds(5);
+
+void default_sink(const LogRecord& r) {
+    FILE* out = r.level >= LogLevel::Warn ? stderr : stdout;
+    fprintf(out, "[%s] %.*s\n", r.component, static_cast<int>(r.length), r.text);
+}
+
+// Bounded MPSC ring after Vyukov: each slot's sequence number says whether it is
+// free for the producer at that position or filled for the consumer.
+class LogRing {
+public:
+    LogRing() {
+        for (size_t i = 0; i < RING_SLOTS; i++) slots_[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(const LogRecord& r) {
+        uint64_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& s = slots_[pos & (RING_SLOTS - 1)];
+            const uint64_t seq = s.seq.load(std::memory_order_acquire);
+            const int64_t diff = static_cast<int64_t>(seq) - static_cast<int64_t>(pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    s.record = r;
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;    // full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Single consumer
+    bool pop(LogRecord& out) {
+        Slot& s = slots_[head_ & (RING_SLOTS - 1)];
+        if (s.seq.load(std::memory_order_acquire) != head_ + 1) return false;
+        out = s.record;
+        s.seq.store(head_ + RING_SLOTS, std::memory_order_release);
+        head_++;
+        return true;
+    }
+
+    uint64_t claimed() const { return tail_.load(std::memory_order_acquire); }
+
+private:
+    struct Slot {
+        std::atomic<uint64_t> seq;
+        LogRecord record;
+    };
+    Slot slots_[RING_SLOTS];
+    alignas(64) std::atomic<uint64_t> tail_{0};
+    alignas(64) uint64_t head_ = 0;
+};
+
+class Logger {
+public:
+    // Never destroyed, so objects that log from their static destructors stay safe;
+    // whatever is still queued is flushed at exit instead
+    static Logger& instance() {
+        static Logger* logger = [] {
+            auto* l = new Logger;
+            std::atexit([] { Logger::instance().flush(); });
+            return l;
+        }();
+        return *logger;
+    }
+
+    void write(const LogRecord& r) {
+        if (!ring_->push(r)) dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void set_sink(LogSink sink) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        sink_ = std::move(sink);
+    }
+
+    void flush() {
+        const uint64_t target = ring_->claimed();
+        std::unique_lock<std::mutex> lk(mutex_);
+        wake_.notify_one();
+        drained_.wait(lk, [&] { return consumed_ >= target; });
+    }
+
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+private:
+    Logger() : ring_(std::make_unique<LogRing>()), thread_([this] { run(); }) {}
+
+    void run() {
+        std::unique_lock<std::mutex> lk(mutex_);
+        LogRecord r;
+        uint64_t reported_drops = 0;
+        for (;;) {
+            // The sink runs under mutex_ so set_sink() never races a write
+            bool wrote = false;
+            while (ring_->pop(r)) {
+                sink_ ? sink_(r) : default_sink(r);
+                consumed_++;
+                wrote = true;
+            }
+            const uint64_t drops = dropped();
+            if (drops != reported_drops) {
+                fprintf(stderr, "[log] %llu messages dropped\n",
+                        static_cast<unsigned long long>(drops - reported_drops));
+                reported_drops = drops;
+            }
+            if (wrote && !sink_) fflush(stdout);
+            drained_.notify_all();
+            wake_.wait_for(lk, DRAIN_INTERVAL);
+        }
+    }
+
+    std::unique_ptr<LogRing> ring_;
+    std::atomic<uint64_t> dropped_{0};
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    std::condition_variable drained_;
+    LogSink sink_;
+    uint64_t consumed_ = 0;
+    std::thread thread_;    // last: started once everything above exists
+};
+
+} // namespace
+
+const char* log_level_name(LogLevel level) {
+    switch (level) {
+        case LogLevel::Trace: return "trace";
+        case LogLevel::Debug: return "debug";
+        case LogLevel::Info:  return "info";
+        case LogLevel::Warn:  return "warn";
+        case LogLevel::Error: return "error";
+        case LogLevel::Off:   return "off";
+    }
+    return "?";
+}
+
+void set_log_level(LogLevel level) {
+    detail::g_log_level.store(static_cast<uint8_t>(level), std::memory_order_relaxed);
+}
+
+LogLevel log_level() {
+    return static_cast<LogLevel>(detail::g_log_level.load(std::memory_order_relaxed));
+}
+
+void set_log_sink(LogSink sink) { Logger::instance().set_sink(std::move(sink)); }
+void flush_log() { Logger::instance().flush(); }
+uint64_t log_dropped() { return Logger::instance().dropped(); }
+
+LogLine::LogLine(LogLevel level, const char* component) {
+    record_.timestamp_us = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+                               std::chrono::system_clock::now().time_since_epoch()).count());
+    record_.thread = static_cast<uint32_t>(std::hash<std::thread::id>{}(std::this_thread::get_id()));
+    record_.level = level;
+    record_.component = component;
+    record_.length = 0;
+}
+
+LogLine& LogLine::operator<<(const void* p) {
+    char buf[2 + 16];
+    buf[0] = '0';
+    buf[1] = 'x';
+    auto res = std::to_chars(buf + 2, buf + sizeof(buf), reinterpret_cast<uintptr_t>(p), 16);
+    append(buf, static_cast<size_t>(res.ptr - buf));
+    return *this;
+}
+
+LogLine& LogLine::operator<<(double v) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    append(buf, static_cast<size_t>(res.ptr - buf));
+    return *this;
+}
+
+void LogLine::submit() {
+    Logger::instance().write(record_);
+}
+
+} // namespace securecomm
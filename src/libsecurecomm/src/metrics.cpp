@@ -0,0 +1,216 @@
+#include "securecomm/metrics.hpp"
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cmath>
+#include <unordered_map>
+
+namespace securecomm {
+
+namespace {
+
+std::atomic<uint64_t> g_next_registry_id{1};
+
+// Prometheus `le` bounds: powers of two from 256 ns to ~17 s. They fall on
+// histogram bucket edges, so the cumulative counts are exact.
+constexpr unsigned PROM_MIN_EXPONENT = 8;
+constexpr unsigned PROM_MAX_EXPONENT = 34;
+
+void append_double(std::string& out, double v) {
+    char buf[32];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+void append_uint(std::string& out, uint64_t v) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+void append_header(std::string& out, const std::string& name, const std::string& help, const char* type) {
+    out += "# HELP " + name + " " + help + "\n";
+    out += "# TYPE " + name + " " + type + "\n";
+}
+
+} // namespace
+
+const char* stage_name(Stage stage) {
+    switch (stage) {
+        case Stage::Encrypt:       return "encrypt";
+        case Stage::Serialize:     return "serialize";
+        case Stage::QueueWait:     return "queue_wait";
+        case Stage::TransportSend: return "transport_send";
+        case Stage::Deserialize:   return "deserialize";
+        case Stage::SessionLookup: return "session_lookup";
+        case Stage::Decrypt:       return "decrypt";
+        case Stage::Callback:      return "callback";
+        case Stage::Count:         break;
+    }
+    return "?";
+}
+
+size_t LatencyHistogram::bucket_for(uint64_t ns) {
+    if (ns < SUB_BUCKETS) return static_cast<size_t>(ns);
+    const unsigned e = 63 - static_cast<unsigned>(std::countl_zero(ns));
+    if (e > MAX_EXPONENT) return BUCKETS - 1;
+    return (e - SUB_BITS + 1) * SUB_BUCKETS + ((ns >> (e - SUB_BITS)) - SUB_BUCKETS);
+}
+
+uint64_t LatencyHistogram::bucket_lower(size_t i) {
+    if (i < SUB_BUCKETS) return i;
+    const size_t block = i / SUB_BUCKETS;
+    return (SUB_BUCKETS + i % SUB_BUCKETS) << (block - 1);
+}
+
+uint64_t LatencyHistogram::bucket_upper(size_t i) {
+    if (i < SUB_BUCKETS) return i + 1;
+    return bucket_lower(i) + (uint64_t(1) << (i / SUB_BUCKETS - 1));
+}
+
+uint64_t MetricsSnapshot::Histogram::percentile_ns(double q) const {
+    if (count == 0) return 0;
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * double(count))));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); i++) {
+        seen += buckets[i];
+        if (seen >= rank) return std::min(LatencyHistogram::bucket_upper(i) - 1, max_ns);
+    }
+    return max_ns;
+}
+
+const MetricsSnapshot::Value* MetricsSnapshot::value(std::string_view name) const {
+    for (const auto& v : values) {
+        if (v.name == name) return &v;
+    }
+    return nullptr;
+}
+
+std::string MetricsSnapshot::to_prometheus() const {
+    std::string out;
+    const std::string name = "securecomm_stage_duration_seconds";
+    append_header(out, name, "Time spent per message in each stage of the dispatcher message path.", "histogram");
+    for (const auto& h : stages) {
+        const std::string label = std::string("stage=\"") + stage_name(h.stage) + "\"";
+        uint64_t cumulative = 0;
+        size_t i = 0;
+        for (unsigned e = PROM_MIN_EXPONENT; e <= PROM_MAX_EXPONENT; e++) {
+            const uint64_t bound = uint64_t(1) << e;
+            for (; i < h.buckets.size() && LatencyHistogram::bucket_upper(i) <= bound; i++) cumulative += h.buckets[i];
+            out += name + "_bucket{" + label + ",le=\"";
+            append_double(out, double(bound) * 1e-9);
+            out += "\"} ";
+            append_uint(out, cumulative);
+            out += "\n";
+        }
+        out += name + "_bucket{" + label + ",le=\"+Inf\"} ";
+        append_uint(out, h.count);
+        out += "\n" + name + "_sum{" + label + "} ";
+        append_double(out, double(h.sum_ns) * 1e-9);
+        out += "\n" + name + "_count{" + label + "} ";
+        append_uint(out, h.count);
+        out += "\n";
+    }
+    for (const auto& v : values) {
+        append_header(out, v.name, v.help, v.counter ? "counter" : "gauge");
+        out += v.name + " ";
+        append_double(out, v.value);
+        out += "\n";
+    }
+    return out;
+}
+
+MetricsRegistry::MetricsRegistry() : id_(g_next_registry_id.fetch_add(1, std::memory_order_relaxed)) {}
+
+MetricsRegistry::~MetricsRegistry() = default;
+
+MetricsRegistry::ThreadBlock& MetricsRegistry::local() {
+    // One-entry cache in front of a per-thread map, so the common case of one
+    // dispatcher per thread costs a compare
+    thread_local uint64_t cached_id = 0;
+    thread_local ThreadBlock* cached = nullptr;
+    if (cached_id == id_) return *cached;
+
+    thread_local std::unordered_map<uint64_t, ThreadBlock*> blocks;
+    ThreadBlock*& block = blocks[id_];
+    if (!block) block = &register_thread();
+    cached_id = id_;
+    cached = block;
+    return *block;
+}
+
+MetricsRegistry::ThreadBlock& MetricsRegistry::register_thread() {
+    auto block = std::make_unique<ThreadBlock>();
+    ThreadBlock& ref = *block;
+    std::lock_guard<std::mutex> lk(threads_mutex_);
+    threads_.push_back(std::move(block));
+    return ref;
+}
+
+std::atomic<uint64_t>& MetricsRegistry::counter(const std::string& name, const std::string& help) {
+    std::lock_guard<std::mutex> lk(values_mutex_);
+    for (auto& c : counters_) {
+        if (c.name == name) return c.value;
+    }
+    auto& c = counters_.emplace_back();
+    c.name = name;
+    c.help = help;
+    return c.value;
+}
+
+void MetricsRegistry::set_gauge(const std::string& name, const std::string& help, std::function<double()> read) {
+    std::lock_guard<std::mutex> lk(values_mutex_);
+    for (auto& g : gauges_) {
+        if (g.name == name) {
+            g.help = help;
+            g.read = std::move(read);
+            return;
+        }
+    }
+    gauges_.push_back(Gauge{name, help, std::move(read)});
+}
+
+void MetricsRegistry::remove_gauge(const std::string& name) {
+    std::lock_guard<std::mutex> lk(values_mutex_);
+    gauges_.erase(std::remove_if(gauges_.begin(), gauges_.end(),
+                                 [&](const Gauge& g) { return g.name == name; }),
+                  gauges_.end());
+}
+
+MetricsSnapshot MetricsRegistry::snapshot() const {
+    MetricsSnapshot snap;
+    for (size_t s = 0; s < STAGE_COUNT; s++) {
+        snap.stages[s].stage = static_cast<Stage>(s);
+        snap.stages[s].buckets.assign(LatencyHistogram::BUCKETS, 0);
+    }
+    {
+        std::lock_guard<std::mutex> lk(threads_mutex_);
+        for (const auto& block : threads_) {
+            for (size_t s = 0; s < STAGE_COUNT; s++) {
+                const LatencyHistogram& h = block->stages[s];
+                MetricsSnapshot::Histogram& out = snap.stages[s];
+                // count is summed from the buckets so the two always agree
+                for (size_t i = 0; i < LatencyHistogram::BUCKETS; i++) {
+                    const uint64_t n = h.buckets_[i].load(std::memory_order_relaxed);
+                    out.buckets[i] += n;
+                    out.count += n;
+                }
+                out.sum_ns += h.sum_.load(std::memory_order_relaxed);
+                out.max_ns = std::max(out.max_ns, h.max_.load(std::memory_order_relaxed));
+            }
+        }
+    }
+    // Gauges call out to their owners, so only values_mutex_ is held here; the
+    // recording path never takes it
+    std::lock_guard<std::mutex> lk(values_mutex_);
+    for (const auto& c : counters_) {
+        snap.values.push_back({c.name, c.help, double(c.value.load(std::memory_order_relaxed)), true});
+    }
+    for (const auto& g : gauges_) {
+        snap.values.push_back({g.name, g.help, g.read ? g.read() : 0.0, false});
+    }
+    return snap;
+}
+
+} // namespace securecomm
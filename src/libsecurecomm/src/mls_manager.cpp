@@ -1,4 +1,6 @@
 #include "securecomm/mls_manager.hpp"
+#include "securecomm/random.hpp"
+#include "securecomm/aead_batch.hpp"
 #include <sodium.h>
 #include <stdexcept>
 #include <chrono>
@@ -12,37 +14,48 @@ MLSManager::MLSManager() {
 
 MLSManager::~MLSManager() = default;
 
-std::vector<uint8_t> MLSManager::random_bytes(size_t n) const {
-    std::vector<uint8_t> out(n);
-    randombytes_buf(out.data(), out.size());
-    return out;
+void MLSManager::set_nonce_mode(AEAD::NonceMode mode) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    nonce_mode_ = mode;
+}
+
+void MLSManager::set_cipher_suite(CipherSuite suite) {
+    if (!cipher_suite_available(suite)) throw std::runtime_error("cipher suite not available on this host");
+    std::lock_guard<std::mutex> lk(mutex_);
+    suite_ = suite;
 }
 
 std::vector<uint8_t> MLSManager::create_group(const std::string& group_name) {
     std::vector<uint8_t> gid(16);
-    randombytes_buf(gid.data(), gid.size());
+    random_bytes(gid.data(), gid.size());
     Group g;
     g.id = gid;
     g.epoch = 1;
     g.leaf_secrets.clear();
-    g.epoch_secret = derive_epoch_secret(g);
+    g.epoch_secret.assign(derive_epoch_secret(g));
+    reset_send_counter(g);
+    std::lock_guard<std::mutex> lk(mutex_);
     groups_.emplace(gid, std::move(g));
     return gid;
 }
 
 void MLSManager::add_member(const std::vector<uint8_t>& group_id, const std::string& member_id) {
+    std::lock_guard<std::mutex> lk(mutex_);
     auto it = groups_.find(group_id);
     if (it == groups_.end()) throw std::runtime_error("group not found");
     Group& g = it->second;
-    std::vector<uint8_t> leaf = random_bytes(32);
-    g.leaf_secrets.push_back(leaf);
+    LockedKey32 leaf;
+    random_bytes(leaf.data(), leaf.size());
+    g.leaf_secrets.push_back(std::move(leaf));
     size_t idx = g.leaf_secrets.size() - 1;
     g.member_index.emplace(member_id, idx);
     g.epoch++;
-    g.epoch_secret = derive_epoch_secret(g);
+    g.epoch_secret.assign(derive_epoch_secret(g));
+    reset_send_counter(g);
 }
 
 void MLSManager::remove_member(const std::vector<uint8_t>& group_id, const std::string& member_id) {
+    std::lock_guard<std::mutex> lk(mutex_);
     auto it = groups_.find(group_id);
     if (it == groups_.end()) throw std::runtime_error("group not found");
     Group& g = it->second;
@@ -55,50 +68,46 @@ void MLSManager::remove_member(const std::vector<uint8_t>& group_id, const std::
         if (p.second > idx) p.second--;
     }
     g.epoch++;
-    g.epoch_secret = derive_epoch_secret(g);
+    g.epoch_secret.assign(derive_epoch_secret(g));
+    reset_send_counter(g);
 }
 
-std::vector<uint8_t> MLSManager::derive_epoch_secret(const Group& g) const {
-    size_t n = g.leaf_secrets.size();
-    std::vector<uint8_t> concat;
-    concat.reserve(n * 32);
-    for (const auto& s : g.leaf_secrets) concat.insert(concat.end(), s.begin(), s.end());
-    if (concat.empty()) {
-        std::vector<uint8_t> z(32, 0);
-        return z;
-    }
-    std::vector<uint8_t> prk(32);
-    crypto_generichash(prk.data(), prk.size(), concat.data(), concat.size(), nullptr, 0);
+SecretKey32 MLSManager::derive_epoch_secret(const Group& g) const {
+    SecretKey32 prk;
+    if (g.leaf_secrets.empty()) return prk;
+    // Hash the leaves incrementally; same digest as hashing their concatenation
+    crypto_generichash_state st;
+    crypto_generichash_init(&st, nullptr, 0, prk.size());
+    for (const auto& s : g.leaf_secrets) crypto_generichash_update(&st, s.data(), s.size());
+    crypto_generichash_final(&st, prk.data(), prk.size());
+    sodium_memzero(&st, sizeof(st));
     return prk;
 }
 
-std::vector<uint8_t> MLSManager::derive_epoch_key(const std::vector<uint8_t>& epoch_secret,
-                                                  const std::vector<uint8_t>& group_id,
-                                                  uint64_t epoch) const {
-    std::vector<uint8_t> info;
-    info.insert(info.end(), group_id.begin(), group_id.end());
-    info.push_back(static_cast<uint8_t>((epoch >> 56) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch >> 48) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch >> 40) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch >> 32) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch >> 24) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch >> 16) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch >> 8) & 0xFF));
-    info.push_back(static_cast<uint8_t>((epoch) & 0xFF));
-    std::vector<uint8_t> key(32);
-    crypto_generichash(key.data(), key.size(), info.data(), info.size(), epoch_secret.data(), epoch_secret.size());
+SecretKey32 MLSManager::derive_epoch_key(const LockedKey32& epoch_secret,
+                                         const std::vector<uint8_t>& group_id,
+                                         uint64_t epoch) const {
+    uint8_t epoch_be[8];
+    for (int i = 0; i < 8; i++) epoch_be[i] = static_cast<uint8_t>((epoch >> (56 - 8 * i)) & 0xFF);
+    // keyed hash of group_id || BE64(epoch)
+    SecretKey32 key;
+    crypto_generichash_state st;
+    crypto_generichash_init(&st, epoch_secret.data(), epoch_secret.size(), key.size());
+    crypto_generichash_update(&st, group_id.data(), group_id.size());
+    crypto_generichash_update(&st, epoch_be, sizeof(epoch_be));
+    crypto_generichash_final(&st, key.data(), key.size());
+    sodium_memzero(&st, sizeof(st));
     return key;
 }
 
-Envelope MLSManager::encrypt_group_message(const std::vector<uint8_t>& group_id,
-                                           const std::string& sender_id,
-                                           const std::vector<uint8_t>& plaintext) {
-    auto git = groups_.find(group_id);
-    if (git == groups_.end()) throw std::runtime_error("group not found");
-    Group& g = git->second;
-    std::vector<uint8_t> key = derive_epoch_key(g.epoch_secret, g.id, g.epoch);
-    aead_.set_key(key);
+void MLSManager::reset_send_counter(Group& g) const {
+    g.send_counter = 0;
+    random_bytes(g.nonce_salt.data(), g.nonce_salt.size());
+}
+
+std::vector<uint8_t> MLSManager::group_aad(const Group& g) const {
     std::vector<uint8_t> aad;
+    aad.reserve(g.id.size() + 8 + 1 + AEAD::SALT_BYTES);
     aad.insert(aad.end(), g.id.begin(), g.id.end());
     aad.push_back(static_cast<uint8_t>((g.epoch >> 56) & 0xFF));
     aad.push_back(static_cast<uint8_t>((g.epoch >> 48) & 0xFF));
@@ -108,40 +117,204 @@ Envelope MLSManager::encrypt_group_message(const std::vector<uint8_t>& group_id,
     aad.push_back(static_cast<uint8_t>((g.epoch >> 16) & 0xFF));
     aad.push_back(static_cast<uint8_t>((g.epoch >> 8) & 0xFF));
     aad.push_back(static_cast<uint8_t>((g.epoch) & 0xFF));
-    auto ct = aead_.encrypt(plaintext, aad);
+    if (nonce_mode_ == AEAD::NonceMode::Counter || suite_ != CipherSuite::ChaCha20Poly1305) {
+        uint8_t flags = static_cast<uint8_t>(static_cast<uint8_t>(suite_) << AAD_SUITE_SHIFT);
+        if (nonce_mode_ == AEAD::NonceMode::Counter) flags |= AAD_FLAG_COUNTER_NONCE;
+        aad.push_back(flags);
+        if (nonce_mode_ == AEAD::NonceMode::Counter) aad.insert(aad.end(), g.nonce_salt.begin(), g.nonce_salt.end());
+    }
+    return aad;
+}
+
+bool MLSManager::parse_group_aad(const Group& g, std::span<const uint8_t> aad,
+                                 uint8_t& flags, std::span<const uint8_t>& salt) {
+    const size_t base = g.id.size() + 8;
+    flags = aad.size() > base ? aad[base] : 0;
+    salt = {};
+    if (flags & AAD_FLAG_COUNTER_NONCE) {
+        if (aad.size() != base + 1 + AEAD::SALT_BYTES) return false;
+        salt = aad.subspan(base + 1);
+        return true;
+    }
+    return aad.size() == base || aad.size() == base + 1;
+}
+
+// Envelope metadata for the next outgoing message; consumes a counter in counter mode
+Envelope MLSManager::group_envelope(Group& g, const std::string& sender_id) const {
     Envelope env;
+    if (nonce_mode_ == AEAD::NonceMode::Counter) {
+        if (g.send_counter == UINT32_MAX) throw std::runtime_error("group epoch exhausted");
+        env.message_index = g.send_counter++;
+    } else {
+        env.message_index = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count() & 0xffffffff);
+    }
     env.session_id = g.id;
-    env.message_index = static_cast<uint32_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
-                        std::chrono::system_clock::now().time_since_epoch()).count() & 0xffffffff);
     env.timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
                         std::chrono::system_clock::now().time_since_epoch()).count());
     env.sender_device_id = sender_id;
-    env.associated_data = aad;
-    env.ciphertext = ct;
+    return env;
+}
+
+Envelope MLSManager::encrypt_group_message(const std::vector<uint8_t>& group_id,
+                                           const std::string& sender_id,
+                                           const std::vector<uint8_t>& plaintext) {
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto git = groups_.find(group_id);
+    if (git == groups_.end()) throw std::runtime_error("group not found");
+    Group& g = git->second;
+    SecretKey32 key = derive_epoch_key(g.epoch_secret, g.id, g.epoch);
+    aead_.set_key(key);
+    aead_.set_suite(suite_);
+    Envelope env = group_envelope(g, sender_id);
+    env.associated_data = group_aad(g);
+    if (nonce_mode_ == AEAD::NonceMode::Counter) {
+        env.ciphertext.resize(aead_.ciphertext_size(plaintext.size(), AEAD::NonceMode::Counter));
+        aead_.encrypt_into(plaintext, env.associated_data, env.ciphertext, env.message_index, g.nonce_salt);
+    } else {
+        env.ciphertext.resize(aead_.ciphertext_size(plaintext.size()));
+        aead_.encrypt_into(plaintext, env.associated_data, env.ciphertext);
+    }
     return env;
 }
 
 std::optional<std::vector<uint8_t>> MLSManager::decrypt_group_message(const std::vector<uint8_t>& group_id,
                                                                       const std::string& member_id,
                                                                       const Envelope& env) {
+    std::lock_guard<std::mutex> lk(mutex_);
     auto git = groups_.find(group_id);
     if (git == groups_.end()) return std::nullopt;
     const Group& g = git->second;
     if (env.session_id != g.id) return std::nullopt;
     uint64_t epoch = g.epoch;
-    std::vector<uint8_t> key = derive_epoch_key(g.epoch_secret, g.id, epoch);
+    SecretKey32 key = derive_epoch_key(g.epoch_secret, g.id, epoch);
     aead_.set_key(key);
-    auto pt = aead_.decrypt(env.ciphertext, env.associated_data);
-    return pt;
+    const auto& aad = env.associated_data;
+    uint8_t flags;
+    std::span<const uint8_t> salt;
+    if (!parse_group_aad(g, aad, flags, salt)) return std::nullopt;
+    const bool counter_nonce = (flags & AAD_FLAG_COUNTER_NONCE) != 0;
+    const AEAD::NonceMode mode = counter_nonce ? AEAD::NonceMode::Counter : AEAD::NonceMode::Random;
+    const auto suite = static_cast<CipherSuite>(flags >> AAD_SUITE_SHIFT);
+    if (!cipher_suite_available(suite)) return std::nullopt;
+    aead_.set_suite(suite);
+    std::vector<uint8_t> plaintext(aead_.plaintext_size(env.ciphertext.size(), mode));
+    auto plen = counter_nonce
+        ? aead_.decrypt_into(env.ciphertext, aad, plaintext, env.message_index, salt)
+        : aead_.decrypt_into(env.ciphertext, aad, plaintext);
+    if (!plen.has_value()) return std::nullopt;
+    plaintext.resize(*plen);
+    return plaintext;
+}
+
+std::vector<Envelope> MLSManager::encrypt_group_messages(const std::vector<uint8_t>& group_id,
+                                                         const std::string& sender_id,
+                                                         const std::vector<std::vector<uint8_t>>& plaintexts,
+                                                         WorkerPool* pool) {
+    std::unique_lock<std::mutex> lk(mutex_);
+    auto git = groups_.find(group_id);
+    if (git == groups_.end()) throw std::runtime_error("group not found");
+    Group& g = git->second;
+    if (nonce_mode_ == AEAD::NonceMode::Counter && UINT32_MAX - g.send_counter < plaintexts.size()) {
+        throw std::runtime_error("group epoch exhausted");
+    }
+    SecretKey32 key = derive_epoch_key(g.epoch_secret, g.id, g.epoch);
+    const std::vector<uint8_t> aad = group_aad(g);
+    const size_t nonce_len = aead_backend(suite_)->nonce_bytes();
+    std::vector<uint8_t> nonces(nonce_mode_ == AEAD::NonceMode::Counter ? plaintexts.size() * nonce_len : 0);
+
+    std::vector<Envelope> envs;
+    envs.reserve(plaintexts.size());
+    AEADBatch batch;
+    batch.reserve(plaintexts.size());
+    for (size_t i = 0; i < plaintexts.size(); i++) {
+        envs.push_back(group_envelope(g, sender_id));
+        Envelope& env = envs.back();
+        env.associated_data = aad;
+        AEADBatch::Job job;
+        job.key = key;
+        job.aad = env.associated_data;
+        job.input = plaintexts[i];
+        job.suite = suite_;
+        if (nonce_mode_ == AEAD::NonceMode::Counter) {
+            std::span<uint8_t> nonce(nonces.data() + i * nonce_len, nonce_len);
+            AEAD::make_counter_nonce(nonce, env.message_index, g.nonce_salt);
+            job.nonce = nonce;
+        }
+        env.ciphertext.resize(AEADBatch::sealed_size(job));
+        job.output = env.ciphertext;
+        batch.add(job);
+    }
+    // Counters are consumed and the jobs only point at locals from here on
+    lk.unlock();
+
+    const auto& results = batch.seal(pool);
+    for (const auto& r : results) {
+        if (!r.ok) throw std::runtime_error("AEAD encryption failed");
+    }
+    return envs;
+}
+
+std::vector<std::optional<std::vector<uint8_t>>> MLSManager::decrypt_group_messages(const std::vector<uint8_t>& group_id,
+                                                                                    const std::string& /*member_id*/,
+                                                                                    const std::vector<Envelope>& envs,
+                                                                                    WorkerPool* pool) {
+    std::vector<std::optional<std::vector<uint8_t>>> out(envs.size());
+    std::unique_lock<std::mutex> lk(mutex_);
+    auto git = groups_.find(group_id);
+    if (git == groups_.end()) return out;
+    const Group& g = git->second;
+    SecretKey32 key = derive_epoch_key(g.epoch_secret, g.id, g.epoch);
+
+    // Envelopes that cannot be opened (wrong group, unknown suite) never enter the batch
+    std::vector<uint8_t> nonces(envs.size() * AEAD::MAX_NONCE_BYTES);
+    std::vector<size_t> batch_index;
+    batch_index.reserve(envs.size());
+    AEADBatch batch;
+    batch.reserve(envs.size());
+    for (size_t i = 0; i < envs.size(); i++) {
+        const Envelope& env = envs[i];
+        if (env.session_id != g.id) continue;
+        uint8_t flags;
+        std::span<const uint8_t> salt;
+        if (!parse_group_aad(g, env.associated_data, flags, salt)) continue;
+        const auto suite = static_cast<CipherSuite>(flags >> AAD_SUITE_SHIFT);
+        if (!cipher_suite_available(suite)) continue;
+
+        AEADBatch::Job job;
+        job.key = key;
+        job.aad = env.associated_data;
+        job.input = env.ciphertext;
+        job.suite = suite;
+        if (flags & AAD_FLAG_COUNTER_NONCE) {
+            std::span<uint8_t> nonce(nonces.data() + i * AEAD::MAX_NONCE_BYTES,
+                                     aead_backend(suite)->nonce_bytes());
+            AEAD::make_counter_nonce(nonce, env.message_index, salt);
+            job.nonce = nonce;
+        }
+        out[i].emplace(AEADBatch::opened_size(job));
+        job.output = *out[i];
+        batch.add(job);
+        batch_index.push_back(i);
+    }
+    lk.unlock();
+
+    const auto& results = batch.open(pool);
+    for (size_t j = 0; j < results.size(); j++) {
+        if (!results[j].ok) out[batch_index[j]].reset();
+    }
+    return out;
 }
 
 std::vector<uint8_t> MLSManager::get_group_epoch_secret(const std::vector<uint8_t>& group_id) const {
+    std::lock_guard<std::mutex> lk(mutex_);
     auto it = groups_.find(group_id);
     if (it == groups_.end()) return {};
-    return it->second.epoch_secret;
+    return it->second.epoch_secret.to_vector();
 }
 
-uint64_t MLSManager::get_group_epoch(const std::vector<uint8_t>& group_id) const {
+uint64_t MLSManager::get_group_epoch(std::span<const uint8_t> group_id) const {
+    std::lock_guard<std::mutex> lk(mutex_);
     auto it = groups_.find(group_id);
     if (it == groups_.end()) return 0;
     return it->second.epoch;
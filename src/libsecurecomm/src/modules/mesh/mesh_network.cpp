@@ -1,8 +1,10 @@
 #include "mesh_network.hpp"
+#include "securecomm/random.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
 #include <sodium.h>
 #include <chrono>
 #include <algorithm>
-#include <iostream>
 #include <cstdio>
 
 namespace securecomm {
@@ -29,13 +31,13 @@ struct MeshNetwork::Impl {
     Impl() {
         // Generate unique mesh ID
         unsigned char mesh_id_bytes[8];
-        randombytes_buf(mesh_id_bytes, sizeof(mesh_id_bytes));
+        random_bytes(mesh_id_bytes, sizeof(mesh_id_bytes));
         char hex[17] = {0};
         for (int i = 0; i < 8; i++) {
             snprintf(hex + i*2, 3, "%02x", mesh_id_bytes[i]);
         }
         mesh_id = std::string(hex, 16);
-        std::cout << "[Mesh] Generated mesh ID: " << mesh_id << std::endl;
+        SC_LOG_DEBUG("Mesh", "Generated mesh ID: " << mesh_id);
     }
     
     void start_discovery() {
@@ -60,7 +62,7 @@ struct MeshNetwork::Impl {
                         peers[new_peer.mesh_id] = new_peer;
                         
                         if (on_peer_discovered) {
-                            std::cout << "[Mesh] Discovered new peer: " << new_peer.device_id << std::endl;
+                            SC_LOG_INFO("Mesh", "Discovered new peer: " << new_peer.device_id);
                             on_peer_discovered(new_peer);
                         }
                     }
@@ -72,7 +74,7 @@ struct MeshNetwork::Impl {
                 
                 for (auto it = peers.begin(); it != peers.end(); ) {
                     if (now - it->second.last_seen > 300) { // 5 minutes
-                        std::cout << "[Mesh] Peer timeout: " << it->second.device_id << std::endl;
+                        SC_LOG_INFO("Mesh", "Peer timeout: " << it->second.device_id);
                         it = peers.erase(it);
                     } else {
                         ++it;
@@ -93,13 +95,14 @@ struct MeshNetwork::Impl {
             {
                 std::lock_guard<std::mutex> lock(state_mutex);
                 if (!send_queue.empty()) {
-                    packet = send_queue.front();
+                    packet = std::move(send_queue.front());
                     send_queue.pop();
                     has_packet = true;
                 }
             }
             
             if (has_packet) {
+                TraceScope trace("mesh_route", tracing_enabled() ? TraceKey::of(packet.packet_id, 0) : TraceKey{});
                 // Flood packet to all peers
                 std::lock_guard<std::mutex> lock(state_mutex);
                 
@@ -118,8 +121,8 @@ struct MeshNetwork::Impl {
                     // Check if we're the recipient
                     if (packet.recipient_device_id == device_id) {
                         if (on_packet_received) {
-                            std::cout << "[Mesh] Packet received for us from: " 
-                                      << packet.sender_mesh_id << std::endl;
+                            SC_LOG_DEBUG("Mesh", "Packet received for us from: " 
+                                      << packet.sender_mesh_id);
                             on_packet_received(packet);
                         }
                     } else {
@@ -129,13 +132,13 @@ struct MeshNetwork::Impl {
                             if (peer_pair.second.has_internet) {
                                 internet_peers++;
                                 // In real implementation, send via Bluetooth/WiFi Direct
-                                std::cout << "[Mesh] Peer " << peer_pair.second.device_id 
-                                          << " has internet, could relay packet" << std::endl;
+                                SC_LOG_DEBUG("Mesh", "Peer " << peer_pair.second.device_id 
+                                          << " has internet, could relay packet");
                             }
                         }
                         if (internet_peers > 0) {
-                            std::cout << "[Mesh] Found " << internet_peers 
-                                      << " peer(s) with internet for relay" << std::endl;
+                            SC_LOG_DEBUG("Mesh", "Found " << internet_peers 
+                                      << " peer(s) with internet for relay");
                         }
                     }
                 }
@@ -147,7 +150,7 @@ struct MeshNetwork::Impl {
     
     std::vector<uint8_t> generate_packet_id() {
         std::vector<uint8_t> id(16);
-        randombytes_buf(id.data(), id.size());
+        random_bytes(id.data(), id.size());
         return id;
     }
 };
@@ -160,7 +163,7 @@ MeshNetwork::~MeshNetwork() {
 
 void MeshNetwork::initialize(const std::string& device_id) {
     impl_->device_id = device_id;
-    std::cout << "[Mesh] Initialized with device ID: " << device_id << std::endl;
+    SC_LOG_INFO("Mesh", "Initialized with device ID: " << device_id);
 }
 
 void MeshNetwork::start() {
@@ -170,7 +173,7 @@ void MeshNetwork::start() {
     impl_->discovery_thread = std::thread([this]() { impl_->start_discovery(); });
     impl_->routing_thread = std::thread([this]() { impl_->start_routing(); });
     
-    std::cout << "[Mesh] Network started" << std::endl;
+    SC_LOG_INFO("Mesh", "Network started");
 }
 
 void MeshNetwork::stop() {
@@ -183,29 +186,30 @@ void MeshNetwork::stop() {
         impl_->routing_thread.join();
     }
     
-    std::cout << "[Mesh] Network stopped" << std::endl;
+    SC_LOG_INFO("Mesh", "Network stopped");
 }
 
 void MeshNetwork::send_packet(const std::string& recipient_device_id, 
-                             const std::vector<uint8_t>& payload) {
+                             Bytes payload) {
     MeshPacket packet;
     packet.packet_id = impl_->generate_packet_id();
     packet.sender_mesh_id = impl_->mesh_id;
     packet.recipient_device_id = recipient_device_id;
-    packet.payload = payload;
+    packet.payload = std::move(payload);
     packet.ttl = 10; // Max hops
     packet.hops = 0;
     packet.timestamp = std::chrono::duration_cast<std::chrono::seconds>(
         std::chrono::system_clock::now().time_since_epoch()).count();
     
+    if (tracing_enabled()) trace_instant("mesh_enqueue", TraceKey::of(packet.packet_id, 0));
     std::lock_guard<std::mutex> lock(impl_->state_mutex);
-    impl_->send_queue.push(packet);
-    std::cout << "[Mesh] Packet queued for delivery to: " << recipient_device_id << std::endl;
+    impl_->send_queue.push(std::move(packet));
+    SC_LOG_DEBUG("Mesh", "Packet queued for delivery to: " << recipient_device_id);
 }
 
-void MeshNetwork::broadcast(const std::vector<uint8_t>& payload) {
+void MeshNetwork::broadcast(Bytes payload) {
     // Broadcast to special "all" recipient
-    send_packet("broadcast", payload);
+    send_packet("broadcast", std::move(payload));
 }
 
 bool MeshNetwork::has_internet_connection() const {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include "securecomm/bytes.hpp"
 #include <vector>
 #include <string>
 #include <map>
@@ -20,7 +21,7 @@ public:
         std::vector<uint8_t> packet_id;
         std::string sender_mesh_id;
         std::string recipient_device_id;
-        std::vector<uint8_t> payload;
+        Bytes payload;    // shared, not copied, as the packet is queued and routed
         uint8_t ttl;
         uint8_t hops;
         uint64_t timestamp;
@@ -52,10 +53,10 @@ public:
     
     // Send packet through mesh
     void send_packet(const std::string& recipient_device_id, 
-                    const std::vector<uint8_t>& payload);
+                    Bytes payload);
     
     // Broadcast to all mesh peers
-    void broadcast(const std::vector<uint8_t>& payload);
+    void broadcast(Bytes payload);
     
     // Check if any peer has internet connectivity
     bool has_internet_connection() const;
@@ -1,6 +1,7 @@
 #include "queue_manager.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
 #include <sqlite3.h>
-#include <iostream>
 #include <chrono>
 #include <sstream>
 #include <iomanip>
@@ -17,7 +18,7 @@ struct OfflineQueue::Impl {
     bool exec(const std::string& sql) {
         char* err = nullptr;
         if (sqlite3_exec(db, sql.c_str(), nullptr, nullptr, &err) != SQLITE_OK) {
-            std::cerr << "[OfflineQueue] SQLite error: " << err << std::endl;
+            SC_LOG_ERROR("OfflineQueue", "SQLite error: " << err);
             sqlite3_free(err);
             return false;
         }
@@ -31,12 +32,12 @@ OfflineQueue::~OfflineQueue() = default;
 
 bool OfflineQueue::initialize(const std::string& db_path) {
     if (sqlite3_open(db_path.c_str(), &impl_->db) != SQLITE_OK) {
-        std::cerr << "[OfflineQueue] Cannot open database: " 
-                  << sqlite3_errmsg(impl_->db) << std::endl;
+        SC_LOG_ERROR("OfflineQueue", "Cannot open database: " 
+                  << sqlite3_errmsg(impl_->db));
         return false;
     }
     
-    std::cout << "[OfflineQueue] Opened database at: " << db_path << std::endl;
+    SC_LOG_INFO("OfflineQueue", "Opened database at: " << db_path);
     
     // Enable WAL mode for better concurrency
     impl_->exec("PRAGMA journal_mode=WAL");
@@ -66,13 +67,14 @@ bool OfflineQueue::initialize(const std::string& db_path) {
         return false;
     }
     
-    std::cout << "[OfflineQueue] Database initialized successfully" << std::endl;
+    SC_LOG_INFO("OfflineQueue", "Database initialized successfully");
     return true;
 }
 
 bool OfflineQueue::queue_message(const std::string& message_id,
                                  const std::string& recipient_id,
-                                 const std::vector<uint8_t>& envelope) {
+                                 std::span<const uint8_t> envelope) {
+    TraceScope trace("offline_enqueue", tracing_enabled() ? TraceKey::of(message_id) : TraceKey{});
     sqlite3_stmt* stmt = nullptr;
     const char* sql = R"(
         INSERT OR REPLACE INTO queued_messages 
@@ -81,8 +83,8 @@ bool OfflineQueue::queue_message(const std::string& message_id,
     )";
     
     if (sqlite3_prepare_v2(impl_->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "[OfflineQueue] Failed to prepare statement: " 
-                  << sqlite3_errmsg(impl_->db) << std::endl;
+        SC_LOG_ERROR("OfflineQueue", "Failed to prepare statement: " 
+                  << sqlite3_errmsg(impl_->db));
         return false;
     }
     
@@ -97,11 +99,11 @@ bool OfflineQueue::queue_message(const std::string& message_id,
     
     bool success = sqlite3_step(stmt) == SQLITE_DONE;
     if (!success) {
-        std::cerr << "[OfflineQueue] Failed to insert message: " 
-                  << sqlite3_errmsg(impl_->db) << std::endl;
+        SC_LOG_ERROR("OfflineQueue", "Failed to insert message: " 
+                  << sqlite3_errmsg(impl_->db));
     } else {
-        std::cout << "[OfflineQueue] Queued message: " << message_id 
-                  << " for recipient: " << recipient_id << std::endl;
+        SC_LOG_DEBUG("OfflineQueue", "Queued message: " << message_id 
+                  << " for recipient: " << recipient_id);
     }
     sqlite3_finalize(stmt);
     
@@ -122,8 +124,8 @@ std::vector<OfflineQueue::QueuedMessage> OfflineQueue::get_pending_messages() {
     )";
     
     if (sqlite3_prepare_v2(impl_->db, sql, -1, &stmt, nullptr) != SQLITE_OK) {
-        std::cerr << "[OfflineQueue] Failed to prepare query: " 
-                  << sqlite3_errmsg(impl_->db) << std::endl;
+        SC_LOG_ERROR("OfflineQueue", "Failed to prepare query: " 
+                  << sqlite3_errmsg(impl_->db));
         return messages;
     }
     
@@ -136,8 +138,7 @@ std::vector<OfflineQueue::QueuedMessage> OfflineQueue::get_pending_messages() {
         // Get envelope blob
         const void* blob = sqlite3_column_blob(stmt, 3);
         int blob_size = sqlite3_column_bytes(stmt, 3);
-        msg.envelope.assign(static_cast<const uint8_t*>(blob), 
-                           static_cast<const uint8_t*>(blob) + blob_size);
+        msg.envelope = Bytes::copy(std::span(static_cast<const uint8_t*>(blob), static_cast<size_t>(blob_size)));
         
         msg.created_at = std::chrono::system_clock::time_point(
             std::chrono::seconds(sqlite3_column_int64(stmt, 4)));
@@ -146,7 +147,7 @@ std::vector<OfflineQueue::QueuedMessage> OfflineQueue::get_pending_messages() {
         msg.retry_count = sqlite3_column_int(stmt, 6);
         msg.status = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 7));
         
-        messages.push_back(msg);
+        messages.push_back(std::move(msg));
     }
     
     sqlite3_finalize(stmt);
@@ -164,7 +165,7 @@ bool OfflineQueue::mark_delivered(const std::string& message_id) {
     sqlite3_bind_text(stmt, 1, message_id.c_str(), -1, SQLITE_STATIC);
     bool success = sqlite3_step(stmt) == SQLITE_DONE;
     if (success) {
-        std::cout << "[OfflineQueue] Marked as delivered: " << message_id << std::endl;
+        SC_LOG_DEBUG("OfflineQueue", "Marked as delivered: " << message_id);
     }
     sqlite3_finalize(stmt);
     
@@ -205,7 +206,7 @@ void OfflineQueue::cleanup_old_messages(int days_to_keep) {
         << " AND status IN ('delivered', 'failed')";
     
     if (impl_->exec(sql.str())) {
-        std::cout << "[OfflineQueue] Cleaned up old messages" << std::endl;
+        SC_LOG_DEBUG("OfflineQueue", "Cleaned up old messages");
     }
 }
 
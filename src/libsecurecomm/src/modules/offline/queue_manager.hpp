@@ -1,5 +1,6 @@
 #pragma once
 
+#include "securecomm/bytes.hpp"
 #include <vector>
 #include <string>
 #include <optional>
@@ -15,7 +16,7 @@ public:
         int64_t id;
         std::string message_id;
         std::string recipient_id;
-        std::vector<uint8_t> envelope;
+        Bytes envelope;    // copied out of the database once; copies of the message share it
         std::chrono::system_clock::time_point created_at;
         int retry_count;
         std::chrono::system_clock::time_point last_attempt;
@@ -31,7 +32,7 @@ public:
     // Queue a message for delivery
     bool queue_message(const std::string& message_id,
                       const std::string& recipient_id,
-                      const std::vector<uint8_t>& envelope);
+                      std::span<const uint8_t> envelope);
     
     // Get all pending messages
     std::vector<QueuedMessage> get_pending_messages();
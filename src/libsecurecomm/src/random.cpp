@@ -0,0 +1,87 @@
+#include "securecomm/random.hpp"
+#include <sodium.h>
+#include <stdexcept>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <pthread.h>
+#include <atomic>
+#define SECURECOMM_HAVE_ATFORK 1
+#endif
+
+namespace securecomm {
+
+namespace {
+
+#ifdef SECURECOMM_HAVE_ATFORK
+// Bumped in every forked child, so buffers filled before the fork can be told
+// apart with a load instead of a getpid() call per draw
+std::atomic<uint64_t> g_fork_generation{0};
+
+void on_fork_child() {
+    g_fork_generation.fetch_add(1, std::memory_order_relaxed);
+}
+#endif
+
+struct RandomBuffer {
+    uint8_t bytes[RANDOM_BLOCK_BYTES];
+    size_t pos = RANDOM_BLOCK_BYTES;    // empty until first use
+#ifdef SECURECOMM_HAVE_ATFORK
+    uint64_t generation = 0;
+#endif
+
+    ~RandomBuffer() { sodium_memzero(bytes, sizeof(bytes)); }
+
+    void refill() {
+        if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
+#ifdef SECURECOMM_HAVE_ATFORK
+        // Registered before the first buffer is filled, so no buffer predates it
+        static const bool atfork_registered = pthread_atfork(nullptr, nullptr, on_fork_child) == 0;
+        if (!atfork_registered) throw std::runtime_error("pthread_atfork failed");
+        generation = g_fork_generation.load(std::memory_order_relaxed);
+#endif
+        randombytes_buf(bytes, sizeof(bytes));
+        pos = 0;
+    }
+
+    bool stale() const {
+#ifdef SECURECOMM_HAVE_ATFORK
+        // A forked child inherits the parent's buffer and must not replay it
+        return pos < RANDOM_BLOCK_BYTES && generation != g_fork_generation.load(std::memory_order_relaxed);
+#else
+        return false;
+#endif
+    }
+};
+
+thread_local RandomBuffer t_buffer;
+
+} // namespace
+
+void random_bytes(void* out, size_t len) {
+    auto* dst = static_cast<uint8_t*>(out);
+    if (len > RANDOM_BLOCK_BYTES / 2) {
+        if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
+        randombytes_buf(dst, len);
+        return;
+    }
+
+    RandomBuffer& buf = t_buffer;
+    if (buf.stale()) buf.pos = RANDOM_BLOCK_BYTES;
+    while (len > 0) {
+        if (buf.pos == RANDOM_BLOCK_BYTES) buf.refill();
+        const size_t n = std::min(len, RANDOM_BLOCK_BYTES - buf.pos);
+        memcpy(dst, buf.bytes + buf.pos, n);
+        sodium_memzero(buf.bytes + buf.pos, n);
+        buf.pos += n;
+        dst += n;
+        len -= n;
+    }
+}
+
+void random_bytes(std::span<uint8_t> out) {
+    random_bytes(out.data(), out.size());
+}
+
+} // namespace securecomm
@@ -1,5 +1,8 @@
 #include "securecomm/ratchet.hpp"
 #include "securecomm/envelope.hpp"
+#include "securecomm/aead_batch.hpp"
+#include "securecomm/random.hpp"
+#include "securecomm/trace.hpp"
 
 #include <sodium.h>
 #include <stdexcept>
@@ -26,18 +29,21 @@ uint32_t Ratchet::read_u32_be(const std::vector<uint8_t>& in, size_t& offset) {
     return v;
 }
 
-std::vector<uint8_t> Ratchet::derive_message_key(const std::vector<uint8_t>& chain_key) const {
-    unsigned char out[crypto_auth_hmacsha256_BYTES];
+static_assert(SecretKey32::BYTES == crypto_auth_hmacsha256_BYTES, "chain key size mismatch");
+static_assert(PublicKey32::BYTES == crypto_scalarmult_BYTES, "DH key size mismatch");
+
+SecretKey32 Ratchet::derive_message_key(const LockedKey32& chain_key) const {
+    SecretKey32 out;
     const unsigned char label[] = { 'm','s','g' };
-    crypto_auth_hmacsha256(out, label, sizeof(label), chain_key.data());
-    return std::vector<uint8_t>(out, out + crypto_auth_hmacsha256_BYTES);
+    crypto_auth_hmacsha256(out.data(), label, sizeof(label), chain_key.data());
+    return out;
 }
 
-std::vector<uint8_t> Ratchet::advance_chain_key(const std::vector<uint8_t>& chain_key) const {
-    unsigned char out[crypto_auth_hmacsha256_BYTES];
+SecretKey32 Ratchet::advance_chain_key(const LockedKey32& chain_key) const {
+    SecretKey32 out;
     const unsigned char label[] = { 'c','k' };
-    crypto_auth_hmacsha256(out, label, sizeof(label), chain_key.data());
-    return std::vector<uint8_t>(out, out + crypto_auth_hmacsha256_BYTES);
+    crypto_auth_hmacsha256(out.data(), label, sizeof(label), chain_key.data());
+    return out;
 }
 
 static void hkdf_extract(uint8_t out_prk[crypto_auth_hmacsha256_BYTES],
@@ -91,36 +97,103 @@ static void hkdf_expand(uint8_t *okm, size_t okm_len,
     sodium_memzero(previous, sizeof(previous));
 }
 
-void Ratchet::hkdf_root_chain(const std::vector<uint8_t>& dh_shared_secret) {
-    uint8_t prk[crypto_auth_hmacsha256_BYTES];
-    hkdf_extract(prk,
-                 root_key_.empty() ? nullptr : root_key_.data(),
-                 root_key_.size(),
+// New root and both chain keys from the current root and a DH output. `root_out`
+// may be `root_in`.
+static void derive_root_chain(const LockedKey32& root_in, const SecretKey32& dh_shared_secret,
+                              const PublicKey32& local_pub, const PublicKey32& remote_pub,
+                              LockedKey32& root_out, LockedKey32& send_chain_out, LockedKey32& recv_chain_out) {
+    // An all-zero root key (before initialize) is the same salt HKDF uses when none is given
+    SecretKey32 prk;
+    hkdf_extract(prk.data(), root_in.data(), root_in.size(),
                  dh_shared_secret.data(), dh_shared_secret.size());
 
-    // Derive both send and receive chain keys deterministically
+    // Both sides derive the same two chains; the one for the side with the lower
+    // public key is labelled "SendChain", so each side's send chain is the other
+    // side's receive chain
     const unsigned char send_info[] = { 'S','e','n','d','C','h','a','i','n' };
     const unsigned char recv_info[] = { 'R','e','c','v','C','h','a','i','n' };
-    uint8_t send_okm[32];
-    uint8_t recv_okm[32];
-    hkdf_expand(send_okm, sizeof(send_okm), prk, send_info, sizeof(send_info));
-    hkdf_expand(recv_okm, sizeof(recv_okm), prk, recv_info, sizeof(recv_info));
+    const bool lower = std::lexicographical_compare(local_pub.begin(), local_pub.end(),
+                                                    remote_pub.begin(), remote_pub.end());
+    hkdf_expand(send_chain_out.data(), send_chain_out.size(), prk.data(),
+                lower ? send_info : recv_info, sizeof(send_info));
+    hkdf_expand(recv_chain_out.data(), recv_chain_out.size(), prk.data(),
+                lower ? recv_info : send_info, sizeof(recv_info));
+    root_out.assign(prk);
+}
 
-    root_key_ = std::vector<uint8_t>(prk, prk + crypto_auth_hmacsha256_BYTES);
-    send_chain_key_ = std::vector<uint8_t>(send_okm, send_okm + sizeof(send_okm));
-    recv_chain_key_ = std::vector<uint8_t>(recv_okm, recv_okm + sizeof(recv_okm));
+void Ratchet::hkdf_root_chain(const SecretKey32& dh_shared_secret, const PublicKey32& remote_pub) {
+    derive_root_chain(root_key_, dh_shared_secret, dh_public_key_, remote_pub, root_key_, send_chain_key_, recv_chain_key_);
+    dirty_ |= DIRTY_ROOT | DIRTY_SEND_CHAIN | DIRTY_RECV_CHAIN;
+    drop_send_key_window();
+    root_epoch_++;
 
     aead_.set_key(send_chain_key_);
+}
+
+void Ratchet::DhStep::compute() {
+    SecretKey32 dh_shared;
+    if (crypto_scalarmult(dh_shared.data(), dh_private_key.data(), remote_pub.data()) != 0)
+        throw std::runtime_error("dh_compute failed");
+    derive_root_chain(base_root, dh_shared, local_pub, remote_pub, root_key, send_chain_key, recv_chain_key);
+    dh_private_key.clear();
+    computed = true;
+}
+
+std::optional<PublicKey32> Ratchet::dh_step_needed(const Envelope& env) const {
+    const auto header = RatchetHeaderView::parse(env.associated_data);
+    return header ? dh_step_needed(*header) : std::nullopt;
+}
+
+std::optional<PublicKey32> Ratchet::dh_step_needed(const RatchetHeaderView& header) const {
+    if (!last_remote_pub_ || header.dh_public == *last_remote_pub_) return std::nullopt;
+    // A late message from a chain we still hold a key for needs no step
+    if (skipped_keys_.peek(header.dh_public, header.message_number)) return std::nullopt;
+    return header.dh_public;
+}
 
-    sodium_memzero(prk, sizeof(prk));
-    sodium_memzero(send_okm, sizeof(send_okm));
-    sodium_memzero(recv_okm, sizeof(recv_okm));
+// Before the receive chain is replaced, cache keys for the next few indices on it:
+// the header carries no previous-chain length, and messages the peer sent on that
+// chain may still arrive after the first one on its new key
+void Ratchet::stash_receive_chain() {
+    if (!last_remote_pub_) return;
+    const uint32_t count = std::min(PREVIOUS_CHAIN_KEYS, max_skip_);
+    LockedKey32 chain = recv_chain_key_;
+    for (uint32_t i = 0; i < count; i++) {
+        skipped_put(*last_remote_pub_, recv_message_number_ + i, derive_message_key(chain));
+        chain.assign(advance_chain_key(chain));
+    }
+}
+
+Ratchet::DhStep Ratchet::prepare_dh_step(const PublicKey32& remote_pub) const {
+    DhStep step;
+    step.remote_pub = remote_pub;
+    step.local_pub = dh_public_key_;
+    step.dh_private_key = dh_private_key_;
+    step.base_root = root_key_;
+    step.epoch = root_epoch_;
+    return step;
+}
+
+bool Ratchet::commit_dh_step(const DhStep& step) {
+    // Stale if another step, initialize or import reset the chains since prepare
+    if (!step.computed || step.epoch != root_epoch_) return false;
+
+    stash_receive_chain();
+    root_key_ = step.root_key;
+    send_chain_key_ = step.send_chain_key;
+    recv_chain_key_ = step.recv_chain_key;
+    dirty_ |= DIRTY_ROOT | DIRTY_SEND_CHAIN | DIRTY_RECV_CHAIN | DIRTY_REMOTE_PUB;
+    drop_send_key_window();
+    root_epoch_++;
+    // Same state decrypt_envelope leaves behind after an inline step
+    aead_.set_key(recv_chain_key_);
+    recv_message_number_ = 0;
+    last_remote_pub_ = step.remote_pub;
+    return true;
 }
 
-std::vector<uint8_t> Ratchet::dh_compute(const std::vector<uint8_t>& remote_public) const {
-    if (remote_public.size() != crypto_scalarmult_BYTES)
-        throw std::runtime_error("dh_compute: invalid public key size");
-    std::vector<uint8_t> dh_shared(crypto_scalarmult_BYTES);
+SecretKey32 Ratchet::dh_compute(const PublicKey32& remote_public) const {
+    SecretKey32 dh_shared;
     if (crypto_scalarmult(dh_shared.data(), dh_private_key_.data(), remote_public.data()) != 0)
         throw std::runtime_error("dh_compute failed");
     return dh_shared;
@@ -130,36 +203,36 @@ Ratchet::Ratchet()
     : send_message_number_(0), recv_message_number_(0) {
     if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
 
-    dh_private_key_.resize(crypto_scalarmult_BYTES);
-    dh_public_key_.resize(crypto_scalarmult_BYTES);
-    randombytes_buf(dh_private_key_.data(), dh_private_key_.size());
+    random_bytes(dh_private_key_.data(), dh_private_key_.size());
     crypto_scalarmult_base(dh_public_key_.data(), dh_private_key_.data());
 }
 
-Ratchet::~Ratchet() {
-    sodium_memzero(dh_private_key_.data(), dh_private_key_.size());
-    sodium_memzero(dh_public_key_.data(), dh_public_key_.size());
-}
+Ratchet::~Ratchet() = default;
 
 // Initialize
 void Ratchet::initialize(const std::vector<uint8_t>& root_key,
                          const std::vector<uint8_t>& session_id) {
     if (root_key.size() != 32) throw std::runtime_error("Root key must be 32 bytes");
-    root_key_ = root_key;
+    root_key_.assign(root_key);
     send_chain_key_ = root_key_;
     recv_chain_key_ = root_key_;
     send_message_number_ = 0;
     recv_message_number_ = 0;
+    drop_send_key_window();
+    root_epoch_++;
     aead_.set_key(send_chain_key_);
     session_id_ = session_id;
-    last_remote_pub_.clear();
+    last_remote_pub_.reset();
+    skipped_keys_.clear();
+    skipped_changes_.clear();
+    dirty_ |= DIRTY_ROOT | DIRTY_SEND_CHAIN | DIRTY_RECV_CHAIN | DIRTY_REMOTE_PUB |
+              DIRTY_SESSION_ID | DIRTY_SKIPPED_CLEAR;
 }
 
-void Ratchet::ratchet_step(const std::vector<uint8_t>& remote_dh_public) {
-    if (remote_dh_public.size() != crypto_scalarmult_BYTES) throw std::runtime_error("ratchet_step: invalid size");
+void Ratchet::ratchet_step(const PublicKey32& remote_dh_public) {
     auto dh_shared = dh_compute(remote_dh_public);
 
-    hkdf_root_chain(dh_shared);
+    hkdf_root_chain(dh_shared, remote_dh_public);
 
     // hkdf_root_chain now sets both send_chain_key_ and recv_chain_key_
     aead_.set_key(recv_chain_key_);
@@ -168,103 +241,348 @@ void Ratchet::ratchet_step(const std::vector<uint8_t>& remote_dh_public) {
     recv_message_number_ = 0;
 
     last_remote_pub_ = remote_dh_public;
-    sodium_memzero(dh_shared.data(), dh_shared.size());
+    dirty_ |= DIRTY_REMOTE_PUB;
+}
+
+void Ratchet::ratchet_step(const std::vector<uint8_t>& remote_dh_public) {
+    if (remote_dh_public.size() != crypto_scalarmult_BYTES) throw std::runtime_error("ratchet_step: invalid size");
+    ratchet_step(PublicKey32(remote_dh_public));
 }
 
 Envelope Ratchet::encrypt_envelope(const std::vector<uint8_t>& plaintext) {
-    Envelope env;
+    return seal_envelope(plaintext, true);
+}
+
+Envelope Ratchet::encrypt_envelope(std::span<const uint8_t> plaintext) {
+    return seal_envelope(plaintext, true);
+}
+
+Ratchet::OutgoingMessage Ratchet::next_outgoing(bool extended_header) {
+    OutgoingMessage out;
+    Envelope& env = out.env;
     if (session_id_.empty()) {
         session_id_.resize(16);
-        randombytes_buf(session_id_.data(), session_id_.size());
+        random_bytes(session_id_.data(), session_id_.size());
+        dirty_ |= DIRTY_SESSION_ID;
     }
     env.session_id = session_id_;
+
+    // A ratchet configured for random nonces and the legacy suite sends the plain
+    // 36-byte header; anything else needs the flags byte.
+    const bool advertise = extended_header &&
+        (nonce_mode_ == AEAD::NonceMode::Counter || suite_ != CipherSuite::ChaCha20Poly1305);
+    out.mode = advertise && nonce_mode_ == AEAD::NonceMode::Counter && peer_counter_nonce_
+        ? AEAD::NonceMode::Counter : AEAD::NonceMode::Random;
+
+    // Only leave the legacy suite once the peer has shown it parses the flags byte
+    out.suite = CipherSuite::ChaCha20Poly1305;
+    if (advertise && peer_extended_header_) {
+        if (suite_ == CipherSuite::XChaCha20Poly1305 ||
+            (suite_ == CipherSuite::Aes256Gcm && peer_aes256gcm_)) {
+            out.suite = suite_;
+        }
+    }
+
     std::vector<uint8_t> header;
+    header.reserve(RatchetHeaderView::EXTENDED_BYTES);
     push_u32_be(header, send_message_number_);
     header.insert(header.end(), dh_public_key_.begin(), dh_public_key_.end());
-
-    auto msg_key = derive_message_key(send_chain_key_);
-    aead_.set_key(msg_key);
-    auto ct = aead_.encrypt(plaintext, header);
+    if (advertise) {
+        uint8_t flags = static_cast<uint8_t>(static_cast<uint8_t>(out.suite) << RatchetHeaderView::SUITE_SHIFT);
+        if (nonce_mode_ == AEAD::NonceMode::Counter) flags |= RatchetHeaderView::FLAG_COUNTER_NONCE_CAPABLE;
+        if (out.mode == AEAD::NonceMode::Counter) flags |= RatchetHeaderView::FLAG_COUNTER_NONCE;
+        if (cipher_suite_available(CipherSuite::Aes256Gcm)) flags |= RatchetHeaderView::FLAG_AES256GCM_CAPABLE;
+        header.push_back(flags);
+    }
 
     env.message_index = send_message_number_;
     env.previous_counter = recv_message_number_;
     env.timestamp = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
                         std::chrono::system_clock::now().time_since_epoch()).count());
     // Note: sender_device_id should be set by the Dispatcher before sending
-    env.associated_data = header;
-    env.ciphertext = ct;
-    
-    send_chain_key_ = advance_chain_key(send_chain_key_);
+    env.associated_data = std::move(header);
+
+    if (window_count_ > 0) {
+        LockedKey32& msg_key = send_window_[2 * window_head_];
+        LockedKey32& next_chain = send_window_[2 * window_head_ + 1];
+        out.msg_key.assign(msg_key);
+        send_chain_key_ = next_chain;
+        msg_key.clear();
+        next_chain.clear();
+        window_head_ = (window_head_ + 1) % send_key_window();
+        window_count_--;
+    } else {
+        out.msg_key = derive_message_key(send_chain_key_);
+        send_chain_key_.assign(advance_chain_key(send_chain_key_));
+    }
     send_message_number_++;
-    sodium_memzero(msg_key.data(), msg_key.size());
+    dirty_ |= DIRTY_SEND_CHAIN;
+    return out;
+}
+
+Envelope Ratchet::seal_envelope(std::span<const uint8_t> plaintext, bool extended_header) {
+    OutgoingMessage msg = next_outgoing(extended_header);
+    Envelope& env = msg.env;
+
+    aead_.set_suite(msg.suite);
+    aead_.set_key(msg.msg_key);
+    env.ciphertext.resize(aead_.ciphertext_size(plaintext.size(), msg.mode));
+    if (msg.mode == AEAD::NonceMode::Counter) {
+        // Message keys are single-use; the sender's DH public key salts the nonce so
+        // the two directions never share a (key, nonce) pair.
+        aead_.encrypt_into(plaintext, env.associated_data, env.ciphertext, env.message_index, dh_public_key_);
+    } else {
+        aead_.encrypt_into(plaintext, env.associated_data, env.ciphertext);
+    }
+
+    return std::move(env);
+}
+
+std::vector<Envelope> Ratchet::encrypt_envelopes(const std::vector<std::vector<uint8_t>>& plaintexts,
+                                                 WorkerPool* pool) {
+    std::vector<OutgoingMessage> msgs;
+    msgs.reserve(plaintexts.size());
+    for (size_t i = 0; i < plaintexts.size(); i++) {
+        msgs.push_back(next_outgoing(true));
+    }
+
+    std::vector<uint8_t> nonces(plaintexts.size() * AEAD::MAX_NONCE_BYTES);
+    AEADBatch batch;
+    batch.reserve(msgs.size());
+    for (size_t i = 0; i < msgs.size(); i++) {
+        OutgoingMessage& msg = msgs[i];
+        AEADBatch::Job job;
+        job.key = msg.msg_key;
+        job.aad = msg.env.associated_data;
+        job.input = plaintexts[i];
+        job.suite = msg.suite;
+        if (msg.mode == AEAD::NonceMode::Counter) {
+            std::span<uint8_t> nonce(nonces.data() + i * AEAD::MAX_NONCE_BYTES,
+                                     aead_backend(msg.suite)->nonce_bytes());
+            AEAD::make_counter_nonce(nonce, msg.env.message_index, dh_public_key_);
+            job.nonce = nonce;
+        }
+        msg.env.ciphertext.resize(AEADBatch::sealed_size(job));
+        job.output = msg.env.ciphertext;
+        batch.add(job);
+    }
+    const auto& results = batch.seal(pool);
+
+    std::vector<Envelope> out;
+    out.reserve(msgs.size());
+    bool ok = true;
+    for (size_t i = 0; i < msgs.size(); i++) {
+        ok = ok && results[i].ok;
+        out.push_back(std::move(msgs[i].env));
+    }
+    if (!ok) throw std::runtime_error("AEAD encryption failed");
+    return out;
+}
+
+void Ratchet::set_cipher_suite(CipherSuite suite) {
+    if (!cipher_suite_available(suite)) throw std::runtime_error("cipher suite not available on this host");
+    suite_ = suite;
+    dirty_ |= DIRTY_CONFIG;
+}
+
+void Ratchet::set_skipped_key_capacity(size_t capacity) {
+    for (const auto& id : skipped_keys_.set_capacity(capacity)) {
+        if (track_deltas_) skipped_changes_.push_back({id, true});
+    }
+    dirty_ |= DIRTY_CONFIG;
+}
+
+void Ratchet::set_send_key_window(size_t window) {
+    drop_send_key_window();
+    send_window_.clear();
+    send_window_.resize(2 * window);
+}
+
+size_t Ratchet::precompute_send_keys() {
+    const size_t window = send_key_window();
+    size_t added = 0;
+    while (window_count_ < window) {
+        const LockedKey32& from = window_count_ == 0
+            ? send_chain_key_
+            : send_window_[2 * ((window_head_ + window_count_ - 1) % window) + 1];
+        const size_t slot = (window_head_ + window_count_) % window;
+        send_window_[2 * slot].assign(derive_message_key(from));
+        send_window_[2 * slot + 1].assign(advance_chain_key(from));
+        window_count_++;
+        added++;
+    }
+    return added;
+}
+
+void Ratchet::drop_send_key_window() {
+    for (size_t i = 0; i < window_count_; i++) {
+        const size_t slot = (window_head_ + i) % send_key_window();
+        send_window_[2 * slot].clear();
+        send_window_[2 * slot + 1].clear();
+    }
+    window_head_ = 0;
+    window_count_ = 0;
+}
+
+void Ratchet::skipped_put(const PublicKey32& remote_pub, uint32_t index, const SecretKey32& key) {
+    auto evicted = skipped_keys_.put(remote_pub, index, key);
+    if (!track_deltas_) return;
+    if (evicted) skipped_changes_.push_back({*evicted, true});
+    skipped_changes_.push_back({{remote_pub, index}, false});
+}
+
+void Ratchet::skipped_erase(const PublicKey32& remote_pub, uint32_t index) {
+    if (skipped_keys_.erase(remote_pub, index) && track_deltas_) {
+        skipped_changes_.push_back({{remote_pub, index}, true});
+    }
+}
+
+// Record what the peer can receive, from an authenticated header
+void Ratchet::note_peer_header(const RatchetHeaderView& header) {
+    peer_extended_header_ = header.extended;
+    peer_counter_nonce_ = (header.flags & RatchetHeaderView::FLAG_COUNTER_NONCE_CAPABLE) != 0;
+    peer_aes256gcm_ = (header.flags & RatchetHeaderView::FLAG_AES256GCM_CAPABLE) != 0;
+    dirty_ |= DIRTY_PEER_CAPS;
+}
 
-    return env;
+std::optional<RatchetHeaderView> RatchetHeaderView::parse(std::span<const uint8_t> header) {
+    if (header.size() < LEGACY_BYTES) return std::nullopt;
+    RatchetHeaderView view;
+    view.bytes = header;
+    view.message_number = (static_cast<uint32_t>(header[0]) << 24) | (static_cast<uint32_t>(header[1]) << 16) |
+                          (static_cast<uint32_t>(header[2]) << 8) | static_cast<uint32_t>(header[3]);
+    view.dh_public.assign(header.subspan(4, PublicKey32::BYTES));
+    view.extended = header.size() >= EXTENDED_BYTES;
+    view.flags = view.extended ? header[LEGACY_BYTES] : 0;
+    return view;
 }
 
 std::optional<std::vector<uint8_t>> Ratchet::decrypt_envelope(const Envelope& env) {
-    if (!session_id_.empty() && env.session_id != session_id_) {
+    return decrypt_envelope(EnvelopeView::of(env));
+}
+
+std::optional<std::vector<uint8_t>> Ratchet::decrypt_envelope(const EnvelopeView& env) {
+    TraceScope trace("decrypt_envelope", tracing_enabled() ? TraceKey::of(env.session_id, env.message_index) : TraceKey{});
+    std::vector<uint8_t> plaintext(env.ciphertext.size());
+    auto plen = decrypt_into(env.session_id, env.associated_data, env.ciphertext, plaintext);
+    if (!plen) return std::nullopt;
+    plaintext.resize(*plen);
+    return plaintext;
+}
+
+std::optional<size_t> Ratchet::decrypt_into(const Envelope& env, std::span<uint8_t> out) {
+    return decrypt_into(env.session_id, env.associated_data, env.ciphertext, out);
+}
+
+std::optional<size_t> Ratchet::decrypt_into(std::span<const uint8_t> session_id,
+                                            std::span<const uint8_t> header_bytes,
+                                            std::span<const uint8_t> ciphertext,
+                                            std::span<uint8_t> out) {
+    if (!session_id_.empty() && !std::equal(session_id.begin(), session_id.end(),
+                                            session_id_.begin(), session_id_.end())) {
         return std::nullopt;
     } else if (session_id_.empty()) {
-        session_id_ = env.session_id;
+        session_id_.assign(session_id.begin(), session_id.end());
+        dirty_ |= DIRTY_SESSION_ID;
     }
-    const std::vector<uint8_t> &header = env.associated_data;
-    size_t off = 0;
+    const auto header = RatchetHeaderView::parse(header_bytes);
+    if (!header) return std::nullopt;
     try {
-        uint32_t msg_num = read_u32_be(header, off);
-        if (off + crypto_scalarmult_BYTES > header.size()) {
+        const uint32_t msg_num = header->message_number;
+        const PublicKey32& remote_pub = header->dh_public;
+        const AEAD::NonceMode mode = header->nonce_mode();
+        if (!cipher_suite_available(header->suite())) {
             return std::nullopt;
         }
-        std::vector<uint8_t> remote_pub(header.begin() + off, header.begin() + off + crypto_scalarmult_BYTES);
-        
+        aead_.set_suite(header->suite());
+        if (out.size() < aead_.plaintext_size(ciphertext.size(), mode)) {
+            return std::nullopt;
+        }
+        auto open = [&]() {
+            return mode == AEAD::NonceMode::Counter
+                ? aead_.decrypt_into(ciphertext, header_bytes, out, msg_num, remote_pub)
+                : aead_.decrypt_into(ciphertext, header_bytes, out);
+        };
+
+        // A cached key is tried before anything else: the message is late, either on
+        // the current chain or on one the peer has since moved away from, and must
+        // not ratchet us back to its key
+        if (const LockedKey32* skipped = skipped_keys_.find(remote_pub, msg_num)) {
+            aead_.set_key(*skipped);
+            auto plen = open();
+            if (plen.has_value()) {
+                skipped_erase(remote_pub, msg_num);
+                note_peer_header(*header);
+            }
+            return plen;
+        }
+
         // Only perform DH ratchet if we've already seen a message from this remote
         // (indicated by last_remote_pub_ not being empty)
-        if (!last_remote_pub_.empty() && remote_pub != last_remote_pub_) {
-            auto dh_shared = dh_compute(remote_pub);
-            hkdf_root_chain(dh_shared);
-            aead_.set_key(recv_chain_key_);
-            recv_message_number_ = 0;
-            last_remote_pub_ = remote_pub;
-            sodium_memzero(dh_shared.data(), dh_shared.size());
-        } else if (last_remote_pub_.empty()) {
+        const bool new_chain = last_remote_pub_ && remote_pub != *last_remote_pub_;
+        const uint32_t next_expected = new_chain ? 0 : recv_message_number_;
+        if (msg_num > next_expected && msg_num - next_expected > max_skip_) {
+            return std::nullopt;
+        }
+        std::optional<size_t> opened;    // set once opened under a new chain
+        if (new_chain) {
+            // Open the message under the new chain before committing to it, so a
+            // message from an older chain whose keys are gone (or a forgery) leaves
+            // the session as it was
+            DhStep step = prepare_dh_step(remote_pub);
+            step.compute();
+            LockedKey32 chain = step.recv_chain_key;
+            for (uint32_t i = 0; i < msg_num; i++) chain.assign(advance_chain_key(chain));
+            aead_.set_key(derive_message_key(chain));
+            opened = open();
+            if (!opened.has_value()) {
+                return std::nullopt;
+            }
+            commit_dh_step(step);
+        } else if (!last_remote_pub_) {
             last_remote_pub_ = remote_pub;
+            dirty_ |= DIRTY_REMOTE_PUB;
         }
         
         while (recv_message_number_ < msg_num) {
             auto sk = derive_message_key(recv_chain_key_);
-            skipped_message_keys_.emplace(recv_message_number_, sk);
-            recv_chain_key_ = advance_chain_key(recv_chain_key_);
+            skipped_put(remote_pub, recv_message_number_, sk);
+            recv_chain_key_.assign(advance_chain_key(recv_chain_key_));
             recv_message_number_++;
+            dirty_ |= DIRTY_RECV_CHAIN;
         }
-        auto sit = skipped_message_keys_.find(msg_num);
-        if (sit != skipped_message_keys_.end()) {
-            aead_.set_key(sit->second);
-            auto pt_opt = aead_.decrypt(env.ciphertext, header);
-            if (pt_opt.has_value()) {
-                skipped_message_keys_.erase(sit);
-                return pt_opt;
-            } else {
-                return std::nullopt;
-            }
+        if (opened.has_value()) {
+            note_peer_header(*header);
+            recv_chain_key_.assign(advance_chain_key(recv_chain_key_));
+            recv_message_number_ = msg_num + 1;
+            dirty_ |= DIRTY_RECV_CHAIN;
+            return opened;
+        }
+        if (msg_num < recv_message_number_) {
+            return std::nullopt;    // already opened, or its key was evicted
         }
         auto msg_key = derive_message_key(recv_chain_key_);
         aead_.set_key(msg_key);
-        auto pt_opt = aead_.decrypt(env.ciphertext, header);
-        if (!pt_opt.has_value()) {
+        auto plen = open();
+        if (!plen.has_value()) {
             return std::nullopt;
         }
-        recv_chain_key_ = advance_chain_key(recv_chain_key_);
+        note_peer_header(*header);
+        recv_chain_key_.assign(advance_chain_key(recv_chain_key_));
         recv_message_number_ = msg_num + 1;
-
-        sodium_memzero(msg_key.data(), msg_key.size());
-        return pt_opt;
+        dirty_ |= DIRTY_RECV_CHAIN;
+        return plen;
     } catch (...) {
         return std::nullopt;
     }
 }
 std::vector<uint8_t> Ratchet::encrypt(const std::vector<uint8_t>& plaintext,
                                       const std::vector<uint8_t>& aad) {
-    auto env = encrypt_envelope(plaintext);
+    // The raw layout is [header(36)] [ciphertext] with no length prefix, so it keeps
+    // the legacy fixed-size header and random nonces.
+    auto env = seal_envelope(plaintext, false);
     std::vector<uint8_t> out;
+    out.reserve(env.associated_data.size() + env.ciphertext.size());
     out.insert(out.end(), env.associated_data.begin(), env.associated_data.end());
     out.insert(out.end(), env.ciphertext.begin(), env.ciphertext.end());
     return out;
@@ -272,40 +590,383 @@ std::vector<uint8_t> Ratchet::encrypt(const std::vector<uint8_t>& plaintext,
 
 std::optional<std::vector<uint8_t>> Ratchet::decrypt(const std::vector<uint8_t>& ciphertext,
                                                      const std::vector<uint8_t>& aad) {
-    if (ciphertext.size() < 4 + crypto_scalarmult_BYTES) return std::nullopt;
-    std::vector<uint8_t> header(ciphertext.begin(), ciphertext.begin() + 4 + crypto_scalarmult_BYTES);
-    std::vector<uint8_t> ct(ciphertext.begin() + 4 + crypto_scalarmult_BYTES, ciphertext.end());
-    Envelope env;
-    env.session_id = session_id_;
-    env.associated_data = header;
-    env.ciphertext = ct;
-    return decrypt_envelope(env);
+    if (ciphertext.size() < RatchetHeaderView::LEGACY_BYTES) return std::nullopt;
+    const std::span<const uint8_t> raw(ciphertext);
+    std::vector<uint8_t> plaintext(ciphertext.size());
+    auto plen = decrypt_into(session_id_, raw.first(RatchetHeaderView::LEGACY_BYTES),
+                             raw.subspan(RatchetHeaderView::LEGACY_BYTES), plaintext);
+    if (!plen) return std::nullopt;
+    plaintext.resize(*plen);
+    return plaintext;
+}
+namespace {
+
+// Snapshot: "SCRS" | version | generation(8) | fields, see export_state()
+// Delta:    "SCRD" | version | base generation(8) | body length(4) | records
+constexpr uint8_t STATE_MAGIC[4] = { 'S','C','R','S' };
+constexpr uint8_t DELTA_MAGIC[4] = { 'S','C','R','D' };
+constexpr uint8_t STATE_VERSION = 2;    // 1 is the original unversioned layout
+constexpr uint8_t DELTA_VERSION = 1;
+constexpr size_t LEGACY_STATE_BYTES = 32 * 3 + 4 + 4 + 32 + 32;
+constexpr size_t DELTA_HEADER_BYTES = 4 + 1 + 8 + 4;
+
+enum DeltaRecord : uint8_t {
+    DELTA_ROOT = 1,         // root(32)
+    DELTA_SEND_CHAIN,       // chain(32) counter(4)
+    DELTA_RECV_CHAIN,       // chain(32) counter(4)
+    DELTA_REMOTE_PUB,       // present(1) [pub(32)]
+    DELTA_SESSION_ID,       // len(2) id
+    DELTA_PEER_CAPS,        // caps(1)
+    DELTA_CONFIG,           // nonce mode(1) suite(1) max_skip(4) capacity(4)
+    DELTA_SKIPPED_CLEAR,
+    DELTA_SKIPPED_ERASE,    // pub(32) index(4)
+    DELTA_SKIPPED_PUT,      // pub(32) index(4) key(32)
+};
+
+constexpr uint8_t PEER_CAP_EXTENDED_HEADER = 0x01;
+constexpr uint8_t PEER_CAP_COUNTER_NONCE = 0x02;
+constexpr uint8_t PEER_CAP_AES256GCM = 0x04;
+
+void push_be(std::vector<uint8_t>& out, uint64_t v, size_t bytes) {
+    for (size_t i = bytes; i-- > 0;) out.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+template <typename Key>
+void push_key(std::vector<uint8_t>& out, const Key& key) {
+    out.insert(out.end(), key.begin(), key.end());
+}
+
+void push_session_id(std::vector<uint8_t>& out, const std::vector<uint8_t>& session_id) {
+    if (session_id.size() > UINT16_MAX) throw std::runtime_error("export_state: session id too long");
+    push_be(out, session_id.size(), 2);
+    out.insert(out.end(), session_id.begin(), session_id.end());
 }
+
+// Bounds-checked big-endian reader over a snapshot or delta
+class StateReader {
+public:
+    StateReader(std::span<const uint8_t> in, const char* what) : in_(in), what_(what) {}
+
+    std::span<const uint8_t> bytes(size_t n) {
+        if (n > in_.size() - off_) throw std::runtime_error(std::string(what_) + ": truncated");
+        auto out = in_.subspan(off_, n);
+        off_ += n;
+        return out;
+    }
+    uint64_t be(size_t n) {
+        uint64_t v = 0;
+        for (uint8_t b : bytes(n)) v = (v << 8) | b;
+        return v;
+    }
+    uint8_t u8() { return bytes(1)[0]; }
+    bool done() const { return off_ == in_.size(); }
+
+private:
+    std::span<const uint8_t> in_;
+    const char* what_;
+    size_t off_ = 0;
+};
+
+} // namespace
+
 std::vector<uint8_t> Ratchet::export_state() const {
     std::vector<uint8_t> s;
-    s.insert(s.end(), root_key_.begin(), root_key_.end());
-    s.insert(s.end(), send_chain_key_.begin(), send_chain_key_.end());
-    s.insert(s.end(), recv_chain_key_.begin(), recv_chain_key_.end());
+    s.reserve(256 + session_id_.size() + skipped_keys_.size() * (32 + 4 + 32));
+    s.insert(s.end(), std::begin(STATE_MAGIC), std::end(STATE_MAGIC));
+    s.push_back(STATE_VERSION);
+    push_be(s, state_generation_, 8);
+
+    push_key(s, root_key_);
+    push_key(s, send_chain_key_);
+    push_key(s, recv_chain_key_);
     push_u32_be(s, send_message_number_);
     push_u32_be(s, recv_message_number_);
-    s.insert(s.end(), dh_private_key_.begin(), dh_private_key_.end());
-    s.insert(s.end(), dh_public_key_.begin(), dh_public_key_.end());
+    push_key(s, dh_private_key_);
+    push_key(s, dh_public_key_);
+
+    s.push_back(last_remote_pub_ ? 1 : 0);
+    if (last_remote_pub_) push_key(s, *last_remote_pub_);
+    push_session_id(s, session_id_);
+    s.push_back((peer_extended_header_ ? PEER_CAP_EXTENDED_HEADER : 0) |
+                (peer_counter_nonce_ ? PEER_CAP_COUNTER_NONCE : 0) |
+                (peer_aes256gcm_ ? PEER_CAP_AES256GCM : 0));
+
+    s.push_back(static_cast<uint8_t>(nonce_mode_));
+    s.push_back(static_cast<uint8_t>(suite_));
+    push_u32_be(s, max_skip_);
+    push_u32_be(s, static_cast<uint32_t>(skipped_keys_.capacity()));
+
+    // Oldest first, so an import rebuilds the same LRU order
+    push_u32_be(s, static_cast<uint32_t>(skipped_keys_.size()));
+    skipped_keys_.for_each([&](const PublicKey32& pub, uint32_t index, const LockedKey32& key) {
+        push_key(s, pub);
+        push_u32_be(s, index);
+        push_key(s, key);
+    });
     return s;
 }
 
 void Ratchet::import_state(const std::vector<uint8_t>& state) {
-    size_t need = 32 + 32 + 32 + 4 + 4 + crypto_scalarmult_BYTES + crypto_scalarmult_BYTES;
-    if (state.size() < need) throw std::runtime_error("import_state: too small");
-    size_t off = 0;
-    root_key_ = std::vector<uint8_t>(state.begin()+off, state.begin()+off+32); off += 32;
-    send_chain_key_ = std::vector<uint8_t>(state.begin()+off, state.begin()+off+32); off += 32;
-    recv_chain_key_ = std::vector<uint8_t>(state.begin()+off, state.begin()+off+32); off += 32;
-    send_message_number_ = read_u32_be(state, off);
-    recv_message_number_ = read_u32_be(state, off);
-    dh_private_key_ = std::vector<uint8_t>(state.begin()+off, state.begin()+off+crypto_scalarmult_BYTES); off += crypto_scalarmult_BYTES;
-    dh_public_key_ = std::vector<uint8_t>(state.begin()+off, state.begin()+off+crypto_scalarmult_BYTES); off += crypto_scalarmult_BYTES;
+    const bool versioned = state.size() >= sizeof(STATE_MAGIC) &&
+                           std::equal(std::begin(STATE_MAGIC), std::end(STATE_MAGIC), state.begin());
+    if (!versioned) {
+        // Original layout: keys, counters and DH keypair only
+        if (state.size() < LEGACY_STATE_BYTES) throw std::runtime_error("import_state: too small");
+        size_t off = 0;
+        std::span<const uint8_t> in(state);
+        root_key_.assign(in.subspan(off, 32)); off += 32;
+        send_chain_key_.assign(in.subspan(off, 32)); off += 32;
+        recv_chain_key_.assign(in.subspan(off, 32)); off += 32;
+        send_message_number_ = read_u32_be(state, off);
+        recv_message_number_ = read_u32_be(state, off);
+        dh_private_key_.assign(in.subspan(off, crypto_scalarmult_BYTES)); off += crypto_scalarmult_BYTES;
+        dh_public_key_.assign(in.subspan(off, crypto_scalarmult_BYTES)); off += crypto_scalarmult_BYTES;
+        drop_send_key_window();
+        root_epoch_++;
+        aead_.set_key(send_chain_key_);
+        last_remote_pub_.reset();
+        reset_journal();
+        return;
+    }
+
+    // Parse everything before touching the ratchet, so a bad blob leaves it intact
+    StateReader r(state, "import_state");
+    r.bytes(sizeof(STATE_MAGIC));
+    if (r.u8() != STATE_VERSION) throw std::runtime_error("import_state: unsupported version");
+    const uint64_t generation = r.be(8);
+
+    LockedKey32 root(r.bytes(32));
+    LockedKey32 send_chain(r.bytes(32));
+    LockedKey32 recv_chain(r.bytes(32));
+    const uint32_t send_n = static_cast<uint32_t>(r.be(4));
+    const uint32_t recv_n = static_cast<uint32_t>(r.be(4));
+    LockedKey32 dh_priv(r.bytes(32));
+    PublicKey32 dh_pub(r.bytes(32));
+
+    std::optional<PublicKey32> remote;
+    if (r.u8()) remote.emplace(r.bytes(32));
+    auto sid = r.bytes(r.be(2));
+    const uint8_t caps = r.u8();
+
+    const auto mode = static_cast<AEAD::NonceMode>(r.u8());
+    const auto suite = static_cast<CipherSuite>(r.u8());
+    const uint32_t max_skip = static_cast<uint32_t>(r.be(4));
+    const uint32_t capacity = static_cast<uint32_t>(r.be(4));
+
+    SkippedKeyCache skipped(capacity);
+    const uint32_t count = static_cast<uint32_t>(r.be(4));
+    for (uint32_t i = 0; i < count; i++) {
+        PublicKey32 pub(r.bytes(32));
+        const uint32_t index = static_cast<uint32_t>(r.be(4));
+        skipped.put(pub, index, r.bytes(32));
+    }
+    if (!r.done()) throw std::runtime_error("import_state: trailing bytes");
+
+    root_key_ = std::move(root);
+    send_chain_key_ = std::move(send_chain);
+    recv_chain_key_ = std::move(recv_chain);
+    send_message_number_ = send_n;
+    recv_message_number_ = recv_n;
+    dh_private_key_ = std::move(dh_priv);
+    dh_public_key_ = dh_pub;
+    last_remote_pub_ = remote;
+    session_id_.assign(sid.begin(), sid.end());
+    peer_extended_header_ = (caps & PEER_CAP_EXTENDED_HEADER) != 0;
+    peer_counter_nonce_ = (caps & PEER_CAP_COUNTER_NONCE) != 0;
+    peer_aes256gcm_ = (caps & PEER_CAP_AES256GCM) != 0;
+    nonce_mode_ = mode == AEAD::NonceMode::Counter ? AEAD::NonceMode::Counter : AEAD::NonceMode::Random;
+    // A suite this host cannot run (e.g. AES-GCM without hardware support) falls back to the default
+    if (cipher_suite_available(suite)) suite_ = suite;
+    max_skip_ = max_skip;
+    skipped_keys_ = std::move(skipped);
+    drop_send_key_window();
+    root_epoch_++;
+    aead_.set_key(send_chain_key_);
+    state_generation_ = generation;
+    reset_journal();
+}
+
+void Ratchet::set_delta_tracking(bool enabled) {
+    track_deltas_ = enabled;
+    reset_journal();
+}
+
+void Ratchet::reset_journal() {
+    dirty_ = 0;
+    skipped_changes_.clear();
+}
+
+std::vector<uint8_t> Ratchet::export_state_delta() {
+    if (!track_deltas_) throw std::runtime_error("export_state_delta: delta tracking is off");
+
+    std::vector<uint8_t> d;
+    d.insert(d.end(), std::begin(DELTA_MAGIC), std::end(DELTA_MAGIC));
+    d.push_back(DELTA_VERSION);
+    push_be(d, state_generation_, 8);
+    push_be(d, 0, 4);    // body length, patched below
+
+    if (dirty_ & DIRTY_CONFIG) {
+        d.push_back(DELTA_CONFIG);
+        d.push_back(static_cast<uint8_t>(nonce_mode_));
+        d.push_back(static_cast<uint8_t>(suite_));
+        push_u32_be(d, max_skip_);
+        push_u32_be(d, static_cast<uint32_t>(skipped_keys_.capacity()));
+    }
+    if (dirty_ & DIRTY_ROOT) {
+        d.push_back(DELTA_ROOT);
+        push_key(d, root_key_);
+    }
+    if (dirty_ & DIRTY_SEND_CHAIN) {
+        d.push_back(DELTA_SEND_CHAIN);
+        push_key(d, send_chain_key_);
+        push_u32_be(d, send_message_number_);
+    }
+    if (dirty_ & DIRTY_RECV_CHAIN) {
+        d.push_back(DELTA_RECV_CHAIN);
+        push_key(d, recv_chain_key_);
+        push_u32_be(d, recv_message_number_);
+    }
+    if (dirty_ & DIRTY_REMOTE_PUB) {
+        d.push_back(DELTA_REMOTE_PUB);
+        d.push_back(last_remote_pub_ ? 1 : 0);
+        if (last_remote_pub_) push_key(d, *last_remote_pub_);
+    }
+    if (dirty_ & DIRTY_SESSION_ID) {
+        d.push_back(DELTA_SESSION_ID);
+        push_session_id(d, session_id_);
+    }
+    if (dirty_ & DIRTY_PEER_CAPS) {
+        d.push_back(DELTA_PEER_CAPS);
+        d.push_back((peer_extended_header_ ? PEER_CAP_EXTENDED_HEADER : 0) |
+                    (peer_counter_nonce_ ? PEER_CAP_COUNTER_NONCE : 0) |
+                    (peer_aes256gcm_ ? PEER_CAP_AES256GCM : 0));
+    }
+
+    // Skipped keys: net effect only. Erases go first so a replica never has to
+    // evict on its own, then every key put since the last delta that is still cached.
+    if (dirty_ & DIRTY_SKIPPED_CLEAR) d.push_back(DELTA_SKIPPED_CLEAR);
+    for (const auto& c : skipped_changes_) {
+        if (!c.erased) continue;
+        d.push_back(DELTA_SKIPPED_ERASE);
+        push_key(d, c.id.remote_pub);
+        push_u32_be(d, c.id.index);
+    }
+    for (const auto& c : skipped_changes_) {
+        if (c.erased) continue;
+        const LockedKey32* key = skipped_keys_.peek(c.id.remote_pub, c.id.index);
+        if (!key) continue;
+        d.push_back(DELTA_SKIPPED_PUT);
+        push_key(d, c.id.remote_pub);
+        push_u32_be(d, c.id.index);
+        push_key(d, *key);
+    }
+
+    const uint64_t body = d.size() - DELTA_HEADER_BYTES;
+    for (size_t i = 0; i < 4; i++) d[DELTA_HEADER_BYTES - 4 + i] = static_cast<uint8_t>(body >> (8 * (3 - i)));
+
+    state_generation_++;
+    reset_journal();
+    return d;
+}
+
+void Ratchet::apply_state_delta(const std::vector<uint8_t>& delta) {
+    StateReader header(delta, "apply_state_delta");
+    auto magic = header.bytes(sizeof(DELTA_MAGIC));
+    if (!std::equal(magic.begin(), magic.end(), std::begin(DELTA_MAGIC)))
+        throw std::runtime_error("apply_state_delta: not a ratchet delta");
+    if (header.u8() != DELTA_VERSION) throw std::runtime_error("apply_state_delta: unsupported version");
+    const uint64_t base = header.be(8);
+    if (base != state_generation_) throw std::runtime_error("apply_state_delta: generation mismatch");
+    if (header.be(4) != delta.size() - DELTA_HEADER_BYTES) throw std::runtime_error("apply_state_delta: truncated");
+
+    // Two passes over the records: validate everything, then apply, so a torn
+    // delta never leaves the ratchet half-updated
+    auto walk = [&](bool apply) {
+        StateReader r(std::span<const uint8_t>(delta).subspan(DELTA_HEADER_BYTES), "apply_state_delta");
+        size_t final_capacity = skipped_keys_.capacity();
+        while (!r.done()) {
+            switch (r.u8()) {
+            case DELTA_CONFIG: {
+                const auto mode = static_cast<AEAD::NonceMode>(r.u8());
+                const auto suite = static_cast<CipherSuite>(r.u8());
+                const uint32_t max_skip = static_cast<uint32_t>(r.be(4));
+                const uint32_t capacity = static_cast<uint32_t>(r.be(4));
+                if (capacity == 0) throw std::runtime_error("apply_state_delta: bad capacity");
+                if (!apply) break;
+                nonce_mode_ = mode == AEAD::NonceMode::Counter ? AEAD::NonceMode::Counter : AEAD::NonceMode::Random;
+                if (cipher_suite_available(suite)) suite_ = suite;
+                max_skip_ = max_skip;
+                // Never shrink ahead of the skipped-key records, which already carry the evictions
+                final_capacity = capacity;
+                if (capacity > skipped_keys_.capacity()) skipped_keys_.set_capacity(capacity);
+                break;
+            }
+            case DELTA_ROOT: {
+                auto root = r.bytes(32);
+                if (apply) root_key_.assign(root);
+                break;
+            }
+            case DELTA_SEND_CHAIN: {
+                auto chain = r.bytes(32);
+                const uint32_t n = static_cast<uint32_t>(r.be(4));
+                if (apply) { send_chain_key_.assign(chain); send_message_number_ = n; }
+                break;
+            }
+            case DELTA_RECV_CHAIN: {
+                auto chain = r.bytes(32);
+                const uint32_t n = static_cast<uint32_t>(r.be(4));
+                if (apply) { recv_chain_key_.assign(chain); recv_message_number_ = n; }
+                break;
+            }
+            case DELTA_REMOTE_PUB: {
+                std::optional<PublicKey32> remote;
+                if (r.u8()) remote.emplace(r.bytes(32));
+                if (apply) last_remote_pub_ = remote;
+                break;
+            }
+            case DELTA_SESSION_ID: {
+                auto sid = r.bytes(r.be(2));
+                if (apply) session_id_.assign(sid.begin(), sid.end());
+                break;
+            }
+            case DELTA_PEER_CAPS: {
+                const uint8_t caps = r.u8();
+                if (!apply) break;
+                peer_extended_header_ = (caps & PEER_CAP_EXTENDED_HEADER) != 0;
+                peer_counter_nonce_ = (caps & PEER_CAP_COUNTER_NONCE) != 0;
+                peer_aes256gcm_ = (caps & PEER_CAP_AES256GCM) != 0;
+                break;
+            }
+            case DELTA_SKIPPED_CLEAR:
+                if (apply) skipped_keys_.clear();
+                break;
+            case DELTA_SKIPPED_ERASE: {
+                PublicKey32 pub(r.bytes(32));
+                const uint32_t index = static_cast<uint32_t>(r.be(4));
+                if (apply) skipped_keys_.erase(pub, index);
+                break;
+            }
+            case DELTA_SKIPPED_PUT: {
+                PublicKey32 pub(r.bytes(32));
+                const uint32_t index = static_cast<uint32_t>(r.be(4));
+                auto key = r.bytes(32);
+                if (apply) skipped_keys_.put(pub, index, key);
+                break;
+            }
+            default:
+                throw std::runtime_error("apply_state_delta: unknown record");
+            }
+        }
+        if (apply && final_capacity != skipped_keys_.capacity()) skipped_keys_.set_capacity(final_capacity);
+    };
+    walk(false);
+    walk(true);
+    drop_send_key_window();
+    root_epoch_++;
+
     aead_.set_key(send_chain_key_);
-    last_remote_pub_.clear();
+    state_generation_ = base + 1;
+    reset_journal();
 }
 
 } // namespace securecomm
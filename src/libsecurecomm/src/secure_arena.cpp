@@ -0,0 +1,119 @@
+#include "securecomm/secure_arena.hpp"
+#include "securecomm/secure_key.hpp"
+#include <sodium.h>
+#include <new>
+#include <cstring>
+#include <stdexcept>
+
+namespace securecomm {
+
+static_assert(SecureArena::SLOT_BYTES >= sizeof(void*), "slot too small for the free list");
+
+SecureArena& SecureArena::global() {
+    // Never destroyed, so keys owned by other statics can still be released at exit
+    static SecureArena* arena = new SecureArena();
+    return *arena;
+}
+
+uint8_t* SecureArena::allocate() {
+    std::lock_guard<std::mutex> lk(mutex_);
+    if (!free_) {
+        if (sodium_init() < 0) throw std::runtime_error("libsodium init failed");
+        auto* block = static_cast<uint8_t*>(sodium_malloc(BLOCK_BYTES));
+        if (!block) throw std::bad_alloc();
+        blocks_.push_back(block);
+        // Thread the new block onto the free list back to front so slots are handed out in address order
+        for (size_t i = SLOTS_PER_BLOCK; i-- > 0;) {
+            auto* slot = reinterpret_cast<FreeSlot*>(block + i * SLOT_BYTES);
+            slot->next = free_;
+            free_ = slot;
+        }
+    }
+    FreeSlot* slot = free_;
+    free_ = slot->next;
+    in_use_++;
+    auto* bytes = reinterpret_cast<uint8_t*>(slot);
+    sodium_memzero(bytes, SLOT_BYTES);
+    return bytes;
+}
+
+void SecureArena::release(uint8_t* slot) {
+    if (!slot) return;
+    sodium_memzero(slot, SLOT_BYTES);
+    std::lock_guard<std::mutex> lk(mutex_);
+    auto* free_slot = reinterpret_cast<FreeSlot*>(slot);
+    free_slot->next = free_;
+    free_ = free_slot;
+    in_use_--;
+}
+
+size_t SecureArena::slots_in_use() const {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return in_use_;
+}
+
+size_t SecureArena::blocks() const {
+    std::lock_guard<std::mutex> lk(mutex_);
+    return blocks_.size();
+}
+
+LockedKey32::LockedKey32()
+    : slot_(SecureArena::global().allocate()) {}
+
+LockedKey32::LockedKey32(std::span<const uint8_t> bytes)
+    : LockedKey32() {
+    assign(bytes);
+}
+
+LockedKey32::LockedKey32(const LockedKey32& other)
+    : LockedKey32() {
+    if (other.slot_) memcpy(slot_, other.slot_, BYTES);
+}
+
+LockedKey32::LockedKey32(LockedKey32&& other) noexcept
+    : slot_(other.slot_) {
+    other.slot_ = nullptr;
+}
+
+LockedKey32& LockedKey32::operator=(const LockedKey32& other) {
+    if (this == &other) return *this;
+    if (other.slot_) {
+        memcpy(slot(), other.slot_, BYTES);
+    } else {
+        clear();
+    }
+    return *this;
+}
+
+LockedKey32& LockedKey32::operator=(LockedKey32&& other) noexcept {
+    if (this == &other) return *this;
+    SecureArena::global().release(slot_);
+    slot_ = other.slot_;
+    other.slot_ = nullptr;
+    return *this;
+}
+
+LockedKey32::~LockedKey32() {
+    SecureArena::global().release(slot_);
+}
+
+void LockedKey32::assign(std::span<const uint8_t> bytes) {
+    if (bytes.size() != BYTES) throw std::runtime_error("key must be 32 bytes");
+    memcpy(slot(), bytes.data(), BYTES);
+}
+
+void LockedKey32::clear() {
+    if (slot_) sodium_memzero(slot_, BYTES);
+}
+
+uint8_t* LockedKey32::slot() {
+    if (!slot_) slot_ = SecureArena::global().allocate();
+    return slot_;
+}
+
+bool LockedKey32::operator==(const LockedKey32& other) const {
+    static const uint8_t zero[BYTES] = {};
+    return secure_equal(slot_ ? slot_ : zero, other.slot_ ? other.slot_ : zero, BYTES);
+}
+
+} // namespace securecomm
@@ -0,0 +1,14 @@
+#include "securecomm/secure_key.hpp"
+#include <sodium.h>
+
+namespace securecomm {
+
+void secure_zero(void* data, size_t len) {
+    sodium_memzero(data, len);
+}
+
+bool secure_equal(const void* a, const void* b, size_t len) {
+    return sodium_memcmp(a, b, len) == 0;
+}
+
+} // namespace securecomm
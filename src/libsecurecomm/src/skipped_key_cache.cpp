@@ -0,0 +1,192 @@
+#include "securecomm/skipped_key_cache.hpp"
+#include "securecomm/random.hpp"
+#include <cstring>
+#include <stdexcept>
+
+namespace securecomm {
+
+namespace {
+
+uint64_t mix64(uint64_t x) {
+    // splitmix64 finalizer
+    x ^= x >> 30; x *= 0xbf58476d1ce4e5b9ull;
+    x ^= x >> 27; x *= 0x94d049bb133111ebull;
+    x ^= x >> 31;
+    return x;
+}
+
+} // namespace
+
+SkippedKeyCache::SkippedKeyCache(size_t capacity)
+    : capacity_(capacity) {
+    if (capacity_ == 0) throw std::runtime_error("skipped key capacity must be non-zero");
+    random_bytes(&seed_, sizeof(seed_));
+}
+
+uint32_t SkippedKeyCache::hash_of(const PublicKey32& remote_pub, uint32_t index) const {
+    uint64_t a, b;
+    memcpy(&a, remote_pub.data(), 8);
+    memcpy(&b, remote_pub.data() + 8, 8);
+    return static_cast<uint32_t>(mix64(seed_ ^ a ^ mix64(b ^ index)));
+}
+
+size_t SkippedKeyCache::max_slots() const {
+    size_t n = MIN_SLOTS;
+    while (n < capacity_ * 2) n <<= 1;
+    return n;
+}
+
+uint32_t SkippedKeyCache::locate(const PublicKey32& remote_pub, uint32_t index, uint32_t hash) const {
+    if (slots_.empty()) return NIL;
+    const size_t mask = slots_.size() - 1;
+    for (size_t i = hash & mask;; i = (i + 1) & mask) {
+        const Slot& s = slots_[i];
+        if (!s.used) return NIL;
+        if (s.hash == hash && s.index == index && s.pub == remote_pub) return static_cast<uint32_t>(i);
+    }
+}
+
+void SkippedKeyCache::link_back(uint32_t i) {
+    slots_[i].prev = mru_;
+    slots_[i].next = NIL;
+    if (mru_ != NIL) slots_[mru_].next = i; else lru_ = i;
+    mru_ = i;
+}
+
+void SkippedKeyCache::unlink(uint32_t i) {
+    Slot& s = slots_[i];
+    if (s.prev != NIL) slots_[s.prev].next = s.next; else lru_ = s.next;
+    if (s.next != NIL) slots_[s.next].prev = s.prev; else mru_ = s.prev;
+    s.prev = s.next = NIL;
+}
+
+void SkippedKeyCache::move_slot(uint32_t from, uint32_t to) {
+    Slot& src = slots_[from];
+    Slot& dst = slots_[to];
+    dst.pub = src.pub;
+    dst.index = src.index;
+    dst.hash = src.hash;
+    dst.prev = src.prev;
+    dst.next = src.next;
+    dst.used = true;
+    dst.key = std::move(src.key);
+    if (dst.prev != NIL) slots_[dst.prev].next = to; else lru_ = to;
+    if (dst.next != NIL) slots_[dst.next].prev = to; else mru_ = to;
+    src.key.reset();
+    src.used = false;
+    src.prev = src.next = NIL;
+}
+
+void SkippedKeyCache::remove_at(uint32_t i) {
+    unlink(i);
+    slots_[i].key.reset();    // wipes and returns the arena slot
+    slots_[i].used = false;
+    size_--;
+
+    // Backward-shift deletion: pull later members of the probe run into the hole
+    const size_t mask = slots_.size() - 1;
+    uint32_t hole = i;
+    for (uint32_t j = (i + 1) & mask; slots_[j].used; j = (j + 1) & mask) {
+        const size_t home = slots_[j].hash & mask;
+        if (((j - home) & mask) >= ((j - hole) & mask)) {
+            move_slot(j, hole);
+            hole = j;
+        }
+    }
+}
+
+void SkippedKeyCache::grow() {
+    std::vector<Slot> old = std::move(slots_);
+    uint32_t walk = lru_;
+    slots_ = std::vector<Slot>(old.empty() ? MIN_SLOTS : old.size() * 2);
+    lru_ = mru_ = NIL;
+
+    // Reinsert oldest first so the LRU order survives
+    const size_t mask = slots_.size() - 1;
+    while (walk != NIL) {
+        Slot& s = old[walk];
+        size_t i = s.hash & mask;
+        while (slots_[i].used) i = (i + 1) & mask;
+        Slot& d = slots_[i];
+        d.pub = s.pub;
+        d.index = s.index;
+        d.hash = s.hash;
+        d.used = true;
+        d.key = std::move(s.key);
+        link_back(static_cast<uint32_t>(i));
+        walk = s.next;
+    }
+}
+
+std::optional<SkippedKeyCache::KeyId> SkippedKeyCache::put(const PublicKey32& remote_pub, uint32_t index,
+                                                          std::span<const uint8_t> key) {
+    const uint32_t hash = hash_of(remote_pub, index);
+    uint32_t i = locate(remote_pub, index, hash);
+    if (i != NIL) {
+        slots_[i].key->assign(key);
+        unlink(i);
+        link_back(i);
+        return std::nullopt;
+    }
+
+    std::optional<KeyId> evicted;
+    if (size_ >= capacity_) {
+        evicted = KeyId{slots_[lru_].pub, slots_[lru_].index};
+        remove_at(lru_);
+        evictions_++;
+    }
+    if ((size_ + 1) * 2 > slots_.size() && slots_.size() < max_slots()) grow();
+
+    const size_t mask = slots_.size() - 1;
+    size_t pos = hash & mask;
+    while (slots_[pos].used) pos = (pos + 1) & mask;
+    Slot& s = slots_[pos];
+    s.pub = remote_pub;
+    s.index = index;
+    s.hash = hash;
+    s.used = true;
+    s.key.emplace(key);
+    link_back(static_cast<uint32_t>(pos));
+    size_++;
+    return evicted;
+}
+
+const LockedKey32* SkippedKeyCache::find(const PublicKey32& remote_pub, uint32_t index) {
+    uint32_t i = locate(remote_pub, index, hash_of(remote_pub, index));
+    if (i == NIL) return nullptr;
+    unlink(i);
+    link_back(i);
+    return &*slots_[i].key;
+}
+
+const LockedKey32* SkippedKeyCache::peek(const PublicKey32& remote_pub, uint32_t index) const {
+    uint32_t i = locate(remote_pub, index, hash_of(remote_pub, index));
+    return i == NIL ? nullptr : &*slots_[i].key;
+}
+
+bool SkippedKeyCache::erase(const PublicKey32& remote_pub, uint32_t index) {
+    uint32_t i = locate(remote_pub, index, hash_of(remote_pub, index));
+    if (i == NIL) return false;
+    remove_at(i);
+    return true;
+}
+
+void SkippedKeyCache::clear() {
+    slots_.clear();
+    size_ = 0;
+    lru_ = mru_ = NIL;
+}
+
+std::vector<SkippedKeyCache::KeyId> SkippedKeyCache::set_capacity(size_t capacity) {
+    if (capacity == 0) throw std::runtime_error("skipped key capacity must be non-zero");
+    capacity_ = capacity;
+    std::vector<KeyId> evicted;
+    while (size_ > capacity_) {
+        evicted.push_back(KeyId{slots_[lru_].pub, slots_[lru_].index});
+        remove_at(lru_);
+        evictions_++;
+    }
+    return evicted;
+}
+
+} // namespace securecomm
@@ -0,0 +1,250 @@
+#include "securecomm/trace.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+namespace securecomm {
+
+namespace detail {
+std::atomic<bool> g_tracing{false};
+}
+
+namespace {
+
+struct TraceEvent {
+    uint64_t start;       // trace_ticks()
+    uint64_t duration;    // ticks; 0 for instant events
+    uint64_t session;
+    uint32_t index;
+    uint32_t thread;
+    const char* name;
+    std::atomic<bool> ready{false};    // set last, so readers never see a half-written event
+};
+
+struct TraceBuffer {
+    explicit TraceBuffer(size_t n)
+        : events(std::make_unique<TraceEvent[]>(n)), capacity(n),
+          origin_ticks(detail::trace_ticks()), origin_time(std::chrono::steady_clock::now()) {}
+
+    std::unique_ptr<TraceEvent[]> events;
+    const size_t capacity;
+    // Paired with a clock reading on export to turn ticks into nanoseconds
+    const uint64_t origin_ticks;
+    const std::chrono::steady_clock::time_point origin_time;
+    std::atomic<uint64_t> next{0};    // claimed slots, dropped events included
+};
+
+std::atomic<TraceBuffer*> g_buffer{nullptr};
+
+// A thread that saw tracing on may still be writing into a replaced buffer, so
+// buffers are kept until exit (and never destroyed, like the logger)
+std::mutex& buffers_mutex() {
+    static auto* m = new std::mutex;
+    return *m;
+}
+std::vector<std::unique_ptr<TraceBuffer>>& all_buffers() {
+    static auto* v = new std::vector<std::unique_ptr<TraceBuffer>>;
+    return *v;
+}
+
+uint32_t trace_thread_id() {
+    static std::atomic<uint32_t> next_id{1};
+    thread_local uint32_t id = 0;    // constant-initialised, so no TLS guard on the hot path
+    if (id == 0) id = next_id.fetch_add(1, std::memory_order_relaxed);
+    return id;
+}
+
+// Nanoseconds per trace tick, measured against steady_clock over the life of the
+// buffer (at least 10 ms, waiting out the remainder if tracing was shorter)
+double ns_per_tick(const TraceBuffer& b) {
+#if SECURECOMM_TRACE_TSC
+    constexpr auto MIN_SPAN = std::chrono::milliseconds(10);
+    auto now = std::chrono::steady_clock::now();
+    while (now - b.origin_time < MIN_SPAN) now = std::chrono::steady_clock::now();
+    const uint64_t ticks = detail::trace_ticks() - b.origin_ticks;
+    return double(std::chrono::duration_cast<std::chrono::nanoseconds>(now - b.origin_time).count()) / double(ticks);
+#else
+    (void)b;
+    return 1.0;
+#endif
+}
+
+uint64_t read_be(const uint8_t* p, size_t n) {
+    uint64_t v = 0;
+    for (size_t i = 0; i < n; i++) v = (v << 8) | p[i];
+    return v;
+}
+
+void append_uint(std::string& out, uint64_t v) {
+    char buf[24];
+    auto res = std::to_chars(buf, buf + sizeof(buf), v);
+    out.append(buf, res.ptr);
+}
+
+// Chrome timestamps are microseconds; keep nanosecond precision as a fraction
+void append_us(std::string& out, uint64_t ns) {
+    append_uint(out, ns / 1000);
+    char frac[4] = {'.', char('0' + ns / 100 % 10), char('0' + ns / 10 % 10), char('0' + ns % 10)};
+    out.append(frac, 4);
+}
+
+void append_hex(std::string& out, uint64_t v) {
+    static const char digits[] = "0123456789abcdef";
+    for (int shift = 60; shift >= 0; shift -= 4) out.push_back(digits[(v >> shift) & 0xF]);
+}
+
+struct Recorded {
+    uint64_t start_ns;    // since the buffer was created
+    uint64_t dur_ns;
+    uint64_t session;
+    uint32_t index;
+    uint32_t thread;
+    const char* name;
+};
+
+void append_event_head(std::string& out, const char* name, const char* cat, const char* phase,
+                       uint64_t ts_ns, uint32_t thread) {
+    out += "{\"name\":\"";
+    out += name;
+    out += "\",\"cat\":\"";
+    out += cat;
+    out += "\",\"ph\":\"";
+    out += phase;
+    out += "\",\"pid\":1,\"tid\":";
+    append_uint(out, thread);
+    out += ",\"ts\":";
+    append_us(out, ts_ns);
+}
+
+} // namespace
+
+TraceKey TraceKey::of(std::span<const uint8_t> session_id, uint32_t message_index) {
+    return TraceKey{read_be(session_id.data(), std::min<size_t>(session_id.size(), 8)), message_index};
+}
+
+TraceKey TraceKey::of(std::string_view id) {
+    // FNV-1a
+    uint64_t h = 0xcbf29ce484222325ull;
+    for (char c : id) {
+        h ^= static_cast<uint8_t>(c);
+        h *= 0x100000001b3ull;
+    }
+    return TraceKey{h, 0};
+}
+
+void detail::trace_record(const char* name, TraceKey key, uint64_t start, uint64_t duration) {
+    TraceBuffer* b = g_buffer.load(std::memory_order_acquire);
+    if (!b) return;
+    const uint64_t slot = b->next.fetch_add(1, std::memory_order_relaxed);
+    if (slot >= b->capacity) return;
+    TraceEvent& e = b->events[slot];
+    e.start = start;
+    e.duration = duration;
+    e.session = key.session;
+    e.index = key.index;
+    e.thread = trace_thread_id();
+    e.name = name;
+    e.ready.store(true, std::memory_order_release);
+}
+
+void start_tracing(size_t capacity) {
+    std::lock_guard<std::mutex> lk(buffers_mutex());
+    auto buffer = std::make_unique<TraceBuffer>(std::max<size_t>(capacity, 1));
+    g_buffer.store(buffer.get(), std::memory_order_release);
+    all_buffers().push_back(std::move(buffer));
+    detail::g_tracing.store(true, std::memory_order_relaxed);
+}
+
+void stop_tracing() {
+    detail::g_tracing.store(false, std::memory_order_relaxed);
+}
+
+uint64_t trace_dropped() {
+    TraceBuffer* b = g_buffer.load(std::memory_order_acquire);
+    if (!b) return 0;
+    const uint64_t claimed = b->next.load(std::memory_order_relaxed);
+    return claimed > b->capacity ? claimed - b->capacity : 0;
+}
+
+std::string chrome_trace_json() {
+    std::vector<Recorded> events;
+    if (TraceBuffer* b = g_buffer.load(std::memory_order_acquire)) {
+        const double scale = ns_per_tick(*b);
+        const uint64_t n = std::min<uint64_t>(b->next.load(std::memory_order_relaxed), b->capacity);
+        events.reserve(n);
+        for (uint64_t i = 0; i < n; i++) {
+            const TraceEvent& e = b->events[i];
+            if (!e.ready.load(std::memory_order_acquire)) continue;    // still being written
+            // A scope opened before this buffer existed starts at its origin
+            const uint64_t since = e.start > b->origin_ticks ? e.start - b->origin_ticks : 0;
+            uint64_t dur = static_cast<uint64_t>(double(e.duration) * scale);
+            if (e.duration && dur == 0) dur = 1;    // keep it a complete event, not an instant
+            events.push_back({static_cast<uint64_t>(double(since) * scale), dur,
+                              e.session, e.index, e.thread, e.name});
+        }
+    }
+    std::sort(events.begin(), events.end(),
+              [](const Recorded& a, const Recorded& b) { return a.start_ns < b.start_ns; });
+
+    std::string out = "{\"displayTimeUnit\":\"ns\",\"otherData\":{\"dropped\":";
+    append_uint(out, trace_dropped());
+    out += "},\"traceEvents\":[";
+    bool first = true;
+    auto separator = [&] {
+        if (!first) out += ",\n";
+        first = false;
+    };
+
+    std::map<std::pair<uint64_t, uint32_t>, std::vector<size_t>> flows;
+    for (size_t i = 0; i < events.size(); i++) {
+        const Recorded& e = events[i];
+        separator();
+        append_event_head(out, e.name, "securecomm", e.dur_ns ? "X" : "i", e.start_ns, e.thread);
+        if (e.dur_ns) {
+            out += ",\"dur\":";
+            append_us(out, e.dur_ns);
+        } else {
+            out += ",\"s\":\"t\"";
+        }
+        out += ",\"args\":{\"session\":\"";
+        append_hex(out, e.session);
+        out += "\",\"index\":";
+        append_uint(out, e.index);
+        out += "}}";
+        if (e.session != 0 || e.index != 0) flows[{e.session, e.index}].push_back(i);
+    }
+
+    // Arrows from each event of a message to the next one, across threads
+    uint64_t flow_id = 0;
+    for (const auto& [key, members] : flows) {
+        if (members.size() < 2) continue;
+        flow_id++;
+        for (size_t m = 0; m < members.size(); m++) {
+            const Recorded& e = events[members[m]];
+            const char* phase = m == 0 ? "s" : (m + 1 == members.size() ? "f" : "t");
+            separator();
+            append_event_head(out, "message", "flow", phase, e.start_ns, e.thread);
+            out += ",\"id\":";
+            append_uint(out, flow_id);
+            if (m != 0) out += ",\"bp\":\"e\"";
+            out += "}";
+        }
+    }
+    out += "]}\n";
+    return out;
+}
+
+bool write_chrome_trace(const std::string& path) {
+    std::ofstream f(path, std::ios::binary | std::ios::trunc);
+    if (!f) return false;
+    const std::string json = chrome_trace_json();
+    f.write(json.data(), static_cast<std::streamsize>(json.size()));
+    return static_cast<bool>(f);
+}
+
+} // namespace securecomm
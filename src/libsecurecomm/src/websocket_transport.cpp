@@ -1,4 +1,7 @@
 #include "securecomm/transport.hpp"
+#include "securecomm/envelope.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/trace.hpp"
 #include <curl/curl.h>
 
 #include <thread>
@@ -6,10 +9,10 @@
 #include <queue>
 #include <condition_variable>
 #include <atomic>
-#include <iostream>
 #include <vector>
 #include <string>
 #include <memory>
+#include <span>
 #include <cstring>
 
 namespace securecomm {
@@ -25,20 +28,34 @@ static size_t curl_write_callback(void* contents, size_t size, size_t nmemb, voi
     return realsize;
 }
 
+// Request body handed to libcurl part by part, so a vectored frame goes into the
+// socket buffer without being joined first
+struct RequestBody {
+    std::span<const std::span<const uint8_t>> parts;
+    size_t part = 0;
+    size_t offset = 0;
+};
+
 // Callback for libcurl to read request data
 static size_t curl_read_callback(void* ptr, size_t size, size_t nmemb, void* userp) {
     size_t realsize = size * nmemb;
-    auto* buffer = static_cast<std::vector<uint8_t>*>(userp);
+    auto* body = static_cast<RequestBody*>(userp);
+    auto* out = static_cast<uint8_t*>(ptr);
     
-    if (buffer->empty()) {
-        return 0;
+    size_t copied = 0;
+    while (copied < realsize && body->part < body->parts.size()) {
+        const auto& part = body->parts[body->part];
+        size_t to_copy = std::min(realsize - copied, part.size() - body->offset);
+        if (to_copy) memcpy(out + copied, part.data() + body->offset, to_copy);
+        copied += to_copy;
+        body->offset += to_copy;
+        if (body->offset == part.size()) {
+            body->part++;
+            body->offset = 0;
+        }
     }
     
-    size_t to_copy = std::min(realsize, buffer->size());
-    memcpy(ptr, buffer->data(), to_copy);
-    buffer->erase(buffer->begin(), buffer->begin() + to_copy);
-    
-    return to_copy;
+    return copied;
 }
 
 class WebSocketClientTransport : public Transport {
@@ -61,11 +78,11 @@ public:
         curl_handle_ = curl_easy_init();
         
         if (!curl_handle_) {
-            std::cerr << "[WebSocket] Failed to initialize curl handle" << std::endl;
+            SC_LOG_ERROR("WebSocket", "Failed to initialize curl handle");
             throw std::runtime_error("Failed to initialize curl");
         }
         
-        std::cout << "[WebSocket] Initialized with URI: " << uri_ << std::endl;
+        SC_LOG_INFO("WebSocket", "Initialized with URI: " << uri_);
     }
     
     ~WebSocketClientTransport() {
@@ -83,7 +100,7 @@ public:
         // Start worker thread for sending
         send_thread_ = std::thread([this]() {
             while (running_) {
-                std::vector<uint8_t> data;
+                QueuedFrame frame;
                 {
                     std::unique_lock<std::mutex> lock(mutex_);
                     cond_.wait(lock, [this]() { 
@@ -93,21 +110,28 @@ public:
                     if (!running_) break;
                     
                     if (!send_queue_.empty()) {
-                        data = send_queue_.front();
+                        frame = std::move(send_queue_.front());
                         send_queue_.pop();
                     }
                 }
                 
-                if (!data.empty()) {
-                    send_impl(data);
+                if (frame.size != 0) {
+                    TraceScope trace("transport_send");
+                    if (trace.active()) {
+                        if (auto id = EnvelopeView::peek_id(frame.parts[0])) trace.set_key(TraceKey::of(id->session_id, id->message_index));
+                    }
+                    send_impl(frame);
                 }
             }
         });
         
         // Start worker thread for receiving
         receive_thread_ = std::thread([this]() {
+            std::vector<Bytes> batch;
             while (running_) {
-                std::vector<uint8_t> data;
+                Bytes data;
+                OnMessageCb on_message;
+                OnMessageBatchCb on_message_batch;
                 {
                     std::unique_lock<std::mutex> lock(mutex_);
                     cond_.wait(lock, [this]() { 
@@ -116,14 +140,25 @@ public:
                     
                     if (!running_) break;
                     
-                    if (!receive_queue_.empty()) {
-                        data = receive_queue_.front();
+                    on_message = on_message_;
+                    on_message_batch = on_message_batch_;
+                    if (on_message_batch) {
+                        // Everything queued goes over in one call
+                        while (!receive_queue_.empty()) {
+                            batch.push_back(std::move(receive_queue_.front()));
+                            receive_queue_.pop();
+                        }
+                    } else if (!receive_queue_.empty()) {
+                        data = std::move(receive_queue_.front());
                         receive_queue_.pop();
                     }
                 }
                 
-                if (!data.empty() && on_message_) {
-                    on_message_(data);
+                if (!batch.empty()) {
+                    on_message_batch(batch);
+                    batch.clear();
+                } else if (!data.empty() && on_message) {
+                    on_message(data);
                 }
             }
         });
@@ -133,7 +168,7 @@ public:
             poll_server();
         });
         
-        std::cout << "[WebSocket] Transport started, polling: " << uri_ << std::endl;
+        SC_LOG_INFO("WebSocket", "Transport started, polling: " << uri_);
     }
     
     void stop() override {
@@ -151,18 +186,39 @@ public:
             poll_thread_.join();
         }
         
-        std::cout << "[WebSocket] Transport stopped" << std::endl;
+        SC_LOG_INFO("WebSocket", "Transport stopped");
     }
     
     void send(const std::vector<uint8_t>& bytes) override {
-        std::lock_guard<std::mutex> lock(mutex_);
-        send_queue_.push(bytes);
-        cond_.notify_one();
+        auto owned = std::make_shared<const std::vector<uint8_t>>(bytes);
+        const std::span<const uint8_t> part(*owned);
+        enqueue(std::span<const std::span<const uint8_t>>(&part, 1), std::move(owned));
+    }
+
+    // Queues the parts themselves, kept alive by `owner`; the send thread streams
+    // them to curl. A batch frame from FrameBatcher arrives as many parts and is
+    // not joined either.
+    void send_iov(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner) override {
+        if (owner) {
+            enqueue(parts, std::move(owner));
+            return;
+        }
+        auto joined = std::make_shared<std::vector<uint8_t>>();
+        for (const auto& part : parts) joined->insert(joined->end(), part.begin(), part.end());
+        const std::span<const uint8_t> part(*joined);
+        enqueue(std::span<const std::span<const uint8_t>>(&part, 1), std::move(joined));
     }
     
     void set_on_message(OnMessageCb cb) override {
         std::lock_guard<std::mutex> lock(mutex_);
         on_message_ = cb;
+        on_message_batch_ = nullptr;
+    }
+
+    void set_on_message_batch(OnMessageBatchCb cb) override {
+        std::lock_guard<std::mutex> lock(mutex_);
+        on_message_batch_ = std::move(cb);
+        on_message_ = nullptr;
     }
     
     bool is_connected() const {
@@ -171,6 +227,22 @@ public:
     }
     
 private:
+    struct QueuedFrame {
+        std::vector<std::span<const uint8_t>> parts;
+        size_t size = 0;
+        std::shared_ptr<const void> owner;    // keeps the parts alive
+    };
+
+    void enqueue(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner) {
+        QueuedFrame frame;
+        frame.parts.assign(parts.begin(), parts.end());
+        for (const auto& part : parts) frame.size += part.size();
+        frame.owner = std::move(owner);
+        std::lock_guard<std::mutex> lock(mutex_);
+        send_queue_.push(std::move(frame));
+        cond_.notify_one();
+    }
+
     void poll_server() {
         int poll_interval = 1000; // Start at 1 second
         int max_poll_interval = 30000; // Max 30 seconds
@@ -180,21 +252,20 @@ private:
             try {
                 std::vector<uint8_t> response;
                 
-                if (perform_http_request("GET", uri_ + "/health", 
-                                        std::vector<uint8_t>(), response)) {
+                if (perform_http_request("GET", uri_ + "/health", {}, response)) {
                     connected_ = true;
                     poll_interval = 1000; // Reset to 1 second on success
-                    std::cout << "[WebSocket] Connected to server" << std::endl;
+                    SC_LOG_INFO("WebSocket", "Connected to server");
                 } else {
                     if (connected_) {
-                        std::cout << "[WebSocket] Lost connection to server" << std::endl;
+                        SC_LOG_WARN("WebSocket", "Lost connection to server");
                     }
                     connected_ = false;
                     // Exponential backoff
                     poll_interval = std::min(poll_interval * 2, max_poll_interval);
                 }
             } catch (const std::exception& e) {
-                std::cerr << "[WebSocket] Poll error: " << e.what() << std::endl;
+                SC_LOG_ERROR("WebSocket", "Poll error: " << e.what());
                 connected_ = false;
                 poll_interval = std::min(poll_interval * 2, max_poll_interval);
             }
@@ -203,9 +274,9 @@ private:
         }
     }
     
-    void send_impl(const std::vector<uint8_t>& data) {
+    void send_impl(const QueuedFrame& frame) {
         if (!connected_) {
-            std::cout << "[WebSocket] Cannot send: not connected" << std::endl;
+            SC_LOG_WARN("WebSocket", "Cannot send: not connected");
             return;
         }
         
@@ -213,20 +284,20 @@ private:
             std::vector<uint8_t> response;
             std::string endpoint = uri_ + "/message";
             
-            if (perform_http_request("POST", endpoint, data, response)) {
-                std::cout << "[WebSocket] Sent " << data.size() << " bytes" << std::endl;
+            if (perform_http_request("POST", endpoint, frame.parts, response)) {
+                SC_LOG_DEBUG("WebSocket", "Sent " << frame.size << " bytes");
             } else {
-                std::cerr << "[WebSocket] Send failed" << std::endl;
+                SC_LOG_ERROR("WebSocket", "Send failed");
             }
         } catch (const std::exception& e) {
-            std::cout << "[WebSocket] Send error: " << e.what() << std::endl;
+            SC_LOG_ERROR("WebSocket", "Send error: " << e.what());
             std::lock_guard<std::mutex> lock(mutex_);
             connected_ = false;
         }
     }
     
     bool perform_http_request(const std::string& method, const std::string& url,
-                             const std::vector<uint8_t>& request_data,
+                             std::span<const std::span<const uint8_t>> request_parts,
                              std::vector<uint8_t>& response_data) {
         if (!curl_handle_) {
             return false;
@@ -240,12 +311,20 @@ private:
         curl_easy_setopt(curl_handle_, CURLOPT_CONNECTTIMEOUT, 5L);
         
         // Set method
+        RequestBody body{request_parts};
         if (method == "POST") {
             curl_easy_setopt(curl_handle_, CURLOPT_POST, 1L);
             
-            if (!request_data.empty()) {
-                curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDS, request_data.data());
-                curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDSIZE, request_data.size());
+            size_t size = 0;
+            for (const auto& part : request_parts) size += part.size();
+            curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDSIZE_LARGE, static_cast<curl_off_t>(size));
+            if (request_parts.size() == 1) {
+                // One part: curl reads it in place
+                curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDS, request_parts[0].data());
+            } else {
+                curl_easy_setopt(curl_handle_, CURLOPT_POSTFIELDS, nullptr);
+                curl_easy_setopt(curl_handle_, CURLOPT_READFUNCTION, curl_read_callback);
+                curl_easy_setopt(curl_handle_, CURLOPT_READDATA, &body);
             }
         } else if (method == "GET") {
             curl_easy_setopt(curl_handle_, CURLOPT_HTTPGET, 1L);
@@ -263,8 +342,8 @@ private:
         CURLcode res = curl_easy_perform(curl_handle_);
         
         if (res != CURLE_OK) {
-            std::cerr << "[WebSocket] curl_easy_perform() failed: " 
-                      << curl_easy_strerror(res) << std::endl;
+            SC_LOG_ERROR("WebSocket", "curl_easy_perform() failed: " 
+                      << curl_easy_strerror(res));
             return false;
         }
         
@@ -273,7 +352,7 @@ private:
         curl_easy_getinfo(curl_handle_, CURLINFO_RESPONSE_CODE, &http_code);
         
         if (http_code != 200) {
-            std::cerr << "[WebSocket] HTTP error code: " << http_code << std::endl;
+            SC_LOG_ERROR("WebSocket", "HTTP error code: " << http_code);
             return false;
         }
         
@@ -287,9 +366,10 @@ private:
     
     mutable std::mutex mutex_;
     std::condition_variable cond_;
-    std::queue<std::vector<uint8_t>> send_queue_;
-    std::queue<std::vector<uint8_t>> receive_queue_;
+    std::queue<QueuedFrame> send_queue_;
+    std::queue<Bytes> receive_queue_;
     OnMessageCb on_message_;
+    OnMessageBatchCb on_message_batch_;
     
     std::thread send_thread_;
     std::thread receive_thread_;
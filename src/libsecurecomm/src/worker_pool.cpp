@@ -0,0 +1,183 @@
+#include "securecomm/worker_pool.hpp"
+
+#include <algorithm>
+#include <exception>
+#include <stdexcept>
+
+namespace securecomm {
+
+WorkerPool::WorkerPool(size_t threads) {
+    if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+    workers_.reserve(threads);
+    for (size_t i = 0; i < threads; i++) {
+        workers_.emplace_back([this] { run(); });
+    }
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        stopping_ = true;
+    }
+    cv_.notify_all();
+    for (auto& t : workers_) {
+        if (t.joinable()) t.join();
+    }
+}
+
+void WorkerPool::submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lk(mutex_);
+        tasks_.push(std::move(task));
+    }
+    cv_.notify_one();
+}
+
+void WorkerPool::run() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(mutex_);
+            cv_.wait(lk, [this] { return stopping_ || !tasks_.empty(); });
+            if (tasks_.empty()) return;
+            task = std::move(tasks_.front());
+            tasks_.pop();
+        }
+        task();
+    }
+}
+
+void WorkerPool::parallel_for(size_t count,
+                              const std::function<void(size_t, size_t)>& fn,
+                              size_t min_per_task) {
+    if (count == 0) return;
+    min_per_task = std::max<size_t>(1, min_per_task);
+    const size_t chunks = std::min(size() + 1, (count + min_per_task - 1) / min_per_task);
+    if (chunks <= 1) {
+        fn(0, count);
+        return;
+    }
+
+    struct Join {
+        std::mutex mutex;
+        std::condition_variable cv;
+        size_t remaining;
+        std::exception_ptr error;
+    } join;
+    join.remaining = chunks - 1;
+
+    const size_t per_chunk = count / chunks;
+    const size_t extra = count % chunks;
+    auto chunk_begin = [&](size_t c) { return c * per_chunk + std::min(c, extra); };
+
+    for (size_t c = 1; c < chunks; c++) {
+        const size_t begin = chunk_begin(c);
+        const size_t end = chunk_begin(c + 1);
+        submit([&join, &fn, begin, end] {
+            std::exception_ptr error;
+            try {
+                fn(begin, end);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lk(join.mutex);
+            if (error && !join.error) join.error = error;
+            if (--join.remaining == 0) join.cv.notify_one();
+        });
+    }
+
+    // The calling thread takes the first range instead of idling
+    std::exception_ptr local_error;
+    try {
+        fn(0, chunk_begin(1));
+    } catch (...) {
+        local_error = std::current_exception();
+    }
+
+    std::unique_lock<std::mutex> lk(join.mutex);
+    join.cv.wait(lk, [&join] { return join.remaining == 0; });
+    if (local_error) std::rethrow_exception(local_error);
+    if (join.error) std::rethrow_exception(join.error);
+}
+
+LanePool::LanePool(size_t lanes, size_t capacity)
+    : capacity_(capacity) {
+    if (capacity_ == 0) throw std::runtime_error("lane capacity must be non-zero");
+    if (lanes == 0) lanes = std::max(1u, std::thread::hardware_concurrency());
+    lanes_.reserve(lanes);
+    for (size_t i = 0; i < lanes; i++) lanes_.push_back(std::make_unique<Lane>());
+    for (auto& lane : lanes_) {
+        Lane* l = lane.get();
+        l->thread = std::thread([this, l] { run(*l); });
+    }
+}
+
+LanePool::~LanePool() {
+    for (auto& lane : lanes_) {
+        {
+            std::lock_guard<std::mutex> lk(lane->mutex);
+            lane->stopping = true;
+        }
+        lane->not_empty.notify_all();
+    }
+    for (auto& lane : lanes_) {
+        if (lane->thread.joinable()) lane->thread.join();
+    }
+}
+
+void LanePool::submit(size_t lane, std::function<void()> task) {
+    Lane& l = *lanes_.at(lane);
+    {
+        std::unique_lock<std::mutex> lk(l.mutex);
+        if (l.tasks.size() >= capacity_) {
+            l.stats.full_waits++;
+            l.not_full.wait(lk, [&] { return l.tasks.size() < capacity_; });
+        }
+        l.tasks.push_back(std::move(task));
+        l.stats.high_water = std::max(l.stats.high_water, l.tasks.size());
+    }
+    l.not_empty.notify_one();
+}
+
+bool LanePool::try_submit(size_t lane, std::function<void()>&& task) {
+    Lane& l = *lanes_.at(lane);
+    {
+        std::lock_guard<std::mutex> lk(l.mutex);
+        if (l.tasks.size() >= capacity_) return false;
+        l.tasks.push_back(std::move(task));
+        l.stats.high_water = std::max(l.stats.high_water, l.tasks.size());
+    }
+    l.not_empty.notify_one();
+    return true;
+}
+
+std::vector<LanePool::LaneStats> LanePool::stats() const {
+    std::vector<LaneStats> out;
+    out.reserve(lanes_.size());
+    for (const auto& lane : lanes_) {
+        std::lock_guard<std::mutex> lk(lane->mutex);
+        LaneStats s = lane->stats;
+        s.depth = lane->tasks.size();
+        out.push_back(s);
+    }
+    return out;
+}
+
+void LanePool::run(Lane& lane) {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lk(lane.mutex);
+            lane.not_empty.wait(lk, [&lane] { return lane.stopping || !lane.tasks.empty(); });
+            if (lane.tasks.empty()) return;
+            task = std::move(lane.tasks.front());
+            lane.tasks.pop_front();
+        }
+        lane.not_full.notify_one();
+        task();
+        std::lock_guard<std::mutex> lk(lane.mutex);
+        lane.stats.completed++;
+    }
+}
+
+} // namespace securecomm
@@ -1,8 +1,31 @@
 #include "securecomm/crypto.hpp"
+#include "securecomm/aead_batch.hpp"
+#include "securecomm/worker_pool.hpp"
+#include "securecomm/attachment.hpp"
+#include "securecomm/random.hpp"
+#include "securecomm/log.hpp"
+#include "securecomm/metrics.hpp"
+#include "securecomm/trace.hpp"
+#include "securecomm/envelope.hpp"
+#include "securecomm/bytes.hpp"
+#include "securecomm/frame_batcher.hpp"
+#include "securecomm/mls_manager.hpp"
 #include <iostream>
 #include <cassert>
 #include <sodium.h>
 #include <cstring>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <thread>
+#include <set>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/wait.h>
+#endif
 
 using namespace securecomm;
 
@@ -242,6 +265,1331 @@ void test_aead_tampering_detection() {
     }
 }
 
+// =============================================================================
+// Test: AEAD Span API (caller-provided buffers)
+// =============================================================================
+void test_aead_encrypt_into() {
+    std::cout << "Test: AEAD encrypt_into/decrypt_into... ";
+    
+    try {
+        AEAD aead;
+        std::vector<uint8_t> key(32);
+        randombytes_buf(key.data(), key.size());
+        aead.set_key(key);
+        
+        std::vector<uint8_t> plaintext = {'Z','e','r','o',' ','c','o','p','y'};
+        std::vector<uint8_t> aad = {'h','d','r'};
+        
+        std::vector<uint8_t> sealed(aead.ciphertext_size(plaintext.size()));
+        size_t written = aead.encrypt_into(plaintext, aad, sealed);
+        assert(written == sealed.size());
+        
+        // Interoperates with the vector API in both directions
+        auto via_vector = aead.decrypt(sealed, aad);
+        assert(via_vector.has_value() && via_vector.value() == plaintext);
+        
+        std::vector<uint8_t> opened(aead.plaintext_size(sealed.size()));
+        auto plen = aead.decrypt_into(sealed, aad, opened);
+        assert(plen.has_value() && *plen == plaintext.size());
+        assert(opened == plaintext);
+        
+        // Undersized output buffers are rejected rather than overrun
+        std::vector<uint8_t> short_out(plaintext.size() - 1);
+        assert(!aead.decrypt_into(sealed, aad, short_out).has_value());
+        
+        std::cout << "✓ Span API round-trip with caller buffers" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: AEAD In-Place Decryption
+// =============================================================================
+void test_aead_decrypt_in_place() {
+    std::cout << "Test: AEAD in-place decryption... ";
+    
+    try {
+        AEAD aead;
+        std::vector<uint8_t> key(32);
+        randombytes_buf(key.data(), key.size());
+        aead.set_key(key);
+        
+        std::vector<uint8_t> plaintext(1000, 0x3C);
+        std::vector<uint8_t> buffer = aead.encrypt(plaintext);
+        
+        auto pt = aead.decrypt_in_place(buffer, {});
+        assert(pt.has_value());
+        assert(pt->data() == buffer.data() + AEAD::NONCE_BYTES);
+        assert(std::vector<uint8_t>(pt->begin(), pt->end()) == plaintext);
+        
+        // A tampered buffer fails authentication
+        std::vector<uint8_t> tampered = aead.encrypt(plaintext);
+        tampered.back() ^= 0x01;
+        assert(!aead.decrypt_in_place(tampered, {}).has_value());
+        
+        std::cout << "✓ Decrypted in place without temporaries" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: AEAD Cipher Suites
+// =============================================================================
+void test_aead_cipher_suites() {
+    std::cout << "Test: AEAD cipher suite backends... ";
+    
+    try {
+        auto suites = available_cipher_suites();
+        assert(cipher_suite_available(CipherSuite::ChaCha20Poly1305));
+        assert(cipher_suite_available(CipherSuite::XChaCha20Poly1305));
+        assert(cipher_suite_available(CipherSuite::Aes256Gcm) == (crypto_aead_aes256gcm_is_available() != 0));
+        
+        std::vector<uint8_t> key(32);
+        randombytes_buf(key.data(), key.size());
+        std::vector<uint8_t> plaintext(300, 0x5A);
+        std::vector<uint8_t> aad = {'s','u','i','t','e'};
+        std::vector<uint8_t> salt(AEAD::SALT_BYTES, 0x07);
+        
+        for (auto suite : suites) {
+            AEAD aead(suite);
+            aead.set_key(key);
+            assert(aead.suite() == suite);
+            
+            auto ct = aead.encrypt(plaintext, aad);
+            assert(ct.size() == plaintext.size() + aead.nonce_bytes() + AEAD::TAG_BYTES);
+            auto pt = aead.decrypt(ct, aad);
+            assert(pt.has_value() && pt.value() == plaintext);
+            
+            std::vector<uint8_t> sealed(aead.ciphertext_size(plaintext.size(), AEAD::NonceMode::Counter));
+            aead.encrypt_into(plaintext, aad, sealed, 42, salt);
+            std::vector<uint8_t> opened(plaintext.size());
+            assert(aead.decrypt_into(sealed, aad, opened, 42, salt).has_value());
+            assert(opened == plaintext);
+            assert(!aead.decrypt_into(sealed, aad, opened, 43, salt).has_value());
+        }
+        
+        // Ciphertext from one suite does not open under another
+        AEAD chacha(CipherSuite::ChaCha20Poly1305), xchacha(CipherSuite::XChaCha20Poly1305);
+        chacha.set_key(key);
+        xchacha.set_key(key);
+        assert(!xchacha.decrypt(chacha.encrypt(plaintext, aad), aad).has_value());
+        
+        CipherSuite fastest = select_fastest_cipher_suite(4096, 4);
+        assert(cipher_suite_available(fastest));
+        
+        std::cout << "✓ " << suites.size() << " suite(s) round-trip, fastest: "
+                  << aead_backend(fastest)->name() << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: AEAD Batch
+// =============================================================================
+void test_aead_batch() {
+    std::cout << "Test: AEAD batch seal/open... ";
+    
+    try {
+        const size_t count = 200;
+        std::vector<std::vector<uint8_t>> keys(count, std::vector<uint8_t>(32));
+        std::vector<std::vector<uint8_t>> plaintexts(count);
+        std::vector<std::vector<uint8_t>> nonces(count);
+        std::vector<uint8_t> aad = {'b','a','t','c','h'};
+        std::vector<uint8_t> salt(AEAD::SALT_BYTES, 0x33);
+        for (size_t i = 0; i < count; i++) {
+            randombytes_buf(keys[i].data(), keys[i].size());
+            plaintexts[i].assign(i % 97, static_cast<uint8_t>(i));
+            // Odd jobs use an explicit counter nonce, even jobs a random prefixed one
+            if (i % 2) {
+                nonces[i].resize(AEAD::NONCE_BYTES);
+                AEAD::make_counter_nonce(nonces[i], static_cast<uint32_t>(i), salt);
+            }
+        }
+        
+        WorkerPool pool(4);
+        for (WorkerPool* p : { static_cast<WorkerPool*>(nullptr), &pool }) {
+            AEADBatch sealer;
+            for (size_t i = 0; i < count; i++) {
+                AEADBatch::Job job;
+                job.key = keys[i];
+                job.nonce = nonces[i];
+                job.aad = aad;
+                job.input = plaintexts[i];
+                job.suite = CipherSuite::ChaCha20Poly1305;
+                assert(sealer.add(job) == i);
+            }
+            const auto& sealed = sealer.seal(p);
+            assert(sealed.size() == count);
+            
+            // Sealed output matches the single-message AEAD layout
+            AEAD single(CipherSuite::ChaCha20Poly1305);
+            AEADBatch opener;
+            for (size_t i = 0; i < count; i++) {
+                assert(sealed[i].ok);
+                std::vector<uint8_t> ct(sealed[i].output.begin(), sealed[i].output.end());
+                single.set_key(keys[i]);
+                std::vector<uint8_t> pt(plaintexts[i].size());
+                auto n = i % 2 ? single.decrypt_into(ct, aad, pt, static_cast<uint32_t>(i), salt)
+                               : single.decrypt_into(ct, aad, pt);
+                assert(n.has_value() && pt == plaintexts[i]);
+                
+                AEADBatch::Job job;
+                job.key = keys[i];
+                job.nonce = nonces[i];
+                job.aad = aad;
+                job.input = sealed[i].output;
+                job.suite = CipherSuite::ChaCha20Poly1305;
+                opener.add(job);
+            }
+            // Corrupt one job; only that result fails
+            std::vector<uint8_t> bad_key(32, 0);
+            AEADBatch::Job bad;
+            bad.key = bad_key;
+            bad.aad = aad;
+            bad.input = sealed[0].output;
+            bad.suite = CipherSuite::ChaCha20Poly1305;
+            opener.add(bad);
+            
+            const auto& opened = opener.open(p);
+            for (size_t i = 0; i < count; i++) {
+                assert(opened[i].ok);
+                assert(std::vector<uint8_t>(opened[i].output.begin(), opened[i].output.end()) == plaintexts[i]);
+            }
+            assert(!opened[count].ok);
+        }
+        
+        std::cout << "✓ " << count << " jobs round-trip in order, inline and on "
+                  << pool.size() << " workers" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Streaming Attachment Encryption
+// =============================================================================
+void test_attachment_stream() {
+    std::cout << "Test: streaming attachment encryption... ";
+    
+    try {
+        const uint32_t chunk = 1000;
+        std::vector<uint8_t> data(10500);
+        randombytes_buf(data.data(), data.size());
+        
+        std::vector<std::vector<uint8_t>> chunks;
+        auto desc = encrypt_attachment(data, [&](std::span<const uint8_t> c) {
+            chunks.emplace_back(c.begin(), c.end());
+        }, chunk);
+        assert(desc.size == data.size());
+        assert(chunks.size() == desc.chunk_count() && chunks.size() == 11);
+        assert(chunks.back().size() == 500 + AttachmentEncryptor::CHUNK_OVERHEAD);
+        
+        // The descriptor round-trips and is not mistaken for ordinary text
+        auto parsed = AttachmentDescriptor::parse(desc.serialize());
+        assert(parsed.has_value() && parsed->key == desc.key && parsed->size == desc.size);
+        std::vector<uint8_t> text = {'h', 'e', 'l', 'l', 'o'};
+        assert(!AttachmentDescriptor::parse(text).has_value());
+        
+        auto open_all = [&](const std::vector<std::vector<uint8_t>>& in) {
+            AttachmentDecryptor dec(*parsed);
+            std::vector<uint8_t> out, buf(chunk);
+            for (const auto& c : in) {
+                auto n = dec.pull(c, buf);
+                if (!n.has_value()) return false;
+                out.insert(out.end(), buf.begin(), buf.begin() + *n);
+            }
+            return dec.finished() && out == data;
+        };
+        assert(open_all(chunks));
+        
+        // Truncation, reordering and tampering are all rejected
+        auto truncated = chunks;
+        truncated.pop_back();
+        assert(!open_all(truncated));
+        auto reordered = chunks;
+        std::swap(reordered[2], reordered[3]);
+        assert(!open_all(reordered));
+        auto tampered = chunks;
+        tampered[4][10] ^= 0x01;
+        assert(!open_all(tampered));
+        
+        // File to file with constant-size buffers
+        const std::string plain_path = "attachment_test.bin";
+        const std::string sealed_path = "attachment_test.sealed";
+        const std::string out_path = "attachment_test.out";
+        {
+            std::ofstream f(plain_path, std::ios::binary);
+            f.write(reinterpret_cast<const char*>(data.data()), data.size());
+        }
+        std::ofstream sealed(sealed_path, std::ios::binary);
+        auto file_desc = encrypt_attachment_file(plain_path, [&](std::span<const uint8_t> c) {
+            sealed.write(reinterpret_cast<const char*>(c.data()), c.size());
+        }, chunk);
+        sealed.close();
+        assert(decrypt_attachment_file(file_desc, sealed_path, out_path));
+        std::ifstream check(out_path, std::ios::binary);
+        std::vector<uint8_t> roundtrip((std::istreambuf_iterator<char>(check)), std::istreambuf_iterator<char>());
+        assert(roundtrip == data);
+        
+        // Wrong key: output is not left behind
+        AttachmentDescriptor wrong = file_desc;
+        wrong.key[0] ^= 0x01;
+        assert(!decrypt_attachment_file(wrong, sealed_path, out_path));
+        assert(!std::ifstream(out_path).good());
+        
+        std::remove(plain_path.c_str());
+        std::remove(sealed_path.c_str());
+        
+        std::cout << "✓ " << data.size() << " bytes in " << chunks.size() << " chunks" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Fixed-size Key Types
+// =============================================================================
+void test_fixed_key_types() {
+    std::cout << "Test: SecretKey32/PublicKey32... ";
+    
+    try {
+        // Stored inline: no heap pointer, just the bytes
+        static_assert(sizeof(SecretKey32) == 32 && sizeof(PublicKey32) == 32);
+        
+        std::vector<uint8_t> raw(32, 0xAB);
+        SecretKey32 a(raw), b;
+        assert(!(a == b));
+        b = a;
+        assert(a == b);
+        assert(a.to_vector() == raw);
+        b.clear();
+        assert(b == SecretKey32());
+        
+        bool threw = false;
+        try {
+            SecretKey32 bad(std::vector<uint8_t>(31));
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        
+        // Usable wherever a byte span is expected
+        AEAD aead;
+        aead.set_key(a);
+        std::vector<uint8_t> pt = {'k', 'e', 'y'};
+        AEAD check;
+        check.set_key(raw);
+        assert(check.decrypt(aead.encrypt(pt)).value() == pt);
+        
+        std::cout << "✓ 32-byte inline keys" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Secure Arena
+// =============================================================================
+void test_secure_arena() {
+    std::cout << "Test: SecureArena key slots... ";
+    
+    try {
+        SecureArena& arena = SecureArena::global();
+        const size_t base = arena.slots_in_use();
+        
+        uint8_t* slot;
+        {
+            LockedKey32 k(std::vector<uint8_t>(32, 0x5C));
+            slot = k.data();
+            assert(arena.slots_in_use() == base + 1);
+            LockedKey32 copy = k;
+            assert(copy == k && copy.data() != k.data());
+            LockedKey32 moved = std::move(copy);
+            assert(arena.slots_in_use() == base + 2);
+        }
+        assert(arena.slots_in_use() == base);
+        
+        // The free list hands the most recently released slot straight back
+        LockedKey32 again;
+        assert(again.data() == slot);
+        assert(std::all_of(again.begin(), again.end(), [](uint8_t b) { return b == 0; }));
+        
+        // Thousands of keys fit in a handful of blocks
+        {
+            std::vector<LockedKey32> many(5000);
+            assert(arena.slots_in_use() >= base + 5000);
+            assert(arena.blocks() <= 1 + (base + 5001) / SecureArena::SLOTS_PER_BLOCK + 1);
+        }
+        assert(arena.slots_in_use() == base + 1);
+        
+        // AEAD keeps its key in the arena
+        {
+            AEAD aead;
+            assert(arena.slots_in_use() == base + 2);
+        }
+        
+        std::cout << "✓ " << arena.blocks() << " block(s) of "
+                  << SecureArena::SLOTS_PER_BLOCK << " slots" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Buffered Random Bytes
+// =============================================================================
+void test_random_bytes() {
+    std::cout << "Test: Buffered random bytes... ";
+    
+    try {
+        // Consecutive draws never repeat, including across a buffer refill
+        std::set<std::vector<uint8_t>> seen;
+        for (size_t i = 0; i < 2 * RANDOM_BLOCK_BYTES / 24 + 8; ++i) {
+            std::vector<uint8_t> nonce(24);
+            random_bytes(nonce);
+            assert(seen.insert(nonce).second);
+        }
+        
+        // Large requests bypass the buffer but are still random
+        std::vector<uint8_t> big(RANDOM_BLOCK_BYTES * 2);
+        random_bytes(big);
+        assert(std::any_of(big.begin(), big.end(), [](uint8_t b) { return b != 0; }));
+        
+        // Each thread draws from its own buffer
+        std::vector<uint8_t> a(32), b(32);
+        std::thread ta([&] { random_bytes(a); });
+        std::thread tb([&] { random_bytes(b); });
+        ta.join();
+        tb.join();
+        assert(a != b);
+        
+#if defined(__unix__) || defined(__APPLE__)
+        // A forked child does not replay what is left of the parent's buffer
+        std::vector<uint8_t> before(16), parent(16), child(16);
+        random_bytes(before);
+        int fds[2];
+        assert(pipe(fds) == 0);
+        pid_t pid = fork();
+        assert(pid >= 0);
+        if (pid == 0) {
+            random_bytes(child);
+            _exit(write(fds[1], child.data(), child.size()) == static_cast<ssize_t>(child.size()) ? 0 : 1);
+        }
+        random_bytes(parent);
+        assert(read(fds[0], child.data(), child.size()) == static_cast<ssize_t>(child.size()));
+        int status = 0;
+        waitpid(pid, &status, 0);
+        close(fds[0]);
+        close(fds[1]);
+        assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+        assert(child != parent);
+#endif
+        
+        std::cout << "✓ " << seen.size() << " unique nonces" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Lane Pool
+// =============================================================================
+void test_lane_pool() {
+    std::cout << "Test: Lane pool ordering and backpressure... ";
+    
+    try {
+        // Tasks on one lane run in submission order
+        constexpr size_t KEYS = 8;
+        constexpr size_t PER_KEY = 50;
+        std::vector<std::vector<size_t>> seen(KEYS);
+        {
+            LanePool lanes(3, 4);
+            for (size_t i = 0; i < PER_KEY; ++i) {
+                for (size_t k = 0; k < KEYS; ++k) {
+                    lanes.submit(lanes.lane_for(k), [&seen, k, i] { seen[k].push_back(i); });
+                }
+            }
+        }    // destructor finishes the queued tasks
+        for (const auto& order : seen) {
+            assert(order.size() == PER_KEY);
+            assert(std::is_sorted(order.begin(), order.end()));
+        }
+        
+        // A full lane blocks the producer until the worker frees a slot
+        LanePool lanes(1, 2);
+        std::atomic<bool> release{false};
+        std::atomic<int> ran{0};
+        lanes.submit(0, [&] { while (!release) std::this_thread::yield(); ran++; });
+        while (lanes.stats()[0].depth != 0) std::this_thread::yield();
+        lanes.submit(0, [&] { ran++; });
+        lanes.submit(0, [&] { ran++; });
+        std::atomic<bool> submitted{false};
+        std::thread producer([&] { lanes.submit(0, [&] { ran++; }); submitted = true; });
+        while (lanes.stats()[0].full_waits == 0) std::this_thread::yield();
+        assert(!submitted);
+        release = true;
+        producer.join();
+        assert(submitted);
+        while (lanes.stats()[0].completed != 4) std::this_thread::yield();
+        auto stats = lanes.stats()[0];
+        assert(ran == 4 && stats.depth == 0 && stats.high_water == 2 && stats.full_waits == 1);
+        
+        std::cout << "✓ " << KEYS << " keys kept in order" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Logging
+// =============================================================================
+void test_logging() {
+    std::cout << "Test: Leveled async logging... ";
+    
+    try {
+        std::mutex m;
+        std::vector<std::string> lines;
+        set_log_sink([&](const LogRecord& r) {
+            std::lock_guard<std::mutex> lk(m);
+            lines.push_back(std::string(r.component) + "/" + log_level_name(r.level) + ": " + std::string(r.message()));
+        });
+        
+        // Below the compile-time threshold nothing is evaluated, not even the arguments
+        int evaluated = 0;
+        auto touch = [&] { return ++evaluated; };
+        set_log_level(LogLevel::Trace);
+        SC_LOG_TRACE("Test", "never " << touch());
+        assert(evaluated == (SECURECOMM_LOG_MIN_LEVEL == 0 ? 1 : 0));
+        
+        // Below the runtime threshold the arguments are skipped too
+        set_log_level(LogLevel::Info);
+        SC_LOG_DEBUG("Test", "hidden " << touch());
+        const int before = evaluated;
+        SC_LOG_INFO("Test", "sent " << 42 << " bytes to " << std::string("bob") << ", ok=" << true);
+        SC_LOG_WARN("Test", "size " << size_t(7) << ' ' << uint8_t(3));
+        assert(evaluated == before);
+        
+        // Several threads log at once; flush_log() waits for all of it
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([t] {
+                for (int i = 0; i < 100; i++) SC_LOG_INFO("Thread", t << ":" << i);
+            });
+        }
+        for (auto& t : threads) t.join();
+        
+        // Long messages are truncated, not overflowed
+        SC_LOG_ERROR("Test", std::string(1000, 'x'));
+        flush_log();
+        
+        set_log_sink(nullptr);
+        std::lock_guard<std::mutex> lk(m);
+        assert(lines.size() == 403 + log_dropped());
+        assert(lines[0] == "Test/info: sent 42 bytes to bob, ok=true");
+        assert(lines[1] == "Test/warn: size 7 3");
+        assert(lines.back().size() == std::string("Test/error: ").size() + LogRecord::MAX_TEXT);
+        
+        std::cout << "✓ " << lines.size() << " records delivered" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Latency metrics
+// =============================================================================
+void test_metrics() {
+    std::cout << "Test: Stage latency histograms... ";
+    
+    try {
+        // Every value lands in a bucket that contains it, within 1/16 of its size
+        for (uint64_t v : {0ull, 1ull, 15ull, 16ull, 17ull, 31ull, 32ull, 1000ull, 123456789ull, 1ull << 39}) {
+            size_t b = LatencyHistogram::bucket_for(v);
+            assert(b < LatencyHistogram::BUCKETS);
+            assert(LatencyHistogram::bucket_lower(b) <= v && v < LatencyHistogram::bucket_upper(b));
+            assert((LatencyHistogram::bucket_upper(b) - LatencyHistogram::bucket_lower(b)) * 16 <= std::max<uint64_t>(v, 16));
+        }
+        for (size_t b = 1; b < LatencyHistogram::BUCKETS; b++) {
+            assert(LatencyHistogram::bucket_lower(b) == LatencyHistogram::bucket_upper(b - 1));
+        }
+        assert(LatencyHistogram::bucket_for(UINT64_MAX) == LatencyHistogram::BUCKETS - 1);
+        
+        // Per-thread histograms are merged on snapshot
+        MetricsRegistry registry;
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&registry] {
+                for (uint64_t i = 1; i <= 1000; i++) registry.record(Stage::Decrypt, i * 1000);
+            });
+        }
+        for (auto& t : threads) t.join();
+        registry.record(Stage::Encrypt, 500);
+        
+        auto& sent = registry.counter("securecomm_test_sent_total", "Test counter.");
+        sent += 3;
+        assert(&registry.counter("securecomm_test_sent_total", "Test counter.") == &sent);
+        registry.set_gauge("securecomm_test_depth", "Test gauge.", [] { return 7.5; });
+        registry.set_gauge("securecomm_test_gone", "Removed gauge.", [] { return 1.0; });
+        registry.remove_gauge("securecomm_test_gone");
+        
+        MetricsSnapshot snap = registry.snapshot();
+        const auto& decrypt = snap.stage(Stage::Decrypt);
+        assert(decrypt.count == 4000);
+        assert(decrypt.sum_ns == 4 * 500500 * 1000ull);
+        assert(decrypt.max_ns == 1000000);
+        uint64_t p50 = decrypt.percentile_ns(0.5);
+        uint64_t p99 = decrypt.percentile_ns(0.99);
+        assert(p50 >= 500000 && p50 <= 500000 * 17 / 16);
+        assert(p99 >= 990000 && p99 <= 1000000);
+        assert(decrypt.percentile_ns(1.0) == 1000000);
+        assert(snap.stage(Stage::Encrypt).count == 1 && snap.stage(Stage::Callback).count == 0);
+        assert(snap.value("securecomm_test_sent_total")->value == 3);
+        assert(!snap.value("securecomm_test_depth")->counter && snap.value("securecomm_test_depth")->value == 7.5);
+        assert(snap.value("securecomm_test_gone") == nullptr);
+        
+        std::string text = snap.to_prometheus();
+        assert(text.find("# TYPE securecomm_stage_duration_seconds histogram\n") != std::string::npos);
+        assert(text.find("securecomm_stage_duration_seconds_count{stage=\"decrypt\"} 4000\n") != std::string::npos);
+        assert(text.find("securecomm_stage_duration_seconds_bucket{stage=\"decrypt\",le=\"+Inf\"} 4000\n") != std::string::npos);
+        // 2^19 ns = 524288 ns covers the first 524 values of each thread
+        assert(text.find("securecomm_stage_duration_seconds_bucket{stage=\"decrypt\",le=\"0.000524288\"} 2096\n") != std::string::npos);
+        assert(text.find("# TYPE securecomm_test_sent_total counter\nsecurecomm_test_sent_total 3\n") != std::string::npos);
+        assert(text.find("securecomm_test_depth 7.5\n") != std::string::npos);
+        
+        std::cout << "✓ p50 " << p50 << " ns, p99 " << p99 << " ns" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Message tracing
+// =============================================================================
+void test_tracing() {
+    std::cout << "Test: Chrome trace export... ";
+    
+    try {
+        const std::vector<uint8_t> session_id = {0x01, 0x23, 0x45, 0x67, 0x89, 0xab, 0xcd, 0xef, 0xff, 0xff};
+        const TraceKey key = TraceKey::of(session_id, 7);
+        assert(key.session == 0x0123456789abcdefull && key.index == 7);
+        assert(TraceKey::of("msg-1").session == TraceKey::of("msg-1").session);
+        
+        // Nothing is recorded before tracing starts
+        { TraceScope early("early", key); assert(!early.active()); }
+        
+        start_tracing(8);
+        {
+            TraceScope send("send", key);
+            assert(send.active());
+        }
+        std::thread other([&] {
+            TraceScope receive("receive");
+            receive.set_key(TraceKey::of(session_id, 7));
+        });
+        other.join();
+        trace_instant("queued", TraceKey::of("msg-1"));
+        for (int i = 0; i < 10; i++) trace_instant("overflow", {});
+        stop_tracing();
+        trace_instant("after_stop", key);
+        
+        assert(trace_dropped() == 5);
+        std::string json = chrome_trace_json();
+        assert(json.rfind("{\"displayTimeUnit\"", 0) == 0);
+        assert(json.find("\"dropped\":5") != std::string::npos);
+        assert(json.find("\"name\":\"send\",\"cat\":\"securecomm\",\"ph\":\"X\"") != std::string::npos);
+        assert(json.find("\"name\":\"receive\"") != std::string::npos);
+        assert(json.find("\"name\":\"queued\",\"cat\":\"securecomm\",\"ph\":\"i\"") != std::string::npos);
+        assert(json.find("\"session\":\"0123456789abcdef\",\"index\":7") != std::string::npos);
+        assert(json.find("after_stop") == std::string::npos && json.find("early") == std::string::npos);
+        // send and receive share a key, so a flow joins them
+        assert(json.find("\"name\":\"message\",\"cat\":\"flow\",\"ph\":\"s\"") != std::string::npos);
+        assert(json.find("\"name\":\"message\",\"cat\":\"flow\",\"ph\":\"f\"") != std::string::npos);
+        
+        const std::string path = "/tmp/securecomm_trace_test.json";
+        assert(write_chrome_trace(path));
+        std::remove(path.c_str());
+        
+        std::cout << "✓ " << json.size() << " bytes of trace JSON" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Envelope codec
+// =============================================================================
+void test_envelope_codec() {
+    std::cout << "Test: Envelope codec and view parsing... ";
+    
+    try {
+        Envelope env;
+        env.session_id = {0x01, 0x02, 0x03};
+        env.message_index = 7;
+        env.previous_counter = 3;
+        env.timestamp = 0x0102030405060708ull;
+        env.sender_device_id = "device-a";
+        env.associated_data = std::vector<uint8_t>(40, 0xAD);
+        env.ciphertext = std::vector<uint8_t>(100, 0xC7);
+        env.signature = {0x51};
+        
+        const std::vector<uint8_t> wire = env.serialize();
+        assert(wire.size() == env.serialized_size());
+        assert(wire[3] == Envelope::WIRE_VERSION);
+        
+        // The view points into the wire bytes
+        auto view = EnvelopeView::parse(wire);
+        assert(view.has_value());
+        assert(view->ciphertext.data() >= wire.data() && view->ciphertext.data() < wire.data() + wire.size());
+        assert(view->sender_device_id == "device-a" && view->message_index == 7 && view->timestamp == env.timestamp);
+        const Envelope back = view->to_envelope();
+        assert(back.session_id == env.session_id && back.ciphertext == env.ciphertext && back.signature == env.signature);
+        assert(Envelope::deserialize(wire).associated_data == env.associated_data);
+        
+        // serialize_into writes the same bytes, and refuses a short buffer
+        std::vector<uint8_t> buf(wire.size() + 8, 0xEE);
+        assert(env.serialize_into(buf) == wire.size());
+        assert(std::equal(wire.begin(), wire.end(), buf.begin()));
+        bool threw = false;
+        try { env.serialize_into(std::span<uint8_t>(buf).first(wire.size() - 1)); } catch (const std::runtime_error&) { threw = true; }
+        assert(threw);
+        
+        // The unversioned layout still decodes
+        std::vector<uint8_t> legacy;
+        auto put_bytes = [&](const auto& b) { Envelope::push_u32(legacy, uint32_t(b.size())); legacy.insert(legacy.end(), b.begin(), b.end()); };
+        put_bytes(env.session_id);
+        Envelope::push_u32(legacy, env.message_index);
+        Envelope::push_u32(legacy, env.previous_counter);
+        Envelope::push_u32(legacy, uint32_t(env.timestamp >> 32));
+        Envelope::push_u32(legacy, uint32_t(env.timestamp));
+        put_bytes(env.sender_device_id);
+        put_bytes(env.associated_data);
+        put_bytes(env.ciphertext);
+        auto old = EnvelopeView::parse(legacy);
+        assert(old.has_value() && old->sender_device_id == "device-a" && old->ciphertext.size() == 100 && old->signature.empty());
+        
+        // Trailing or missing bytes are rejected
+        std::vector<uint8_t> longer = wire;
+        longer.push_back(0);
+        assert(!EnvelopeView::parse(longer));
+        assert(!EnvelopeView::parse(std::span<const uint8_t>(wire).first(wire.size() - 1)));
+        assert(!Envelope::try_deserialize({}));
+        
+        // Fuzz: mutated frames must either be rejected or decode to an envelope
+        // that re-encodes to the same bytes (legacy frames gain the 12-byte v1 overhead)
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        auto next = [&] {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+        size_t accepted = 0;
+        const std::vector<uint8_t>* seeds[] = {&wire, &legacy};
+        for (int i = 0; i < 20000; i++) {
+            std::vector<uint8_t> input = *seeds[i & 1];
+            switch (next() % 4) {
+                case 0:    // bit flips
+                    for (uint64_t n = next() % 4 + 1; n; n--) input[next() % input.size()] ^= uint8_t(1u << (next() % 8));
+                    break;
+                case 1:    // truncation
+                    input.resize(next() % input.size());
+                    break;
+                case 2: {  // a length or count field replaced
+                    const size_t at = (next() % (input.size() / 4)) * 4;
+                    const uint32_t v = uint32_t(next() % 3 == 0 ? next() : next() % 256);
+                    for (int b = 0; b < 4; b++) input[at + b] = uint8_t(v >> (24 - 8 * b));
+                    break;
+                }
+                default:   // random bytes
+                    input.resize(next() % 256);
+                    for (auto& b : input) b = uint8_t(next());
+                    break;
+            }
+            auto parsed = EnvelopeView::parse(input);
+            if (!parsed) continue;
+            accepted++;
+            const std::vector<uint8_t> again = parsed->to_envelope().serialize();
+            if (again.size() == input.size()) {
+                // byte 2 is the sender's readable-version advert, which serialize() leaves at 0
+                input[2] = 0;
+                assert(again == input);
+            } else {
+                assert(again.size() == input.size() + 12);
+            }
+        }
+        
+        std::cout << "✓ 20000 fuzzed frames, " << accepted << " accepted" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: v2 wire format and WireCodec
+// =============================================================================
+void test_wire_codec() {
+    std::cout << "Test: v2 wire format and negotiation... ";
+    
+    try {
+        auto same = [](const EnvelopeView& a, const EnvelopeView& b) {
+            auto eq = [](std::span<const uint8_t> x, std::span<const uint8_t> y) { return std::equal(x.begin(), x.end(), y.begin(), y.end()); };
+            return eq(a.session_id, b.session_id) && a.message_index == b.message_index &&
+                   a.previous_counter == b.previous_counter && a.timestamp == b.timestamp &&
+                   a.sender_device_id == b.sender_device_id && eq(a.associated_data, b.associated_data) &&
+                   eq(a.ciphertext, b.ciphertext) && eq(a.signature, b.signature) && eq(a.aad, b.aad);
+        };
+        
+        // A short chat message: 16-byte session id, 37-byte ratchet header
+        Envelope env;
+        env.session_id = std::vector<uint8_t>(16, 0x5E);
+        env.message_index = 5;
+        env.timestamp = 1760000000000ull;
+        env.sender_device_id = "phone-4c1d9e2a7b";
+        env.associated_data = std::vector<uint8_t>(37, 0xAD);
+        env.ciphertext = std::vector<uint8_t>(60, 0xC7);
+        
+        WireCodec alice, bob;
+        alice.set_connection_state(true);
+        bob.set_connection_state(true);
+        
+        // Until a peer has heard v2 from the other side it sends v1, advertising v2
+        // and batch frames
+        const auto hello = alice.encode(env);
+        assert(hello.size() == env.serialized_size() && hello[2] == 3 && hello[3] == 1);
+        auto first = bob.decode(hello);
+        assert(first && first->version == 1 && same(*first, EnvelopeView::of(env)));
+        assert(bob.peer_version() == 3 && alice.peer_version() == 1);
+        
+        // bob's first frame is v1 as well, so alice learns his version even though
+        // he already knows hers
+        Envelope reply = env;
+        reply.sender_device_id = "laptop-77f0a3e1c2";
+        const auto r0 = bob.encode(reply);
+        assert(r0[0] == 0 && r0[2] == 3 && alice.decode(r0) && alice.peer_version() == 3);
+        
+        // Then v2; the first v2 frame carries his id and adds it to the dictionary
+        const auto r1 = bob.encode(reply);
+        assert(r1[0] == 2);
+        auto got = alice.decode(r1);
+        assert(got && got->version == 2 && same(*got, EnvelopeView::of(reply)));
+        assert(alice.peer_version() == 3);
+        
+        // Later frames refer to it by index and send the timestamp as a delta, even backwards
+        reply.message_index = 6;
+        reply.timestamp += 1500;
+        const auto r2 = bob.encode(reply);
+        assert(r2.size() + reply.sender_device_id.size() + 4 <= r1.size());
+        got = alice.decode(r2);
+        assert(got && same(*got, EnvelopeView::of(reply)));
+        reply.message_index = 7;
+        reply.timestamp -= 20;
+        const auto r3 = bob.encode(reply);
+        got = alice.decode(r3);
+        assert(got && same(*got, EnvelopeView::of(reply)));
+        
+        // Such frames only decode with the connection's state, but their id can be read
+        assert(!EnvelopeView::parse(r2));
+        assert(EnvelopeView::peek_id(r2)->message_index == 6);
+        WireCodec stranger;
+        assert(!stranger.decode(r2));
+        // and only by a codec with connection state enabled, even the first one
+        WireCodec stateless;
+        assert(!stateless.decode(r1) && !stateless.decode(r2));
+
+        // A failed send resets the state at both ends, whether the frame was lost
+        // (its new sender id never reached alice) or arrived after all
+        for (bool arrived : {false, true}) {
+            Envelope other = reply;
+            other.sender_device_id = arrived ? "watch-0b5e" : "tablet-9a31";
+            other.timestamp += 60000;
+            const auto failed = bob.encode(other);
+            assert(failed[0] == 2);
+            if (arrived) assert(alice.decode(failed));
+            bob.send_failed();
+            // The next frame advertises again, the one after starts the state over
+            const auto readvertised = bob.encode(reply);
+            assert(readvertised[0] == 0 && alice.decode(readvertised));
+            for (const Envelope* e : {&other, &reply, &other}) {
+                const auto frame = bob.encode(*e);
+                got = alice.decode(frame);
+                assert(got && same(*got, EnvelopeView::of(*e)));
+            }
+        }
+
+        // Without negotiation the peer's frames leave its version alone
+        WireCodec relayed, v2_sender;
+        relayed.set_negotiation(false);
+        v2_sender.set_peer_version(2);
+        assert(relayed.decode(hello) && relayed.decode(v2_sender.encode(env)));
+        relayed.saw_batch_frame();
+        assert(relayed.peer_version() == 1 && relayed.encode(env)[3] == 1);
+
+        const size_t payload = env.session_id.size() + env.associated_data.size() + env.ciphertext.size();
+        const size_t v1_overhead = hello.size() - payload;
+        const size_t v2_overhead = r2.size() - payload;
+        assert(v2_overhead * 4 < v1_overhead);
+        
+        // Without connection state v2 frames stand alone, trailer included
+        WireCodec plain;
+        plain.set_peer_version(2);
+        Envelope signed_env = env;
+        signed_env.signature = {1, 2, 3};
+        const auto standalone = plain.encode(signed_env);
+        auto parsed = EnvelopeView::parse(standalone);
+        assert(parsed && same(*parsed, EnvelopeView::of(signed_env)));
+        assert(Envelope::deserialize(standalone).signature == signed_env.signature);
+        
+        // encode_framing is encode() with the ciphertext left out, for Transport::send_iov;
+        // the part before it is enough to read the message id
+        auto framed = [](WireCodec& codec, const Envelope& e) {
+            std::vector<uint8_t> framing;
+            const size_t head = codec.encode_framing(e, framing);
+            assert(EnvelopeView::peek_id(std::span(framing).first(head))->message_index == e.message_index);
+            std::vector<uint8_t> out(framing.begin(), framing.begin() + head);
+            out.insert(out.end(), e.ciphertext.begin(), e.ciphertext.end());
+            out.insert(out.end(), framing.begin() + head, framing.end());
+            return out;
+        };
+        for (int v : {0, 1, 2}) {
+            for (bool stateful : {false, true}) {
+                WireCodec a, b;
+                for (WireCodec* c : {&a, &b}) {
+                    c->set_peer_version(v);
+                    c->set_connection_state(stateful);
+                }
+                for (const Envelope* e : {&signed_env, &reply, &reply}) assert(framed(a, *e) == b.encode(*e));
+            }
+        }
+        
+        // A peer that may only read the unversioned layout is sent that, without the
+        // signature and aad, until one of its frames shows it reads more
+        WireCodec legacy_peer;
+        legacy_peer.set_peer_version(Envelope::WIRE_VERSION_LEGACY);
+        const auto unversioned = legacy_peer.encode(signed_env);
+        assert(unversioned.size() == signed_env.serialized_size() - 4 - 8 - signed_env.signature.size());
+        size_t offset = 0;
+        assert(Envelope::read_u32(unversioned, offset) == signed_env.session_id.size());
+        parsed = EnvelopeView::parse(unversioned);
+        assert(parsed && parsed->version == Envelope::WIRE_VERSION_LEGACY && parsed->signature.empty());
+        assert(legacy_peer.decode(unversioned) && legacy_peer.peer_version() == Envelope::WIRE_VERSION_LEGACY);
+        assert(legacy_peer.decode(hello) && legacy_peer.peer_version() == 3);
+        const auto upgraded = legacy_peer.encode(env);
+        assert(upgraded[0] == 0 && upgraded[2] == 3 && upgraded[3] == 1);
+        assert(legacy_peer.encode(env)[0] == 2);
+        
+        // Dictionary entries outlive resets, so their total size is capped: repeated
+        // RESET frames each adding a new long id are rejected once they would pass it
+        auto reset_frame = [](const std::string& sender) {
+            std::vector<uint8_t> f = {2, 0x10 | 0x04, 1, 'S', 0, 0, 0};
+            f.push_back(uint8_t(sender.size() | 0x80));
+            f.push_back(uint8_t(sender.size() >> 7));
+            f.insert(f.end(), sender.begin(), sender.end());
+            f.insert(f.end(), {0, 0});
+            return f;
+        };
+        WireCodec flooded;
+        flooded.set_connection_state(true);
+        size_t resets = 0;
+        auto flood_id = [](size_t i) { return std::string(1000, char('a' + i % 26)) + std::to_string(i); };
+        while (resets < 1000 && flooded.decode(reset_frame(flood_id(resets)))) resets++;
+        assert(resets == WireCodec::DICTIONARY_STORAGE_BYTES / (1004 + WireCodec::DICTIONARY_ENTRY_COST));
+        // The rejected frame changed nothing
+        const std::vector<uint8_t> by_index = {2, 0x02, 1, 'S', 1, 0, 0, 0, 0, 0};
+        assert(flooded.decode(by_index)->sender_device_id == flood_id(resets - 1));
+        
+        // An encoder never makes its peer reject one: it counts the same way and
+        // falls back to inline ids
+        WireCodec resetting, resetting_peer;
+        resetting.set_connection_state(true);
+        resetting.set_peer_version(2);
+        resetting_peer.set_connection_state(true);
+        Envelope long_id = env;
+        for (int i = 0; i < 400; i++) {
+            long_id.sender_device_id = std::string(1000, 'd') + std::to_string(1000 + i);
+            resetting.send_failed();
+            resetting.encode(long_id);    // readvertises in v1
+            const auto f = resetting.encode(long_id);
+            got = resetting_peer.decode(f);
+            assert(f[0] == 2 && got && same(*got, EnvelopeView::of(long_id)));
+            if (i >= int(resets)) assert(!(f[1] & 0x04));
+        }
+        
+        // Varints must be in shortest form
+        std::vector<uint8_t> overlong = {2, 0, 0x81, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
+        assert(!EnvelopeView::parse(overlong));
+        overlong[2] = 0x00;
+        overlong.erase(overlong.begin() + 3);
+        assert(EnvelopeView::parse(overlong).has_value());
+        
+        // Fuzz: a mutated frame is rejected or decodes to fields that round-trip,
+        // with and without connection state
+        uint64_t state = 0x2545f4914f6cdd1dull;
+        auto next = [&] {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+        size_t accepted = 0;
+        for (int i = 0; i < 20000; i++) {
+            const bool stateful = i & 1;
+            std::vector<uint8_t> input = stateful ? r2 : standalone;
+            if (next() % 2) {
+                for (uint64_t n = next() % 3 + 1; n; n--) input[next() % input.size()] ^= uint8_t(1u << (next() % 8));
+            } else {
+                input.resize(next() % input.size());
+            }
+            WireCodec receiver;
+            receiver.set_connection_state(true);
+            if (stateful) receiver.decode(r1);
+            auto v = receiver.decode(input);
+            if (!v) continue;
+            accepted++;
+            WireCodec sender;
+            sender.set_peer_version(2);
+            const auto again = sender.encode(v->to_envelope());
+            auto round = EnvelopeView::parse(again);
+            assert(round && same(*round, *v));
+        }
+        
+        std::cout << "✓ framing " << v1_overhead << " -> " << v2_overhead << " bytes, "
+                  << accepted << "/20000 fuzzed frames accepted" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Refcounted Bytes and BytesPool
+// =============================================================================
+void test_bytes() {
+    std::cout << "Test: refcounted bytes and pool... ";
+    
+    try {
+        std::vector<uint8_t> source(1000);
+        for (size_t i = 0; i < source.size(); i++) source[i] = uint8_t(i * 7);
+        
+        // Copies and slices share the buffer
+        Bytes frame = Bytes::copy(source);
+        assert(frame.size() == source.size() && std::equal(frame.begin(), frame.end(), source.begin()));
+        Bytes copy = frame;
+        Bytes tail = frame.slice(900, 100);
+        assert(copy.shares_buffer(frame) && tail.shares_buffer(frame) && tail.data() == frame.data() + 900);
+        assert(tail[0] == source[900] && tail.to_vector() == std::vector<uint8_t>(source.begin() + 900, source.end()));
+        assert(frame.slice(1000, 0).empty());
+        bool threw = false;
+        try { frame.slice(901, 100); } catch (const std::out_of_range&) { threw = true; }
+        assert(threw);
+        assert(Bytes::copy({}).empty());
+        
+        // A builder is filled in place and frozen without a copy
+        BytesBuilder builder(64);
+        std::memcpy(builder.data(), "frame", 5);
+        const uint8_t* written = builder.data();
+        Bytes built = std::move(builder).freeze(5);
+        assert(built.size() == 5 && built.data() == written && built[4] == 'e');
+        
+        // The last reference returns the buffer, and the next allocation of that
+        // size class takes it back
+        BytesPool::global().trim();
+        const auto before = BytesPool::global().stats();
+        const uint8_t* buffer = frame.data();
+        frame = Bytes();
+        copy = Bytes();
+        assert(BytesPool::global().stats().cached_buffers == before.cached_buffers);
+        tail = Bytes();
+        assert(BytesPool::global().stats().cached_buffers == before.cached_buffers + 1);
+        Bytes reused = Bytes::copy(std::span(source).first(600));
+        const auto after = BytesPool::global().stats();
+        assert(reused.data() == buffer && after.hits == before.hits + 1 && after.cached_buffers == before.cached_buffers);
+        
+        // Sizes above the largest class bypass the pool
+        Bytes large = Bytes::copy(std::vector<uint8_t>(BytesPool::MAX_CLASS_BYTES + 1, 0x42));
+        large = Bytes();
+        assert(BytesPool::global().stats().cached_buffers == after.cached_buffers);
+        
+        // References taken and dropped from several threads at once
+        Bytes shared = Bytes::copy(source);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&shared, t] {
+                for (int i = 0; i < 20000; i++) {
+                    Bytes mine = shared;
+                    Bytes part = mine.slice(size_t(t), 10);
+                    assert(part[0] == uint8_t(t * 7));
+                }
+            });
+        }
+        for (auto& th : threads) th.join();
+        assert(shared[999] == source[999]);
+        
+        std::cout << "✓ shared, sliced and " << after.hits - before.hits << " buffer reused from the pool" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Batch Frames and FrameBatcher
+// =============================================================================
+void test_frame_batch() {
+    std::cout << "Test: batch frames and frame batcher... ";
+    
+    try {
+        // Collects what the batcher sends, joined
+        struct Sink {
+            std::mutex mutex;
+            std::vector<Bytes> sent;
+            size_t parts = 0;
+            void send(std::span<const std::span<const uint8_t>> parts_in, std::shared_ptr<const void> owner) {
+                assert(owner);
+                size_t size = 0;
+                for (const auto& part : parts_in) size += part.size();
+                BytesBuilder frame(size);
+                size_t offset = 0;
+                for (const auto& part : parts_in) {
+                    std::memcpy(frame.data() + offset, part.data(), part.size());
+                    offset += part.size();
+                }
+                std::lock_guard<std::mutex> lk(mutex);
+                sent.push_back(std::move(frame).freeze());
+                parts += parts_in.size();
+            }
+        };
+        auto frame_of = [](size_t size, uint8_t fill) { return std::vector<uint8_t>(size, fill); };
+        
+        // Size flush: frames go out together once they reach max_bytes, in order,
+        // and unpack to slices of the received buffer
+        Sink sink;
+        std::vector<std::vector<uint8_t>> frames = {frame_of(100, 1), frame_of(200, 2), frame_of(300, 3)};
+        {
+            FrameBatcher batcher(600, std::chrono::seconds(10),
+                                 [&sink](auto parts, auto owner) { sink.send(parts, std::move(owner)); });
+            for (const auto& f : frames) {
+                // Two parts each, the second one owned by the batcher's caller
+                auto owned = std::make_shared<std::vector<uint8_t>>(f);
+                const std::span<const uint8_t> whole(*owned);
+                const std::span<const uint8_t> parts[] = {whole.first(10), whole.subspan(10)};
+                batcher.add(parts, owned);
+            }
+            const auto stats = batcher.stats();
+            assert(stats.frames == 3 && stats.sends == 1 && stats.size_flushes == 1 && stats.timer_flushes == 0);
+        }
+        assert(sink.sent.size() == 1 && BatchFrame::is_batch(sink.sent[0]));
+        assert(sink.parts == 3 * 3);    // a prefix and two parts per frame
+        std::vector<Bytes> unpacked;
+        assert(BatchFrame::unpack(sink.sent[0], unpacked) && unpacked.size() == 3);
+        for (size_t i = 0; i < 3; i++) {
+            assert(unpacked[i].to_vector() == frames[i] && unpacked[i].shares_buffer(sink.sent[0]));
+        }
+        
+        // Timer flush, and a frame that is alone goes out without a batch header
+        Sink timed;
+        FrameBatcher batcher(1 << 20, std::chrono::milliseconds(5),
+                             [&timed](auto parts, auto owner) { timed.send(parts, std::move(owner)); });
+        const auto lone = frame_of(50, 9);
+        const std::span<const uint8_t> lone_part(lone);
+        batcher.add(std::span(&lone_part, 1), nullptr);    // no owner: copied
+        for (int i = 0; i < 200 && batcher.stats().sends == 0; i++) std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        {
+            std::lock_guard<std::mutex> lk(timed.mutex);
+            assert(timed.sent.size() == 1 && timed.sent[0].to_vector() == lone);
+        }
+        assert(batcher.stats().timer_flushes == 1);
+        batcher.add(std::span(&lone_part, 1), nullptr);
+        batcher.add(std::span(&lone_part, 1), nullptr);
+        batcher.flush();
+        {
+            std::lock_guard<std::mutex> lk(timed.mutex);
+            assert(timed.sent.size() == 2 && BatchFrame::is_batch(timed.sent[1]));
+        }
+
+        // Completions run on the batcher's thread once the send carrying their frame
+        // has returned, and get its error if it threw, timer flushes included
+        {
+            std::mutex mutex;
+            std::condition_variable cond;
+            std::vector<std::exception_ptr> outcomes;
+            auto record = [&](std::exception_ptr error) {
+                std::lock_guard<std::mutex> lk(mutex);
+                outcomes.push_back(error);
+                cond.notify_all();
+            };
+            auto wait_outcomes = [&](size_t count) {
+                std::unique_lock<std::mutex> lk(mutex);
+                return cond.wait_for(lk, std::chrono::seconds(20), [&] { return outcomes.size() >= count; });
+            };
+            std::atomic<bool> down{false};
+            Sink flaky;
+            auto send = [&](auto parts, auto owner) {
+                if (down) throw std::runtime_error("transport down");
+                flaky.send(parts, std::move(owner));
+            };
+            FrameBatcher failing(1 << 20, std::chrono::seconds(10), send);
+            failing.add(std::span(&lone_part, 1), nullptr, record);
+            failing.add(std::span(&lone_part, 1), nullptr, record);
+            failing.flush();
+            assert(wait_outcomes(2) && !outcomes[0] && !outcomes[1]);
+
+            down = true;
+            failing.add(std::span(&lone_part, 1), nullptr, record);
+            failing.add(std::span(&lone_part, 1), nullptr, record);
+            bool threw = false;
+            try {
+                failing.flush();
+            } catch (const std::runtime_error&) {
+                threw = true;
+            }
+            assert(threw && wait_outcomes(4) && outcomes[2] && outcomes[3]);
+
+            const auto stats = failing.stats();
+            assert(stats.sends == 2 && stats.failed_sends == 1);
+
+            FrameBatcher on_timer(1 << 20, std::chrono::milliseconds(5), send);
+            on_timer.add(std::span(&lone_part, 1), nullptr, record);
+            assert(wait_outcomes(5) && outcomes[4]);
+            assert(on_timer.stats().timer_flushes == 1 && on_timer.stats().failed_sends == 1);
+            std::lock_guard<std::mutex> lk(flaky.mutex);
+            assert(flaky.sent.size() == 1);
+        }
+        
+        // Malformed batches are rejected and leave the output as it was
+        unpacked.assign(1, Bytes::copy(lone));
+        const auto good = sink.sent[0].to_vector();
+        auto rejects = [&](std::vector<uint8_t> bad) {
+            return !BatchFrame::unpack(Bytes::copy(bad), unpacked) && unpacked.size() == 1;
+        };
+        assert(rejects({}));
+        assert(rejects({3}));
+        assert(rejects({3, 1, 1, 7}));                                          // one frame is not a batch
+        assert(rejects({3, 2, 1, 7, 0}));                                       // empty frame
+        assert(rejects({3, 0x82, 0x00, 1, 7, 1, 8}));                           // overlong count
+        assert(rejects(std::vector<uint8_t>(good.begin(), good.end() - 1)));    // truncated
+        auto trailing = good;
+        trailing.push_back(0);
+        assert(rejects(trailing));
+        assert(BatchFrame::unpack(Bytes::copy(good), unpacked) && unpacked.size() == 4);
+        
+        // Fuzz: a mutated batch is rejected or unpacks to frames that fit inside it
+        uint64_t state = 0x9e3779b97f4a7c15ull;
+        auto next = [&] {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            return state;
+        };
+        size_t accepted = 0;
+        for (int i = 0; i < 20000; i++) {
+            auto input = good;
+            if (next() % 2) {
+                input[next() % 8] ^= uint8_t(1u << (next() % 8));
+            } else {
+                input.resize(next() % input.size());
+            }
+            std::vector<Bytes> out;
+            const Bytes batch = Bytes::copy(input);
+            if (!BatchFrame::unpack(batch, out)) {
+                assert(out.empty());
+                continue;
+            }
+            accepted++;
+            size_t total = 0;
+            for (const auto& f : out) total += f.size();
+            assert(out.size() >= 2 && total < input.size());
+        }
+        
+        std::cout << "✓ " << frames.size() << " frames in one send, " << accepted << "/20000 fuzzed batches accepted" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Concurrent Group Messages
+// =============================================================================
+void test_mls_concurrent() {
+    std::cout << "Test: concurrent group sends and receives... ";
+    
+    try {
+        MLSManager mls;
+        mls.set_nonce_mode(AEAD::NonceMode::Counter);
+        std::vector<std::vector<uint8_t>> groups;
+        for (int g = 0; g < 2; g++) {
+            groups.push_back(mls.create_group("group"));
+            mls.add_member(groups.back(), "alice");
+            mls.add_member(groups.back(), "bob");
+        }
+        WorkerPool pool(2);
+        
+        // Each thread sends to both groups, singly and in batches, and opens every
+        // envelope it sent; indices are collected per group to catch reuse
+        constexpr int THREADS = 4;
+        constexpr int ROUNDS = 200;
+        std::mutex indices_mutex;
+        std::vector<std::vector<uint32_t>> indices(groups.size());
+        std::atomic<int> failures{0};
+        std::vector<std::thread> threads;
+        for (int t = 0; t < THREADS; t++) {
+            threads.emplace_back([&, t] {
+                const std::vector<uint8_t> pt(64, static_cast<uint8_t>(t));
+                for (int r = 0; r < ROUNDS; r++) {
+                    const size_t g = static_cast<size_t>(r + t) % groups.size();
+                    std::vector<Envelope> envs;
+                    if (r % 4 == 0) {
+                        envs = mls.encrypt_group_messages(groups[g], "alice", {pt, pt, pt}, &pool);
+                    } else {
+                        envs.push_back(mls.encrypt_group_message(groups[g], "alice", pt));
+                    }
+                    for (const auto& env : envs) {
+                        if (mls.decrypt_group_message(groups[g], "bob", env) != pt) failures++;
+                    }
+                    if (r % 4 == 1) {
+                        for (const auto& opened : mls.decrypt_group_messages(groups[g], "bob", envs, &pool)) {
+                            if (opened != pt) failures++;
+                        }
+                    }
+                    std::lock_guard<std::mutex> lk(indices_mutex);
+                    for (const auto& env : envs) indices[g].push_back(env.message_index);
+                }
+            });
+        }
+        for (auto& th : threads) th.join();
+        
+        assert(failures == 0);
+        size_t sent = 0;
+        for (auto& idx : indices) {
+            std::sort(idx.begin(), idx.end());
+            assert(std::adjacent_find(idx.begin(), idx.end()) == idx.end());
+            sent += idx.size();
+        }
+        assert(sent == THREADS * (ROUNDS / 4 * 3 + (ROUNDS - ROUNDS / 4)));
+        
+        std::cout << "✓ " << sent << " envelopes, no nonce reused" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
 // =============================================================================
 // Test: HMAC-SHA256 Generation
 // =============================================================================
@@ -443,6 +1791,23 @@ int main() {
         test_aead_empty_plaintext();
         test_aead_large_message();
         test_aead_tampering_detection();
+        test_aead_encrypt_into();
+        test_aead_decrypt_in_place();
+        test_aead_cipher_suites();
+        test_aead_batch();
+        test_attachment_stream();
+        test_fixed_key_types();
+        test_secure_arena();
+        test_random_bytes();
+        test_lane_pool();
+        test_logging();
+        test_metrics();
+        test_tracing();
+        test_envelope_codec();
+        test_wire_codec();
+        test_bytes();
+        test_frame_batch();
+        test_mls_concurrent();
         
         std::cout << std::endl;
         
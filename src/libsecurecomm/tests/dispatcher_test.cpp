@@ -0,0 +1,787 @@
+#include "securecomm/dispatcher.hpp"
+#include "securecomm/ratchet.hpp"
+#include "securecomm/log.hpp"
+#include <iostream>
+#include <cassert>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <mutex>
+#include <condition_variable>
+#include <optional>
+#include <deque>
+#include <map>
+#include <memory>
+#include <thread>
+#include <future>
+#include <exception>
+#include <stdexcept>
+
+using namespace securecomm;
+
+// Process-wide connected pair from in_memory_transport.cpp
+extern "C" securecomm::Transport* create_inmemory_transport_a();
+extern "C" securecomm::Transport* create_inmemory_transport_b();
+
+namespace {
+
+// The pair outlives every test; each test builds fresh dispatchers on it and waits
+// for all of its traffic, so nothing is left queued for the next one
+TransportPtr transport_a() { return TransportPtr(create_inmemory_transport_a(), [](Transport*) {}); }
+TransportPtr transport_b() { return TransportPtr(create_inmemory_transport_b(), [](Transport*) {}); }
+
+const std::vector<uint8_t> ROOT_KEY(32, 0x42);
+
+// Payload with a sequence number up front and filler derived from it, so both
+// order and integrity can be checked on arrival
+std::vector<uint8_t> numbered(uint32_t n, size_t size = 64) {
+    std::vector<uint8_t> out(size);
+    out[0] = static_cast<uint8_t>(n >> 24);
+    out[1] = static_cast<uint8_t>(n >> 16);
+    out[2] = static_cast<uint8_t>(n >> 8);
+    out[3] = static_cast<uint8_t>(n);
+    for (size_t i = 4; i < size; i++) out[i] = static_cast<uint8_t>(n * 31 + i);
+    return out;
+}
+
+// nullopt if the payload is not an intact numbered() one
+std::optional<uint32_t> number_of(const std::vector<uint8_t>& payload) {
+    if (payload.size() < 4) return std::nullopt;
+    const uint32_t n = (static_cast<uint32_t>(payload[0]) << 24) | (static_cast<uint32_t>(payload[1]) << 16) |
+                       (static_cast<uint32_t>(payload[2]) << 8) | payload[3];
+    if (payload != numbered(n, payload.size())) return std::nullopt;
+    return n;
+}
+
+// What on_inbound delivered, in delivery order; filled from any thread. Declare
+// it before the dispatcher that fills it.
+struct Inbox {
+    std::mutex mutex;
+    std::condition_variable cond;
+    std::vector<Envelope> received;
+
+    void add(const Envelope& env) {
+        std::lock_guard<std::mutex> lk(mutex);
+        received.push_back(env);
+        cond.notify_all();
+    }
+
+    // False if fewer than `count` arrived in time
+    bool wait_for(size_t count, std::chrono::seconds timeout = std::chrono::seconds(20)) {
+        std::unique_lock<std::mutex> lk(mutex);
+        return cond.wait_for(lk, timeout, [&] { return received.size() >= count; });
+    }
+
+    // Sequence numbers from `sender`, in delivery order; asserts every payload is intact
+    std::vector<uint32_t> numbers_from(const std::string& sender) {
+        std::lock_guard<std::mutex> lk(mutex);
+        std::vector<uint32_t> out;
+        for (const Envelope& env : received) {
+            if (env.sender_device_id != sender) continue;
+            auto n = number_of(env.ciphertext);    // on_inbound gets the plaintext here
+            assert(n.has_value());
+            out.push_back(*n);
+        }
+        return out;
+    }
+};
+
+bool in_sequence(const std::vector<uint32_t>& numbers, uint32_t count) {
+    if (numbers.size() != count) return false;
+    for (uint32_t i = 0; i < count; i++) {
+        if (numbers[i] != i) return false;
+    }
+    return true;
+}
+
+// A hub and its spokes, for one dispatcher talking to several peers over one
+// transport. Spokes' frames go to the hub; the hub's frames go to the spoke their
+// session id last came from (both ends of a session use the same id), so every
+// spoke must send first. Each port delivers on its own thread, one frame at a time.
+class StarRelay {
+public:
+    class Port : public Transport, public std::enable_shared_from_this<Port> {
+    public:
+        Port(StarRelay& relay, bool hub) : relay_(relay), hub_(hub) {}
+        ~Port() override { stop(); }
+
+        void start() override {
+            std::lock_guard<std::mutex> lk(mutex_);
+            if (worker_.joinable()) return;
+            running_ = true;
+            worker_ = std::thread([this] { run(); });
+        }
+
+        void stop() override {
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                running_ = false;
+            }
+            cond_.notify_all();
+            if (worker_.joinable()) worker_.join();
+        }
+
+        void send(const std::vector<uint8_t>& bytes) override { relay_.route(*this, Bytes::copy(bytes)); }
+
+        void set_on_message(OnMessageCb cb) override {
+            std::lock_guard<std::mutex> lk(mutex_);
+            on_message_ = std::move(cb);
+        }
+
+        void deliver(Bytes frame) {
+            {
+                std::lock_guard<std::mutex> lk(mutex_);
+                queue_.push_back(std::move(frame));
+            }
+            cond_.notify_one();
+        }
+
+        bool is_hub() const { return hub_; }
+
+    private:
+        void run() {
+            std::unique_lock<std::mutex> lk(mutex_);
+            while (true) {
+                cond_.wait(lk, [this] { return !queue_.empty() || !running_; });
+                if (!running_) return;
+                Bytes frame = std::move(queue_.front());
+                queue_.pop_front();
+                OnMessageCb cb = on_message_;
+                lk.unlock();
+                if (cb) cb(frame);
+                lk.lock();
+            }
+        }
+
+        StarRelay& relay_;
+        const bool hub_;
+        std::mutex mutex_;
+        std::condition_variable cond_;
+        std::deque<Bytes> queue_;
+        OnMessageCb on_message_;
+        bool running_ = false;
+        std::thread worker_;
+    };
+
+    std::shared_ptr<Port> hub() {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (!hub_) hub_ = std::make_shared<Port>(*this, true);
+        return hub_;
+    }
+
+    std::shared_ptr<Port> spoke() { return std::make_shared<Port>(*this, false); }
+
+private:
+    void route(Port& from, Bytes frame) {
+        auto id = EnvelopeView::peek_id(frame);
+        assert(id.has_value());
+        std::vector<uint8_t> session(id->session_id.begin(), id->session_id.end());
+        std::shared_ptr<Port> to;
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            if (from.is_hub()) {
+                auto it = spokes_.find(session);
+                assert(it != spokes_.end());
+                to = it->second;
+            } else {
+                spokes_[session] = from.shared_from_this();
+                to = hub_;
+            }
+        }
+        if (to) to->deliver(std::move(frame));
+    }
+
+    std::mutex mutex_;
+    std::shared_ptr<Port> hub_;
+    std::map<std::vector<uint8_t>, std::shared_ptr<Port>> spokes_;
+};
+
+// Transport whose send() holds the calling thread until open() and then drops the
+// frame, so a test can keep a send worker busy
+class GatedTransport : public Transport {
+public:
+    void start() override {}
+    void stop() override {}
+    void set_on_message(OnMessageCb) override {}
+
+    void send(const std::vector<uint8_t>&) override {
+        std::unique_lock<std::mutex> lk(mutex_);
+        entered_++;
+        cond_.notify_all();
+        cond_.wait(lk, [this] { return open_; });
+        sent_++;
+        cond_.notify_all();
+    }
+
+    void open() {
+        {
+            std::lock_guard<std::mutex> lk(mutex_);
+            open_ = true;
+        }
+        cond_.notify_all();
+    }
+
+    // False if fewer than `count` sends reached the gate in time
+    bool wait_entered(size_t count) {
+        std::unique_lock<std::mutex> lk(mutex_);
+        return cond_.wait_for(lk, std::chrono::seconds(20), [&] { return entered_ >= count; });
+    }
+
+    size_t sent() {
+        std::lock_guard<std::mutex> lk(mutex_);
+        return sent_;
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    bool open_ = false;
+    size_t entered_ = 0;
+    size_t sent_ = 0;
+};
+
+// Forwards to another transport, except that chosen sends throw before reaching it
+class FailingTransport : public Transport {
+public:
+    explicit FailingTransport(TransportPtr inner) : inner_(std::move(inner)) {}
+
+    void start() override { inner_->start(); }
+    void stop() override { inner_->stop(); }
+    void set_on_message(OnMessageCb cb) override { inner_->set_on_message(std::move(cb)); }
+    void set_on_message_batch(OnMessageBatchCb cb) override { inner_->set_on_message_batch(std::move(cb)); }
+
+    void send(const std::vector<uint8_t>& bytes) override {
+        fail_if_chosen();
+        inner_->send(bytes);
+    }
+
+    void send_iov(std::span<const std::span<const uint8_t>> parts, std::shared_ptr<const void> owner) override {
+        fail_if_chosen();
+        inner_->send_iov(parts, std::move(owner));
+    }
+
+    // The send after `sends` more succeed throws
+    void fail_after(size_t sends) {
+        std::lock_guard<std::mutex> lk(mutex_);
+        fail_in_ = sends + 1;
+    }
+
+private:
+    void fail_if_chosen() {
+        std::lock_guard<std::mutex> lk(mutex_);
+        if (fail_in_ == 0 || --fail_in_ != 0) return;
+        throw std::runtime_error("transport down");
+    }
+
+    TransportPtr inner_;
+    std::mutex mutex_;
+    size_t fail_in_ = 0;    // 0: none chosen
+};
+
+bool is_ready(const std::future<void>& future) {
+    return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+// The message of the exception a failed send completed with
+std::string error_of(std::future<void>& future) {
+    try {
+        future.get();
+    } catch (const std::exception& e) {
+        return e.what();
+    }
+    return "";
+}
+
+} // namespace
+
+// =============================================================================
+// Test: Async DH Ratchet Step
+// =============================================================================
+void test_async_ratchet_turn() {
+    std::cout << "Test: Sends across a DH ratchet turn on crypto workers... ";
+
+    try {
+        Inbox inbox;
+        Dispatcher bob(transport_b());
+        bob.register_device("bob");
+        bob.create_session_with("alice", ROOT_KEY);
+        bob.set_on_inbound([&](const Envelope& env) { inbox.add(env); });
+        bob.set_crypto_workers(2);
+        bob.set_async_ratchet_steps(true);
+
+        // Alice is played by bare ratchets on the other end, since a dispatcher
+        // session never changes its own DH key
+        TransportPtr alice = transport_a();
+        std::mutex mutex;
+        std::condition_variable cond;
+        std::vector<Bytes> from_bob;
+        alice->set_on_message([&](const Bytes& frame) {
+            std::lock_guard<std::mutex> lk(mutex);
+            from_bob.push_back(frame);
+            cond.notify_all();
+        });
+        alice->start();
+        bob.start();
+
+        // Bob's first message tells Alice the session id and Bob's ratchet key
+        bob.send_message_to_device("alice", numbered(0));
+        std::vector<uint8_t> session_id;
+        PublicKey32 bob_pub;
+        {
+            std::unique_lock<std::mutex> lk(mutex);
+            assert(cond.wait_for(lk, std::chrono::seconds(20), [&] { return !from_bob.empty(); }));
+            auto hello = EnvelopeView::parse(from_bob[0]);
+            // Sent in the layout earlier Dispatchers read, as nothing says alice reads more
+            assert(hello.has_value() && hello->version == Envelope::WIRE_VERSION_LEGACY);
+            session_id.assign(hello->session_id.begin(), hello->session_id.end());
+            auto header = RatchetHeaderView::parse(hello->associated_data);
+            assert(header.has_value());
+            bob_pub = header->dh_public;
+        }
+
+        // A burst under Alice's first key, then one under a new key: Bob's step runs
+        // on a worker while the second burst arrives behind the message that
+        // announced the key and is held
+        Ratchet first_key, second_key;
+        first_key.initialize(ROOT_KEY, session_id);
+        second_key.initialize(ROOT_KEY, session_id);
+        second_key.ratchet_step(bob_pub);
+        auto send_as_alice = [&](Ratchet& ratchet, uint32_t n) {
+            Envelope env = ratchet.encrypt_envelope(numbered(n));
+            env.sender_device_id = "alice";
+            alice->send(env.serialize());
+        };
+        constexpr uint32_t BURST = 100;
+        for (uint32_t n = 0; n < BURST; n++) send_as_alice(first_key, n);
+        for (uint32_t n = BURST; n < 2 * BURST; n++) send_as_alice(second_key, n);
+
+        assert(inbox.wait_for(2 * BURST));
+        assert(in_sequence(inbox.numbers_from("alice"), 2 * BURST));
+
+        bob.stop();
+        alice->stop();
+        alice->set_on_message(nullptr);
+        std::cout << "✓ " << 2 * BURST << " delivered in order" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Concurrent Peers
+// =============================================================================
+void test_concurrent_peers() {
+    std::cout << "Test: Concurrent sends and receives across peers... ";
+
+    try {
+        StarRelay relay;
+        constexpr size_t PEERS = 4;
+        constexpr uint32_t COUNT = 300;
+
+        Inbox hub_inbox;
+        std::vector<std::unique_ptr<Inbox>> peer_inboxes;
+        Dispatcher hub(relay.hub());
+        hub.register_device("hub");
+        hub.set_on_inbound([&](const Envelope& env) { hub_inbox.add(env); });
+        hub.set_inbound_workers(3);
+
+        std::vector<std::unique_ptr<Dispatcher>> peers;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < PEERS; i++) {
+            names.push_back("peer-" + std::to_string(i));
+            hub.create_session_with(names[i], ROOT_KEY);
+            peers.push_back(std::make_unique<Dispatcher>(relay.spoke()));
+            peer_inboxes.push_back(std::make_unique<Inbox>());
+            Inbox& inbox = *peer_inboxes[i];
+            peers[i]->register_device(names[i]);
+            peers[i]->create_session_with("hub", ROOT_KEY);
+            peers[i]->set_on_inbound([&inbox](const Envelope& env) { inbox.add(env); });
+            peers[i]->start();
+        }
+        hub.start();
+
+        // Each peer's first message also shows the relay where its session lives
+        for (size_t i = 0; i < PEERS; i++) peers[i]->send_message_to_device("hub", numbered(0));
+        assert(hub_inbox.wait_for(PEERS));
+
+        // Every peer sends to the hub while the hub sends to every peer, each
+        // stream from its own thread
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < PEERS; i++) {
+            threads.emplace_back([&, i] {
+                for (uint32_t n = 1; n <= COUNT; n++) peers[i]->send_message_to_device("hub", numbered(n, 32 + n % 200));
+            });
+            threads.emplace_back([&, i] {
+                for (uint32_t n = 0; n < COUNT; n++) hub.send_message_to_device(names[i], numbered(n, 32 + n % 200));
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        assert(hub_inbox.wait_for(PEERS * (COUNT + 1)));
+        // Behind a relay the hub doesn't take one peer's frames as everyone's version
+        assert(hub.peer_wire_version() == Envelope::WIRE_VERSION_LEGACY);
+        for (size_t i = 0; i < PEERS; i++) {
+            assert(peer_inboxes[i]->wait_for(COUNT));
+            assert(in_sequence(hub_inbox.numbers_from(names[i]), COUNT + 1));
+            assert(in_sequence(peer_inboxes[i]->numbers_from("hub"), COUNT));
+        }
+
+        hub.stop();
+        for (auto& peer : peers) peer->stop();
+        std::cout << "✓ " << PEERS << " peers, " << 2 * PEERS * COUNT << " messages intact and in order" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Inbound Workers
+// =============================================================================
+void test_inbound_workers() {
+    std::cout << "Test: Inbound workers keep session order under backpressure... ";
+
+    try {
+        StarRelay relay;
+        constexpr size_t PEERS = 4, WORKERS = 3, CAPACITY = 2;
+        constexpr uint32_t COUNT = 100;
+
+        // The callback waits on `open`, so the workers stall, their queues fill
+        // and the relay's delivery thread has to wait for room
+        std::mutex gate_mutex;
+        std::condition_variable gate_cond;
+        bool open = false;
+        Inbox inbox;
+        Dispatcher hub(relay.hub());
+        hub.register_device("hub");
+        hub.set_on_inbound([&](const Envelope& env) {
+            {
+                std::unique_lock<std::mutex> lk(gate_mutex);
+                gate_cond.wait(lk, [&] { return open; });
+            }
+            inbox.add(env);
+        });
+        hub.set_inbound_workers(WORKERS, CAPACITY);
+
+        std::vector<std::unique_ptr<Dispatcher>> peers;
+        std::vector<std::string> names;
+        for (size_t i = 0; i < PEERS; i++) {
+            names.push_back("peer-" + std::to_string(i));
+            hub.create_session_with(names[i], ROOT_KEY);
+            peers.push_back(std::make_unique<Dispatcher>(relay.spoke()));
+            peers[i]->register_device(names[i]);
+            peers[i]->create_session_with("hub", ROOT_KEY);
+            peers[i]->start();
+        }
+        hub.start();
+
+        std::vector<std::thread> threads;
+        for (size_t i = 0; i < PEERS; i++) {
+            threads.emplace_back([&, i] {
+                for (uint32_t n = 0; n < COUNT; n++) peers[i]->send_message_to_device("hub", numbered(n));
+            });
+        }
+        for (auto& t : threads) t.join();
+
+        // Stalled: every queue the traffic reached is full and the delivery thread waits
+        const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+        Dispatcher::InboundStats stalled = hub.inbound_stats();
+        while (stalled.backpressure_waits == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            stalled = hub.inbound_stats();
+        }
+        assert(stalled.workers == WORKERS && stalled.queue_capacity == CAPACITY);
+        assert(stalled.lanes.size() == WORKERS);
+        assert(stalled.backpressure_waits >= 1);
+        assert(stalled.queued >= CAPACITY && stalled.queued <= WORKERS * CAPACITY);
+        size_t depth = 0;
+        for (const auto& lane : stalled.lanes) {
+            assert(lane.depth <= CAPACITY && lane.high_water <= CAPACITY);
+            depth += lane.depth;
+        }
+        assert(depth == stalled.queued);
+        assert(stalled.processed == 0);
+
+        {
+            std::lock_guard<std::mutex> lk(gate_mutex);
+            open = true;
+        }
+        gate_cond.notify_all();
+        assert(inbox.wait_for(PEERS * COUNT));
+        for (size_t i = 0; i < PEERS; i++) assert(in_sequence(inbox.numbers_from(names[i]), COUNT));
+
+        // One task per frame here: the relay delivers frames one at a time
+        Dispatcher::InboundStats drained = hub.inbound_stats();
+        while (drained.processed < PEERS * COUNT && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            drained = hub.inbound_stats();
+        }
+        assert(drained.processed == PEERS * COUNT);
+        assert(drained.queued == 0);
+        assert(drained.backpressure_waits >= stalled.backpressure_waits);
+
+        hub.stop();
+        for (auto& peer : peers) peer->stop();
+        std::cout << "✓ " << PEERS * COUNT << " in order, " << drained.backpressure_waits << " backpressure waits" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Async Send Ordering
+// =============================================================================
+void test_send_async_order() {
+    std::cout << "Test: send_async keeps per-peer order across queued sends... ";
+
+    try {
+        constexpr uint32_t COUNT = 500;
+        Inbox inbox;
+        Dispatcher alice(transport_a());
+        Dispatcher bob(transport_b());
+        alice.register_device("alice");
+        bob.register_device("bob");
+        alice.create_session_with("bob", ROOT_KEY);
+        bob.create_session_with("alice", ROOT_KEY);
+        bob.set_on_inbound([&](const Envelope& env) { inbox.add(env); });
+        alice.set_send_workers(4, COUNT);
+        alice.start();
+        bob.start();
+
+        // Queued faster than one worker can seal and send them
+        std::vector<std::future<void>> futures;
+        futures.reserve(COUNT);
+        for (uint32_t n = 0; n < COUNT; n++) futures.push_back(alice.send_async("bob", numbered(n, 32 + n % 200)));
+        for (auto& future : futures) future.get();
+
+        assert(inbox.wait_for(COUNT));
+        assert(in_sequence(inbox.numbers_from("alice"), COUNT));
+
+        alice.stop();
+        bob.stop();
+        std::cout << "✓ " << COUNT << " delivered in order" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Async Send Errors
+// =============================================================================
+void test_send_async_errors() {
+    std::cout << "Test: send_async reports missing sessions and full queues... ";
+
+    try {
+        auto transport = std::make_shared<GatedTransport>();
+        Dispatcher alice(transport);
+        alice.register_device("alice");
+        alice.create_session_with("bob", ROOT_KEY);
+        alice.start();
+
+        // No session: the error comes back through the future and the callback
+        // rather than being thrown at the caller
+        std::future<void> unknown = alice.send_async("carol", numbered(0));
+        assert(error_of(unknown) == "session not initialized");
+        std::promise<std::exception_ptr> reported;
+        alice.send_async("carol", numbered(0), [&](std::exception_ptr error) { reported.set_value(error); });
+        std::exception_ptr error = reported.get_future().get();
+        assert(error != nullptr);
+        try {
+            std::rethrow_exception(error);
+        } catch (const std::runtime_error& e) {
+            assert(std::string(e.what()) == "session not initialized");
+        }
+        assert(transport->sent() == 0);
+
+        // One worker held in the transport and its queue full: the next send fails
+        // at once instead of blocking
+        constexpr size_t CAPACITY = 4;
+        alice.set_send_workers(1, CAPACITY);
+        std::vector<std::future<void>> held;
+        held.push_back(alice.send_async("bob", numbered(0)));
+        assert(transport->wait_entered(1));
+        for (uint32_t n = 1; n <= CAPACITY; n++) held.push_back(alice.send_async("bob", numbered(n)));
+
+        std::future<void> rejected = alice.send_async("bob", numbered(CAPACITY + 1));
+        assert(is_ready(rejected));
+        assert(error_of(rejected) == "send queue full");
+        bool rejected_now = false;
+        alice.send_async("bob", numbered(CAPACITY + 2), [&](std::exception_ptr e) { rejected_now = e != nullptr; });
+        assert(rejected_now);
+        for (const auto& future : held) assert(!is_ready(future));
+
+        // Opening the gate lets every accepted send through and nothing else
+        transport->open();
+        for (auto& future : held) future.get();
+        assert(transport->sent() == CAPACITY + 1);
+
+        alice.stop();
+        std::cout << "✓ " << CAPACITY + 1 << " accepted, overflow rejected" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Async Sends in Batches
+// =============================================================================
+void test_send_async_batching() {
+    std::cout << "Test: Batched send_async completes when its batch goes out... ";
+
+    try {
+        constexpr uint32_t COUNT = 20;
+        Inbox inbox;
+        auto link = std::make_shared<FailingTransport>(transport_a());
+        Dispatcher alice(link);
+        Dispatcher bob(transport_b());
+        alice.register_device("alice");
+        bob.register_device("bob");
+        alice.create_session_with("bob", ROOT_KEY);
+        bob.create_session_with("alice", ROOT_KEY);
+        bob.set_on_inbound([&](const Envelope& env) { inbox.add(env); });
+        alice.set_peer_wire_version(Envelope::WIRE_VERSION_BATCH);
+        alice.start();
+        bob.start();
+
+        // Sends the next `count` messages; returns once all of them reached the batcher
+        uint32_t next = 0;
+        auto queue_sends = [&](uint32_t count) {
+            std::vector<std::future<void>> futures;
+            const uint64_t frames = alice.send_batching_stats().frames + count;
+            for (uint32_t i = 0; i < count; i++) futures.push_back(alice.send_async("bob", numbered(next++)));
+            const auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(20);
+            while (alice.send_batching_stats().frames < frames && std::chrono::steady_clock::now() < deadline) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
+            assert(alice.send_batching_stats().frames == frames);
+            return futures;
+        };
+
+        // Queued is not sent: the futures wait for the batch
+        alice.set_send_batching(1 << 20, std::chrono::seconds(60));
+        auto sent = queue_sends(COUNT);
+        for (const auto& future : sent) assert(!is_ready(future));
+        alice.flush_sends();
+        for (auto& future : sent) future.get();
+        assert(inbox.wait_for(COUNT));
+        assert(in_sequence(inbox.numbers_from("alice"), COUNT));
+
+        // A batch that fails fails every message in it, flushed by hand...
+        link->fail_after(0);
+        auto lost = queue_sends(COUNT);
+        bool threw = false;
+        try {
+            alice.flush_sends();
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        for (auto& future : lost) assert(error_of(future) == "transport down");
+
+        // ...or by the timer, where there is nobody else to tell
+        alice.set_send_batching(1 << 20, std::chrono::milliseconds(5));
+        link->fail_after(0);
+        auto timed_out = queue_sends(1);
+        assert(error_of(timed_out[0]) == "transport down");
+        assert(alice.send_batching_stats().timer_flushes == 1 && alice.send_batching_stats().failed_sends == 1);
+
+        alice.stop();
+        bob.stop();
+        std::cout << "✓ " << COUNT << " sent, " << COUNT + 1 << " failures reported" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+// =============================================================================
+// Test: Wire Connection State Across a Failed Send
+// =============================================================================
+void test_wire_send_failure() {
+    std::cout << "Test: Wire connection state survives a failed send... ";
+
+    try {
+        Inbox alice_inbox, bob_inbox;
+        auto link = std::make_shared<FailingTransport>(transport_a());
+        Dispatcher alice(link);
+        Dispatcher bob(transport_b());
+        for (Dispatcher* d : {&alice, &bob}) {
+            d->set_wire_negotiation(true);
+            d->set_wire_connection_state(true);
+        }
+        alice.register_device("alice");
+        bob.register_device("bob");
+        alice.create_session_with("bob", ROOT_KEY);
+        bob.create_session_with("alice", ROOT_KEY);
+        alice.set_on_inbound([&](const Envelope& env) { alice_inbox.add(env); });
+        bob.set_on_inbound([&](const Envelope& env) { bob_inbox.add(env); });
+        alice.start();
+        bob.start();
+
+        // Each side's first frame is v1 and shows the other it reads v2
+        bob.send_message_to_device("alice", numbered(0));
+        assert(alice_inbox.wait_for(1));
+        alice.send_message_to_device("bob", numbered(0));
+        assert(bob_inbox.wait_for(1));
+        assert(alice.peer_wire_version() == Envelope::WIRE_VERSION_BATCH);
+
+        // Alice's first v2 frame would have put her id in the dictionary; it never
+        // leaves, so the frames after it must not refer to that entry
+        link->fail_after(0);
+        bool threw = false;
+        try {
+            alice.send_message_to_device("bob", numbered(1));
+        } catch (const std::runtime_error&) {
+            threw = true;
+        }
+        assert(threw);
+        constexpr uint32_t COUNT = 50;
+        for (uint32_t n = 2; n < COUNT; n++) alice.send_message_to_device("bob", numbered(n));
+
+        assert(bob_inbox.wait_for(COUNT - 1));
+        std::vector<uint32_t> expected = {0};
+        for (uint32_t n = 2; n < COUNT; n++) expected.push_back(n);
+        assert(bob_inbox.numbers_from("alice") == expected);
+
+        alice.stop();
+        bob.stop();
+        std::cout << "✓ " << COUNT - 1 << " delivered after the failure" << std::endl;
+    } catch (const std::exception& e) {
+        std::cout << "✗ FAILED: " << e.what() << std::endl;
+        throw;
+    }
+}
+
+int main() {
+    std::cout << "========================================" << std::endl;
+    std::cout << "  Dispatcher Tests" << std::endl;
+    std::cout << "========================================" << std::endl << std::endl;
+
+    set_log_level(LogLevel::Error);
+    try {
+        test_async_ratchet_turn();
+        test_concurrent_peers();
+        test_inbound_workers();
+        test_send_async_order();
+        test_send_async_errors();
+        test_send_async_batching();
+        test_wire_send_failure();
+
+        std::cout << std::endl;
+        std::cout << "========================================" << std::endl;
+        std::cout << "  ✓ All tests passed!" << std::endl;
+        std::cout << "========================================" << std::endl;
+
+        return 0;
+    } catch (const std::exception& e) {
+        std::cout << std::endl;
+        std::cout << "========================================" << std::endl;
+        std::cout << "  ✗ Test suite failed" << std::endl;
+        std::cout << "========================================" << std::endl;
+        return 1;
+    }
+}
@@ -2,6 +2,7 @@
 #include "securecomm/envelope.hpp"
 #include <iostream>
 #include <cassert>
+#include <algorithm>
 #include <sodium.h>
 
 using namespace securecomm;
@@ -36,6 +37,21 @@ int main() {
     assert(alice_plain.has_value());
     assert(alice_plain.value() == pt2);
 
+    // Counter nonces are opt-in and salted per sender epoch
+    m.set_nonce_mode(AEAD::NonceMode::Counter);
+    Envelope c1 = m.encrypt_group_message(gid, "alice", pt);
+    Envelope c2 = m.encrypt_group_message(gid, "alice", pt);
+    assert(c1.message_index == 0 && c2.message_index == 1);
+    assert(c1.associated_data.size() == gid.size() + 8 + 1 + AEAD::SALT_BYTES);
+    assert(m.decrypt_group_message(gid, "bob", c2) == pt);
+    assert(m.decrypt_group_message(gid, "bob", c1) == pt);
+    m.add_member(gid, "dave");
+    Envelope c3 = m.encrypt_group_message(gid, "alice", pt);
+    assert(c3.message_index == 0);
+    assert(!std::equal(c3.associated_data.end() - AEAD::SALT_BYTES, c3.associated_data.end(),
+                       c1.associated_data.end() - AEAD::SALT_BYTES));
+    assert(m.decrypt_group_message(gid, "bob", c3) == pt);
+
     std::cout << "MLS unit test: OK\n";
     return 0;
 }
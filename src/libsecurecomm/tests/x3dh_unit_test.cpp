@@ -9,18 +9,18 @@ using namespace securecomm;
 int main() {
     if (sodium_init() < 0) return 1;
 
-    std::vector<uint8_t> alice_ik_pub, alice_ik_priv;
-    std::vector<uint8_t> bob_ik_pub, bob_ik_priv;
+    PublicKey32 alice_ik_pub; SecretKey32 alice_ik_priv;
+    PublicKey32 bob_ik_pub; SecretKey32 bob_ik_priv;
     X3DH::generate_identity_keypair(alice_ik_pub, alice_ik_priv);
     X3DH::generate_identity_keypair(bob_ik_pub, bob_ik_priv);
 
-    std::vector<uint8_t> bob_spk_pub, bob_spk_priv;
+    PublicKey32 bob_spk_pub; SecretKey32 bob_spk_priv;
     X3DH::generate_signed_prekey(bob_ik_priv, bob_spk_pub, bob_spk_priv);
 
-    std::vector<uint8_t> bob_opk_pub, bob_opk_priv;
+    PublicKey32 bob_opk_pub; SecretKey32 bob_opk_priv;
     X3DH::generate_one_time_prekey(bob_opk_pub, bob_opk_priv);
 
-    std::vector<uint8_t> alice_eph_pub, alice_eph_priv;
+    PublicKey32 alice_eph_pub; SecretKey32 alice_eph_priv;
     X3DH::generate_one_time_prekey(alice_eph_pub, alice_eph_priv);
 
     Envelope e_init = X3DH::initiate_handshake(alice_ik_priv, alice_eph_priv,
@@ -31,6 +31,7 @@ int main() {
 
     assert(e_init.ciphertext.size() == 32);
     assert(e_resp.ciphertext.size() == 32);
+    assert(e_init.ciphertext == e_resp.ciphertext);
 
     std::cout << "X3DH (envelope) unit test: OK\n";
     return 0;